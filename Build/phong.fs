@@ -71,6 +71,8 @@ uniform sampler2D TexEmissive; /* Emissive coefficient */
 uniform bool      isUseTextures;
 uniform int         materialType;
 uniform bool      useVertexColor;
+uniform bool      isInstanced;
+uniform bool      isTwoSided;     /* Back faces are lit against the flipped normal */
 
 /* Lighting params */
 uniform vec4         I_globAmbient; /* Global ambience */
@@ -84,6 +86,7 @@ uniform MaterialContext surfaceClr;
 varying vec3 v3_pos;       /* Fragment position       */
 varying vec2 v2_texCoords; /* Fragment texture coords */
 varying vec3 v3_normal;    /* Normal at fragment      */
+varying vec4 v4_instanceClr; /* Instance surface colour */
 
 /*------------------------------------------------------------------------------
  * Fragment shader code */
@@ -100,8 +103,8 @@ void main()
     }
 	else
 	{
-		mat.K_ambient = surfaceClr.K_ambient;
-		mat.K_diffuse = surfaceClr.K_diffuse;
+		mat.K_ambient = isInstanced ? v4_instanceClr : surfaceClr.K_ambient;
+		mat.K_diffuse = isInstanced ? v4_instanceClr : surfaceClr.K_diffuse;
 		mat.K_specular = surfaceClr.K_specular;
 		mat.K_emissive = surfaceClr.K_emissive;
 		mat.shinePower = mat.K_specular.a * 255.0;
@@ -122,10 +125,12 @@ void main()
 	 */
     vec4 fragColour = (I_globAmbient * mat.K_ambient) + mat.K_emissive;
 	
+	vec3 fragNormal = (isTwoSided && !gl_FrontFacing) ? -v3_normal : v3_normal;
+
 	/* Iterate through active lightsources and compute colour intensities for each */
 	for (int i = 0; i < numLightSrc ; ++i)
 	{
-        fragColour += ComputeFragColor(lights[i], mat, v3_normal, v3_pos);
+        fragColour += ComputeFragColor(lights[i], mat, fragNormal, v3_pos);
 	}
     
 	float fogCoeff = ComputeFogCoeff(fog.nearDist, fog.farDist, v3_pos.z);
@@ -15,19 +15,46 @@ Creation date:  2011-09-27
 
 - End Header -----------------------------------------------------------------*/
 
+/*------------------------------------------------------------------------------
+ * Uniform vars */
+uniform bool isInstanced; /* Model transform comes from instance attributes */
+
+/*------------------------------------------------------------------------------
+ * Attribute vars -- Per-instance, only read when isInstanced */
+attribute mat4 instanceMtx; /* Model-to-world transform */
+attribute vec4 instanceClr; /* Surface colour           */
+
 /*------------------------------------------------------------------------------
  * Varying vars -- Interpolated fragment-wise across triangle */
-varying vec3 v3_pos;       /* Fragment position       */
-varying vec2 v2_texCoords; /* Fragment texture coords */
-varying vec3 v3_normal;    /* Normal at fragment      */
+varying vec3 v3_pos;         /* Fragment position       */
+varying vec2 v2_texCoords;   /* Fragment texture coords */
+varying vec3 v3_normal;      /* Normal at fragment      */
+varying vec4 v4_instanceClr; /* Instance surface colour */
 
 /*------------------------------------------------------------------------------
  * Vertex shader code */
 void main()
 {
-	gl_Position   =  gl_ModelViewProjectionMatrix * gl_Vertex;
-    v3_pos        = (gl_ModelViewMatrix * gl_Vertex).xyz;
-	gl_FrontColor =  gl_Color;
-	v2_texCoords  =  gl_MultiTexCoord0.st;
-	v3_normal     =  gl_NormalMatrix * gl_Normal;
+	/* Instanced draws leave only the world-to-view transform on the modelview stack */
+	vec4 v4_vertex = isInstanced ? instanceMtx * gl_Vertex : gl_Vertex;
+	vec3 v3_nrm    = gl_Normal;
+	if (isInstanced)
+	{
+		/* Cofactors of the instance's linear part are its inverse-transpose scaled
+		   by the determinant, so normals stay perpendicular under non-uniform scale */
+		vec3 c0 = instanceMtx[0].xyz;
+		vec3 c1 = instanceMtx[1].xyz;
+		vec3 c2 = instanceMtx[2].xyz;
+		mat3 cofactors = mat3(cross(c1, c2), cross(c2, c0), cross(c0, c1));
+		v3_nrm = cofactors * gl_Normal;
+		if (dot(c0, cofactors[0]) < 0.0) /* Mirroring transform */
+			v3_nrm = -v3_nrm;
+	}
+
+	gl_Position    =  gl_ModelViewProjectionMatrix * v4_vertex;
+    v3_pos         = (gl_ModelViewMatrix * v4_vertex).xyz;
+	gl_FrontColor  =  gl_Color;
+	v2_texCoords   =  gl_MultiTexCoord0.st;
+	v3_normal      =  gl_NormalMatrix * v3_nrm;
+	v4_instanceClr =  instanceClr;
 }
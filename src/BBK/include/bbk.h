@@ -13,6 +13,10 @@
 /* Framework engine modules */
 #include "framework/gamestatemgr.h"
 #include "framework/gamestate.h"
+#include "framework/rigidbodyworld.h"
+#include "framework/clothgrid.h"
+#include "framework/clothmesh.h"
+#include "framework/profiler.h"
 #include "framework/BObject.h"
 #include "framework/baseobjs/DisParticle.h"
 #include "framework/baseobjs/DisClothParticle.h"
@@ -22,6 +26,13 @@
 namespace bbk
 {
 bool InitFramework();
+/**
+ * Simulates and records each frame on a worker thread while the main thread
+ * renders the previous one. States must then leave GL calls to Load, Init,
+ * Cleanup and Unload, and set per-frame shader and texture state through the
+ * recorded gfx calls.
+ */
+void EnableFramePipelining(bool flag);
 void RunFramework();
 } // namespace bbk
 
@@ -0,0 +1,40 @@
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#include <cstddef>
+
+namespace bbk
+{
+namespace fileio
+{
+/**
+ * @class MappedFile
+ * @brief Read-only view of a whole file mapped into memory
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/// Maps file into memory; returns false if it cannot be opened or is empty
+	bool Open(const char *filename);
+	void Close();
+
+	bool        IsOpen()  const {return data_ != nullptr;}
+	const char* GetData() const {return data_;}
+	size_t      GetSize() const {return size_;}
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char *data_;
+	size_t      size_;
+	void       *fileHandle_;
+	void       *mapHandle_;
+}; // class MappedFile
+} // namespace fileio
+} // namespace bbk
+
+#endif /* _MAPPEDFILE_H */
@@ -2,34 +2,38 @@
 #define _BOBJECT_H
 
 #include "BArchive.h"
-#include "graphics/rendercontext.h"
-#include "math/quaternion.h"
+#include "rigidbodyworld.h"
 
 namespace bbk
 {
+/**
+ * \class BObject
+ * \brief Handle to a body of a RigidBodyWorld, which integrates it in
+ *        RigidBodyWorld::Step; the object owns the body's render context.
+ */
 class BObject : public BArchive
 {
 public:
-	BObject();
+	explicit BObject(RigidBodyWorld& world);
+	~BObject();
 	
-	void Integrate(float deltatime);
-	void Update(float deltatime);
+	/// Draws object directly; once stepped, object is in the scene and drawn by gfx::DrawScene instead
 	void Draw();
 
 	void SetGeometry(Model* model);
 
 	/** @name
 	 *  State vector methods *///\{
-	const Vector3&   GetPosition() const;
+	Vector3          GetPosition() const {return world_->GetPosition(body_);}
 	void             SetPosition(const Vector3& pos);
-	const Quat&      GetQuat() const {return orient_;}
-	const Matrix3x3& GetRotation() const;
+	Quat             GetQuat() const {return world_->GetQuat(body_);}
+	Matrix3x3        GetRotation() const;
 	void             SetRotation(const Matrix3x3 &rot);
-	const Vector3&   GetVelocity() const {return linVel_;}
-	const Quat&      GetAngularVel() const {return angVel_;}
+	Vector3          GetVelocity() const {return world_->GetVelocity(body_);}
+	Quat             GetAngularVel() const {return world_->GetAngularVel(body_);}
 	void             SetAngularVel(const Vector3& axisangle);
 	void             AddAngularVel(const Vector3& axisangle);
-	const Vector3&   GetAngularMom() const {return angMom_;}
+	Vector3          GetAngularMom() const {return world_->GetAngularMom(body_);}
 	void             SetAngularMom(const Vector3& axisangle);
 	void             AddForce(const Vector3& force, const Vector3& contactPt=Vector3());
 	void             ApplyNettForce(const Vector3& nettForce, const Vector3& contactPt=Vector3());
@@ -51,27 +55,19 @@ public:
 	RenderContext&   GetRenderContext()      {return renderContext_;}
 	//\}
 
-private:
-	/** @name
-	 *  State vector *///\{
-	Vector3   pos_;
-	Matrix3x3 rot_;
-	Quat      orient_;
-	Vector3   linMom_;
-	Vector3   angMom_;
+	RigidBodyWorld&  GetWorld() const        {return *world_;}
+	int              GetBody() const         {return body_;}
 
-	Vector3   linVel_;
-	Quat      angVel_;
-	Vector3   force_;
-	Vector3   torque_;
-	
-	float     invMass_;
-	Matrix3x3 invBodyInertiaTensor_;
-	//\}
+private:
+	BObject(const BObject&);
+	BObject& operator=(const BObject&);
 
-	bool overrideQuat_;
+	/// Mass properties of model at current scale
+	void UpdateMassProperties();
 
-	RenderContext renderContext_;
+	RigidBodyWorld *world_;
+	int             body_;          ///< Handle into world_
+	RenderContext   renderContext_; ///< Written by world_ each step
 
 	virtual void Read(xmlElement* rootnode);
 	virtual void Write(xmlElement* rootnode);
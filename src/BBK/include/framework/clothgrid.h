@@ -0,0 +1,188 @@
+#ifndef _CLOTHGRID_H
+#define _CLOTHGRID_H
+
+#include <cstddef>
+#include <vector>
+#include "math/vector3.h"
+
+namespace bbk
+{
+/**
+ * \class ClothGrid
+ * \brief Sheet of cloth particles on a regular rows x cols grid, with springs
+ *        between grid neighbours.
+ *
+ * Positions, momenta, velocities and forces each live in one 16 byte aligned
+ * array indexed by (row, col). Rows are padded with particles of zero weight
+ * on every side, so springs are an implicit stencil of fixed index offsets
+ * with no neighbour pointers or edge cases:
+ *  - structural springs to the 4 direct neighbours
+ *  - shear springs to the 4 diagonal neighbours
+ *  - bend springs to the 4 particles 2 along a row or column
+ *
+ * Two solvers are available:
+ *  - SPRINGS evaluates every spring force 4 particles per SSE operation, with
+ *    rows split across job workers, and integrates in substeps.
+ *  - XPBD treats each spring as a compliant distance constraint and corrects
+ *    positions directly, which stays stable at any step. It substeps too, as
+ *    each Gauss-Seidel pass carries a correction only a few particles along
+ *    the sheet and shorter steps leave less to carry. The constraints are
+ *    coloured so no two of one colour share a particle, and each colour is
+ *    solved across job workers in turn.
+ */
+class ClothGrid
+{
+public:
+	enum SpringType
+	{
+		STRUCTURAL,
+		SHEAR,
+		BEND,
+		NUM_SPRING_TYPES
+	};
+
+	enum Solver
+	{
+		SPRINGS,
+		XPBD
+	};
+
+	/// Lays the sheet flat, cols along colDir and rows along rowDir from origin, every particle of unit mass
+	ClothGrid(unsigned rows, unsigned cols, float spacing, const Point3& origin,
+		const Vector3& colDir = Vector3(1.0f, 0.0f, 0.0f), const Vector3& rowDir = Vector3(0.0f, -1.0f, 0.0f));
+	~ClothGrid();
+
+	unsigned GetNumRows() const {return rows_;}
+	unsigned GetNumCols() const {return cols_;}
+	float    GetSpacing() const {return spacing_;}
+
+	/** @name
+	 *  Simulation settings *///\{
+	void     SetSolver(Solver solver) {solver_ = solver;}
+	Solver   GetSolver() const {return solver_;}
+	/// SPRINGS: stiffness in N/m and damping in Ns/m
+	void     SetSpring(SpringType type, float stiffness, float damping);
+	/// Step divides deltatime into this many. Explicit SPRINGS are only stable for short steps,
+	/// and XPBD holds rest lengths better with more substeps than with more iterations
+	void     SetNumSubsteps(unsigned numSubsteps) {numSubsteps_ = numSubsteps;}
+	unsigned GetNumSubsteps() const {return numSubsteps_;}
+	/// XPBD: compliance is inverse stiffness in m/N, 0 for inextensible. Damping is
+	/// scaled by compliance, so compliance * damping is the time over which it acts
+	void     SetCompliance(SpringType type, float compliance, float damping);
+	/// XPBD: passes over all constraints per substep; more converge closer to the rest lengths
+	void     SetNumIterations(unsigned numIterations) {numIterations_ = numIterations;}
+	unsigned GetNumIterations() const {return numIterations_;}
+	/// XPBD: constraint batches solved one after another per iteration
+	unsigned GetNumColours() const {return static_cast<unsigned>(colourStarts_.size() - 1);}
+	//\}
+
+	/** @name
+	 *  Particle at (row, col) *///\{
+	Vector3 GetPosition(unsigned row, unsigned col) const;
+	void    SetPosition(unsigned row, unsigned col, const Vector3& pos);
+	Vector3 GetVelocity(unsigned row, unsigned col) const;
+	float   GetInvMass(unsigned row, unsigned col) const;
+	void    SetInvMass(unsigned row, unsigned col, float invMass);
+	/// Pinned particles have infinite mass and stay where they are put; unpinning restores the inverse mass last set
+	void    SetPinned(unsigned row, unsigned col, bool bPinned);
+	/// Accumulates force until the next Step
+	void    AddForce(unsigned row, unsigned col, const Vector3& force);
+	//\}
+
+	/// Accumulates a force on every particle until the next Step, e.g. gravity times particle mass
+	void AddUniformForce(const Vector3& force) {uniformForce_ += force;}
+
+	/// Advances the sheet over deltatime with the current solver, then clears accumulated forces
+	void Step(float deltatime);
+
+private:
+	/// One array per component, indexed by Index(row, col)
+	enum Field
+	{
+		POS_X, POS_Y, POS_Z,
+		MOM_X, MOM_Y, MOM_Z,
+		VEL_X, VEL_Y, VEL_Z,
+		FORCE_X, FORCE_Y, FORCE_Z, ///< Springs plus external, rebuilt each substep
+		EXT_X, EXT_Y, EXT_Z,       ///< Accumulated by AddForce
+		PREV_X, PREV_Y, PREV_Z,    ///< Positions at the start of an XPBD step
+		INV_MASS,
+		FREE_INV_MASS,             ///< Inverse mass while not pinned, set by SetInvMass
+		WEIGHT,                    ///< 1 for particles, 0 for padding
+		NUM_FIELDS
+	};
+
+	struct Spring
+	{
+		float stiffness;
+		float damping;
+		float restLength;
+		float compliance;
+		float constraintDamping;
+	}; // struct Spring
+
+	/// Distance constraint between particles a and b, as Index values
+	struct Constraint
+	{
+		unsigned a;
+		unsigned b;
+		int      type;
+	}; // struct Constraint
+
+	struct StepData
+	{
+		ClothGrid *cloth;
+		float      deltatime;
+	}; // struct StepData
+
+	struct SolveData
+	{
+		ClothGrid *cloth;
+		size_t     first;                        ///< Constraint the colour starts at
+		float      alphaTilde[NUM_SPRING_TYPES]; ///< Compliance / deltatime^2
+		float      gamma[NUM_SPRING_TYPES];      ///< Compliance * damping / deltatime
+	}; // struct SolveData
+
+	ClothGrid(const ClothGrid&);
+	ClothGrid& operator=(const ClothGrid&);
+
+	size_t       Index(unsigned row, unsigned col) const {return (row + PadRows) * stride_ + PadCols + col;}
+	float*       GetField(int field)       {return data_ + field * fieldSize_;}
+	const float* GetField(int field) const {return data_ + field * fieldSize_;}
+
+	/// Lists every spring as a constraint, grouped by colour
+	void BuildConstraints();
+	void StepXPBD(float deltatime);
+
+	/** @name
+	 *  Each works on rows [begin, end) *///\{
+	static void ForceRange(size_t begin, size_t end, void *data);
+	static void IntegrateRange(size_t begin, size_t end, void *data);
+	static void PredictRange(size_t begin, size_t end, void *data);
+	static void UpdateVelocityRange(size_t begin, size_t end, void *data);
+	//\}
+
+	/// Works on constraints [begin, end) of one colour
+	static void SolveRange(size_t begin, size_t end, void *data);
+
+	static const unsigned PadRows = 2; ///< Bend springs reach 2 rows
+	static const unsigned PadCols = 4; ///< Bend springs reach 2 columns; 4 keeps rows aligned
+
+	unsigned rows_;
+	unsigned cols_;
+	float    spacing_;
+	size_t   stride_;      ///< Floats per padded row, multiple of 4
+	size_t   fieldSize_;   ///< Floats per field
+	float   *data_;        ///< NUM_FIELDS arrays of fieldSize_ floats
+	Spring   springs_[NUM_SPRING_TYPES];
+	Solver   solver_;
+	unsigned numSubsteps_;
+	unsigned numIterations_;
+	Vector3  uniformForce_;
+
+	std::vector<Constraint> constraints_;  ///< Sorted by colour
+	std::vector<float>      lambdas_;      ///< Per constraint, accumulated over one XPBD step
+	std::vector<size_t>     colourStarts_; ///< First constraint of each colour, then constraints_.size()
+}; // class ClothGrid
+} // namespace bbk
+
+#endif /* _CLOTHGRID_H */
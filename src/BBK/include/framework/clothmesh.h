@@ -0,0 +1,44 @@
+#ifndef _CLOTHMESH_H
+#define _CLOTHMESH_H
+
+#include <vector>
+#include "graphics/vertex.h"
+
+namespace bbk
+{
+class ClothGrid;
+
+/**
+ * \class ClothMesh
+ * \brief Renderable surface of a ClothGrid: one vertex per particle, two
+ *        triangles per grid cell and a line per structural spring.
+ *
+ * Index arrays are built once for the grid's size; Update refreshes vertex
+ * positions and normals from the simulation, and Draw queues the whole sheet
+ * as a single dynamic mesh.
+ */
+class ClothMesh
+{
+public:
+	explicit ClothMesh(const ClothGrid& cloth);
+
+	/// Copies particle positions, then recomputes every normal from its grid neighbours
+	void Update(const ClothGrid& cloth);
+	void Draw(const Colour& clr = Colour(1.0f, 1.0f, 1.0f, 1.0f), bool bWireframe = false, const Colour& wireClr = Colour(0.0f, 0.0f, 0.0f, 1.0f)) const;
+
+	const std::vector<Vertex>&   GetVertices()    const {return vertices_;}
+	const std::vector<unsigned>& GetTriIndices()  const {return triIndices_;}
+	const std::vector<unsigned>& GetLineIndices() const {return lineIndices_;}
+
+private:
+	unsigned Index(unsigned row, unsigned col) const {return row * cols_ + col;}
+
+	unsigned              rows_;
+	unsigned              cols_;
+	std::vector<Vertex>   vertices_;    ///< Row by row
+	std::vector<unsigned> triIndices_;
+	std::vector<unsigned> lineIndices_; ///< Wireframe along rows and columns
+}; // class ClothMesh
+} // namespace bbk
+
+#endif /* _CLOTHMESH_H */
@@ -12,6 +12,8 @@ public:
 	virtual bool Load()                  = 0;
 	virtual void Init()                  = 0;
 	virtual void Update(float deltatime) = 0;
+	/// Runs once per fixed step, 0 or more times a frame between Update and Draw; steps physics
+	virtual void FixedUpdate(float /*timestep*/) {}
 	virtual void Draw()                  = 0;
 	virtual void Cleanup()               = 0;
 	virtual void Unload()                = 0;
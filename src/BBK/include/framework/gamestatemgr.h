@@ -17,7 +17,12 @@ class GameStateMgr
 public:
 	static bool Init();
 	static void Halt();
+	/// Simulate followed by ApplyStackChanges
 	static void Update(float deltatime);
+	/// Updates, fixed-steps and draws states on the stack without changing the stack, so it may run off the main thread
+	static void Simulate(float deltatime);
+	/// Executes pushes, pops and switches requested by states; returns true if there were any. Loads states, so needs the GL thread
+	static bool ApplyStackChanges();
 
 	/**
 	 * \name
@@ -58,6 +63,15 @@ public:
 	static bool OuterCheckPoint();
 	/// Returns whether to continue running inner, main game-frame loop
 	static bool InnerCheckPoint();
+
+	/// Frame time accumulates until it covers a fixed step, so FixedUpdate always sees the same
+	/// timestep whatever the frame rate. 0 steps per second runs one FixedUpdate per frame instead
+	static void     SetFixedStepRate(float stepsPerSecond, unsigned maxSubsteps);
+	static float    GetFixedTimestep() {return fixedTimestep_;}
+	/// FixedUpdates per frame beyond this are dropped, so a slow frame does not make the next slower
+	static unsigned GetMaxSubsteps() {return maxSubsteps_;}
+	/// Fraction of a fixed step the time drawn is past the last FixedUpdate, for interpolating render state
+	static float    GetInterpolation() {return interpolation_;}
 	//\}
 
 private:
@@ -74,6 +88,7 @@ private:
 	static unsigned                next_;       ///< Index of next state
 
 	static void UpdateStates(float deltatime);
+	static void FixedUpdateStates(float timestep);
 	static void DrawStates();
 	static void SetupBaseState();
 	static void CloseBaseState();
@@ -111,8 +126,12 @@ private:
 	 * \name
 	 * Gameloop
 	 *///\{
-	static int   numCycles_;
-	static float timeElapsed_;
+	static int      numCycles_;
+	static float    timeElapsed_;
+	static float    fixedTimestep_;  ///< 0 for one variable step per frame
+	static unsigned maxSubsteps_;
+	static float    accumulator_;    ///< Frame time not yet covered by fixed steps
+	static float    interpolation_;
 	//\}
 
 	GameStateMgr();
@@ -0,0 +1,76 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace bbk
+{
+/**
+ * Per-frame timing of named, nested scopes. Each scope's time is summed over a
+ * frame and kept for the last HistorySize frames, from which percentiles are
+ * taken. Scopes nest per thread, so the same name under different parents is
+ * timed separately, and a scope outside any other on its thread is a child of
+ * the frame. Scopes must begin and end within one frame. Every scope start and
+ * end takes a lock, so scopes suit subsystems and frame phases, not inner loops.
+ */
+namespace profiler
+{
+const unsigned HistorySize = 256; ///< Frames kept per scope
+
+/// Percentiles, in milliseconds, of a scope's per-frame times over the frames it was seen in
+struct Summary
+{
+	const char *name;
+	int         depth;     ///< 0 for the frame itself, 1 for scopes outside any other
+	unsigned    numFrames;
+	float       p50;
+	float       p95;
+	float       p99;
+	float       max;
+}; // struct Summary
+
+bool Init();
+void Halt();
+/// Takes effect at the next BeginFrame; while disabled, scopes still nest but record nothing
+void SetEnabled(bool flag);
+bool IsEnabled();
+
+/** @name
+ *  Frames. BeginFrame to EndFrame is itself recorded as scope "Frame" *///\{
+void BeginFrame();
+/// Adds every scope's time this frame to its history
+void EndFrame();
+//\}
+
+/** @name
+ *  Scopes. Names are compared by content and must outlive the profiler, e.g. string literals *///\{
+void BeginScope(const char *name);
+void EndScope();
+
+/// Times its own lifetime
+class Scope
+{
+public:
+	explicit Scope(const char *name) {BeginScope(name);}
+	~Scope()                         {EndScope();}
+
+private:
+	Scope(const Scope&);
+	Scope& operator=(const Scope&);
+}; // class Scope
+//\}
+
+/** @name
+ *  Reports *///\{
+/// One per scope, parents before children
+void GetSummaries(std::vector<Summary>& summaries);
+/// Adds a line per scope to the debug overlay of the frame being recorded
+void PrintSummaries();
+/// Writes one row per frame in history and one column per scope, in milliseconds
+bool DumpCSV(const char *filename);
+//\}
+} // namespace profiler
+} // namespace bbk
+
+#endif /* _PROFILER_H */
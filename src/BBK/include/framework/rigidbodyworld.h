@@ -0,0 +1,160 @@
+#ifndef _RIGIDBODYWORLD_H
+#define _RIGIDBODYWORLD_H
+
+#include <cstddef>
+#include <vector>
+#include "graphics/rendercontext.h"
+#include "intersect/sweepandprune.h"
+#include "math/matrix3x3.h"
+#include "math/quaternion.h"
+
+namespace bbk
+{
+/**
+ * \class RigidBodyWorld
+ * \brief Owns the state vectors of all rigid bodies as structure-of-arrays and
+ *        steps them together.
+ *
+ * Every state component lives in its own 16 byte aligned array, padded to a
+ * multiple of 4 bodies, so Step integrates 4 bodies per SSE operation and
+ * splits the bodies across job workers. Bodies are identified by handles that
+ * stay valid while others are removed; the dense slot behind a handle moves.
+ *
+ * Each body writes its transform and bounding volumes to a RenderContext that
+ * the caller owns and keeps alive until RemoveBody. Step adds bodies with a
+ * model to the scene tree and keeps them fitted there, and to a sweep and
+ * prune broad phase whose overlapping pairs it reports.
+ *
+ * Bodies that move further than their bounding radius in a step could pass
+ * through thin geometry between steps. With continuous collision on, such a
+ * body's broad phase AABB covers its whole sweep, and its bounding sphere is
+ * swept against the BVHs it overlaps; at the first impact it stops and loses
+ * the momentum into the surface. Slower bodies skip all of this.
+ *
+ * Stepped at a fixed rate, bodies would visibly stutter against a different
+ * render rate, so Interpolate rewrites render state part of the way from the
+ * previous Step's state to the last one's.
+ */
+class RigidBodyWorld
+{
+public:
+	RigidBodyWorld();
+	~RigidBodyWorld();
+
+	/** @name
+	 *  Bodies start at rest at the origin with unit mass *///\{
+	int      AddBody(RenderContext& renderContext);
+	void     RemoveBody(int body);
+	unsigned GetNumBodies() const {return numBodies_;}
+	//\}
+
+	/// Integrates all bodies over deltatime, then writes their render state
+	void Step(float deltatime);
+	/// Writes render state alpha of the way from before the last Step (0) to after it (1), e.g. GameStateMgr::GetInterpolation()
+	void Interpolate(float alpha);
+	/// Bodies whose world AABBs overlapped after the last Step; a fast body's AABB covers its sweep
+	const std::vector<OverlapPair>& GetOverlappingPairs() const {return overlaps_;}
+	/// Sweeps bodies that move further than their bounding radius in a step. On by default.
+	void SetContinuous(bool flag) {bContinuous_ = flag;}
+	bool IsContinuous() const     {return bContinuous_;}
+
+	/** @name
+	 *  State vector of one body *///\{
+	Vector3   GetPosition(int body) const;
+	/// Moves body without Interpolate sweeping it from where it was
+	void      SetPosition(int body, const Vector3& pos);
+	Quat      GetQuat(int body) const;
+	Matrix3x3 GetRotation(int body) const;
+	/// Fixes rotation, ignoring orientation from then on
+	void      SetRotation(int body, const Matrix3x3& rot);
+	Vector3   GetVelocity(int body) const;
+	Quat      GetAngularVel(int body) const;
+	void      SetAngularVel(int body, const Quat& angVel);
+	Vector3   GetAngularMom(int body) const;
+	void      SetAngularMom(int body, const Vector3& angMom);
+	/// Accumulates force and torque until the next Step
+	void      AddForce(int body, const Vector3& force, const Vector3& torque);
+	void      SetForce(int body, const Vector3& force, const Vector3& torque);
+	float     GetInvMass(int body) const;
+	void      SetInvMass(int body, float invMass);
+	/// Inverse inertia tensor in body frame
+	void      SetInvInertiaTensor(int body, const Matrix3x3& invInertiaTensor);
+	/// Scene tree proxy, -1 until the body has a model and has been stepped
+	int       GetSceneId(int body) const {return sceneIds_[handleToSlot_[body]];}
+	//\}
+
+private:
+	/// One array per component, indexed by slot
+	enum Field
+	{
+		POS_X, POS_Y, POS_Z,
+		PREV_POS_X, PREV_POS_Y, PREV_POS_Z, ///< Position before the last Step
+		ORIENT_S, ORIENT_X, ORIENT_Y, ORIENT_Z,
+		PREV_ORIENT_S, PREV_ORIENT_X, PREV_ORIENT_Y, PREV_ORIENT_Z, ///< Orientation before the last Step
+		LINMOM_X, LINMOM_Y, LINMOM_Z,
+		ANGMOM_X, ANGMOM_Y, ANGMOM_Z,
+		LINVEL_X, LINVEL_Y, LINVEL_Z,
+		ANGVEL_S, ANGVEL_X, ANGVEL_Y, ANGVEL_Z,
+		FORCE_X, FORCE_Y, FORCE_Z,
+		TORQUE_X, TORQUE_Y, TORQUE_Z,
+		INV_MASS,
+		INV_INERTIA,                      ///< 9 column-major elements
+		ROT = INV_INERTIA + 9,            ///< 9 column-major elements
+		OVERRIDE_ROT = ROT + 9,           ///< Non-zero if rotation was set directly
+		NUM_FIELDS
+	};
+
+	struct StepData
+	{
+		RigidBodyWorld *world;
+		float           deltatime;
+		float           linearDt;  ///< deltatime, or 0 if linear motion is frozen
+		float           angularDt; ///< deltatime, or 0 if angular motion is frozen
+	}; // struct StepData
+
+	/// Earliest swept contact of a fast body in a Step
+	struct Impact
+	{
+		float   toi;    ///< Fraction of the step's displacement, 1 if none
+		Vector3 normal; ///< Towards the body
+	}; // struct Impact
+
+	RigidBodyWorld(const RigidBodyWorld&);
+	RigidBodyWorld& operator=(const RigidBodyWorld&);
+
+	float*       GetField(int field)                 {return data_ + field * capacity_;}
+	const float* GetField(int field) const           {return data_ + field * capacity_;}
+	float&       At(int field, int body)             {return data_[field * capacity_ + handleToSlot_[body]];}
+	float        At(int field, int body) const       {return data_[field * capacity_ + handleToSlot_[body]];}
+	void         Reserve(size_t capacity);
+	void         ClearSlot(size_t slot);
+
+	/// Integrates slots [begin, end) 4 at a time and writes back their render state
+	static void StepRange(size_t begin, size_t end, void *data);
+	void IntegrateRange(size_t begin, size_t end, const StepData& step);
+	void WriteRenderState(size_t begin, size_t end);
+	/// Displacement over the last Step; fast if longer than the bounding radius
+	Vector3 GetDisplacement(size_t slot) const;
+	bool    IsFast(size_t slot) const;
+	/// Stops fast bodies at their first impact with a broad phase partner
+	void    SweepFastBodies();
+
+	float                       *data_;      ///< NUM_FIELDS arrays of capacity_ floats
+	size_t                       capacity_;  ///< Multiple of 4
+	unsigned                     numBodies_;
+	std::vector<RenderContext*>  contexts_;  ///< Per slot
+	std::vector<int>             sceneIds_;  ///< Per slot
+	std::vector<int>             broadPhaseIds_; ///< Per slot, -1 without a proxy
+	std::vector<int>             slotToHandle_;
+	std::vector<int>             handleToSlot_;
+	std::vector<int>             freeHandles_;
+
+	SweepAndPrune                broadPhase_;
+	std::vector<int>             proxyToHandle_;
+	std::vector<OverlapPair>     overlaps_;  ///< Body handles
+	bool                         bContinuous_;
+	std::vector<Impact>          impacts_;   ///< Per slot, for SweepFastBodies
+}; // class RigidBodyWorld
+} // namespace bbk
+
+#endif /* _RIGIDBODYWORLD_H */
@@ -41,9 +41,19 @@ void Halt();
 
 void EnableVSync(bool flag);
 void PrintDebugInfo(bool flag);
+/// Draws runs of the same model as one instanced draw where hardware allows
+void EnableInstancing(bool flag);
 
 /** @name
- *  Rendering *///\{
+ *  Rendering. Draw calls record into one frame while Render submits another,
+ *  so a frame can be recorded on another thread while the previous one is
+ *  rendered on the thread owning the GL context. *///\{
+/// Culls queued objects, completing the recorded frame
+void EndFrame();
+/// Hands frame completed by EndFrame to Render and starts recording the next; call while neither runs
+void SwapFrames();
+/// Drops recorded and unrendered frames, e.g. before the models they draw are unloaded
+void DiscardFrames();
 /// Calls graphics engine to render scene
 void Render();
 
@@ -54,8 +64,30 @@ void DrawLine(const Vertex &startVtx, const Vertex &endVtx);
 void DrawTri(const Vertex &v0, const Vertex &v1, const Vertex &v2);
 void DrawQuad(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex &v3);
 void DrawModel(Model *pModel, bool useTextures = true, const Colour& clr = Colour(1.0f, 1.0f, 1.0f, 1.0f));
+/// Queues object for view-frustum culling; renderContext must stay valid until Render
 void DrawObject(RenderContext& renderContext);
 void DrawShape(Shape shape, const Colour& clr = Colour(1.0f, 1.0f, 1.0f, 1.0f));
+/**
+ * Draws geometry that deforms every frame, such as cloth, two-sided and lit,
+ * with back faces lit against the flipped normal. Vertices and indices are
+ * copied, and all of a frame's vertices are streamed to the GPU in one
+ * upload; the triangles take one draw and the optional wireframe lines
+ * another.
+ */
+void DrawDynamicMesh(
+	const Vertex *vertices, size_t numVertices,
+	const unsigned *triIndices, size_t numTriIndices, const Colour& clr = Colour(1.0f, 1.0f, 1.0f, 1.0f),
+	const unsigned *lineIndices = nullptr, size_t numLineIndices = 0, const Colour& lineClr = Colour());
+//\}
+
+/** @name
+ *  Shader and texture state recorded with the frame and applied by Render,
+ *  so it may be set while recording off the GL thread *///\{
+void BindTexture(unsigned unit, const Texture& texture);
+void SetUniform(LocationMgr::UniformID id, int value);
+void SetUniform(LocationMgr::UniformID id, float value);
+void SetUniform3fv(LocationMgr::UniformID id, const float *values);
+void SetUniform4fv(LocationMgr::UniformID id, const float *values);
 //\}
 
 void SetClearColor(float r, float g, float b, float a);
@@ -114,6 +146,27 @@ bool GetPlaneCoherency();
 void SetPlaneCoherency(bool bEnabled);
 void DrawBoundingVolumes(bool bDrawBV);
 //\}
+
+/** @name
+ *  Scene tree. Objects added to the scene are kept in a dynamic AABB tree
+ *  and culled a subtree at a time by DrawScene, instead of one by one by
+ *  DrawObject. Render contexts must stay valid until removed. *///\{
+int  AddSceneObject(RenderContext& renderContext);
+/// Refits object after its render context's AABB changed
+void UpdateSceneObject(int sceneId);
+void RemoveSceneObject(int sceneId);
+void DrawScene();
+//\}
+
+/** @name
+ *  Occlusion culling. Occluders added each frame are rasterized on the CPU
+ *  into a low resolution depth buffer, and objects that passed frustum
+ *  culling but are hidden behind them are not drawn. *///\{
+void SetOcclusionCulling(bool bEnabled);
+bool GetOcclusionCulling();
+/// Uses render context's model as occluder this frame, placed by its transform alone as its bounding volumes are; renderContext must stay valid until Render
+void AddOccluder(RenderContext& renderContext);
+//\}
 } // namespace gfx
 } // namespace bbk
 
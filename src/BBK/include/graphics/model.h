@@ -1,6 +1,7 @@
 #ifndef _MODEL_H
 #define _MODEL_H
 
+#include <cstdint>
 #include <string>
 #include "vertex.h"
 #include "intersect/intersect.h"
@@ -8,6 +9,11 @@
 
 namespace bbk
 {
+namespace fileio
+{
+class MappedFile;
+} // namespace fileio
+
 class Model
 {
 public:
@@ -15,7 +21,12 @@ public:
 	~Model();
 
 	const std::string& GetName() const {return modelName_;}
-	bool LoadGeometryFromFile(const char *filename);
+	/// Loads XML geometry, or binary geometry if filename has the .bbkm extension; a current .cache sidecar is read instead of parsing either
+	bool LoadGeometryFromFile(const char *filename, BVHBuildScheme bvhScheme=E_BVH_MEANSPLIT, unsigned bvhLeafTris=1);
+	/// Loads geometry, bounding volumes and mass properties only: builds no BVH and neither reads nor writes the cache sidecar
+	bool LoadRawGeometryFromFile(const char *filename);
+	/// Saves geometry, bounding volumes and mass properties as a binary mesh file
+	bool SaveGeometryToFile(const char *filename) const;
 
 	/** @name
 	 *  Vertices and vertex attributes *///\{
@@ -28,6 +39,16 @@ public:
 	bool hasNormals()   const {return hasNormals_;}
 	//\}
 
+	/** @name
+	 *  GPU-resident copies of vertex and index arrays *///\{
+	/// Loads vertex and index arrays into buffer objects; needs a current GL context
+	bool     LoadGeometryToGPU();
+	/// Frees buffer objects from GPU
+	void     FreeBufferObjs();
+	unsigned GetVBOHandle() const {return vbo_;}
+	unsigned GetIBOHandle() const {return ibo_;}
+	//\}
+
 	/** @name
 	 *  Bounding Volumes *///\{
 	const BSphere& GetBSphere()       const {return bsphere_;}
@@ -36,7 +57,7 @@ public:
 	const Vector3& GetAABBOffset()    const {return aabbOffset_;}
 	const OBB&     GetOBB()           const {return obb_;}
 	const Vector3& GetOBBOffset()     const {return obbOffset_;}
-	BVHNode*       GetBVH()                 {return bvhroot_;}
+	const BVH*     GetBVH()           const {return bvh_;}
 	//\}
 	
 	/** @name
@@ -47,11 +68,25 @@ public:
 	//\}
 
 private:
+	/// Parses an XML or binary mesh file already mapped as source, which may be closed on return
+	bool LoadSourceFile(const char *filename, fileio::MappedFile& source);
+	bool LoadMeshFile(const char *data, size_t size);
+	bool LoadXMLFile(const char *filename);
+
+	/** @name
+	 *  Binary sidecar holding everything loaded or derived from the source
+	 *  file: geometry, BVH, bounding volumes and mass properties *///\{
+	bool LoadCache(const char *cacheFilename, uint64_t sourceHash, BVHBuildScheme bvhScheme, unsigned bvhLeafTris);
+	void WriteCache(const char *cacheFilename, uint64_t sourceHash, BVHBuildScheme bvhScheme, unsigned bvhLeafTris) const;
+	//\}
+
 	std::string modelName_;
 	size_t      numVertices_;
 	Vertex*     vertices_;
 	size_t      numIndices_;
 	unsigned*   indices_;
+	unsigned    vbo_;
+	unsigned    ibo_;
 
 	bool hasTexCoords_;
 	bool hasNormals_;
@@ -62,7 +97,7 @@ private:
 	Vector3  aabbOffset_;
 	OBB      obb_;
 	Vector3  obbOffset_;
-	BVHNode* bvhroot_;
+	BVH*     bvh_;
 
 	Vector3 centerMass_;
 	float   mass_;
@@ -0,0 +1,62 @@
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include <vector>
+#include "math/matrix4x4.h"
+#include "intersect/AABB.h"
+#include "intersect/OBB.h"
+#include "vertex.h"
+
+namespace bbk
+{
+/**
+ * \class OcclusionBuffer
+ * \brief Low resolution depth buffer that occluder meshes are rasterized into
+ *        on the CPU, with a hierarchical max-depth pyramid for testing
+ *        whether bounding boxes are hidden.
+ *
+ * Depths are normalized device z, so smaller is nearer. Triangles crossing
+ * the near plane are skipped and boxes crossing it are never occluded, which
+ * errs on the side of drawing.
+ */
+class OcclusionBuffer
+{
+public:
+	/// Width is rounded up to a multiple of 4
+	OcclusionBuffer(unsigned width = 256, unsigned height = 128);
+
+	/** @name
+	 *  Per-frame setup: clear, set camera, rasterize occluders, build pyramid *///\{
+	void Clear();
+	void SetViewProjMtx(const Matrix4x4& viewProj) {viewProj_ = viewProj;}
+	void RasterizeOccluder(const Matrix4x4& modelToWorld, const Vertex *vertices, const unsigned *indices, size_t numIndices);
+	void BuildHiZ();
+	//\}
+
+	/** @name
+	 *  Occlusion queries, valid after BuildHiZ. Boxes are in world frame. *///\{
+	bool IsOccluded(const AABB& aabb) const;
+	bool IsOccluded(const OBB& obb) const;
+	//\}
+
+	unsigned     GetWidth() const           {return width_;}
+	unsigned     GetHeight() const          {return height_;}
+	const float* GetDepth() const           {return &depth_[0];}
+	unsigned     GetNumTrisRasterized() const {return numTrisRasterized_;}
+
+private:
+	/// Tests box given by its 8 world frame corners
+	bool IsOccluded(const Vector3 corners[8]) const;
+
+	unsigned              width_, height_;
+	Matrix4x4             viewProj_;
+	std::vector<float>    depth_;      ///< Nearest occluder depth per pixel
+	std::vector<float>    hiZ_;        ///< Mip levels of farthest depth, level 0 first
+	std::vector<unsigned> levelOffset_;
+	std::vector<unsigned> levelWidth_;
+	std::vector<unsigned> levelHeight_;
+	unsigned              numTrisRasterized_;
+}; // class OcclusionBuffer
+} // namespace bbk
+
+#endif /* _OCCLUSION_H */
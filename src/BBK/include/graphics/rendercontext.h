@@ -16,9 +16,10 @@ struct RenderContext
 	BSphere   bsphere;
 	AABB      aabb;
 	OBB       obb;
-	char      planeInd; ///< Cached plane index for plane-coherency culling
+	char      planeInd;  ///< Cached plane index for plane-coherency culling
+	bool      bOccluder; ///< Set by gfx::AddOccluder until the frame's objects are culled
 
-	RenderContext(): model(nullptr), scale(1.0f), planeInd(0) {}
+	RenderContext(): model(nullptr), scale(1.0f), planeInd(0), bOccluder(false) {}
 }; // struct RenderContext
 } // namespace bbk
 
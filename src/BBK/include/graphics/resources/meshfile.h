@@ -0,0 +1,58 @@
+#ifndef _MESHFILE_H
+#define _MESHFILE_H
+
+#include <cstdint>
+#include "graphics/vertex.h"
+#include "intersect/intersect.h"
+#include "math/matrix3x3.h"
+
+namespace bbk
+{
+/**
+ * @struct MeshFileHeader
+ * @brief  Start of a binary mesh (.bbkm) file. Followed by numVertices
+ *         Vertex structs and numIndices unsigned indices, stored exactly as
+ *         they are laid out in memory so loading needs no parsing.
+ */
+struct MeshFileHeader
+{
+	char     magic[4];
+	uint32_t version;
+	char     name[64];
+	uint32_t numVertices;
+	uint32_t numIndices;
+	uint32_t vertexSize;   ///< sizeof(Vertex) when written
+	uint8_t  hasTexCoords;
+	uint8_t  hasNormals;
+	uint8_t  hasMassInfo;
+	uint8_t  pad;
+
+	/** @name
+	 *  Bounding volumes, centered at origin with offsets from model origin *///\{
+	BSphere   bsphere;
+	Vector3   bsphereOffset;
+	AABB      aabb;
+	Vector3   aabbOffset;
+	OBB       obb;
+	Vector3   obbOffset;
+	//\}
+
+	/** @name
+	 *  Rigid body properties, only valid if hasMassInfo *///\{
+	Vector3   centerMass;
+	float     mass;
+	Matrix3x3 inertiaTensor;
+	//\}
+
+	MeshFileHeader();
+}; // struct MeshFileHeader
+
+/// Writes header and geometry arrays to a binary mesh file
+bool WriteMeshFile(const char *filename, const MeshFileHeader& header, const Vertex *vertices, const unsigned *indices);
+/// Returns header of a mapped binary mesh file, nullptr if data is not a valid mesh file or an index is out of range
+const MeshFileHeader* GetMeshFileHeader(const char *data, size_t size);
+/// Returns true if filename has the binary mesh file extension
+bool IsMeshFile(const char *filename);
+} // namespace bbk
+
+#endif /* _MESHFILE_H */
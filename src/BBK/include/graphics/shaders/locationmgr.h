@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 namespace bbk
 {
@@ -13,6 +14,10 @@ namespace bbk
 class LocationMgr
 {
 public:
+	/// Small integer handle of a registered uniform, valid for the lifetime of the manager
+	typedef unsigned UniformID;
+	static const UniformID INVALID_UNIFORM = ~0u;
+
 	LocationMgr();
 	~LocationMgr();
 
@@ -29,6 +34,22 @@ public:
 	int  GetUniformLocHandle(const std::string &var) const;
 	//\}
 
+	/**
+	 * \name
+	 * Uniform handles and shadow values. Look a uniform's ID up once, then set
+	 * it by ID. Setting a value equal to the shadow copy is a no-op; changed
+	 * values are uploaded by FlushUniforms, which needs the program in use.
+	 *///\{
+	/// Retrieves the ID of a registered shader uniform variable. INVALID_UNIFORM if not registered.
+	UniformID GetUniformID(const std::string &var) const;
+	void      SetUniform(UniformID id, int value);
+	void      SetUniform(UniformID id, float value);
+	void      SetUniform3fv(UniformID id, const float *values);
+	void      SetUniform4fv(UniformID id, const float *values);
+	/// Uploads uniform values changed since last flush
+	void      FlushUniforms();
+	//\}
+
 	/**
 	 * \name
 	 * Attribute locations
@@ -41,9 +62,32 @@ public:
 	
 
 private:
-	unsigned int               shadProgHandle_;
-	std::map<std::string, int> uni_var_loc_map_;
-	std::map<std::string, int> att_var_loc_map_;
+	enum UniformType
+	{
+		E_UNI_UNSET,
+		E_UNI_INT,
+		E_UNI_FLOAT,
+		E_UNI_VEC3,
+		E_UNI_VEC4
+	}; // enum UniformType
+
+	struct UniformSlot
+	{
+		int         location;
+		UniformType type;
+		bool        bDirty;
+		int         intValue;
+		float       floatValues[4];
+	}; // struct UniformSlot
+
+	/// Records value in shadow copy and queues it for upload if it changed
+	void SetShadow(UniformID id, UniformType type, int intValue, const float *floatValues, unsigned numFloats);
+
+	unsigned int                     shadProgHandle_;
+	std::map<std::string, UniformID> uni_var_id_map_;
+	std::map<std::string, int>       att_var_loc_map_;
+	std::vector<UniformSlot>         uniforms_;
+	std::vector<UniformID>           dirtyUniforms_;
 }; // class LocationMgr
 } // namespace bbk
 
@@ -1,20 +1,40 @@
 #ifndef _BVH_NODE_H
 #define _BVH_NODE_H
 
+#include <vector>
 #include "OBB.h"
 
 namespace bbk
 {
+/// Node of a linearised BVH. Nodes are laid out depth-first, so the left child
+/// of an interior node is always the node directly after it.
 struct BVHNode
 {
 	OBB       obb;
-	size_t    numVerts;
-	Vector3   *triVerts; ///< Always 3 vectors if any present
-	BVHNode   *left, *right;
-	
-	BVHNode(const OBB& inOBB=OBB(), Vector3 *vertArray=nullptr) : obb(inOBB), triVerts(vertArray), left(nullptr), right(nullptr), numVerts(0) {}
-	~BVHNode() {if (triVerts) delete[] triVerts; if (left) delete left; if (right) delete right;}
-};
+	unsigned  rightChild; ///< Index of right child in BVH::nodes, 0 for leaves
+	unsigned  firstTri;   ///< First entry in BVH::triIndices under this node
+	unsigned  numTris;    ///< Number of triangles under this node
+
+	BVHNode(const OBB& inOBB=OBB()) : obb(inOBB), rightChild(0), firstTri(0), numTris(0) {}
+	bool IsLeaf() const {return rightChild == 0;}
+}; // struct BVHNode
+
+/// Bounding volume hierarchy over a triangle list
+struct BVH
+{
+	std::vector<BVHNode>  nodes;      ///< nodes[0] is the root
+	std::vector<unsigned> triIndices; ///< Triangles ordered so every node covers a contiguous range
+	std::vector<Vector3>  triVerts;   ///< 3 vertices per triangle, in source order
+	unsigned              depth;      ///< Levels below the root, for sizing traversal stacks
+
+	BVH() : depth(0) {}
+	/// Recomputes depth from nodes
+	void UpdateDepth();
+
+	unsigned       GetLeftChild(unsigned node) const {return node + 1;}
+	unsigned       GetRightChild(unsigned node) const {return nodes[node].rightChild;}
+	const Vector3* GetTri(unsigned i) const {return &triVerts[triIndices[i] * 3];} ///< i indexes triIndices
+}; // struct BVH
 } // namespace bbk
 
 #endif /* _BVH_NODE_H */
@@ -0,0 +1,75 @@
+#ifndef _AABBTREE_H
+#define _AABBTREE_H
+
+#include <vector>
+#include "AABB.h"
+
+namespace bbk
+{
+/// Node of a dynamic AABB tree. Leaves hold a proxy's enlarged AABB and user
+/// data, interior nodes the union of their children's AABBs.
+struct AABBTreeNode
+{
+	AABB  aabb;
+	void *userData;
+	int   parent;    ///< Next free node while node is unused
+	int   child1;    ///< AABBTree::NullNode for leaves
+	int   child2;
+	int   height;    ///< 0 for leaves, -1 while node is unused
+	char  planeInd;  ///< Cached plane index for plane-coherency culling
+
+	bool IsLeaf() const {return child1 == -1;}
+}; // struct AABBTreeNode
+
+/**
+ * \class AABBTree
+ * \brief Dynamic bounding volume hierarchy of AABBs that supports inserting,
+ *        moving and removing proxies.
+ *
+ * Leaf AABBs are enlarged by a margin so small movements do not touch the
+ * tree. Insertion picks the sibling that least increases total surface area
+ * and the tree is kept balanced by rotations.
+ */
+class AABBTree
+{
+public:
+	static const int NullNode = -1;
+
+	explicit AABBTree(float margin = 0.1f);
+
+	/** @name
+	 *  Proxies are identified by the index of their leaf node *///\{
+	int  CreateProxy(const AABB& aabb, void *userData);
+	void DestroyProxy(int proxy);
+	/// Refits proxy to aabb; returns true if it left its enlarged AABB and was reinserted
+	bool MoveProxy(int proxy, const AABB& aabb);
+	void* GetUserData(int proxy) const {return nodes_[proxy].userData;}
+	//\}
+
+	/** @name
+	 *  Traversal *///\{
+	int                 GetRoot() const          {return root_;}
+	const AABBTreeNode& GetNode(int node) const  {return nodes_[node];}
+	AABBTreeNode&       GetNode(int node)        {return nodes_[node];}
+	unsigned            GetNumProxies() const    {return numProxies_;}
+	int                 GetHeight() const        {return root_ == NullNode ? 0 : nodes_[root_].height;}
+	//\}
+
+private:
+	int  AllocNode();
+	void FreeNode(int node);
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	int  Balance(int node);
+	/// Recomputes heights and AABBs from node up to root, rebalancing on the way
+	void Refit(int node);
+
+	std::vector<AABBTreeNode> nodes_;
+	int                       root_;
+	int                       freeList_;
+	unsigned                  numProxies_;
+	float                     margin_;
+}; // class AABBTree
+} // namespace bbk
+
+#endif /* _AABBTREE_H */
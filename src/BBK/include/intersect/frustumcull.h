@@ -0,0 +1,57 @@
+#ifndef _FRUSTUMCULL_H
+#define _FRUSTUMCULL_H
+
+#include <cstddef>
+#include <cstdint>
+#include "math/frustum.h"
+
+namespace bbk
+{
+/**
+ * @name
+ * Batch view-frustum culling. Bounding volumes of many objects are passed as
+ * structure of arrays, one array per component, and tested 4 at a time with
+ * SSE against all six frustum planes.
+ *
+ * Results are written as bitmasks, bit (i % 32) of word (i / 32) for object i:
+ * visibleMask has a bit set for objects intersecting the frustum, insideMask
+ * (may be nullptr) for those completely inside it. Both need room for
+ * (count + 31) / 32 words.
+ *
+ * planeInds holds the plane-coherency index of each object, indexing planes in
+ * the order left, right, near, far, bottom, top. When plane coherency is on,
+ * each object is first tested against its cached plane; the index is updated
+ * to the plane that rejected the object.
+ *
+ * Each function returns the number of plane equations evaluated.
+ *///\{
+struct BSphereSoA
+{
+	const float *centerX, *centerY, *centerZ;
+	const float *radius;
+}; // struct BSphereSoA
+
+struct AABBSoA
+{
+	const float *centerX, *centerY, *centerZ;
+	const float *diagX, *diagY, *diagZ;       ///< Half extents
+}; // struct AABBSoA
+
+struct OBBSoA
+{
+	const float *centerX, *centerY, *centerZ;
+	const float *uX, *uY, *uZ;                ///< Unit box axes
+	const float *vX, *vY, *vZ;
+	const float *wX, *wY, *wZ;
+	const float *halfX, *halfY, *halfZ;       ///< Half extents along u, v, w
+}; // struct OBBSoA
+
+const unsigned NUM_FRUSTUM_PLANES = 6;
+
+unsigned FrustumCullBSpheres(const Frustum& frustum, const BSphereSoA& bspheres, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask = nullptr);
+unsigned FrustumCullAABBs(const Frustum& frustum, const AABBSoA& aabbs, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask = nullptr);
+unsigned FrustumCullOBBs(const Frustum& frustum, const OBBSoA& obbs, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask = nullptr);
+//\}
+} // namespace bbk
+
+#endif /* _FRUSTUMCULL_H */
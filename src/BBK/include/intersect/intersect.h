@@ -9,10 +9,37 @@
 
 namespace bbk
 {
+enum BVHBuildScheme
+{
+	E_BVH_MEANSPLIT, ///< Split at mean centroid along longest OBB axis
+	E_BVH_SAH        ///< Split by surface area heuristic over binned centroids
+};
+
+/// Point where two meshes touch, in world frame
+struct Contact
+{
+	Point3  point;
+	Vector3 normal; ///< Unit, pointing from the second mesh towards the first
+}; // struct Contact
+
+/// Nearest triangle a ray hits; tri is -1 on a miss
+struct RayHit
+{
+	float t;   ///< Hit point is ray.pt + ray.vec * t
+	int   tri; ///< Source triangle, so its vertices are BVH::triVerts[tri * 3] onwards
+	float u;   ///< Barycentric weight of the triangle's second vertex
+	float v;   ///< Barycentric weight of the triangle's third vertex
+}; // struct RayHit
+
+/// Barycentric slack ray-triangle tests allow past each edge, so rounding cannot slip a ray between two triangles sharing an edge
+const float TriEdgeEpsilon = 1e-5f;
+
 bool LinevsPlane(const Line& line, const Plane& plane, Point3& intersection);
 bool LinevsSphere(const Line& line, const BSphere& sphere, float intersects[2]);
 bool LinevsAABB(const Line& line, const AABB& aabb, float intersects[2]);
 bool LinevsOBB(const Line& line, const OBB& obb, float intersects[2]);
+/// Moller-Trumbore test hitting either side at or past ray.start, within TriEdgeEpsilon of the edges; u and v weight tri[1] and tri[2]
+bool RayvsTri(const Ray& ray, const Vector3 *tri, float& t, float& u, float& v);
 
 BSphere TransformBSphere(const Matrix4x4& transform, const BSphere& srcBSphere);
 int BSpherevsPlane(const BSphere& bsphere, const Plane& plane);
@@ -21,6 +48,32 @@ int AABBvsPlane(const AABB& aabb, const Plane& plane);
 OBB TransformOBB(const Matrix4x4& transform, const OBB& srcOBB);
 int OBBvsPlane(const OBB& obb, const Plane& plane);
 
+bool OBBvsOBB(const OBB& a, const OBB& b);
+/// Segment where triangles a and b cross; coplanar triangles never intersect
+bool TrivsTri(const Vector3 *a, const Vector3 *b, Point3 segment[2]);
+/**
+ * Descends two BVHs together, each placed by its model transform, and writes
+ * a contact for every pair of crossing triangles, up to maxContacts. Returns
+ * the number written; pass 1 for a yes/no query. Transforms may hold rotation,
+ * translation and uniform scale. Does not allocate.
+ */
+unsigned BVHvsBVH(const BVH& bvhA, const Matrix4x4& transformA, const BVH& bvhB, const Matrix4x4& transformB, Contact *contacts, unsigned maxContacts);
+/**
+ * Finds the nearest triangle each ray hits at or past its start, for a BVH
+ * placed by transform. Rays are traced in packets of 4 with SSE, so batches of
+ * rays that start close together and point the same way trace fastest; large
+ * batches are split across job workers. Triangles are hit from either side.
+ */
+void RaycastBVH(const BVH& bvh, const Matrix4x4& transform, const Ray *rays, size_t numRays, RayHit *hits);
+/**
+ * Sweeps a sphere by displacement against a BVH placed by transform, and finds
+ * the fraction of displacement at which it first touches a triangle, with the
+ * unit normal there pointing towards the sphere. Triangles the sphere already
+ * touches at the start are ignored. For a body's bounding sphere the result
+ * is conservative: the body itself cannot touch any sooner.
+ */
+bool SweptSpherevsBVH(const BSphere& sphere, const Vector3& displacement, const BVH& bvh, const Matrix4x4& transform, float& toi, Vector3& normal);
+
 void DrawBSphereR(const BSphere& bsphere);
 void DrawBSphereG(const BSphere& bsphere);
 void DrawAABBR(const AABB& aabb);
@@ -32,7 +85,7 @@ void DrawOBBB(const OBB& obb);
 
 OBB FitOBBToTri(Vector3 *vertices);
 OBB FitOBBToVerts(Vector3 *vertices, size_t numVerts);
-BVHNode* BuildBVH(Vector3 *vertices, size_t numVerts);
+BVH* BuildBVH(const Vector3 *vertices, size_t numVerts, BVHBuildScheme scheme=E_BVH_MEANSPLIT, unsigned maxLeafTris=1);
 } // namespace bbk
 
 #endif /* _INTERSECT_H */
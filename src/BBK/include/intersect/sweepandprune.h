@@ -0,0 +1,77 @@
+#ifndef _SWEEPANDPRUNE_H
+#define _SWEEPANDPRUNE_H
+
+#include <cstddef>
+#include <vector>
+#include "AABB.h"
+
+namespace bbk
+{
+/// Ids of two objects whose AABBs overlap; SweepAndPrune orders them a < b
+struct OverlapPair
+{
+	int a;
+	int b;
+}; // struct OverlapPair
+
+/**
+ * \class SweepAndPrune
+ * \brief Broad phase that keeps proxy AABBs sorted by their minimum along one
+ *        axis and sweeps the sorted list for overlapping pairs.
+ *
+ * The order persists between updates and is repaired by insertion sort, which
+ * is close to linear when proxies move little per frame. The sweep only
+ * compares a proxy with those starting before it ends along the sort axis and
+ * is split across job workers.
+ */
+class SweepAndPrune
+{
+public:
+	static const int NullProxy = -1;
+
+	/// axis is 0, 1 or 2 for x, y or z; pick the one bodies are most spread along
+	explicit SweepAndPrune(int axis = 0);
+
+	/** @name
+	 *  Proxies are identified by small integers that are reused once freed *///\{
+	int  CreateProxy(const AABB& aabb);
+	void DestroyProxy(int proxy);
+	void MoveProxy(int proxy, const AABB& aabb);
+	unsigned GetNumProxies() const {return static_cast<unsigned>(order_.size());}
+	//\}
+
+	/// Re-sorts proxies and finds every overlapping pair
+	void UpdatePairs();
+	/// Pairs of proxies found by the last UpdatePairs, in sweep order
+	const std::vector<OverlapPair>& GetPairs() const {return pairs_;}
+	/// Insertion sort swaps made by the last UpdatePairs
+	unsigned GetNumSwaps() const {return numSwaps_;}
+
+private:
+	struct Bounds
+	{
+		float min[3];
+		float max[3];
+	}; // struct Bounds
+
+	/// Appends pairs starting at sorted proxies [begin, end) to their chunk's list
+	static void SweepRange(size_t begin, size_t end, void *data);
+
+	int                       axis_;
+	std::vector<Bounds>       bounds_;       ///< Per proxy
+	std::vector<int>          freeProxies_;
+	std::vector<int>          order_;        ///< Proxies sorted by min along axis_
+
+	/** @name
+	 *  Bounds gathered in sorted order, axis_ first *///\{
+	std::vector<float>        sortedMin_[3];
+	std::vector<float>        sortedMax_[3];
+	//\}
+
+	std::vector< std::vector<OverlapPair> > chunkPairs_;
+	std::vector<OverlapPair>  pairs_;
+	unsigned                  numSwaps_;
+}; // class SweepAndPrune
+} // namespace bbk
+
+#endif /* _SWEEPANDPRUNE_H */
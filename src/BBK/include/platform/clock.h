@@ -1,17 +1,22 @@
 #ifndef _CLOCK_H
 #define _CLOCK_H
 
-#include <cstdint> /* uint32_t */
+#include <cstdint> /* uint32_t, uint64_t */
 
 namespace bbk
 {
 namespace clock
 {
-//static void Update();
-/// Returns total elapsed tick count
+/// Samples the clock; the Delta functions report time between the last two Updates. Call once per frame
+void Update();
+/// Returns total elapsed milliseconds
 uint32_t GetTicks();
-/// Returns difference in tick count between current and previous update
+/// Returns difference in milliseconds between the last two Updates
 uint32_t GetDeltaTicks();
+/// Returns monotonic nanoseconds since an arbitrary start; only differences are meaningful
+uint64_t GetNanoseconds();
+/// Returns difference in nanoseconds between the last two Updates
+uint64_t GetDeltaNanoseconds();
 } // namespace clock
 } // namespace bbk
 
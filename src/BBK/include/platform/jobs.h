@@ -0,0 +1,51 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <cstddef> /* size_t */
+
+namespace bbk
+{
+namespace jobs
+{
+typedef void (*JobFunc)(void *data);
+typedef void (*RangeFunc)(size_t begin, size_t end, void *data);
+
+/// Number of outstanding jobs. Run increments it, job completion decrements it.
+struct Counter
+{
+	volatile long value;
+
+	Counter() : value(0) {}
+}; // struct Counter
+
+/// Starts worker threads, one per core besides the calling thread if numWorkers is 0
+bool Init(unsigned numWorkers = 0);
+/// Stops and joins all worker threads
+void Halt();
+/// Returns number of worker threads, 0 if jobs run inline on the submitting thread
+unsigned GetNumWorkers();
+/// Runs every job inline on the submitting thread in submission order, for reproducible runs and debugging
+void SetSingleThreaded(bool flag);
+bool IsSingleThreaded();
+
+/**
+ * \name
+ * Job submission
+ *///\{
+/// Queues a job on the calling thread's deque, or runs it immediately if there are no workers.
+/// Job does not start until dependency, if given, reaches zero; an inline job waits for it first.
+void Run(JobFunc func, void *data, Counter *counter = nullptr, const Counter *dependency = nullptr);
+/// Blocks until counter reaches zero, executing queued jobs in the meantime
+void WaitForCounter(const Counter *counter);
+/**
+ * Calls func on consecutive chunks of [0, count), each at most grainSize
+ * long, and returns once all are done. Chunks are the same whatever the
+ * number of workers, so per-chunk results combined in chunk order do not
+ * depend on threading.
+ */
+void ParallelFor(size_t count, size_t grainSize, RangeFunc func, void *data);
+//\}
+} // namespace jobs
+} // namespace bbk
+
+#endif /* _JOBS_H */
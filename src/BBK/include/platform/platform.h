@@ -3,6 +3,7 @@
 
 #include "clock.h"
 #include "event.h"
+#include "jobs.h"
 #include "keyboard.h"
 #include "mouse.h"
 #include "pollster.h"
@@ -1,6 +1,8 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -23,6 +25,23 @@ std::string VarArgToStr(const char * format, ...);
 
 std::vector<std::string>& SplitStrToWords(const std::string &origStr, char delimiter, std::vector< std::string > &outputWordsVec);
 std::vector<std::string> SplitStrToWords(const std::string &origStr, char delimiter);
+
+/** @name
+ *  In-place number parsing. Each call skips leading whitespace, converts one
+ *  number and advances str past it. Returns false, leaving str and value
+ *  untouched, if str does not start with a number. No memory is allocated. *///\{
+bool ParseFloat(const char *&str, float &value);
+bool ParseInt(const char *&str, int &value);
+bool ParseUnsigned(const char *&str, unsigned &value);
+//\}
+
+/// Parses up to count whitespace-separated floats into out; returns number parsed
+size_t ParseFloats(const char *&str, float *out, size_t count);
+/// Parses up to count whitespace-separated unsigned ints into out; returns number parsed
+size_t ParseUnsigneds(const char *&str, unsigned *out, size_t count);
+
+/// 64-bit FNV-1a hash of a block of memory
+uint64_t HashFNV1a(const void *data, size_t size);
 } // namespace utils
 } // namespace bbk
 
@@ -6,8 +6,12 @@ bool bUpdateAngular = true;
 namespace
 {
 void UpdateInput();
+void RunSerialFrame(float deltatime);
+void RunPipelinedFrame(float deltatime);
+void SimulateFrameJob(void *data);
 
 const float frametime = 1000.0f / 60.0f;
+bool        bPipelined = false;
 } // anon namespace
 
 namespace bbk
@@ -18,36 +22,50 @@ bool InitFramework()
 		return false;
 	if (!bbk::gfx::Init())
 		return false;
+	if (!bbk::profiler::Init())
+		return false;
 
 	return true;
 }
 
+void EnableFramePipelining(bool flag)
+{
+	::bPipelined = flag;
+}
+
 void RunFramework()
 {
 	while (bbk::GameStateMgr::OuterCheckPoint()) // Application keeps running within this loop
 	{
-		uint32_t ts_frameStart = 0;
-		uint32_t ts_prevFrame  = 0;
+		bbk::clock::Update();
 
 		while (bbk::GameStateMgr::InnerCheckPoint()) // Main loop (game frame)
 		{
-			ts_frameStart      = bbk::clock::GetTicks();
-			uint32_t deltatime = ts_frameStart - ts_prevFrame;
-			ts_prevFrame       = ts_frameStart;
-
-			::UpdateInput();
-
-			bbk::GameStateMgr::Update(static_cast<float>(deltatime) * 0.001f);
-
-			bbk::gfx::Render();
-			bbk::appwindow::SwapFramebuffers();
+			bbk::clock::Update();
+			const float deltatime = static_cast<float>(bbk::clock::GetDeltaNanoseconds()) * 1.0e-9f;
+
+			bbk::profiler::BeginFrame();
+			{
+				bbk::profiler::Scope scope("Input");
+				::UpdateInput();
+			}
+
+			if (::bPipelined)
+				::RunPipelinedFrame(deltatime);
+			else
+				::RunSerialFrame(deltatime);
+			bbk::profiler::EndFrame();
 			
 			/*while ((bbk::SysClock::GetTicks() - ts_frameStart) < ::frametime)
 				;*/
 		}
+
+		// Recorded frames may draw models of states that are being unloaded
+		bbk::gfx::DiscardFrames();
 	}
 
 	bbk::GameStateMgr::Halt();
+	bbk::profiler::Halt();
 	bbk::gfx::Halt();
 	bbk::HaltPlatform();
 }
@@ -55,6 +73,61 @@ void RunFramework()
 
 namespace
 {
+void RunSerialFrame(float deltatime)
+{
+	::SimulateFrameJob(&deltatime);
+	bbk::gfx::SwapFrames();
+
+	{
+		bbk::profiler::Scope scope("Render");
+		bbk::gfx::Render();
+	}
+	{
+		bbk::profiler::Scope scope("Present");
+		bbk::appwindow::SwapFramebuffers();
+	}
+
+	bbk::GameStateMgr::ApplyStackChanges();
+}
+
+/// Simulates and records the next frame on a worker while this thread renders
+/// the previous one, so what is shown lags input by a frame
+void RunPipelinedFrame(float deltatime)
+{
+	bbk::jobs::Counter counter;
+	bbk::jobs::Run(::SimulateFrameJob, &deltatime, &counter);
+
+	{
+		bbk::profiler::Scope scope("Render");
+		bbk::gfx::Render();
+	}
+	{
+		bbk::profiler::Scope scope("Present");
+		bbk::appwindow::SwapFramebuffers();
+	}
+
+	{
+		bbk::profiler::Scope scope("Wait");
+		bbk::jobs::WaitForCounter(&counter);
+	}
+	if (bbk::GameStateMgr::ApplyStackChanges())
+		bbk::gfx::DiscardFrames();
+	else
+		bbk::gfx::SwapFrames();
+}
+
+void SimulateFrameJob(void *data)
+{
+	{
+		bbk::profiler::Scope scope("Simulate");
+		bbk::GameStateMgr::Simulate(*static_cast<float*>(data));
+	}
+	{
+		bbk::profiler::Scope scope("Cull");
+		bbk::gfx::EndFrame();
+	}
+}
+
 void UpdateInput()
 {
 	// Clear status of input devices prior to polling for this frame
@@ -0,0 +1,103 @@
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+#include "mappedfile.h"
+
+namespace bbk
+{
+namespace fileio
+{
+MappedFile::MappedFile() :
+	data_(nullptr),
+	size_(0),
+	fileHandle_(nullptr),
+	mapHandle_(nullptr)
+{}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char *filename)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data_)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	size_       = static_cast<size_t>(fileSize.QuadPart);
+	fileHandle_ = file;
+	mapHandle_  = mapping;
+#else
+	const int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data_ = static_cast<const char*>(view);
+	size_ = static_cast<size_t>(fileStat.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!data_)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data_);
+	CloseHandle(static_cast<HANDLE>(mapHandle_));
+	CloseHandle(static_cast<HANDLE>(fileHandle_));
+#else
+	munmap(const_cast<char*>(data_), size_);
+#endif
+	data_       = nullptr;
+	size_       = 0;
+	fileHandle_ = nullptr;
+	mapHandle_  = nullptr;
+}
+} // namespace fileio
+} // namespace bbk
@@ -0,0 +1,524 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+#include "clothgrid.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const size_t   RowGrainSize        = 8;      ///< Rows per job
+const size_t   ConstraintGrainSize = 512;    ///< Constraints per job
+const float    MinLengthSq         = 1e-12f; ///< Keeps springs between coincident particles finite
+const unsigned MaxColours          = 32;     ///< Bits in a colour mask
+
+/// Neighbour a particle has a spring to, as a grid offset
+struct StencilEntry
+{
+	int dRow;
+	int dCol;
+	int type;
+}; // struct StencilEntry
+
+const StencilEntry Stencil[] =
+{
+	{ 0, -1, bbk::ClothGrid::STRUCTURAL}, { 0,  1, bbk::ClothGrid::STRUCTURAL},
+	{-1,  0, bbk::ClothGrid::STRUCTURAL}, { 1,  0, bbk::ClothGrid::STRUCTURAL},
+	{-1, -1, bbk::ClothGrid::SHEAR},      {-1,  1, bbk::ClothGrid::SHEAR},
+	{ 1, -1, bbk::ClothGrid::SHEAR},      { 1,  1, bbk::ClothGrid::SHEAR},
+	{ 0, -2, bbk::ClothGrid::BEND},       { 0,  2, bbk::ClothGrid::BEND},
+	{-2,  0, bbk::ClothGrid::BEND},       { 2,  0, bbk::ClothGrid::BEND}
+};
+const int StencilSize = sizeof(Stencil) / sizeof(Stencil[0]);
+
+/// Every particle has at most StencilSize springs, so the two ends of a constraint hold at most
+/// 2 * (StencilSize - 1) colours between them and greedy colouring needs at most 23. Large
+/// grids use 13 in practice. Fails to compile if a colour mask cannot hold the bound
+typedef char MaxColoursCoversStencil[2 * (StencilSize - 1) + 1 <= static_cast<int>(MaxColours) ? 1 : -1];
+
+/// Stencil entries pointing forwards in index order, so each spring is listed once as a constraint
+const int ForwardStencil[] = {1, 3, 6, 7, 9, 11};
+const int ForwardStencilSize = sizeof(ForwardStencil) / sizeof(ForwardStencil[0]);
+
+/// x, y and z components of 4 vectors
+struct Vec3x4
+{
+	__m128 x, y, z;
+}; // struct Vec3x4
+
+inline Vec3x4 LoadVec3(const float *const v[3], size_t i)
+{
+	const Vec3x4 r = {_mm_load_ps(v[0] + i), _mm_load_ps(v[1] + i), _mm_load_ps(v[2] + i)};
+	return r;
+}
+
+inline Vec3x4 LoadVec3Unaligned(const float *const v[3], size_t i)
+{
+	const Vec3x4 r = {_mm_loadu_ps(v[0] + i), _mm_loadu_ps(v[1] + i), _mm_loadu_ps(v[2] + i)};
+	return r;
+}
+
+inline void StoreVec3(float *const v[3], size_t i, const Vec3x4& a)
+{
+	_mm_store_ps(v[0] + i, a.x);
+	_mm_store_ps(v[1] + i, a.y);
+	_mm_store_ps(v[2] + i, a.z);
+}
+
+inline Vec3x4 Sub(const Vec3x4& a, const Vec3x4& b)
+{
+	const Vec3x4 r = {_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z)};
+	return r;
+}
+
+inline Vec3x4 Scale(const Vec3x4& a, const __m128& s)
+{
+	const Vec3x4 r = {_mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s)};
+	return r;
+}
+
+/// a + b * s
+inline Vec3x4 MulAdd(const Vec3x4& a, const Vec3x4& b, const __m128& s)
+{
+	const Vec3x4 r = {_mm_add_ps(a.x, _mm_mul_ps(b.x, s)), _mm_add_ps(a.y, _mm_mul_ps(b.y, s)), _mm_add_ps(a.z, _mm_mul_ps(b.z, s))};
+	return r;
+}
+
+inline __m128 Dot(const Vec3x4& a, const Vec3x4& b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+} // anon namespace
+
+namespace bbk
+{
+ClothGrid::ClothGrid(unsigned rows, unsigned cols, float spacing, const Point3& origin, const Vector3& colDir, const Vector3& rowDir) :
+	rows_(rows),
+	cols_(cols),
+	spacing_(spacing),
+	stride_(PadCols + ((cols + 3) & ~3u) + PadCols),
+	fieldSize_((rows + 2 * PadRows) * stride_),
+	data_(static_cast<float*>(_mm_malloc(NUM_FIELDS * fieldSize_ * sizeof(float), 16))),
+	solver_(SPRINGS),
+	numSubsteps_(12),
+	numIterations_(1)
+{
+	std::memset(data_, 0, NUM_FIELDS * fieldSize_ * sizeof(float));
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		for (unsigned col = 0; col < cols_; ++col)
+		{
+			const size_t i = Index(row, col);
+			SetPosition(row, col, origin + colDir * (col * spacing) + rowDir * (row * spacing));
+			GetField(INV_MASS)[i]      = 1.0f;
+			GetField(FREE_INV_MASS)[i] = 1.0f;
+			GetField(WEIGHT)[i]        = 1.0f;
+		}
+	}
+
+	// Defaults hold a 128 x 128 sheet of unit masses hanging from its top row to
+	// within a few percent of its rest lengths. Stiffness is about half of what
+	// 12 substeps of a 60 Hz frame keep stable. Under XPBD only bend constraints give
+	const float restLengths[NUM_SPRING_TYPES]       = {spacing, spacing * std::sqrt(2.0f), 2.0f * spacing};
+	const float stiffness[NUM_SPRING_TYPES]         = {150000.0f, 37500.0f, 15000.0f};
+	const float damping[NUM_SPRING_TYPES]           = {50.0f, 12.5f, 5.0f};
+	const float compliance[NUM_SPRING_TYPES]        = {0.0f, 0.0f, 0.00001f};
+	const float constraintDamping[NUM_SPRING_TYPES] = {0.0f, 0.0f, 50.0f};
+	for (int type = 0; type < NUM_SPRING_TYPES; ++type)
+	{
+		springs_[type].stiffness         = stiffness[type];
+		springs_[type].damping           = damping[type];
+		springs_[type].restLength        = restLengths[type];
+		springs_[type].compliance        = compliance[type];
+		springs_[type].constraintDamping = constraintDamping[type];
+	}
+
+	BuildConstraints();
+}
+
+ClothGrid::~ClothGrid()
+{
+	_mm_free(data_);
+}
+
+void ClothGrid::SetSpring(SpringType type, float stiffness, float damping)
+{
+	springs_[type].stiffness = stiffness;
+	springs_[type].damping   = damping;
+}
+
+void ClothGrid::SetCompliance(SpringType type, float compliance, float damping)
+{
+	springs_[type].compliance        = compliance;
+	springs_[type].constraintDamping = damping;
+}
+
+Vector3 ClothGrid::GetPosition(unsigned row, unsigned col) const
+{
+	const size_t i = Index(row, col);
+	return Vector3(GetField(POS_X)[i], GetField(POS_Y)[i], GetField(POS_Z)[i]);
+}
+
+void ClothGrid::SetPosition(unsigned row, unsigned col, const Vector3& pos)
+{
+	const size_t i = Index(row, col);
+	GetField(POS_X)[i] = pos.x;
+	GetField(POS_Y)[i] = pos.y;
+	GetField(POS_Z)[i] = pos.z;
+}
+
+Vector3 ClothGrid::GetVelocity(unsigned row, unsigned col) const
+{
+	const size_t i = Index(row, col);
+	return Vector3(GetField(VEL_X)[i], GetField(VEL_Y)[i], GetField(VEL_Z)[i]);
+}
+
+float ClothGrid::GetInvMass(unsigned row, unsigned col) const
+{
+	return GetField(INV_MASS)[Index(row, col)];
+}
+
+void ClothGrid::SetInvMass(unsigned row, unsigned col, float invMass)
+{
+	const size_t i = Index(row, col);
+	GetField(INV_MASS)[i]      = invMass;
+	GetField(FREE_INV_MASS)[i] = invMass;
+}
+
+void ClothGrid::SetPinned(unsigned row, unsigned col, bool bPinned)
+{
+	const size_t i = Index(row, col);
+	GetField(INV_MASS)[i] = bPinned ? 0.0f : GetField(FREE_INV_MASS)[i];
+	for (int field = MOM_X; field <= VEL_Z; ++field)
+		GetField(field)[i] = 0.0f;
+}
+
+void ClothGrid::AddForce(unsigned row, unsigned col, const Vector3& force)
+{
+	const size_t i = Index(row, col);
+	GetField(EXT_X)[i] += force.x;
+	GetField(EXT_Y)[i] += force.y;
+	GetField(EXT_Z)[i] += force.z;
+}
+
+void ClothGrid::Step(float deltatime)
+{
+	const unsigned numSubsteps = std::max(numSubsteps_, 1u);
+	if (solver_ == XPBD)
+	{
+		for (unsigned i = 0; i < numSubsteps; ++i)
+			StepXPBD(deltatime / numSubsteps);
+		std::memset(GetField(EXT_X), 0, 3 * fieldSize_ * sizeof(float));
+		uniformForce_ = Vector3();
+		return;
+	}
+
+	StepData step;
+	step.cloth     = this;
+	step.deltatime = deltatime / numSubsteps;
+
+	// Forces read neighbours' positions, so all are found before any particle moves
+	for (unsigned i = 0; i < numSubsteps; ++i)
+	{
+		jobs::ParallelFor(rows_, ::RowGrainSize, ForceRange, &step);
+		jobs::ParallelFor(rows_, ::RowGrainSize, IntegrateRange, &step);
+	}
+
+	std::memset(GetField(EXT_X), 0, 3 * fieldSize_ * sizeof(float));
+	uniformForce_ = Vector3();
+}
+
+void ClothGrid::BuildConstraints()
+{
+	// Greedy colouring: each constraint takes the lowest colour neither of its
+	// particles has yet, so no colour touches a particle twice
+	std::vector<unsigned>   particleColours(fieldSize_, 0);
+	std::vector<Constraint> unsorted;
+	std::vector<unsigned>   colours;
+	std::vector<size_t>     colourCounts(::MaxColours, 0);
+	unsigned numColours = 0;
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		for (unsigned col = 0; col < cols_; ++col)
+		{
+			for (int s = 0; s < ::ForwardStencilSize; ++s)
+			{
+				const ::StencilEntry &entry = ::Stencil[::ForwardStencil[s]];
+				const int otherRow = static_cast<int>(row) + entry.dRow;
+				const int otherCol = static_cast<int>(col) + entry.dCol;
+				if (otherRow >= static_cast<int>(rows_) || otherCol < 0 || otherCol >= static_cast<int>(cols_))
+					continue;
+
+				Constraint constraint;
+				constraint.a    = static_cast<unsigned>(Index(row, col));
+				constraint.b    = static_cast<unsigned>(Index(otherRow, otherCol));
+				constraint.type = entry.type;
+
+				const unsigned used = particleColours[constraint.a] | particleColours[constraint.b];
+				unsigned colour = 0;
+				while (colour < ::MaxColours && (used & (1u << colour)))
+					++colour;
+				assert(colour < ::MaxColours);
+				particleColours[constraint.a] |= 1u << colour;
+				particleColours[constraint.b] |= 1u << colour;
+				++colourCounts[colour];
+				numColours = std::max(numColours, colour + 1);
+
+				unsorted.push_back(constraint);
+				colours.push_back(colour);
+			}
+		}
+	}
+
+	// Counting sort into contiguous batches, keeping grid order within each
+	colourStarts_.assign(numColours + 1, 0);
+	for (unsigned colour = 0; colour < numColours; ++colour)
+		colourStarts_[colour + 1] = colourStarts_[colour] + colourCounts[colour];
+	std::vector<size_t> next(colourStarts_.begin(), colourStarts_.end() - 1);
+	constraints_.resize(unsorted.size());
+	for (size_t i = 0; i < unsorted.size(); ++i)
+		constraints_[next[colours[i]]++] = unsorted[i];
+	lambdas_.assign(constraints_.size(), 0.0f);
+}
+
+void ClothGrid::StepXPBD(float deltatime)
+{
+	if (deltatime <= 0.0f)
+		return;
+
+	StepData step;
+	step.cloth     = this;
+	step.deltatime = deltatime;
+	jobs::ParallelFor(rows_, ::RowGrainSize, PredictRange, &step);
+
+	SolveData solve;
+	solve.cloth = this;
+	for (int type = 0; type < NUM_SPRING_TYPES; ++type)
+	{
+		solve.alphaTilde[type] = springs_[type].compliance / (deltatime * deltatime);
+		solve.gamma[type]      = springs_[type].compliance * springs_[type].constraintDamping / deltatime;
+	}
+
+	// Colours run one after another, as later ones move particles earlier ones read
+	std::fill(lambdas_.begin(), lambdas_.end(), 0.0f);
+	for (unsigned iteration = 0; iteration < numIterations_; ++iteration)
+	{
+		for (size_t colour = 0; colour + 1 < colourStarts_.size(); ++colour)
+		{
+			solve.first = colourStarts_[colour];
+			jobs::ParallelFor(colourStarts_[colour + 1] - solve.first, ::ConstraintGrainSize, SolveRange, &solve);
+		}
+	}
+
+	jobs::ParallelFor(rows_, ::RowGrainSize, UpdateVelocityRange, &step);
+}
+
+void ClothGrid::ForceRange(size_t begin, size_t end, void *data)
+{
+	ClothGrid   &cloth    = *static_cast<const StepData*>(data)->cloth;
+	const float *pos[3]   = {cloth.GetField(POS_X), cloth.GetField(POS_Y), cloth.GetField(POS_Z)};
+	const float *vel[3]   = {cloth.GetField(VEL_X), cloth.GetField(VEL_Y), cloth.GetField(VEL_Z)};
+	const float *ext[3]   = {cloth.GetField(EXT_X), cloth.GetField(EXT_Y), cloth.GetField(EXT_Z)};
+	float       *force[3] = {cloth.GetField(FORCE_X), cloth.GetField(FORCE_Y), cloth.GetField(FORCE_Z)};
+	const float *weight   = cloth.GetField(WEIGHT);
+
+	// Stencil as flat index offsets, with its spring's constants
+	ptrdiff_t offsets[::StencilSize];
+	__m128    stiffness[::StencilSize], damping[::StencilSize], restLength[::StencilSize];
+	for (int s = 0; s < ::StencilSize; ++s)
+	{
+		const Spring &spring = cloth.springs_[::Stencil[s].type];
+		offsets[s]    = ::Stencil[s].dRow * static_cast<ptrdiff_t>(cloth.stride_) + ::Stencil[s].dCol;
+		stiffness[s]  = _mm_set1_ps(spring.stiffness);
+		damping[s]    = _mm_set1_ps(spring.damping);
+		restLength[s] = _mm_set1_ps(spring.restLength);
+	}
+	const Vec3x4 uniform     = {_mm_set1_ps(cloth.uniformForce_.x), _mm_set1_ps(cloth.uniformForce_.y), _mm_set1_ps(cloth.uniformForce_.z)};
+	const __m128 one         = _mm_set1_ps(1.0f);
+	const __m128 minLengthSq = _mm_set1_ps(::MinLengthSq);
+	const size_t rowLength   = (cloth.cols_ + 3) & ~3u;
+
+	for (size_t row = begin; row < end; ++row)
+	{
+		const size_t rowBegin = cloth.Index(static_cast<unsigned>(row), 0);
+		for (size_t i = rowBegin; i < rowBegin + rowLength; i += 4)
+		{
+			const Vec3x4 p = ::LoadVec3(pos, i);
+			const Vec3x4 v = ::LoadVec3(vel, i);
+			Vec3x4 f = ::LoadVec3(ext, i);
+			f.x = _mm_add_ps(f.x, uniform.x);
+			f.y = _mm_add_ps(f.y, uniform.y);
+			f.z = _mm_add_ps(f.z, uniform.z);
+
+			// Each particle sums its own springs, so rows are written by one job only
+			for (int s = 0; s < ::StencilSize; ++s)
+			{
+				const size_t j      = i + offsets[s];
+				const Vec3x4 gap    = ::Sub(::LoadVec3Unaligned(pos, j), p);
+				const __m128 length = _mm_sqrt_ps(_mm_max_ps(::Dot(gap, gap), minLengthSq));
+				const Vec3x4 dir    = ::Scale(gap, _mm_div_ps(one, length));
+				const __m128 relVel = ::Dot(::Sub(::LoadVec3Unaligned(vel, j), v), dir);
+
+				// Hooke's law plus damping along the spring; padding neighbours weigh 0
+				const __m128 mag = _mm_add_ps(
+					_mm_mul_ps(stiffness[s], _mm_sub_ps(length, restLength[s])),
+					_mm_mul_ps(damping[s], relVel));
+				f = ::MulAdd(f, dir, _mm_mul_ps(mag, _mm_loadu_ps(weight + j)));
+			}
+			::StoreVec3(force, i, ::Scale(f, _mm_load_ps(weight + i)));
+		}
+	}
+}
+
+void ClothGrid::IntegrateRange(size_t begin, size_t end, void *data)
+{
+	const StepData &step  = *static_cast<const StepData*>(data);
+	ClothGrid      &cloth = *step.cloth;
+	float       *pos[3]   = {cloth.GetField(POS_X), cloth.GetField(POS_Y), cloth.GetField(POS_Z)};
+	float       *mom[3]   = {cloth.GetField(MOM_X), cloth.GetField(MOM_Y), cloth.GetField(MOM_Z)};
+	float       *vel[3]   = {cloth.GetField(VEL_X), cloth.GetField(VEL_Y), cloth.GetField(VEL_Z)};
+	const float *force[3] = {cloth.GetField(FORCE_X), cloth.GetField(FORCE_Y), cloth.GetField(FORCE_Z)};
+	const float *invMass  = cloth.GetField(INV_MASS);
+
+	const __m128 dt        = _mm_set1_ps(step.deltatime);
+	const __m128 zero      = _mm_setzero_ps();
+	const size_t rowLength = (cloth.cols_ + 3) & ~3u;
+
+	for (size_t row = begin; row < end; ++row)
+	{
+		const size_t rowBegin = cloth.Index(static_cast<unsigned>(row), 0);
+		for (size_t i = rowBegin; i < rowBegin + rowLength; i += 4)
+		{
+			// Semi-implicit Euler; pinned particles and padding keep no momentum
+			const __m128 w        = _mm_load_ps(invMass + i);
+			const __m128 unpinned = _mm_cmpneq_ps(w, zero);
+			Vec3x4 m = ::MulAdd(::LoadVec3(mom, i), ::LoadVec3(force, i), dt);
+			m.x = _mm_and_ps(m.x, unpinned);
+			m.y = _mm_and_ps(m.y, unpinned);
+			m.z = _mm_and_ps(m.z, unpinned);
+			const Vec3x4 v = ::Scale(m, w);
+
+			::StoreVec3(mom, i, m);
+			::StoreVec3(vel, i, v);
+			::StoreVec3(pos, i, ::MulAdd(::LoadVec3(pos, i), v, dt));
+		}
+	}
+}
+
+void ClothGrid::PredictRange(size_t begin, size_t end, void *data)
+{
+	const StepData &step  = *static_cast<const StepData*>(data);
+	ClothGrid      &cloth = *step.cloth;
+	float       *pos[3]  = {cloth.GetField(POS_X), cloth.GetField(POS_Y), cloth.GetField(POS_Z)};
+	float       *vel[3]  = {cloth.GetField(VEL_X), cloth.GetField(VEL_Y), cloth.GetField(VEL_Z)};
+	float       *prev[3] = {cloth.GetField(PREV_X), cloth.GetField(PREV_Y), cloth.GetField(PREV_Z)};
+	const float *ext[3]  = {cloth.GetField(EXT_X), cloth.GetField(EXT_Y), cloth.GetField(EXT_Z)};
+	const float *invMass = cloth.GetField(INV_MASS);
+
+	const Vec3x4 uniform   = {_mm_set1_ps(cloth.uniformForce_.x), _mm_set1_ps(cloth.uniformForce_.y), _mm_set1_ps(cloth.uniformForce_.z)};
+	const __m128 dt        = _mm_set1_ps(step.deltatime);
+	const __m128 zero      = _mm_setzero_ps();
+	const size_t rowLength = (cloth.cols_ + 3) & ~3u;
+
+	for (size_t row = begin; row < end; ++row)
+	{
+		const size_t rowBegin = cloth.Index(static_cast<unsigned>(row), 0);
+		for (size_t i = rowBegin; i < rowBegin + rowLength; i += 4)
+		{
+			// Move by external forces alone; the constraints then pull positions back into shape
+			const __m128 w        = _mm_load_ps(invMass + i);
+			const __m128 unpinned = _mm_cmpneq_ps(w, zero);
+			Vec3x4 f = ::LoadVec3(ext, i);
+			f.x = _mm_add_ps(f.x, uniform.x);
+			f.y = _mm_add_ps(f.y, uniform.y);
+			f.z = _mm_add_ps(f.z, uniform.z);
+			Vec3x4 v = ::MulAdd(::LoadVec3(vel, i), f, _mm_mul_ps(w, dt));
+			v.x = _mm_and_ps(v.x, unpinned);
+			v.y = _mm_and_ps(v.y, unpinned);
+			v.z = _mm_and_ps(v.z, unpinned);
+
+			const Vec3x4 p = ::LoadVec3(pos, i);
+			::StoreVec3(prev, i, p);
+			::StoreVec3(vel, i, v);
+			::StoreVec3(pos, i, ::MulAdd(p, v, dt));
+		}
+	}
+}
+
+void ClothGrid::SolveRange(size_t begin, size_t end, void *data)
+{
+	const SolveData &solve  = *static_cast<const SolveData*>(data);
+	ClothGrid       &cloth  = *solve.cloth;
+	float       *pos[3]  = {cloth.GetField(POS_X), cloth.GetField(POS_Y), cloth.GetField(POS_Z)};
+	const float *prev[3] = {cloth.GetField(PREV_X), cloth.GetField(PREV_Y), cloth.GetField(PREV_Z)};
+	const float *invMass = cloth.GetField(INV_MASS);
+
+	for (size_t c = solve.first + begin; c < solve.first + end; ++c)
+	{
+		const Constraint &constraint = cloth.constraints_[c];
+		const unsigned a  = constraint.a;
+		const unsigned b  = constraint.b;
+		const float    wa = invMass[a];
+		const float    wb = invMass[b];
+		const float alphaTilde = solve.alphaTilde[constraint.type];
+		const float gamma      = solve.gamma[constraint.type];
+		const float denom      = (1.0f + gamma) * (wa + wb) + alphaTilde;
+		if (denom <= 0.0f)
+			continue; // Both ends pinned and inextensible
+
+		const Vector3 gap(pos[0][a] - pos[0][b], pos[1][a] - pos[1][b], pos[2][a] - pos[2][b]);
+		const float   length = std::sqrt(std::max(gap.Dot(gap), ::MinLengthSq));
+		const Vector3 dir(gap / length);
+
+		// Rate the constraint has changed at over the step, for damping
+		const Vector3 moved(
+			(pos[0][a] - prev[0][a]) - (pos[0][b] - prev[0][b]),
+			(pos[1][a] - prev[1][a]) - (pos[1][b] - prev[1][b]),
+			(pos[2][a] - prev[2][a]) - (pos[2][b] - prev[2][b]));
+
+		const float error   = length - cloth.springs_[constraint.type].restLength;
+		float      &lambda  = cloth.lambdas_[c];
+		const float dLambda = (-error - alphaTilde * lambda - gamma * dir.Dot(moved)) / denom;
+		lambda += dLambda;
+
+		pos[0][a] += dir.x * (wa * dLambda);
+		pos[1][a] += dir.y * (wa * dLambda);
+		pos[2][a] += dir.z * (wa * dLambda);
+		pos[0][b] -= dir.x * (wb * dLambda);
+		pos[1][b] -= dir.y * (wb * dLambda);
+		pos[2][b] -= dir.z * (wb * dLambda);
+	}
+}
+
+void ClothGrid::UpdateVelocityRange(size_t begin, size_t end, void *data)
+{
+	const StepData &step  = *static_cast<const StepData*>(data);
+	ClothGrid      &cloth = *step.cloth;
+	const float *pos[3]  = {cloth.GetField(POS_X), cloth.GetField(POS_Y), cloth.GetField(POS_Z)};
+	const float *prev[3] = {cloth.GetField(PREV_X), cloth.GetField(PREV_Y), cloth.GetField(PREV_Z)};
+	float       *mom[3]  = {cloth.GetField(MOM_X), cloth.GetField(MOM_Y), cloth.GetField(MOM_Z)};
+	float       *vel[3]  = {cloth.GetField(VEL_X), cloth.GetField(VEL_Y), cloth.GetField(VEL_Z)};
+	const float *invMass = cloth.GetField(INV_MASS);
+
+	const __m128 invDt     = _mm_set1_ps(1.0f / step.deltatime);
+	const __m128 one       = _mm_set1_ps(1.0f);
+	const __m128 zero      = _mm_setzero_ps();
+	const size_t rowLength = (cloth.cols_ + 3) & ~3u;
+
+	for (size_t row = begin; row < end; ++row)
+	{
+		const size_t rowBegin = cloth.Index(static_cast<unsigned>(row), 0);
+		for (size_t i = rowBegin; i < rowBegin + rowLength; i += 4)
+		{
+			// Velocity from how far the particle ended up moving; momentum kept in step for SPRINGS
+			const __m128 w        = _mm_load_ps(invMass + i);
+			const __m128 unpinned = _mm_cmpneq_ps(w, zero);
+			const __m128 mass     = _mm_and_ps(_mm_div_ps(one, _mm_or_ps(w, _mm_andnot_ps(unpinned, one))), unpinned);
+			const Vec3x4 v        = ::Scale(::Sub(::LoadVec3(pos, i), ::LoadVec3(prev, i)), invDt);
+			::StoreVec3(vel, i, v);
+			::StoreVec3(mom, i, ::Scale(v, mass));
+		}
+	}
+}
+} // namespace bbk
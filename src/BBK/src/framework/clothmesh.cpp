@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cmath>
+#include "clothmesh.h"
+#include "clothgrid.h"
+#include "graphics/graphics.h"
+
+namespace bbk
+{
+ClothMesh::ClothMesh(const ClothGrid& cloth) :
+	rows_(cloth.GetNumRows()),
+	cols_(cloth.GetNumCols()),
+	vertices_(rows_ * cols_)
+{
+	// Texture coordinates span the sheet once
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		for (unsigned col = 0; col < cols_; ++col)
+		{
+			Vertex &vtx = vertices_[Index(row, col)];
+			vtx.tc[0] = cols_ > 1 ? static_cast<float>(col) / (cols_ - 1) : 0.0f;
+			vtx.tc[1] = rows_ > 1 ? static_cast<float>(row) / (rows_ - 1) : 0.0f;
+		}
+	}
+
+	// Wound so faces point along colDir x rowDir, the way Update's normals do
+	if (rows_ > 1 && cols_ > 1)
+	{
+		triIndices_.reserve(6 * (rows_ - 1) * (cols_ - 1));
+		for (unsigned row = 0; row + 1 < rows_; ++row)
+		{
+			for (unsigned col = 0; col + 1 < cols_; ++col)
+			{
+				triIndices_.push_back(Index(row,     col));
+				triIndices_.push_back(Index(row,     col + 1));
+				triIndices_.push_back(Index(row + 1, col));
+
+				triIndices_.push_back(Index(row,     col + 1));
+				triIndices_.push_back(Index(row + 1, col + 1));
+				triIndices_.push_back(Index(row + 1, col));
+			}
+		}
+	}
+
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		for (unsigned col = 0; col < cols_; ++col)
+		{
+			if (col + 1 < cols_)
+			{
+				lineIndices_.push_back(Index(row, col));
+				lineIndices_.push_back(Index(row, col + 1));
+			}
+			if (row + 1 < rows_)
+			{
+				lineIndices_.push_back(Index(row,     col));
+				lineIndices_.push_back(Index(row + 1, col));
+			}
+		}
+	}
+
+	Update(cloth);
+}
+
+void ClothMesh::Update(const ClothGrid& cloth)
+{
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		for (unsigned col = 0; col < cols_; ++col)
+			vertices_[Index(row, col)].pos = cloth.GetPosition(row, col);
+	}
+
+	// Each normal crosses the differences across its neighbours along the row and
+	// column, so every vertex is written once instead of summing face normals
+	for (unsigned row = 0; row < rows_; ++row)
+	{
+		const unsigned above = row > 0 ? row - 1 : row;
+		const unsigned below = std::min(row + 1, rows_ - 1);
+		for (unsigned col = 0; col < cols_; ++col)
+		{
+			const unsigned left  = col > 0 ? col - 1 : col;
+			const unsigned right = std::min(col + 1, cols_ - 1);
+			const Vector3 alongCol(vertices_[Index(row, right)].pos - vertices_[Index(row, left)].pos);
+			const Vector3 alongRow(vertices_[Index(below, col)].pos - vertices_[Index(above, col)].pos);
+			const Vector3 normal(alongCol.Cross(alongRow));
+
+			// Folded flat onto itself, the old normal is the best guess
+			const float lengthSq = normal.MagnitudeSq();
+			if (lengthSq > 0.0f)
+				vertices_[Index(row, col)].nrm = normal / std::sqrt(lengthSq);
+		}
+	}
+}
+
+void ClothMesh::Draw(const Colour& clr, bool bWireframe, const Colour& wireClr) const
+{
+	if (vertices_.empty() || triIndices_.empty())
+		return;
+
+	gfx::DrawDynamicMesh(
+		&vertices_[0], vertices_.size(),
+		&triIndices_[0], triIndices_.size(), clr,
+		bWireframe && !lineIndices_.empty() ? &lineIndices_[0] : nullptr, lineIndices_.size(), wireClr);
+}
+} // namespace bbk
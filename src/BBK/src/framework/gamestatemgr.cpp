@@ -1,5 +1,7 @@
+#include <cmath>
 #include "gamestatemgr.h"
 #include "gamestate.h"
+#include "profiler.h"
 
 namespace
 {
@@ -25,13 +27,24 @@ bool GameStateMgr::toPush_   = false;
 bool GameStateMgr::toPop_    = false;
 bool GameStateMgr::toSwitch_ = false;
 
-int   GameStateMgr::numCycles_   = 0;
-float GameStateMgr::timeElapsed_ = 0.0f;
+int      GameStateMgr::numCycles_     = 0;
+float    GameStateMgr::timeElapsed_   = 0.0f;
+float    GameStateMgr::fixedTimestep_ = 1.0f / 60.0f;
+unsigned GameStateMgr::maxSubsteps_   = 5;
+float    GameStateMgr::accumulator_   = 0.0f;
+float    GameStateMgr::interpolation_ = 1.0f;
 
 //\}
 
 bool GameStateMgr::Init() {return true;}
 
+void GameStateMgr::SetFixedStepRate(float stepsPerSecond, unsigned maxSubsteps)
+{
+	fixedTimestep_ = stepsPerSecond > 0.0f ? 1.0f / stepsPerSecond : 0.0f;
+	maxSubsteps_   = maxSubsteps;
+	accumulator_   = 0.0f;
+}
+
 void GameStateMgr::Halt()
 {
 	for (size_t i = 0, size = statesVec_.size(); i < size; ++i)
@@ -41,21 +54,59 @@ void GameStateMgr::Halt()
 }
 
 void GameStateMgr::Update(float deltatime)
+{
+	Simulate(deltatime);
+	ApplyStackChanges();
+}
+
+void GameStateMgr::Simulate(float deltatime)
 {
 	if (!::bFirstFrame)
 	{
-		UpdateStates(deltatime);
+		{
+			profiler::Scope scope("Update");
+			UpdateStates(deltatime);
+		}
+
+		profiler::BeginScope("FixedUpdate");
+		if (fixedTimestep_ > 0.0f)
+		{
+			accumulator_ += deltatime;
+			unsigned numSteps = 0;
+			for (; accumulator_ >= fixedTimestep_ && numSteps < maxSubsteps_; ++numSteps)
+			{
+				FixedUpdateStates(fixedTimestep_);
+				accumulator_ -= fixedTimestep_;
+			}
+			if (accumulator_ >= fixedTimestep_)
+				accumulator_ = std::fmod(accumulator_, fixedTimestep_);
+			interpolation_ = accumulator_ / fixedTimestep_;
+		}
+		else
+		{
+			FixedUpdateStates(deltatime);
+			interpolation_ = 1.0f;
+		}
+		profiler::EndScope();
+
+		profiler::Scope scope("Draw");
 		DrawStates();
 	}
 	else
 		::bFirstFrame = false;
-	
+}
+
+bool GameStateMgr::ApplyStackChanges()
+{
+	const bool bChanged = toPop_ || toPush_ || toSwitch_;
+
 	if (toPop_)
 		ExecutePop();
 	if (toPush_)
 		ExecutePush();
 	if (toSwitch_)
 		ExecuteSwitch();
+	return bChanged;
 }
 
 unsigned GameStateMgr::RegisterGameState(GameState * const pState)
@@ -146,6 +197,17 @@ void GameStateMgr::UpdateStates(float deltatime)
 	}
 }
 
+void GameStateMgr::FixedUpdateStates(float timestep)
+{
+	for (int i = gsStackTopInd_; i >= 0; --i)
+	{
+		pCurrState_ = gsStack_[i].pState;
+		pCurrState_->FixedUpdate(timestep);
+		if (!gsStack_[i].updateBelow)
+			return;
+	}
+}
+
 void GameStateMgr::DrawStates()
 {
 	for (int i = gsStackTopInd_; i >= 0; --i)
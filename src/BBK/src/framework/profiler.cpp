@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "sdl/SDL_mutex.h"
+#include "sdl/SDL_thread.h"
+#include "profiler.h"
+#include "platform/clock.h"
+#include "graphics/graphics.h"
+
+namespace
+{
+struct Node
+{
+	const char         *name;
+	int                 parent;
+	int                 depth;
+	std::vector<int>    children;
+	uint64_t            frameNs;  ///< Summed over the frame being recorded
+	bool                bSeen;    ///< Whether any scope of this node closed this frame
+	std::vector<float>  history;  ///< Milliseconds per frame, negative for frames it was not seen in
+}; // struct Node
+
+struct OpenScope
+{
+	int      node;
+	uint64_t start;
+	bool     bRecorded; ///< Whether recording was on when the scope began
+}; // struct OpenScope
+
+/// Scopes open on one thread, innermost last
+struct ThreadScopes
+{
+	Uint32                 threadId;
+	std::vector<OpenScope> open;
+}; // struct ThreadScopes
+
+std::vector<Node>         nodes;       ///< [0] is the frame, parents before children
+std::vector<ThreadScopes> threads;
+SDL_mutex                *lock        = nullptr;
+bool                      bEnabled    = true;
+bool                      bRecording  = false; ///< bEnabled as of the last BeginFrame
+uint64_t                  frameStart  = 0;
+unsigned                  numFrames   = 0;     ///< Frames recorded since Init
+
+int  AddNode(const char *name, int parent);
+int  FindChild(int parent, const char *name);
+ThreadScopes& GetThreadScopes();
+void GetTreeOrder(int node, std::vector<int>& order);
+std::string GetPath(int node);
+float Percentile(const std::vector<float>& sorted, float fraction);
+} // anon namespace
+
+namespace bbk
+{
+namespace profiler
+{
+bool Init()
+{
+	if (::lock)
+		return true;
+
+	::lock = SDL_CreateMutex();
+	if (!::lock)
+	{
+		std::fprintf(stdout, "profiler::Init: Failed to create mutex\n");
+		return false;
+	}
+
+	::AddNode("Frame", -1);
+	::numFrames = 0;
+	return true;
+}
+
+void Halt()
+{
+	if (!::lock)
+		return;
+
+	SDL_DestroyMutex(::lock);
+	::lock       = nullptr;
+	::bRecording = false;
+	::nodes.clear();
+	::threads.clear();
+}
+
+void SetEnabled(bool flag)
+{
+	::bEnabled = flag;
+}
+
+bool IsEnabled()
+{
+	return ::bEnabled;
+}
+
+void BeginFrame()
+{
+	::bRecording = ::bEnabled && ::lock;
+	::frameStart = clock::GetNanoseconds();
+}
+
+void EndFrame()
+{
+	if (!::bRecording)
+		return;
+
+	const uint64_t end = clock::GetNanoseconds();
+	SDL_mutexP(::lock);
+
+	::nodes[0].frameNs = end - ::frameStart;
+	::nodes[0].bSeen   = true;
+
+	const unsigned slot = ::numFrames % HistorySize;
+	for (size_t i = 0, size = ::nodes.size(); i < size; ++i)
+	{
+		Node &node = ::nodes[i];
+		node.history[slot] = node.bSeen ? static_cast<float>(static_cast<double>(node.frameNs) * 1.0e-6) : -1.0f;
+		node.frameNs = 0;
+		node.bSeen   = false;
+	}
+	++::numFrames;
+
+	SDL_mutexV(::lock);
+}
+
+void BeginScope(const char *name)
+{
+	if (!::lock)
+		return;
+
+	SDL_mutexP(::lock);
+
+	// Pushed even while not recording, so a scope that straddles a toggle still
+	// pairs with its own EndScope rather than its parent's
+	ThreadScopes &scopes = ::GetThreadScopes();
+	const int parent = scopes.open.empty() ? 0 : scopes.open.back().node;
+	OpenScope scope;
+	scope.node      = ::FindChild(parent, name);
+	scope.bRecorded = ::bRecording;
+	// Sampled last, so the lookup is not counted against the scope
+	scope.start     = clock::GetNanoseconds();
+	scopes.open.push_back(scope);
+
+	SDL_mutexV(::lock);
+}
+
+void EndScope()
+{
+	if (!::lock)
+		return;
+
+	const uint64_t end = clock::GetNanoseconds();
+	SDL_mutexP(::lock);
+
+	ThreadScopes &scopes = ::GetThreadScopes();
+	if (!scopes.open.empty())
+	{
+		const OpenScope &scope = scopes.open.back();
+		if (scope.bRecorded && ::bRecording)
+		{
+			::nodes[scope.node].frameNs += end - scope.start;
+			::nodes[scope.node].bSeen    = true;
+		}
+		scopes.open.pop_back();
+	}
+
+	SDL_mutexV(::lock);
+}
+
+void GetSummaries(std::vector<Summary>& summaries)
+{
+	summaries.clear();
+	if (!::lock)
+		return;
+
+	SDL_mutexP(::lock);
+
+	std::vector<int> order;
+	::GetTreeOrder(0, order);
+
+	const unsigned numRecorded = std::min(::numFrames, HistorySize);
+	std::vector<float> times;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const Node &node = ::nodes[order[i]];
+		times.clear();
+		for (unsigned j = 0; j < numRecorded; ++j)
+		{
+			if (node.history[j] >= 0.0f)
+				times.push_back(node.history[j]);
+		}
+		std::sort(times.begin(), times.end());
+
+		Summary summary;
+		summary.name      = node.name;
+		summary.depth     = node.depth;
+		summary.numFrames = static_cast<unsigned>(times.size());
+		summary.p50       = ::Percentile(times, 0.50f);
+		summary.p95       = ::Percentile(times, 0.95f);
+		summary.p99       = ::Percentile(times, 0.99f);
+		summary.max       = times.empty() ? 0.0f : times.back();
+		summaries.push_back(summary);
+	}
+
+	SDL_mutexV(::lock);
+}
+
+void PrintSummaries()
+{
+	std::vector<Summary> summaries;
+	GetSummaries(summaries);
+
+	char buffer[128] = {0};
+	std::sprintf(buffer, "Scope ms: p50 / p95 / p99 / max over %u frames", std::min(::numFrames, HistorySize));
+	gfx::PrintDebugInfo(buffer);
+	for (size_t i = 0; i < summaries.size(); ++i)
+	{
+		const Summary &summary = summaries[i];
+		std::sprintf(buffer, "%*s%.32s: %.2f / %.2f / %.2f / %.2f",
+			2 * summary.depth, "", summary.name, summary.p50, summary.p95, summary.p99, summary.max);
+		gfx::PrintDebugInfo(buffer);
+	}
+}
+
+bool DumpCSV(const char *filename)
+{
+	if (!::lock)
+		return false;
+
+	std::FILE *file = std::fopen(filename, "w");
+	if (!file)
+	{
+		std::fprintf(stdout, "profiler::DumpCSV: Failed to open %s for writing\n", filename);
+		return false;
+	}
+
+	SDL_mutexP(::lock);
+
+	std::vector<int> order;
+	::GetTreeOrder(0, order);
+
+	bool bSuccess = std::fprintf(file, "frame") > 0;
+	for (size_t i = 0; bSuccess && i < order.size(); ++i)
+		bSuccess = std::fprintf(file, ",%s", ::GetPath(order[i]).c_str()) > 0;
+	bSuccess = bSuccess && std::fputc('\n', file) != EOF;
+
+	// Oldest frame first
+	const unsigned numRecorded = std::min(::numFrames, HistorySize);
+	for (unsigned frame = ::numFrames - numRecorded; bSuccess && frame < ::numFrames; ++frame)
+	{
+		const unsigned slot = frame % HistorySize;
+		bSuccess = std::fprintf(file, "%u", frame) > 0;
+		for (size_t i = 0; bSuccess && i < order.size(); ++i)
+		{
+			const float ms = ::nodes[order[i]].history[slot];
+			bSuccess = (ms >= 0.0f ? std::fprintf(file, ",%.4f", ms) : std::fprintf(file, ",")) > 0;
+		}
+		bSuccess = bSuccess && std::fputc('\n', file) != EOF;
+	}
+
+	SDL_mutexV(::lock);
+	std::fclose(file);
+
+	if (!bSuccess)
+		std::fprintf(stdout, "profiler::DumpCSV: Failed to write %s\n", filename);
+	return bSuccess;
+}
+} // namespace profiler
+} // namespace bbk
+
+namespace
+{
+int AddNode(const char *name, int parent)
+{
+	Node node;
+	node.name    = name;
+	node.parent  = parent;
+	node.depth   = parent < 0 ? 0 : ::nodes[parent].depth + 1;
+	node.frameNs = 0;
+	node.bSeen   = false;
+	node.history.assign(bbk::profiler::HistorySize, -1.0f);
+
+	const int index = static_cast<int>(::nodes.size());
+	::nodes.push_back(node);
+	if (parent >= 0)
+		::nodes[parent].children.push_back(index);
+	return index;
+}
+
+int FindChild(int parent, const char *name)
+{
+	const std::vector<int> &children = ::nodes[parent].children;
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		const char *childName = ::nodes[children[i]].name;
+		if (childName == name || std::strcmp(childName, name) == 0)
+			return children[i];
+	}
+	return ::AddNode(name, parent);
+}
+
+ThreadScopes& GetThreadScopes()
+{
+	const Uint32 id = SDL_ThreadID();
+	for (size_t i = 0; i < ::threads.size(); ++i)
+	{
+		if (::threads[i].threadId == id)
+			return ::threads[i];
+	}
+
+	::threads.push_back(ThreadScopes());
+	::threads.back().threadId = id;
+	return ::threads.back();
+}
+
+void GetTreeOrder(int node, std::vector<int>& order)
+{
+	order.push_back(node);
+	const std::vector<int> &children = ::nodes[node].children;
+	for (size_t i = 0; i < children.size(); ++i)
+		::GetTreeOrder(children[i], order);
+}
+
+std::string GetPath(int node)
+{
+	std::string path(::nodes[node].name);
+	for (int parent = ::nodes[node].parent; parent >= 0; parent = ::nodes[parent].parent)
+		path = std::string(::nodes[parent].name) + "/" + path;
+	return path;
+}
+
+/// Nearest-rank: the smallest time at least the given fraction of frames are no slower than
+float Percentile(const std::vector<float>& sorted, float fraction)
+{
+	if (sorted.empty())
+		return 0.0f;
+
+	const size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+	return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+} // anon namespace
@@ -0,0 +1,666 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+#include "rigidbodyworld.h"
+#include "graphics/graphics.h"
+#include "platform/jobs.h"
+
+extern bool bUpdateLinear;
+extern bool bUpdateAngular;
+
+namespace
+{
+const size_t StepGrainSize = 128;   ///< Bodies per job, multiple of 4
+const float  DragCoeff     = 0.47f; ///< Of a sphere
+const float  MinQuatMag    = 0.000001f;
+const float  ContactSkin   = 0.01f;  ///< Gap a swept body keeps from what it hit
+
+/// x, y and z components of 4 vectors
+struct Vec3x4
+{
+	__m128 x, y, z;
+}; // struct Vec3x4
+
+inline Vec3x4 LoadVec3(const float *x, const float *y, const float *z)
+{
+	const Vec3x4 v = {_mm_load_ps(x), _mm_load_ps(y), _mm_load_ps(z)};
+	return v;
+}
+
+inline void StoreVec3(float *x, float *y, float *z, const Vec3x4& v)
+{
+	_mm_store_ps(x, v.x);
+	_mm_store_ps(y, v.y);
+	_mm_store_ps(z, v.z);
+}
+
+inline Vec3x4 Add(const Vec3x4& a, const Vec3x4& b)
+{
+	const Vec3x4 v = {_mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z)};
+	return v;
+}
+
+inline Vec3x4 Scale(const Vec3x4& a, const __m128& s)
+{
+	const Vec3x4 v = {_mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s)};
+	return v;
+}
+
+/// a + b * s
+inline Vec3x4 MulAdd(const Vec3x4& a, const Vec3x4& b, const __m128& s)
+{
+	return ::Add(a, ::Scale(b, s));
+}
+
+inline __m128 Dot(const Vec3x4& a, const Vec3x4& b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+inline Vec3x4 Cross(const Vec3x4& a, const Vec3x4& b)
+{
+	const Vec3x4 v = {
+		_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+		_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+		_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))};
+	return v;
+}
+
+/// (1/6)(a + 2b + 2c + d)
+inline Vec3x4 RK4Average(const Vec3x4& a, const Vec3x4& b, const Vec3x4& c, const Vec3x4& d)
+{
+	const __m128 two   = _mm_set1_ps(2.0f);
+	const __m128 sixth = _mm_set1_ps(1.0f / 6.0f);
+	return ::Scale(::Add(::Add(a, d), ::Scale(::Add(b, c), two)), sixth);
+}
+
+/// Quadratic drag opposing velocity, (1/2)|v|^2 Cd (-v/|v|)
+inline Vec3x4 Drag(const Vec3x4& vel)
+{
+	const __m128 k = _mm_mul_ps(_mm_sqrt_ps(::Dot(vel, vel)), _mm_set1_ps(-0.5f * ::DragCoeff));
+	return ::Scale(vel, k);
+}
+
+/// Column-major m * v
+inline Vec3x4 Mul(const __m128 m[9], const Vec3x4& v)
+{
+	const Vec3x4 r = {
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], v.x), _mm_mul_ps(m[3], v.y)), _mm_mul_ps(m[6], v.z)),
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], v.x), _mm_mul_ps(m[4], v.y)), _mm_mul_ps(m[7], v.z)),
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], v.x), _mm_mul_ps(m[5], v.y)), _mm_mul_ps(m[8], v.z))};
+	return r;
+}
+
+/// Column-major transpose(m) * v
+inline Vec3x4 MulTranspose(const __m128 m[9], const Vec3x4& v)
+{
+	const Vec3x4 r = {
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], v.x), _mm_mul_ps(m[1], v.y)), _mm_mul_ps(m[2], v.z)),
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3], v.x), _mm_mul_ps(m[4], v.y)), _mm_mul_ps(m[5], v.z)),
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[6], v.x), _mm_mul_ps(m[7], v.y)), _mm_mul_ps(m[8], v.z))};
+	return r;
+}
+
+/// Same as bbk::QuatToMatrix, for 4 quaternions
+inline void QuatToMatrix(const __m128& s, const Vec3x4& v, __m128 m[9])
+{
+	const __m128 one  = _mm_set1_ps(1.0f);
+	const __m128 x2   = _mm_add_ps(v.x, v.x);
+	const __m128 y2   = _mm_add_ps(v.y, v.y);
+	const __m128 z2   = _mm_add_ps(v.z, v.z);
+	const __m128 xsq2 = _mm_mul_ps(x2, v.x);
+	const __m128 ysq2 = _mm_mul_ps(y2, v.y);
+	const __m128 zsq2 = _mm_mul_ps(z2, v.z);
+	const __m128 xy2  = _mm_mul_ps(x2, v.y);
+	const __m128 yz2  = _mm_mul_ps(y2, v.z);
+	const __m128 xz2  = _mm_mul_ps(x2, v.z);
+	const __m128 sx2  = _mm_mul_ps(s, x2);
+	const __m128 sy2  = _mm_mul_ps(s, y2);
+	const __m128 sz2  = _mm_mul_ps(s, z2);
+
+	m[0] = _mm_sub_ps(_mm_sub_ps(one, ysq2), zsq2);
+	m[1] = _mm_add_ps(xy2, sz2);
+	m[2] = _mm_sub_ps(xz2, sy2);
+	m[3] = _mm_sub_ps(xy2, sz2);
+	m[4] = _mm_sub_ps(_mm_sub_ps(one, xsq2), zsq2);
+	m[5] = _mm_add_ps(yz2, sx2);
+	m[6] = _mm_add_ps(xz2, sy2);
+	m[7] = _mm_sub_ps(yz2, sx2);
+	m[8] = _mm_sub_ps(_mm_sub_ps(one, xsq2), ysq2);
+}
+
+/// mask ? a : b per lane
+inline __m128 Select(const __m128& mask, const __m128& a, const __m128& b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// Writes transform and, with a model, world bounding volumes of a body at pos with rotation rot
+void WriteContext(bbk::RenderContext& rc, const bbk::Vector3& pos, const bbk::Matrix3x3& rot)
+{
+	const float  scale = rc.scale;
+	const float *r     = rot.elements;
+
+	// Translate(pos) * rot * UniScale(scale), column-major
+	float *m = rc.transform.elements;
+	m[0]  = r[0] * scale; m[1]  = r[1] * scale; m[2]  = r[2] * scale; m[3]  = 0.0f;
+	m[4]  = r[3] * scale; m[5]  = r[4] * scale; m[6]  = r[5] * scale; m[7]  = 0.0f;
+	m[8]  = r[6] * scale; m[9]  = r[7] * scale; m[10] = r[8] * scale; m[11] = 0.0f;
+	m[12] = pos.x;        m[13] = pos.y;        m[14] = pos.z;        m[15] = 1.0f;
+
+	if (!rc.model)
+		return;
+
+	{
+		rc.bsphere = bbk::TransformBSphere(rc.transform, rc.model->GetBSphere());
+		rc.bsphere.center += rot * (rc.model->GetBSphereOffset() * scale);
+		rc.bsphere.radius *= std::fabs(scale);
+	}
+	{
+		rc.aabb = bbk::TransformAABB(rc.transform, rc.model->GetAABB());
+		rc.aabb.center += rot * (rc.model->GetAABBOffset() * scale);
+	}
+	{
+		rc.obb = bbk::TransformOBB(rc.transform, rc.model->GetOBB());
+		rc.obb.center += rot * (rc.model->GetOBBOffset() * scale);
+		rc.obb.halfExtents *= scale;
+	}
+}
+} // anon namespace
+
+namespace bbk
+{
+RigidBodyWorld::RigidBodyWorld() :
+	data_(nullptr),
+	capacity_(0),
+	numBodies_(0),
+	bContinuous_(true)
+{}
+
+RigidBodyWorld::~RigidBodyWorld()
+{
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		if (sceneIds_[i] >= 0)
+			gfx::RemoveSceneObject(sceneIds_[i]);
+	}
+	_mm_free(data_);
+}
+
+int RigidBodyWorld::AddBody(RenderContext& renderContext)
+{
+	if (numBodies_ == capacity_)
+		Reserve(capacity_ ? 2 * capacity_ : 16);
+
+	const size_t slot = numBodies_++;
+	ClearSlot(slot);
+	GetField(ORIENT_S)[slot]      = 1.0f;
+	GetField(PREV_ORIENT_S)[slot] = 1.0f;
+	GetField(INV_MASS)[slot]      = 1.0f;
+	for (int i = 0; i < 9; i += 4)
+	{
+		GetField(INV_INERTIA + i)[slot] = 1.0f;
+		GetField(ROT + i)[slot]         = 1.0f;
+	}
+
+	int body;
+	if (freeHandles_.empty())
+	{
+		body = static_cast<int>(handleToSlot_.size());
+		handleToSlot_.push_back(static_cast<int>(slot));
+	}
+	else
+	{
+		body = freeHandles_.back();
+		freeHandles_.pop_back();
+		handleToSlot_[body] = static_cast<int>(slot);
+	}
+	slotToHandle_.push_back(body);
+	contexts_.push_back(&renderContext);
+	sceneIds_.push_back(-1);
+	broadPhaseIds_.push_back(-1);
+	return body;
+}
+
+void RigidBodyWorld::RemoveBody(int body)
+{
+	const size_t slot = handleToSlot_[body];
+	const size_t last = numBodies_ - 1;
+	if (sceneIds_[slot] >= 0)
+		gfx::RemoveSceneObject(sceneIds_[slot]);
+	if (broadPhaseIds_[slot] != SweepAndPrune::NullProxy)
+		broadPhase_.DestroyProxy(broadPhaseIds_[slot]);
+
+	// Last body fills the hole so slots stay dense
+	if (slot != last)
+	{
+		for (int field = 0; field < NUM_FIELDS; ++field)
+			GetField(field)[slot] = GetField(field)[last];
+		contexts_[slot]      = contexts_[last];
+		sceneIds_[slot]      = sceneIds_[last];
+		broadPhaseIds_[slot] = broadPhaseIds_[last];
+		slotToHandle_[slot]  = slotToHandle_[last];
+		handleToSlot_[slotToHandle_[slot]] = static_cast<int>(slot);
+	}
+	ClearSlot(last);
+	contexts_.pop_back();
+	sceneIds_.pop_back();
+	broadPhaseIds_.pop_back();
+	slotToHandle_.pop_back();
+	--numBodies_;
+
+	handleToSlot_[body] = -1;
+	freeHandles_.push_back(body);
+}
+
+void RigidBodyWorld::Step(float deltatime)
+{
+	if (numBodies_ == 0)
+	{
+		overlaps_.clear();
+		return;
+	}
+
+	StepData step;
+	step.world     = this;
+	step.deltatime = deltatime;
+	step.linearDt  = ::bUpdateLinear  ? deltatime : 0.0f;
+	step.angularDt = ::bUpdateAngular ? deltatime : 0.0f;
+
+	// Padding slots are zero and integrate harmlessly, so every chunk is whole SSE batches
+	const size_t numSlots = (numBodies_ + 3) & ~static_cast<size_t>(3);
+	jobs::ParallelFor(numSlots, ::StepGrainSize, StepRange, &step);
+
+	// Fast bodies enter the broad phase with AABBs around their whole sweep, so what they would pass through pairs with them
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		if (!contexts_[i]->model)
+			continue;
+
+		AABB aabb(contexts_[i]->aabb);
+		if (bContinuous_ && IsFast(i))
+		{
+			const Vector3 disp(GetDisplacement(i));
+			aabb.center -= disp * 0.5f;
+			aabb.diag   += Vector3(std::fabs(disp.x), std::fabs(disp.y), std::fabs(disp.z)) * 0.5f;
+		}
+
+		if (broadPhaseIds_[i] == SweepAndPrune::NullProxy)
+		{
+			broadPhaseIds_[i] = broadPhase_.CreateProxy(aabb);
+			if (proxyToHandle_.size() <= static_cast<size_t>(broadPhaseIds_[i]))
+				proxyToHandle_.resize(broadPhaseIds_[i] + 1);
+			proxyToHandle_[broadPhaseIds_[i]] = slotToHandle_[i];
+		}
+		else
+			broadPhase_.MoveProxy(broadPhaseIds_[i], aabb);
+	}
+
+	broadPhase_.UpdatePairs();
+	if (bContinuous_)
+		SweepFastBodies();
+
+	// Scene tree is not thread-safe, so it is kept fitted here
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		if (!contexts_[i]->model)
+			continue;
+		if (sceneIds_[i] < 0)
+			sceneIds_[i] = gfx::AddSceneObject(*contexts_[i]);
+		else
+			gfx::UpdateSceneObject(sceneIds_[i]);
+	}
+	const std::vector<OverlapPair> &pairs = broadPhase_.GetPairs();
+	overlaps_.resize(pairs.size());
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		overlaps_[i].a = proxyToHandle_[pairs[i].a];
+		overlaps_[i].b = proxyToHandle_[pairs[i].b];
+	}
+}
+
+void RigidBodyWorld::Interpolate(float alpha)
+{
+	const float *f[NUM_FIELDS];
+	for (int field = 0; field < NUM_FIELDS; ++field)
+		f[field] = GetField(field);
+
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		const Vector3 prevPos(f[PREV_POS_X][i], f[PREV_POS_Y][i], f[PREV_POS_Z][i]);
+		const Vector3 pos(f[POS_X][i], f[POS_Y][i], f[POS_Z][i]);
+
+		// Directly set rotations are not integrated, so have nothing to interpolate from
+		Matrix3x3 rot;
+		if (f[OVERRIDE_ROT][i] != 0.0f)
+		{
+			for (int e = 0; e < 9; ++e)
+				rot.elements[e] = f[ROT + e][i];
+		}
+		else
+		{
+			// Normalised lerp, along the shorter arc
+			const Quat prevOrient(f[PREV_ORIENT_S][i], Vector3(f[PREV_ORIENT_X][i], f[PREV_ORIENT_Y][i], f[PREV_ORIENT_Z][i]));
+			Quat orient(f[ORIENT_S][i], Vector3(f[ORIENT_X][i], f[ORIENT_Y][i], f[ORIENT_Z][i]));
+			if (prevOrient.s * orient.s + prevOrient.v.Dot(orient.v) < 0.0f)
+				orient = -1.0f * orient;
+			rot = QuatToMatrix((prevOrient + (orient - prevOrient) * alpha).Normalise());
+		}
+		::WriteContext(*contexts_[i], prevPos + (pos - prevPos) * alpha, rot);
+	}
+
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		if (sceneIds_[i] >= 0)
+			gfx::UpdateSceneObject(sceneIds_[i]);
+	}
+}
+
+void RigidBodyWorld::StepRange(size_t begin, size_t end, void *data)
+{
+	const StepData &step = *static_cast<const StepData*>(data);
+	step.world->IntegrateRange(begin, end, step);
+	step.world->WriteRenderState(begin, std::min(end, static_cast<size_t>(step.world->numBodies_)));
+}
+
+void RigidBodyWorld::IntegrateRange(size_t begin, size_t end, const StepData& step)
+{
+	const __m128 zero         = _mm_setzero_ps();
+	const __m128 one          = _mm_set1_ps(1.0f);
+	const __m128 dt           = _mm_set1_ps(step.deltatime);
+	const __m128 halfDt       = _mm_set1_ps(0.5f * step.deltatime);
+	const __m128 linearDt     = _mm_set1_ps(step.linearDt);
+	const __m128 halfAngDt    = _mm_set1_ps(0.5f * step.angularDt);
+	const __m128 minQuatMagSq = _mm_set1_ps(::MinQuatMag * ::MinQuatMag);
+
+	float *f[NUM_FIELDS];
+	for (int field = 0; field < NUM_FIELDS; ++field)
+		f[field] = GetField(field);
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		const __m128 invMass = _mm_load_ps(f[INV_MASS] + i);
+		Vec3x4 force   = ::LoadVec3(f[FORCE_X] + i, f[FORCE_Y] + i, f[FORCE_Z] + i);
+		Vec3x4 torque  = ::LoadVec3(f[TORQUE_X] + i, f[TORQUE_Y] + i, f[TORQUE_Z] + i);
+		Vec3x4 linMom  = ::LoadVec3(f[LINMOM_X] + i, f[LINMOM_Y] + i, f[LINMOM_Z] + i);
+		Vec3x4 angMom  = ::LoadVec3(f[ANGMOM_X] + i, f[ANGMOM_Y] + i, f[ANGMOM_Z] + i);
+		Vec3x4 pos     = ::LoadVec3(f[POS_X] + i, f[POS_Y] + i, f[POS_Z] + i);
+		__m128 orientS = _mm_load_ps(f[ORIENT_S] + i);
+		Vec3x4 orientV = ::LoadVec3(f[ORIENT_X] + i, f[ORIENT_Y] + i, f[ORIENT_Z] + i);
+
+		// RK4 over drag; average drag is added to the external force
+		const __m128 halfDtInvMass = _mm_mul_ps(halfDt, invMass);
+		const __m128 dtInvMass     = _mm_mul_ps(dt, invMass);
+		const Vec3x4 k1Vel   = ::Scale(linMom, invMass);
+		const Vec3x4 k1Force = ::Drag(k1Vel);
+		const Vec3x4 k2Vel   = ::MulAdd(k1Vel, k1Force, halfDtInvMass);
+		const Vec3x4 k2Force = ::Drag(k2Vel);
+		const Vec3x4 k3Vel   = ::MulAdd(k1Vel, k2Force, halfDtInvMass);
+		const Vec3x4 k3Force = ::Drag(k3Vel);
+		const Vec3x4 k4Vel   = ::MulAdd(k1Vel, k3Force, dtInvMass);
+		const Vec3x4 k4Force = ::Drag(k4Vel);
+		force = ::Add(force, ::RK4Average(k1Force, k2Force, k3Force, k4Force));
+		const Vec3x4 linVel = ::RK4Average(k1Vel, k2Vel, k3Vel, k4Vel);
+
+		// Angular velocity from world frame inverse inertia, R invI R^T
+		__m128 rot[9], invInertia[9];
+		::QuatToMatrix(orientS, orientV, rot);
+		for (int e = 0; e < 9; ++e)
+			invInertia[e] = _mm_load_ps(f[INV_INERTIA + e] + i);
+		const Vec3x4 angVel = ::Mul(rot, ::Mul(invInertia, ::MulTranspose(rot, ::MulAdd(angMom, torque, dt))));
+
+		// Update state vector
+		::StoreVec3(f[PREV_POS_X] + i, f[PREV_POS_Y] + i, f[PREV_POS_Z] + i, pos);
+		_mm_store_ps(f[PREV_ORIENT_S] + i, orientS);
+		::StoreVec3(f[PREV_ORIENT_X] + i, f[PREV_ORIENT_Y] + i, f[PREV_ORIENT_Z] + i, orientV);
+		pos = ::MulAdd(pos, linVel, linearDt);
+		{
+			// orient += (dt/2) (0, w) orient
+			const __m128 dS = _mm_sub_ps(zero, ::Dot(angVel, orientV));
+			const Vec3x4 dV = ::Add(::Scale(angVel, orientS), ::Cross(angVel, orientV));
+			orientS = _mm_add_ps(orientS, _mm_mul_ps(halfAngDt, dS));
+			orientV = ::MulAdd(orientV, dV, halfAngDt);
+
+			const __m128 magSq  = _mm_add_ps(_mm_mul_ps(orientS, orientS), ::Dot(orientV, orientV));
+			const __m128 invMag = ::Select(_mm_cmpge_ps(magSq, minQuatMagSq), _mm_div_ps(one, _mm_sqrt_ps(magSq)), one);
+			orientS = _mm_mul_ps(orientS, invMag);
+			orientV = ::Scale(orientV, invMag);
+		}
+		{
+			const __m128 overrideRot = _mm_cmpneq_ps(_mm_load_ps(f[OVERRIDE_ROT] + i), zero);
+			::QuatToMatrix(orientS, orientV, rot);
+			for (int e = 0; e < 9; ++e)
+				_mm_store_ps(f[ROT + e] + i, ::Select(overrideRot, _mm_load_ps(f[ROT + e] + i), rot[e]));
+		}
+		linMom = ::MulAdd(linMom, force, dt);
+		angMom = ::MulAdd(angMom, torque, dt);
+
+		::StoreVec3(f[POS_X] + i, f[POS_Y] + i, f[POS_Z] + i, pos);
+		_mm_store_ps(f[ORIENT_S] + i, orientS);
+		::StoreVec3(f[ORIENT_X] + i, f[ORIENT_Y] + i, f[ORIENT_Z] + i, orientV);
+		::StoreVec3(f[LINMOM_X] + i, f[LINMOM_Y] + i, f[LINMOM_Z] + i, linMom);
+		::StoreVec3(f[ANGMOM_X] + i, f[ANGMOM_Y] + i, f[ANGMOM_Z] + i, angMom);
+		::StoreVec3(f[LINVEL_X] + i, f[LINVEL_Y] + i, f[LINVEL_Z] + i, linVel);
+		_mm_store_ps(f[ANGVEL_S] + i, zero);
+		::StoreVec3(f[ANGVEL_X] + i, f[ANGVEL_Y] + i, f[ANGVEL_Z] + i, angVel);
+
+		// Reset force accumulator
+		const Vec3x4 zeroVec = {zero, zero, zero};
+		::StoreVec3(f[FORCE_X] + i, f[FORCE_Y] + i, f[FORCE_Z] + i, zeroVec);
+		::StoreVec3(f[TORQUE_X] + i, f[TORQUE_Y] + i, f[TORQUE_Z] + i, zeroVec);
+	}
+}
+
+void RigidBodyWorld::WriteRenderState(size_t begin, size_t end)
+{
+	const float *rot[9];
+	for (int e = 0; e < 9; ++e)
+		rot[e] = GetField(ROT + e);
+	const float *posX = GetField(POS_X), *posY = GetField(POS_Y), *posZ = GetField(POS_Z);
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		const Matrix3x3 r(
+			rot[0][i], rot[1][i], rot[2][i],
+			rot[3][i], rot[4][i], rot[5][i],
+			rot[6][i], rot[7][i], rot[8][i]);
+		::WriteContext(*contexts_[i], Vector3(posX[i], posY[i], posZ[i]), r);
+	}
+}
+
+Vector3 RigidBodyWorld::GetDisplacement(size_t slot) const
+{
+	return Vector3(
+		GetField(POS_X)[slot] - GetField(PREV_POS_X)[slot],
+		GetField(POS_Y)[slot] - GetField(PREV_POS_Y)[slot],
+		GetField(POS_Z)[slot] - GetField(PREV_POS_Z)[slot]);
+}
+
+bool RigidBodyWorld::IsFast(size_t slot) const
+{
+	const float radius = contexts_[slot]->bsphere.radius;
+	return GetDisplacement(slot).MagnitudeSq() > radius * radius;
+}
+
+void RigidBodyWorld::SweepFastBodies()
+{
+	const Impact none = {1.0f, Vector3()};
+	impacts_.assign(numBodies_, none);
+
+	const std::vector<OverlapPair> &pairs = broadPhase_.GetPairs();
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		size_t mover  = handleToSlot_[proxyToHandle_[pairs[i].a]];
+		size_t target = handleToSlot_[proxyToHandle_[pairs[i].b]];
+		if (!IsFast(mover) && !IsFast(target))
+			continue;
+
+		// Faster body is swept against the other's BVH, relative to its motion
+		if (GetDisplacement(target).MagnitudeSq() > GetDisplacement(mover).MagnitudeSq())
+			std::swap(mover, target);
+		const BVH *bvh = contexts_[target]->model->GetBVH();
+		if (!bvh)
+			continue;
+
+		const Vector3 relDisp(GetDisplacement(mover) - GetDisplacement(target));
+		const BSphere start(contexts_[mover]->bsphere.center - relDisp, contexts_[mover]->bsphere.radius);
+		float   toi;
+		Vector3 normal;
+		if (SweptSpherevsBVH(start, relDisp, *bvh, contexts_[target]->transform, toi, normal) && toi < impacts_[mover].toi)
+		{
+			impacts_[mover].toi    = toi;
+			impacts_[mover].normal = normal;
+		}
+	}
+
+	float *linMom[3] = {GetField(LINMOM_X), GetField(LINMOM_Y), GetField(LINMOM_Z)};
+	float *linVel[3] = {GetField(LINVEL_X), GetField(LINVEL_Y), GetField(LINVEL_Z)};
+	for (unsigned i = 0; i < numBodies_; ++i)
+	{
+		const Impact &impact = impacts_[i];
+		if (impact.toi >= 1.0f)
+			continue;
+
+		// Back to just short of the impact, keeping only momentum along the surface
+		const Vector3 disp(GetDisplacement(i));
+		const float   toi = std::max(0.0f, impact.toi - ::ContactSkin / disp.Magnitude());
+		GetField(POS_X)[i] = GetField(PREV_POS_X)[i] + disp.x * toi;
+		GetField(POS_Y)[i] = GetField(PREV_POS_Y)[i] + disp.y * toi;
+		GetField(POS_Z)[i] = GetField(PREV_POS_Z)[i] + disp.z * toi;
+
+		const Vector3 &n = impact.normal;
+		const float momInto = std::min(0.0f, linMom[0][i] * n.x + linMom[1][i] * n.y + linMom[2][i] * n.z);
+		const float velInto = std::min(0.0f, linVel[0][i] * n.x + linVel[1][i] * n.y + linVel[2][i] * n.z);
+		linMom[0][i] -= n.x * momInto;
+		linMom[1][i] -= n.y * momInto;
+		linMom[2][i] -= n.z * momInto;
+		linVel[0][i] -= n.x * velInto;
+		linVel[1][i] -= n.y * velInto;
+		linVel[2][i] -= n.z * velInto;
+		WriteRenderState(i, i + 1);
+	}
+}
+
+Vector3 RigidBodyWorld::GetPosition(int body) const
+{
+	return Vector3(At(POS_X, body), At(POS_Y, body), At(POS_Z, body));
+}
+
+void RigidBodyWorld::SetPosition(int body, const Vector3& pos)
+{
+	At(POS_X, body)      = pos.x;
+	At(POS_Y, body)      = pos.y;
+	At(POS_Z, body)      = pos.z;
+	At(PREV_POS_X, body) = pos.x;
+	At(PREV_POS_Y, body) = pos.y;
+	At(PREV_POS_Z, body) = pos.z;
+}
+
+Quat RigidBodyWorld::GetQuat(int body) const
+{
+	return Quat(At(ORIENT_S, body), Vector3(At(ORIENT_X, body), At(ORIENT_Y, body), At(ORIENT_Z, body)));
+}
+
+Matrix3x3 RigidBodyWorld::GetRotation(int body) const
+{
+	Matrix3x3 rot;
+	for (int e = 0; e < 9; ++e)
+		rot.elements[e] = At(ROT + e, body);
+	return rot;
+}
+
+void RigidBodyWorld::SetRotation(int body, const Matrix3x3& rot)
+{
+	for (int e = 0; e < 9; ++e)
+		At(ROT + e, body) = rot.elements[e];
+	At(OVERRIDE_ROT, body) = 1.0f;
+}
+
+Vector3 RigidBodyWorld::GetVelocity(int body) const
+{
+	return Vector3(At(LINVEL_X, body), At(LINVEL_Y, body), At(LINVEL_Z, body));
+}
+
+Quat RigidBodyWorld::GetAngularVel(int body) const
+{
+	return Quat(At(ANGVEL_S, body), Vector3(At(ANGVEL_X, body), At(ANGVEL_Y, body), At(ANGVEL_Z, body)));
+}
+
+void RigidBodyWorld::SetAngularVel(int body, const Quat& angVel)
+{
+	At(ANGVEL_S, body) = angVel.s;
+	At(ANGVEL_X, body) = angVel.v.x;
+	At(ANGVEL_Y, body) = angVel.v.y;
+	At(ANGVEL_Z, body) = angVel.v.z;
+}
+
+Vector3 RigidBodyWorld::GetAngularMom(int body) const
+{
+	return Vector3(At(ANGMOM_X, body), At(ANGMOM_Y, body), At(ANGMOM_Z, body));
+}
+
+void RigidBodyWorld::SetAngularMom(int body, const Vector3& angMom)
+{
+	At(ANGMOM_X, body) = angMom.x;
+	At(ANGMOM_Y, body) = angMom.y;
+	At(ANGMOM_Z, body) = angMom.z;
+}
+
+void RigidBodyWorld::AddForce(int body, const Vector3& force, const Vector3& torque)
+{
+	At(FORCE_X, body)  += force.x;
+	At(FORCE_Y, body)  += force.y;
+	At(FORCE_Z, body)  += force.z;
+	At(TORQUE_X, body) += torque.x;
+	At(TORQUE_Y, body) += torque.y;
+	At(TORQUE_Z, body) += torque.z;
+}
+
+void RigidBodyWorld::SetForce(int body, const Vector3& force, const Vector3& torque)
+{
+	At(FORCE_X, body)  = force.x;
+	At(FORCE_Y, body)  = force.y;
+	At(FORCE_Z, body)  = force.z;
+	At(TORQUE_X, body) = torque.x;
+	At(TORQUE_Y, body) = torque.y;
+	At(TORQUE_Z, body) = torque.z;
+}
+
+float RigidBodyWorld::GetInvMass(int body) const
+{
+	return At(INV_MASS, body);
+}
+
+void RigidBodyWorld::SetInvMass(int body, float invMass)
+{
+	At(INV_MASS, body) = invMass;
+}
+
+void RigidBodyWorld::SetInvInertiaTensor(int body, const Matrix3x3& invInertiaTensor)
+{
+	for (int e = 0; e < 9; ++e)
+		At(INV_INERTIA + e, body) = invInertiaTensor.elements[e];
+}
+
+void RigidBodyWorld::Reserve(size_t capacity)
+{
+	capacity = (capacity + 3) & ~static_cast<size_t>(3);
+	float *data = static_cast<float*>(_mm_malloc(NUM_FIELDS * capacity * sizeof(float), 16));
+	std::memset(data, 0, NUM_FIELDS * capacity * sizeof(float));
+	if (data_)
+	{
+		for (int field = 0; field < NUM_FIELDS; ++field)
+			std::memcpy(data + field * capacity, GetField(field), numBodies_ * sizeof(float));
+		_mm_free(data_);
+	}
+	data_     = data;
+	capacity_ = capacity;
+}
+
+void RigidBodyWorld::ClearSlot(size_t slot)
+{
+	for (int field = 0; field < NUM_FIELDS; ++field)
+		GetField(field)[slot] = 0.0f;
+}
+} // namespace bbk
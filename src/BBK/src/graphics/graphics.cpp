@@ -1,7 +1,14 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <vector>
 #include "opengl/glew.h"
 #include "opengl/wglew.h"
 #include "graphics.h"
+#include "intersect/frustumcull.h"
+#include "intersect/aabbtree.h"
+#include "occlusion.h"
+#include "platform/jobs.h"
 
 namespace
 {
@@ -14,15 +21,57 @@ struct PointRenderContext
 	bbk::Colour clr;
 }; // struct PointRenderContext
 
-struct ModelRenderContext
+struct DrawCommand
 {
-	ModelRenderContext(bbk::Model *pModel, bool useTextures = true, const bbk::Colour& clr = bbk::Colour()) :
-		model(pModel), bUseTextures(useTextures), surfaceClr(clr) {}
+	DrawCommand(bbk::Model *pModel, unsigned transform, bool useTextures = true, const bbk::Colour& clr = bbk::Colour()) :
+		model(pModel), transformInd(transform), bUseTextures(useTextures), surfaceClr(clr) {}
 
 	bbk::Model* model;
+	unsigned    transformInd; ///< Index of TransformDrawRange holding model's transform
 	bool        bUseTextures;
 	bbk::Colour surfaceClr;
-}; // struct ModelRenderContext
+}; // struct DrawCommand
+
+/**
+ * Sort key of a draw command, most significant field first so that sorting
+ * groups commands sharing the most expensive state. Mesh ranks above material
+ * so that draws of one mesh end up adjacent and can be instanced:
+ * | unused (4) | textured (1) | mesh (12) | material (12) | view depth (24) | unused (11) |
+ * Every draw uses the one shader program, so there is no shader field; one
+ * would go in the top bits.
+ */
+struct DrawKey
+{
+	uint64_t key;
+	unsigned cmdInd;
+}; // struct DrawKey
+
+const unsigned KeyTexturedShift = 59;
+const unsigned KeyMeshShift     = 47;
+const unsigned KeyMaterialShift = 35;
+const unsigned KeyDepthShift    = 11;
+const unsigned KeyIdMask        = 0xFFF;
+const unsigned KeyDepthMask     = 0xFFFFFF;
+
+/// Per-instance attributes of an instanced draw, as laid out in instance buffer
+struct InstanceData
+{
+	float       transform[16];
+	bbk::Colour surfaceClr;
+}; // struct InstanceData
+
+/// Run of sorted draw commands sharing mesh and texture flag, drawn as one instanced draw
+struct InstanceBatch
+{
+	InstanceBatch(unsigned first, unsigned count, unsigned instance) :
+		firstKey(first), numInstances(count), firstInstance(instance) {}
+
+	unsigned firstKey;      ///< Index into drawKeys of first command in batch
+	unsigned numInstances;
+	unsigned firstInstance; ///< Index into instance buffer of first instance
+}; // struct InstanceBatch
+
+const unsigned MinInstanceBatch = 4; ///< Runs shorter than this are cheaper to draw one by one
 
 struct TransformDrawRange
 {
@@ -33,10 +82,22 @@ struct TransformDrawRange
 	std::vector<unsigned> pointIndices;
 	std::vector<unsigned> lineIndices;
 	std::vector<unsigned> triIndices;
-	std::vector<unsigned> meshIndices;
-	std::vector<unsigned> shapeIndices;
 }; // struct TransformDrawRange
 
+/// Deformable mesh drawn in a frame; its vertices are in the frame's dynamicVerts
+/// and its indices, relative to firstVertex, in the frame's dynamicIndices
+struct DynamicMeshDraw
+{
+	unsigned    transformInd;   ///< Index of TransformDrawRange holding mesh's transform
+	unsigned    firstVertex;    ///< Index into dynamicVerts of mesh's first vertex
+	unsigned    firstTriIndex;  ///< Index into dynamicIndices of mesh's first triangle index
+	unsigned    numTriIndices;
+	unsigned    firstLineIndex; ///< Index into dynamicIndices of mesh's first line index
+	unsigned    numLineIndices; ///< 0 for no wireframe
+	bbk::Colour surfaceClr;
+	bbk::Colour lineClr;
+}; // struct DynamicMeshDraw
+
 struct TextRenderContext
 {
 	TextRenderContext(const std::string &str, int xCoord = 0, int yCoord = 0) : text(str), x(xCoord), y(yCoord) {}
@@ -45,6 +106,64 @@ struct TextRenderContext
 	int x, y;
 }; // struct TextRenderContext
 
+struct TextureBinding
+{
+	TextureBinding(unsigned texUnit, unsigned glHandle) : unit(texUnit), handle(glHandle) {}
+
+	unsigned unit;
+	unsigned handle;
+}; // struct TextureBinding
+
+/// Uniform value set while recording, uploaded when the frame is rendered
+struct UniformWrite
+{
+	enum Type {E_INT, E_FLOAT, E_VEC3, E_VEC4};
+
+	bbk::LocationMgr::UniformID id;
+	Type                        type;
+	int                         intValue;
+	float                       floatValues[4];
+}; // struct UniformWrite
+
+/**
+ * Everything recorded for one frame. Draw calls record into recFrame while
+ * Render submits renderFrame, so one frame can be recorded while the previous
+ * one is submitted. Objects are culled before the frame is handed over, so a
+ * recorded frame holds copies of transforms and colours and no pointers into
+ * render contexts.
+ */
+struct FrameData
+{
+	FrameData() {Clear();}
+	void Clear();
+
+	std::vector<PointRenderContext> points;   ///< Pixels to draw in frame
+	std::vector<PointRenderContext> lines;    ///< Lines to draw in frame
+	std::vector<PointRenderContext> tris;
+	std::vector<DrawCommand>        drawCmds; ///< Models and shapes to draw in frame
+	std::vector<bbk::Vertex>        dynamicVerts;
+	std::vector<unsigned>           dynamicIndices;
+	std::vector<DynamicMeshDraw>    dynamicMeshes;
+	std::vector<TransformDrawRange> transformRanges;
+	std::vector<TextureBinding>     textureBindings;
+	std::vector<UniformWrite>       uniformWrites;
+	std::vector<TextRenderContext>  strings;
+	std::vector<std::string>        debugStr;
+	bbk::Matrix4x4                  perspProjMtx;
+	bbk::Matrix4x4                  worldViewMtx;
+
+	/** @name
+	 *  Culling stats *///\{
+	unsigned numObjsRequested;
+	unsigned numObjsRendered;
+	unsigned numObjsInside;
+	unsigned numObjsOccluded;
+	unsigned numPlaneTests;
+	unsigned numSceneNodesTested;
+	int      sceneTreeHeight;
+	//\}
+}; // struct FrameData
+
 /** @name
  *  Geometry storage *///\{
 bbk::Model* shapeMeshes[bbk::gfx::NUM_SHAPES] = {nullptr};
@@ -59,18 +178,50 @@ bbk::Model* shapeMeshes[bbk::gfx::NUM_SHAPES] = {nullptr};
 
 /** @name
  *  Geometry to render *///\{
-std::vector<PointRenderContext>    points; ///< Pixels to draw in current frame
-std::vector<PointRenderContext>    lines;  ///< Lines to draw in current frame
-std::vector<PointRenderContext>    tris;
-std::vector<ModelRenderContext>    models; ///< Models to draw in current frame
-std::vector<ModelRenderContext>    shapes;
+FrameData  frames[2];
+FrameData *recFrame    = &frames[0]; ///< Frame that draw calls record into
+FrameData *renderFrame = &frames[1]; ///< Frame that Render submits
+//\}
+
+/** @name
+ *  Draw command sorting *///\{
+std::vector<DrawKey>            drawKeys;
+std::vector<DrawKey>            drawKeysScratch;
+std::vector<bbk::Colour>        frameMaterials; ///< Distinct surface colours in current frame
+std::vector<const bbk::Model*>  frameMeshes;    ///< Distinct meshes in current frame
+//\}
+
+/** @name
+ *  Instancing *///\{
+bool                       bInstancingSupported = false;
+bool                       bInstancingEnabled   = true;
+unsigned                   instanceVBO          = 0;
+int                        instanceMtxLoc       = -1; ///< First of 4 column attributes
+int                        instanceClrLoc       = -1;
+std::vector<InstanceData>  instanceData;
+std::vector<InstanceBatch> instanceBatches;
+//\}
+
+/** @name
+ *  Dynamic meshes *///\{
+unsigned dynamicVBO = 0; ///< Respecified with every frame's dynamic vertices
+//\}
+
+/** @name
+ *  Uniforms set while rendering, looked up once when shaders are loaded *///\{
+bbk::LocationMgr::UniformID uniUseVertexColor = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniUseTextures    = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniInstanced      = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniTwoSided       = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniKAmbient       = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniKDiffuse       = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniKSpecular      = bbk::LocationMgr::INVALID_UNIFORM;
+bbk::LocationMgr::UniformID uniKEmissive      = bbk::LocationMgr::INVALID_UNIFORM;
 //\}
-std::vector<TextRenderContext>     strings;
 
 /** @name
  *  Matrix stacks *///\{
 std::vector<bbk::Matrix4x4>     cl_MV_mtxStack;
-std::vector<TransformDrawRange> transformRanges;
 std::vector<unsigned>           lastPushIndices;
 unsigned                        currTransformInd;
 //\}
@@ -100,38 +251,31 @@ bbk::Tuple<float, 4> clearcolor;
 bbk::Frustum cullingFrustum;
 bbk::Vector4 r0, r1, r2, r3;
 
-inline int BSvsLeftPlane(const bbk::BSphere& bsphere);
-inline int BSvsRightPlane(const bbk::BSphere& bsphere);
-inline int BSvsBottomPlane(const bbk::BSphere& bsphere);
-inline int BSvsTopPlane(const bbk::BSphere& bsphere);
-inline int BSvsNearPlane(const bbk::BSphere& bsphere);
-inline int BSvsFarPlane(const bbk::BSphere& bsphere);
-
-inline int AABBvsLeftPlane(const bbk::AABB& aabb);
-inline int AABBvsRightPlane(const bbk::AABB& aabb);
-inline int AABBvsBottomPlane(const bbk::AABB& aabb);
-inline int AABBvsTopPlane(const bbk::AABB& aabb);
-inline int AABBvsNearPlane(const bbk::AABB& aabb);
-inline int AABBvsFarPlane(const bbk::AABB& aabb);
-
-inline int OBBvsLeftPlane(const bbk::OBB& obb);
-inline int OBBvsRightPlane(const bbk::OBB& obb);
-inline int OBBvsBottomPlane(const bbk::OBB& obb);
-inline int OBBvsTopPlane(const bbk::OBB& obb);
-inline int OBBvsNearPlane(const bbk::OBB& obb);
-inline int OBBvsFarPlane(const bbk::OBB& obb);
-
-int (*bsTestFuncs[6])(const bbk::BSphere&) = {BSvsLeftPlane, BSvsRightPlane, BSvsNearPlane, BSvsFarPlane, BSvsBottomPlane, BSvsTopPlane};
-int (*aabbTestFuncs[6])(const bbk::AABB&)  = {AABBvsLeftPlane, AABBvsRightPlane, AABBvsNearPlane, AABBvsFarPlane, AABBvsBottomPlane, AABBvsTopPlane};
-int (*obbTestFuncs[6])(const bbk::OBB&)  = {OBBvsLeftPlane, OBBvsRightPlane, OBBvsNearPlane, OBBvsFarPlane, OBBvsBottomPlane, OBBvsTopPlane};
-
-void BSphereVFC(bbk::RenderContext& rc);
-void AABBVFC(bbk::RenderContext& rc);
-void OBBVFC(bbk::RenderContext& rc);
-void BSphereVFC_PC(bbk::RenderContext& rc);
-void AABBVFC_PC(bbk::RenderContext& rc);
-void OBBVFC_PC(bbk::RenderContext& rc);
-void (*vfcScheme)(bbk::RenderContext&) = {OBBVFC_PC};
+/// Object passed to DrawObject, culled in a batch when the frame is rendered
+struct CullObject
+{
+	CullObject(bbk::RenderContext *context, unsigned parent) : rc(context), parentTransformInd(parent) {}
+
+	bbk::RenderContext *rc;
+	unsigned            parentTransformInd; ///< Index of TransformDrawRange current when object was drawn
+}; // struct CullObject
+
+std::vector<CullObject> cullObjs;
+std::vector<CullObject> insideObjs;     ///< Objects of scene subtrees completely inside frustum
+std::vector<float>      cullSoA;        ///< Bounding volume components of cullObjs, one array after another
+std::vector<uint8_t>    cullPlaneInds;
+std::vector<uint32_t>   cullVisibleMask;
+std::vector<uint32_t>   cullInsideMask;
+std::vector<unsigned>   cullChunkPlaneTests;    ///< Plane tests of each ParallelFor chunk of cullObjs
+
+const size_t CullGrainSize = 256; ///< Objects per culling job; multiple of 32 to keep mask words apart
+
+bbk::AABBTree      sceneTree;                 ///< Objects culled hierarchically by DrawScene
+const bbk::Plane  *scenePlanes[6] = {nullptr}; ///< Culling planes in plane-coherency index order
+
+bool                             bOcclusionCulling = true;
+bbk::OcclusionBuffer             occlusionBuffer;
+std::vector<bbk::RenderContext*> occluders; ///< Occluders of current frame, each with bOccluder set
 
 bbk::gfx::VFCScheme vfcBV_type= bbk::gfx::E_OBB;
 bool bPlaneCoherency = true;
@@ -141,15 +285,42 @@ bool bDrawBV = false;
 /** @name
  *  Debug info *///\{
 bool     bPrintDebugInfo = false;
-std::vector<std::string> debugStr;
 unsigned                 numVertsToGPU = 0;
-unsigned numObjsRequested = 0;
-unsigned numObjsRendered = 0;
-unsigned numObjsInside = 0;
-unsigned numPlaneTests = 0;
+unsigned numStateChanges = 0;
+unsigned numStateChangesUnsorted = 0; ///< State changes the same draws would issue in submission order
+unsigned numInstancedDraws = 0;
+unsigned numInstances = 0;
+unsigned numDynamicDraws = 0;
 //\}
 
 bool vsyncOn = true;
+
+/// Frustum and occlusion culls queued objects and draws the visible ones
+void CullObjects();
+/// Frustum culls cullObjs into cullVisibleMask and cullInsideMask
+void BatchFrustumCull();
+void CullChunk(size_t begin, size_t end, void *data);
+/// Rasterizes occluders and tests object's bounding volume against them
+void BuildOcclusionBuffer();
+/// Empties occluders and clears their render contexts' bOccluder
+void ClearOccluders();
+bool IsObjectOccluded(const bbk::RenderContext& rc);
+/// Culls scene tree node against the planes set in planeMask, the planes its ancestors straddle
+void CullSceneNode(int node, unsigned planeMask);
+/// Queues every object under a scene tree node that lies completely inside the frustum
+void DrawSceneSubtree(int node);
+void DrawCulledObject(bbk::RenderContext& rc);
+void DrawCulledBV(const bbk::RenderContext& rc, bool bVisible);
+void BuildDrawKeys();
+void SortDrawKeys();
+void BuildInstanceBatches();
+/// State changes a submission-order replay of the frame's draw commands issues
+/// when it skips the same redundant state the sorted replay does
+unsigned CountUnsortedStateChanges();
+/// Streams the frame's dynamic mesh vertices to the GPU and draws the meshes
+void DrawDynamicMeshes();
+/// Binds model's buffer objects, or its client memory if it has none, as vertex arrays
+void BindModelGeometry(bbk::Model *pModel, bool &bTexCoordsEnabled, bool &bNormalsEnabled);
 } // anon namespace
 
 namespace bbk
@@ -163,9 +334,8 @@ bool Init()
 {
 	::clearcolor[0] = ::clearcolor[1] = ::clearcolor[2] = ::clearcolor[3] = 0.0f;
 	::cl_MV_mtxStack.push_back(bbk::Matrix4x4::IDENTITY);
-	::transformRanges.push_back(TransformDrawRange(bbk::Matrix4x4::IDENTITY));
 
-	// Load meshes of shapes
+	// Load meshes of shapes; they are loaded to GPU once a GL context exists in InitGL
 	{
 		::shapeMeshes[gfx::E_PLANE] = new bbk::Model;
 		::shapeMeshes[gfx::E_PLANE]->LoadGeometryFromFile("Plane.xml");
@@ -200,6 +370,20 @@ bool InitGL()
 
 	LoadShaders();
 
+	for (size_t i = 0; i < gfx::NUM_SHAPES; ++i)
+	{
+		if (::shapeMeshes[i])
+			::shapeMeshes[i]->LoadGeometryToGPU();
+	}
+
+	// Instancing needs instanced draws, per-instance attributes and the shader's instance inputs
+	::instanceMtxLoc = bbk::gfx::locationMgrs[0].AddAttributeLocation("instanceMtx");
+	::instanceClrLoc = bbk::gfx::locationMgrs[0].AddAttributeLocation("instanceClr");
+	::bInstancingSupported = GLEW_ARB_draw_instanced && GLEW_ARB_instanced_arrays && ::instanceMtxLoc >= 0 && ::instanceClrLoc >= 0;
+	if (::bInstancingSupported)
+		glGenBuffers(1, &::instanceVBO);
+	glGenBuffers(1, &::dynamicVBO);
+
 	return true;
 }
 
@@ -260,6 +444,8 @@ void LoadShaders()
 	bbk::gfx::locationMgrs[0].AddUniformLocation("isUseTextures");
 	bbk::gfx::locationMgrs[0].AddUniformLocation("materialType");
 	bbk::gfx::locationMgrs[0].AddUniformLocation("useVertexColor");
+	bbk::gfx::locationMgrs[0].AddUniformLocation("isInstanced");
+	bbk::gfx::locationMgrs[0].AddUniformLocation("isTwoSided");
 
 	bbk::gfx::locationMgrs[0].AddUniformLocation("surfaceClr.K_ambient");
 	bbk::gfx::locationMgrs[0].AddUniformLocation("surfaceClr.K_diffuse");
@@ -270,6 +456,15 @@ void LoadShaders()
 	bbk::gfx::locationMgrs[0].AddUniformLocation("TexDiffuse");
 	bbk::gfx::locationMgrs[0].AddUniformLocation("TexSpecular");
 	bbk::gfx::locationMgrs[0].AddUniformLocation("TexEmissive");
+
+	::uniUseVertexColor = bbk::gfx::locationMgrs[0].GetUniformID("useVertexColor");
+	::uniUseTextures    = bbk::gfx::locationMgrs[0].GetUniformID("isUseTextures");
+	::uniInstanced      = bbk::gfx::locationMgrs[0].GetUniformID("isInstanced");
+	::uniTwoSided       = bbk::gfx::locationMgrs[0].GetUniformID("isTwoSided");
+	::uniKAmbient       = bbk::gfx::locationMgrs[0].GetUniformID("surfaceClr.K_ambient");
+	::uniKDiffuse       = bbk::gfx::locationMgrs[0].GetUniformID("surfaceClr.K_diffuse");
+	::uniKSpecular      = bbk::gfx::locationMgrs[0].GetUniformID("surfaceClr.K_specular");
+	::uniKEmissive      = bbk::gfx::locationMgrs[0].GetUniformID("surfaceClr.K_emissive");
 }
 
 void Halt()
@@ -279,6 +474,12 @@ void Halt()
 		if (::shapeMeshes[i])
 			delete ::shapeMeshes[i];
 	}
+	if (::instanceVBO)
+		glDeleteBuffers(1, &::instanceVBO);
+	::instanceVBO = 0;
+	if (::dynamicVBO)
+		glDeleteBuffers(1, &::dynamicVBO);
+	::dynamicVBO = 0;
 	::font.FreeTextureObj();
 }
 
@@ -292,9 +493,47 @@ void PrintDebugInfo(bool flag)
 	::bPrintDebugInfo = flag;
 }
 
+void EnableInstancing(bool flag)
+{
+	::bInstancingEnabled = flag;
+}
+
 void Render()
 {
-	::numVertsToGPU = 0;
+	FrameData &frame = *::renderFrame;
+
+	::numVertsToGPU        = 0;
+	::numStateChanges         = 0;
+	::numStateChangesUnsorted = 0;
+	::numInstancedDraws       = 0;
+	::numInstances            = 0;
+	::numDynamicDraws         = 0;
+
+	// Apply shader and texture state recorded with the frame
+	for (size_t i = 0, size = frame.uniformWrites.size(); i < size; ++i)
+	{
+		const UniformWrite &write = frame.uniformWrites[i];
+		switch (write.type)
+		{
+		case UniformWrite::E_INT:
+			bbk::gfx::locationMgrs[0].SetUniform(write.id, write.intValue);
+			break;
+		case UniformWrite::E_FLOAT:
+			bbk::gfx::locationMgrs[0].SetUniform(write.id, write.floatValues[0]);
+			break;
+		case UniformWrite::E_VEC3:
+			bbk::gfx::locationMgrs[0].SetUniform3fv(write.id, write.floatValues);
+			break;
+		case UniformWrite::E_VEC4:
+			bbk::gfx::locationMgrs[0].SetUniform4fv(write.id, write.floatValues);
+			break;
+		}
+	}
+	for (size_t i = 0, size = frame.textureBindings.size(); i < size; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + frame.textureBindings[i].unit);
+		glBindTexture(GL_TEXTURE_2D, frame.textureBindings[i].handle);
+	}
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -303,173 +542,245 @@ void Render()
 
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
-	glLoadMatrixf(::currPerspProjMtx.elements);
+	glLoadMatrixf(frame.perspProjMtx.elements);
 	//glLoadMatrixf(::pCurrentCam->GetProjectionMtx().elements);
 
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
-	glLoadMatrixf(::currWorldViewMtx.elements);
+	glLoadMatrixf(frame.worldViewMtx.elements);
 	//glLoadMatrixf(::pCurrentCam->GetWorldToViewMtx().elements);
 
-	for (size_t i = 0, size = ::transformRanges.size(); i < size; ++i)
+	for (size_t i = 0, size = frame.transformRanges.size(); i < size; ++i)
 	{
-		if (::transformRanges[i].numToRender)
+		if (frame.transformRanges[i].numToRender)
 		{
 			// Set transform for current batch
 			glPushMatrix();
-			glMultMatrixf(::transformRanges[i].transform.elements);
+			glMultMatrixf(frame.transformRanges[i].transform.elements);
 
-			glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("useVertexColor"), true);
+			bbk::gfx::locationMgrs[0].SetUniform(::uniUseVertexColor, 1);
+			bbk::gfx::locationMgrs[0].FlushUniforms();
 		
 			// Render points
-			if (unsigned numPoints = ::transformRanges[i].pointIndices.size())
+			if (unsigned numPoints = frame.transformRanges[i].pointIndices.size())
 			{
-				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(::points[0].pos));
-				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(::points[0].clr));
+				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(frame.points[0].pos));
+				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(frame.points[0].clr));
 
-				glDrawElements(GL_POINTS, numPoints, GL_UNSIGNED_INT, &(::transformRanges[i].pointIndices[0]));
+				glDrawElements(GL_POINTS, numPoints, GL_UNSIGNED_INT, &(frame.transformRanges[i].pointIndices[0]));
 
 				//::numVertsToGPU += numPoints;
 			}
 			// Render lines
-			if (unsigned numVtx = ::transformRanges[i].lineIndices.size())
+			if (unsigned numVtx = frame.transformRanges[i].lineIndices.size())
 			{
-				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(::lines[0].pos));
-				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(::lines[0].clr));
+				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(frame.lines[0].pos));
+				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(frame.lines[0].clr));
 
-				glDrawElements(GL_LINES, numVtx, GL_UNSIGNED_INT, &(::transformRanges[i].lineIndices[0]));
+				glDrawElements(GL_LINES, numVtx, GL_UNSIGNED_INT, &(frame.transformRanges[i].lineIndices[0]));
 
 				//::numVertsToGPU += numVtx;
 			}
 			// Render triangles
-			if (unsigned numVtx = ::transformRanges[i].triIndices.size())
+			if (unsigned numVtx = frame.transformRanges[i].triIndices.size())
 			{
-				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(::tris[0].pos));
-				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(::tris[0].clr));
+				glVertexPointer(3, GL_FLOAT, sizeof(PointRenderContext), &(frame.tris[0].pos));
+				glColorPointer (4, GL_FLOAT, sizeof(PointRenderContext), &(frame.tris[0].clr));
 
-				glDrawElements(GL_TRIANGLES, numVtx, GL_UNSIGNED_INT, &(::transformRanges[i].triIndices[0]));
+				glDrawElements(GL_TRIANGLES, numVtx, GL_UNSIGNED_INT, &(frame.transformRanges[i].triIndices[0]));
 
 				//::numVertsToGPU += numVtx;
 			}
 
-			glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("useVertexColor"), false);
-			// Render models
-			for (size_t j = 0, size = ::transformRanges[i].meshIndices.size(); j < size; ++j)
+			glPopMatrix();
+		}
+	}
+
+	// Render models and shapes in sort key order, only issuing state that differs
+	// from the previous command
+	if (!frame.drawCmds.empty())
+	{
+		::BuildDrawKeys();
+		::SortDrawKeys();
+		::BuildInstanceBatches();
+
+		bbk::gfx::locationMgrs[0].SetUniform(::uniUseVertexColor, 0);
+		{
+			const Colour white(1.0f, 1.0f, 1.0f, 1.0f);
+			const Colour black(0.0f, 0.0f, 0.0f, 0.0f);
+			bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKSpecular, &white.r);
+			bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKEmissive, &black.r);
+		}
+
+		const unsigned NoTransform       = ~0u;
+		unsigned       currTransform     = NoTransform;
+		int            currTextured      = -1;
+		const Colour  *currMaterial      = nullptr;
+		bbk::Model    *currMesh          = nullptr;
+		bool           bTexCoordsEnabled = false;
+		bool           bNormalsEnabled   = false;
+
+		size_t batchInd = 0;
+		for (size_t i = 0, size = ::drawKeys.size(); i < size; ++i)
+		{
+			const DrawCommand &cmd = frame.drawCmds[::drawKeys[i].cmdInd];
+			unsigned numChanges = 0; // State changes issued for this command
+
+			// Instanced batch: one draw takes every instance's transform and
+			// surface colour from the instance buffer
+			if (batchInd < ::instanceBatches.size() && ::instanceBatches[batchInd].firstKey == i)
 			{
-				ModelRenderContext &currModel = ::models[::transformRanges[i].meshIndices[j]];
+				const InstanceBatch &batch = ::instanceBatches[batchInd++];
 
-				glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("isUseTextures"), currModel.bUseTextures);
-				if (!currModel.bUseTextures)
+				// Instance transforms are relative to the world-to-view transform
+				if (currTransform != NoTransform)
 				{
-					const Colour white(1.0f, 1.0f, 1.0f, 1.0f);
-					const Colour black(0.0f, 0.0f, 0.0f, 0.0f);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_ambient"), 1, &currModel.surfaceClr.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_diffuse"), 1, &currModel.surfaceClr.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_specular"), 1, &white.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_emissive"), 1, &black.r);
+					glPopMatrix();
+					currTransform = NoTransform;
+					++numChanges;
+				}
+				if (static_cast<int>(cmd.bUseTextures) != currTextured)
+				{
+					bbk::gfx::locationMgrs[0].SetUniform(::uniUseTextures, static_cast<int>(cmd.bUseTextures));
+					currTextured = cmd.bUseTextures;
+					++numChanges;
 				}
 
-				if (currModel.model->hasTexCoords())
-					glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				if (currModel.model->hasNormals())
-					glEnableClientState(GL_NORMAL_ARRAY);
-
-				glVertexPointer(3, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].pos));
-				glColorPointer (4, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].clr));
-				if (currModel.model->hasTexCoords())
-					glTexCoordPointer(2, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].tc));
-				if (currModel.model->hasNormals())
-					glNormalPointer(GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].nrm));
-
-				glDrawElements(
+				// Attribute pointers latch the buffer bound when they are set, so
+				// model geometry can be bound afterwards
+				glBindBuffer(GL_ARRAY_BUFFER, ::instanceVBO);
+				const char *instBase = reinterpret_cast<const char*>(batch.firstInstance * sizeof(InstanceData));
+				for (int col = 0; col < 4; ++col)
+				{
+					glEnableVertexAttribArray(::instanceMtxLoc + col);
+					glVertexAttribPointer(::instanceMtxLoc + col, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), instBase + col * 4 * sizeof(float));
+					glVertexAttribDivisorARB(::instanceMtxLoc + col, 1);
+				}
+				glEnableVertexAttribArray(::instanceClrLoc);
+				glVertexAttribPointer(::instanceClrLoc, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), instBase + offsetof(InstanceData, surfaceClr));
+				glVertexAttribDivisorARB(::instanceClrLoc, 1);
+				bbk::gfx::locationMgrs[0].SetUniform(::uniInstanced, 1);
+				numChanges += 2;
+
+				::BindModelGeometry(cmd.model, bTexCoordsEnabled, bNormalsEnabled);
+				currMesh = cmd.model;
+				++numChanges;
+
+				bbk::gfx::locationMgrs[0].FlushUniforms();
+				glDrawElementsInstancedARB(
 					GL_TRIANGLES,
-					currModel.model->GetNumIndices(),
+					cmd.model->GetNumIndices(),
 					GL_UNSIGNED_INT,
-					currModel.model->GetVertIndArray());
-
-				if (currModel.model->hasTexCoords())
-					glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-				if (currModel.model->hasNormals())
-					glDisableClientState(GL_NORMAL_ARRAY);
+					cmd.model->GetVBOHandle() ? nullptr : cmd.model->GetVertIndArray(),
+					batch.numInstances);
+				if (!cmd.model->GetVBOHandle())
+					::numVertsToGPU += cmd.model->GetNumIndices();
+
+				bbk::gfx::locationMgrs[0].SetUniform(::uniInstanced, 0);
+				for (int col = 0; col < 4; ++col)
+					glDisableVertexAttribArray(::instanceMtxLoc + col);
+				glDisableVertexAttribArray(::instanceClrLoc);
+				numChanges += 2;
+
+				::numStateChanges += numChanges;
+				::numInstances    += batch.numInstances;
+				++::numInstancedDraws;
+				i += batch.numInstances - 1;
+				continue;
+			}
 
-				::numVertsToGPU += currModel.model->GetNumIndices();
+			if (cmd.transformInd != currTransform)
+			{
+				if (currTransform != NoTransform)
+					glPopMatrix();
+				glPushMatrix();
+				glMultMatrixf(frame.transformRanges[cmd.transformInd].transform.elements);
+				currTransform = cmd.transformInd;
+				++numChanges;
 			}
-			// Render shapes
-			for (size_t j = 0, size = ::transformRanges[i].shapeIndices.size(); j < size; ++j)
+
+			if (static_cast<int>(cmd.bUseTextures) != currTextured)
 			{
-				ModelRenderContext &currModel = ::shapes[::transformRanges[i].shapeIndices[j]];
+				bbk::gfx::locationMgrs[0].SetUniform(::uniUseTextures, static_cast<int>(cmd.bUseTextures));
+				currTextured = cmd.bUseTextures;
+				++numChanges;
+			}
 
-				glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("isUseTextures"), false);
+			if (!cmd.bUseTextures)
+			{
+				if (!currMaterial || std::memcmp(currMaterial, &cmd.surfaceClr, sizeof(Colour)) != 0)
 				{
-					const Colour white(1.0f, 1.0f, 1.0f, 1.0f);
-					const Colour black(0.0f, 0.0f, 0.0f, 0.0f);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_ambient"), 1, &currModel.surfaceClr.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_diffuse"), 1, &currModel.surfaceClr.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_specular"), 1, &white.r);
-					glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_emissive"), 1, &black.r);
+					bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKAmbient, &cmd.surfaceClr.r);
+					bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKDiffuse, &cmd.surfaceClr.r);
+					currMaterial = &cmd.surfaceClr;
+					++numChanges;
 				}
+			}
 
-				if (currModel.model->hasTexCoords())
-					glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-				if (currModel.model->hasNormals())
-					glEnableClientState(GL_NORMAL_ARRAY);
+			if (cmd.model != currMesh)
+			{
+				::BindModelGeometry(cmd.model, bTexCoordsEnabled, bNormalsEnabled);
+				currMesh = cmd.model;
+				++numChanges;
+			}
 
-				glVertexPointer(3, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].pos));
-				glColorPointer (4, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].clr));
-				if (currModel.model->hasTexCoords())
-					glTexCoordPointer(2, GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].tc));
-				if (currModel.model->hasNormals())
-					glNormalPointer(GL_FLOAT, sizeof(bbk::Vertex), &(currModel.model->GetVertexArray()[0].nrm));
+			bbk::gfx::locationMgrs[0].FlushUniforms();
+			glDrawElements(
+				GL_TRIANGLES,
+				cmd.model->GetNumIndices(),
+				GL_UNSIGNED_INT,
+				cmd.model->GetVBOHandle() ? nullptr : cmd.model->GetVertIndArray());
+			if (!cmd.model->GetVBOHandle())
+				::numVertsToGPU += cmd.model->GetNumIndices();
 
-				glDrawElements(
-					GL_TRIANGLES,
-					currModel.model->GetNumIndices(),
-					GL_UNSIGNED_INT,
-					currModel.model->GetVertIndArray());
+			::numStateChanges += numChanges;
+		}
 
-				if (currModel.model->hasTexCoords())
-					glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-				if (currModel.model->hasNormals())
-					glDisableClientState(GL_NORMAL_ARRAY);
-			}
+		if (::bPrintDebugInfo)
+			::numStateChangesUnsorted = ::CountUnsortedStateChanges();
 
+		if (currTransform != NoTransform)
 			glPopMatrix();
-		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		if (bTexCoordsEnabled)
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		if (bNormalsEnabled)
+			glDisableClientState(GL_NORMAL_ARRAY);
 	}
+
+	::DrawDynamicMeshes();
+
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_COLOR_ARRAY);
 
-	::points.clear();
-	::lines.clear();
-	::tris.clear();
-	::models.clear();
-	::shapes.clear();
-	/*for (size_t i = 0, size = ::transformRanges.size(); i < size; ++i)
-	{
-		::transformRanges[i].pointIndices.clear();
-		::transformRanges[i].lineIndices.clear();
-		::transformRanges[i].meshIndices.clear();
-		::transformRanges[i].shapeIndices.clear();
-	}*/
-	::transformRanges.clear();
-	::transformRanges.push_back(TransformDrawRange(bbk::Matrix4x4::IDENTITY));
-
-	// Print debug info
+	// Print debug info. Render may run alongside recording of the next frame,
+	// so lines go straight into the frame being rendered
 	if (::bPrintDebugInfo)
 	{
 		char buffer[64] = {0};
 		std::sprintf(buffer, "#vertices sent: %u", ::numVertsToGPU);
-		PrintDebugInfo(buffer);
-		std::sprintf(buffer, "#objs outside frustum: %u", ::numObjsRequested - ::numObjsRendered);
-		PrintDebugInfo(buffer);
-		std::sprintf(buffer, "#objs straddling frustum: %u", ::numObjsRendered - ::numObjsInside);
-		PrintDebugInfo(buffer);
-		std::sprintf(buffer, "#objs inside frustum: %u", ::numObjsInside);
-		PrintDebugInfo(buffer);
-		std::sprintf(buffer, "Avg #plane eqn evals per obj: %.1f", static_cast<float>(::numPlaneTests) / ::numObjsRequested);
-		PrintDebugInfo(buffer);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#state changes: %u issued, %u unsorted", ::numStateChanges, ::numStateChangesUnsorted);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#instanced draws: %u (%u instances)", ::numInstancedDraws, ::numInstances);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#dynamic mesh draws: %u (%u vertices)", ::numDynamicDraws, static_cast<unsigned>(frame.dynamicVerts.size()));
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#objs outside frustum: %u", frame.numObjsRequested - frame.numObjsRendered - frame.numObjsOccluded);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#objs occluded: %u", frame.numObjsOccluded);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#objs straddling frustum: %u", frame.numObjsRendered + frame.numObjsOccluded - frame.numObjsInside);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#objs inside frustum: %u", frame.numObjsInside);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "Avg #plane eqn evals per obj: %.1f", static_cast<float>(frame.numPlaneTests) / frame.numObjsRequested);
+		frame.debugStr.push_back(buffer);
+		std::sprintf(buffer, "#scene nodes tested: %u (tree height %d)", frame.numSceneNodesTested, frame.sceneTreeHeight);
+		frame.debugStr.push_back(buffer);
 		std::sprintf(buffer, ::bPlaneCoherency ? "Plane coherency on" : "Plane coherency off");
-		PrintDebugInfo(buffer);
+		frame.debugStr.push_back(buffer);
 		switch (::vfcBV_type)
 		{
 		case E_BSPHERE:
@@ -482,12 +793,7 @@ void Render()
 			std::sprintf(buffer, "Using OBBs");
 			break;
 		}
-		PrintDebugInfo(buffer);
-		
-		::numObjsRequested = 0;
-		::numObjsRendered = 0;
-		::numObjsInside = 0;
-		::numPlaneTests = 0;
+		frame.debugStr.push_back(buffer);
 	}
 
 	/*========================================================================*/
@@ -504,14 +810,14 @@ void Render()
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
 
-	for (size_t i = 0, size = ::strings.size(); i < size; ++i)
+	for (size_t i = 0, size = frame.strings.size(); i < size; ++i)
 	{
 		bbk::Vector3 offset(
-			-0.975f + ::strings[i].x * 0.048f,
-			0.975f  - ::strings[i].y * 0.05f,
+			-0.975f + frame.strings[i].x * 0.048f,
+			0.975f  - frame.strings[i].y * 0.05f,
 			0.0f);
 		
-		for (size_t j = 0, strlen = ::strings[i].text.size(); j < strlen; ++j)
+		for (size_t j = 0, strlen = frame.strings[i].text.size(); j < strlen; ++j)
 		{
 			bbk::Matrix4x4 mtx44_offset = bbk::Matrix4x4::MakeTranslate(offset);
 			glPushMatrix();
@@ -521,8 +827,8 @@ void Render()
 			glLoadIdentity();
 
 			bbk::Matrix4x4 mtx44_texcoord(bbk::Matrix4x4::MakeScale(0.0625f, 0.0625f, 1.0f));
-			int col = strings[i].text[j] % 16;
-			int row = strings[i].text[j] / 16;
+			int col = frame.strings[i].text[j] % 16;
+			int row = frame.strings[i].text[j] / 16;
 			mtx44_texcoord.elements[12] = col * 0.0625f;
 			mtx44_texcoord.elements[13] = row * 0.0625f;
 			glLoadMatrixf(mtx44_texcoord.elements);
@@ -540,10 +846,10 @@ void Render()
 	}
 
 	bbk::Vector3 offset(-0.975f, 0.975f, 0.0f);
-	for (size_t i = 0, size = ::debugStr.size(); i < size; ++i)
+	for (size_t i = 0, size = frame.debugStr.size(); i < size; ++i)
 	{
 		offset.x = -0.975f;
-		for (size_t j = 0, strlen = ::debugStr[i].size(); j < strlen; ++j)
+		for (size_t j = 0, strlen = frame.debugStr[i].size(); j < strlen; ++j)
 		{
 			bbk::Matrix4x4 mtx44_offset = bbk::Matrix4x4::MakeTranslate(offset);
 			glPushMatrix();
@@ -553,8 +859,8 @@ void Render()
 			glLoadIdentity();
 
 			bbk::Matrix4x4 mtx44_texcoord(bbk::Matrix4x4::MakeScale(0.0625f, 0.0625f, 1.0f));
-			int col = debugStr[i][j] % 16;
-			int row = debugStr[i][j] / 16;
+			int col = frame.debugStr[i][j] % 16;
+			int row = frame.debugStr[i][j] / 16;
 			mtx44_texcoord.elements[12] = col * 0.0625f;
 			mtx44_texcoord.elements[13] = row * 0.0625f;
 			glLoadMatrixf(mtx44_texcoord.elements);
@@ -577,15 +883,66 @@ void Render()
 	glDisableClientState(GL_VERTEX_ARRAY);
 	shaderProgs[0].Use();
 
-	::strings.clear();
-	::debugStr.clear();
+	frame.Clear();
+}
+
+void EndFrame()
+{
+	::CullObjects();
+
+	::recFrame->perspProjMtx    = ::currPerspProjMtx;
+	::recFrame->worldViewMtx    = ::currWorldViewMtx;
+	::recFrame->sceneTreeHeight = ::sceneTree.GetHeight();
+}
+
+void SwapFrames()
+{
+	std::swap(::recFrame, ::renderFrame);
+}
+
+void DiscardFrames()
+{
+	::recFrame->Clear();
+	::renderFrame->Clear();
+	::cullObjs.clear();
+	::insideObjs.clear();
+	::ClearOccluders();
+}
+
+void BindTexture(unsigned unit, const Texture& texture)
+{
+	::recFrame->textureBindings.push_back(TextureBinding(unit, texture.GetGLHandle()));
+}
+
+void SetUniform(LocationMgr::UniformID id, int value)
+{
+	UniformWrite write = {id, UniformWrite::E_INT, value};
+	::recFrame->uniformWrites.push_back(write);
+}
+
+void SetUniform(LocationMgr::UniformID id, float value)
+{
+	UniformWrite write = {id, UniformWrite::E_FLOAT, 0, {value}};
+	::recFrame->uniformWrites.push_back(write);
+}
+
+void SetUniform3fv(LocationMgr::UniformID id, const float *values)
+{
+	UniformWrite write = {id, UniformWrite::E_VEC3, 0, {values[0], values[1], values[2]}};
+	::recFrame->uniformWrites.push_back(write);
+}
+
+void SetUniform4fv(LocationMgr::UniformID id, const float *values)
+{
+	UniformWrite write = {id, UniformWrite::E_VEC4, 0, {values[0], values[1], values[2], values[3]}};
+	::recFrame->uniformWrites.push_back(write);
 }
 
 void DrawPoint(const Point3 &pos, const Colour &clr)
 {
-	++(::transformRanges[::currTransformInd].numToRender);
-	::transformRanges[::currTransformInd].pointIndices.push_back(::points.size());
-	::points.push_back(PointRenderContext(pos, clr));
+	++(::recFrame->transformRanges[::currTransformInd].numToRender);
+	::recFrame->transformRanges[::currTransformInd].pointIndices.push_back(::recFrame->points.size());
+	::recFrame->points.push_back(PointRenderContext(pos, clr));
 }
 
 void DrawPoint(const Vertex &vtx)
@@ -595,11 +952,11 @@ void DrawPoint(const Vertex &vtx)
 
 void DrawLine(const Point3 &startPos, const Colour &startClr, const Point3 &endPos, const Colour &endClr)
 {
-	++(::transformRanges[::currTransformInd].numToRender);
-	::transformRanges[::currTransformInd].lineIndices.push_back(::lines.size());
-	::lines.push_back(PointRenderContext(startPos, startClr));
-	::transformRanges[::currTransformInd].lineIndices.push_back(::lines.size());
-	::lines.push_back(PointRenderContext(endPos, endClr));
+	++(::recFrame->transformRanges[::currTransformInd].numToRender);
+	::recFrame->transformRanges[::currTransformInd].lineIndices.push_back(::recFrame->lines.size());
+	::recFrame->lines.push_back(PointRenderContext(startPos, startClr));
+	::recFrame->transformRanges[::currTransformInd].lineIndices.push_back(::recFrame->lines.size());
+	::recFrame->lines.push_back(PointRenderContext(endPos, endClr));
 }
 
 void DrawLine(const Vertex &startVtx, const Vertex &endVtx)
@@ -609,13 +966,13 @@ void DrawLine(const Vertex &startVtx, const Vertex &endVtx)
 
 void DrawTri(const Vertex &v0, const Vertex &v1, const Vertex &v2)
 {
-	++(::transformRanges[::currTransformInd].numToRender);
-	::transformRanges[::currTransformInd].triIndices.push_back(::tris.size());
-	tris.push_back(PointRenderContext(v0.pos, v0.clr));
-	::transformRanges[::currTransformInd].triIndices.push_back(::tris.size());
-	::tris.push_back(PointRenderContext(v1.pos, v1.clr));
-	::transformRanges[::currTransformInd].triIndices.push_back(::tris.size());
-	::tris.push_back(PointRenderContext(v2.pos, v2.clr));
+	++(::recFrame->transformRanges[::currTransformInd].numToRender);
+	::recFrame->transformRanges[::currTransformInd].triIndices.push_back(::recFrame->tris.size());
+	::recFrame->tris.push_back(PointRenderContext(v0.pos, v0.clr));
+	::recFrame->transformRanges[::currTransformInd].triIndices.push_back(::recFrame->tris.size());
+	::recFrame->tris.push_back(PointRenderContext(v1.pos, v1.clr));
+	::recFrame->transformRanges[::currTransformInd].triIndices.push_back(::recFrame->tris.size());
+	::recFrame->tris.push_back(PointRenderContext(v2.pos, v2.clr));
 }
 
 void DrawQuad(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex &v3)
@@ -626,22 +983,97 @@ void DrawQuad(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex
 
 void DrawModel(Model *pModel, bool useTextures, const Colour& clr)
 {
-	++(::transformRanges[::currTransformInd].numToRender);
-	::transformRanges[::currTransformInd].meshIndices.push_back(::models.size());
-	::models.push_back(ModelRenderContext(pModel, useTextures, clr));
+	::recFrame->drawCmds.push_back(DrawCommand(pModel, ::currTransformInd, useTextures, clr));
+}
+
+void DrawDynamicMesh(
+	const Vertex *vertices, size_t numVertices,
+	const unsigned *triIndices, size_t numTriIndices, const Colour& clr,
+	const unsigned *lineIndices, size_t numLineIndices, const Colour& lineClr)
+{
+	if (numVertices == 0 || numTriIndices == 0)
+		return;
+
+	if (!lineIndices)
+		numLineIndices = 0;
+
+	// Copied like every other recorded command, so the caller may change them once this returns
+	std::vector<unsigned> &indices = ::recFrame->dynamicIndices;
+	DynamicMeshDraw draw;
+	draw.transformInd   = ::currTransformInd;
+	draw.firstVertex    = static_cast<unsigned>(::recFrame->dynamicVerts.size());
+	draw.firstTriIndex  = static_cast<unsigned>(indices.size());
+	draw.numTriIndices  = static_cast<unsigned>(numTriIndices);
+	draw.firstLineIndex = static_cast<unsigned>(indices.size() + numTriIndices);
+	draw.numLineIndices = static_cast<unsigned>(numLineIndices);
+	draw.surfaceClr     = clr;
+	draw.lineClr        = lineClr;
+	::recFrame->dynamicMeshes.push_back(draw);
+	::recFrame->dynamicVerts.insert(::recFrame->dynamicVerts.end(), vertices, vertices + numVertices);
+	indices.insert(indices.end(), triIndices, triIndices + numTriIndices);
+	if (numLineIndices)
+		indices.insert(indices.end(), lineIndices, lineIndices + numLineIndices);
 }
 
 void DrawObject(RenderContext& rc)
 {
-	++::numObjsRequested;
-	::vfcScheme(rc);
+	++::recFrame->numObjsRequested;
+	::cullObjs.push_back(CullObject(&rc, ::currTransformInd));
+}
+
+int AddSceneObject(RenderContext& rc)
+{
+	return ::sceneTree.CreateProxy(rc.aabb, &rc);
+}
+
+void UpdateSceneObject(int sceneId)
+{
+	::sceneTree.MoveProxy(sceneId, static_cast<RenderContext*>(::sceneTree.GetUserData(sceneId))->aabb);
+}
+
+void RemoveSceneObject(int sceneId)
+{
+	::sceneTree.DestroyProxy(sceneId);
+}
+
+void SetOcclusionCulling(bool bEnabled)
+{
+	::bOcclusionCulling = bEnabled;
+}
+
+bool GetOcclusionCulling()
+{
+	return ::bOcclusionCulling;
+}
+
+void AddOccluder(RenderContext& rc)
+{
+	if (rc.model && rc.model->GetVertexArray() && !rc.bOccluder)
+	{
+		rc.bOccluder = true;
+		::occluders.push_back(&rc);
+	}
+}
+
+void DrawScene()
+{
+	if (::sceneTree.GetRoot() == AABBTree::NullNode)
+		return;
+
+	::scenePlanes[0] = &::cullingFrustum.leftPl;
+	::scenePlanes[1] = &::cullingFrustum.rightPl;
+	::scenePlanes[2] = &::cullingFrustum.nearPl;
+	::scenePlanes[3] = &::cullingFrustum.farPl;
+	::scenePlanes[4] = &::cullingFrustum.bottomPl;
+	::scenePlanes[5] = &::cullingFrustum.topPl;
+
+	::recFrame->numObjsRequested += ::sceneTree.GetNumProxies();
+	::CullSceneNode(::sceneTree.GetRoot(), 0x3F);
 }
 
 void DrawShape(Shape shape, const Colour& clr)
 {
-	++(::transformRanges[::currTransformInd].numToRender);
-	::transformRanges[::currTransformInd].shapeIndices.push_back(::shapes.size());
-	::shapes.push_back(ModelRenderContext(::shapeMeshes[shape], false, clr));
+	::recFrame->drawCmds.push_back(DrawCommand(::shapeMeshes[shape], ::currTransformInd, false, clr));
 }
 
 void SetClearColor(float r, float g, float b, float a)
@@ -655,12 +1087,12 @@ void SetClearColor(float r, float g, float b, float a)
 
 void PrintStr(const char *string, int x, int y)
 {
-	::strings.push_back(TextRenderContext(string, x, y));
+	::recFrame->strings.push_back(TextRenderContext(string, x, y));
 }
 
 void PrintDebugInfo(const char *string)
 {
-	::debugStr.push_back(string);
+	::recFrame->debugStr.push_back(string);
 }
 
 void PushMVMatrixStack()
@@ -691,8 +1123,8 @@ void ClearMVMatrixStack()
 void MV_Push(const Matrix4x4 &mtx)
 {
 	::cl_MV_mtxStack.back() = ::cl_MV_mtxStack.back() * mtx;
-	::currTransformInd = ::transformRanges.size();
-	::transformRanges.push_back(::cl_MV_mtxStack.back());
+	::currTransformInd = ::recFrame->transformRanges.size();
+	::recFrame->transformRanges.push_back(::cl_MV_mtxStack.back());
 }
 
 void MV_Scale(float x_scalar, float y_scalar, float z_scalar)
@@ -703,15 +1135,15 @@ void MV_Scale(float x_scalar, float y_scalar, float z_scalar)
 void MV_Scale(const Vector3 &scalar)
 {
 	::cl_MV_mtxStack.back() = ::cl_MV_mtxStack.back() * bbk::Matrix4x4::MakeScale(scalar);
-	::currTransformInd = ::transformRanges.size();
-	::transformRanges.push_back(::cl_MV_mtxStack.back());
+	::currTransformInd = ::recFrame->transformRanges.size();
+	::recFrame->transformRanges.push_back(::cl_MV_mtxStack.back());
 }
 
 void MV_Rotate(const Vector3 &axis, float angle_rad)
 {
 	::cl_MV_mtxStack.back() = ::cl_MV_mtxStack.back() * bbk::Matrix4x4::MakeRotate(axis, angle_rad);
-	::currTransformInd = ::transformRanges.size();
-	::transformRanges.push_back(::cl_MV_mtxStack.back());
+	::currTransformInd = ::recFrame->transformRanges.size();
+	::recFrame->transformRanges.push_back(::cl_MV_mtxStack.back());
 }
 
 void MV_Translate(float x_disp, float y_disp, float z_disp)
@@ -722,8 +1154,8 @@ void MV_Translate(float x_disp, float y_disp, float z_disp)
 void MV_Translate(const Vector3 &displacement)
 {
 	::cl_MV_mtxStack.back() = ::cl_MV_mtxStack.back() * bbk::Matrix4x4::MakeTranslate(displacement);
-	::currTransformInd = ::transformRanges.size();
-	::transformRanges.push_back(::cl_MV_mtxStack.back());
+	::currTransformInd = ::recFrame->transformRanges.size();
+	::recFrame->transformRanges.push_back(::cl_MV_mtxStack.back());
 }
 
 Model* MakeModel()
@@ -935,36 +1367,6 @@ void SetCullingFrustum(const Frustum& frustum)
 void SetVFCScheme(VFCScheme scheme)
 {
 	::vfcBV_type = scheme;
-	if (::bPlaneCoherency)
-	{
-		switch (scheme)
-		{
-		case E_BSPHERE:
-			::vfcScheme = ::BSphereVFC_PC;
-			break;
-		case E_AABB:
-			::vfcScheme = ::AABBVFC_PC;
-			break;
-		case E_OBB:
-			::vfcScheme = ::OBBVFC_PC;
-			break;
-		}
-	}
-	else
-	{
-		switch (scheme)
-		{
-		case E_BSPHERE:
-			::vfcScheme = ::BSphereVFC;
-			break;
-		case E_AABB:
-			::vfcScheme = ::AABBVFC;
-			break;
-		case E_OBB:
-			::vfcScheme = ::OBBVFC;
-			break;
-		}
-	}
 }
 
 bool GetPlaneCoherency()
@@ -975,18 +1377,6 @@ bool GetPlaneCoherency()
 void SetPlaneCoherency(bool bEnabled)
 {
 	::bPlaneCoherency = bEnabled;
-	switch (::vfcBV_type)
-	{
-	case E_BSPHERE:
-		::vfcScheme = ::bPlaneCoherency ? ::BSphereVFC_PC : ::BSphereVFC;
-		break;
-	case E_AABB:
-		::vfcScheme = ::bPlaneCoherency ? ::AABBVFC_PC : ::AABBVFC;
-		break;
-	case E_OBB:
-		::vfcScheme = ::bPlaneCoherency ? ::OBBVFC_PC : ::OBBVFC;
-		break;
-	}
 }
 
 void DrawBoundingVolumes(bool flag)
@@ -998,336 +1388,613 @@ void DrawBoundingVolumes(bool flag)
 
 namespace
 {
-int BSvsLeftPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.leftPl);
-}
+void FrameData::Clear()
+{
+	points.clear();
+	lines.clear();
+	tris.clear();
+	drawCmds.clear();
+	dynamicVerts.clear();
+	dynamicIndices.clear();
+	dynamicMeshes.clear();
+	transformRanges.clear();
+	transformRanges.push_back(TransformDrawRange(bbk::Matrix4x4::IDENTITY));
+	textureBindings.clear();
+	uniformWrites.clear();
+	strings.clear();
+	debugStr.clear();
+
+	numObjsRequested    = 0;
+	numObjsRendered     = 0;
+	numObjsInside       = 0;
+	numObjsOccluded     = 0;
+	numPlaneTests       = 0;
+	numSceneNodesTested = 0;
+	sceneTreeHeight     = 0;
+}
+
+void CullObjects()
+{
+	const bool bTestOcclusion = ::bOcclusionCulling && !::occluders.empty();
+	if (bTestOcclusion)
+		::BuildOcclusionBuffer();
+	if (!::cullObjs.empty())
+		::BatchFrustumCull();
+
+	// Draw visible objects under the transform that was current when they were
+	// submitted, then restore the matrix stack
+	const bbk::Matrix4x4 savedMtx          = ::cl_MV_mtxStack.back();
+	const unsigned       savedTransformInd = ::currTransformInd;
+
+	for (size_t i = 0, numObjs = ::cullObjs.size(); i < numObjs; ++i)
+	{
+		bbk::RenderContext &rc = *::cullObjs[i].rc;
+		rc.planeInd = static_cast<char>(::cullPlaneInds[i]);
 
-int BSvsRightPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.rightPl);
-}
+		::currTransformInd      = ::cullObjs[i].parentTransformInd;
+		::cl_MV_mtxStack.back() = ::recFrame->transformRanges[::currTransformInd].transform;
 
-int BSvsBottomPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.bottomPl);
-}
+		const uint32_t bit      = 1u << (i % 32);
+		bool           bVisible = (::cullVisibleMask[i / 32] & bit) != 0;
 
-int BSvsTopPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.topPl);
-}
+		if (bVisible)
+		{
+			if (::cullInsideMask[i / 32] & bit)
+				++::recFrame->numObjsInside;
+			if (bTestOcclusion && ::IsObjectOccluded(rc))
+			{
+				++::recFrame->numObjsOccluded;
+				bVisible = false;
+			}
+			else
+				::DrawCulledObject(rc);
+		}
+		::DrawCulledBV(rc, bVisible);
+	}
 
-int BSvsNearPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.nearPl);
-}
+	for (size_t i = 0, numObjs = ::insideObjs.size(); i < numObjs; ++i)
+	{
+		bbk::RenderContext &rc = *::insideObjs[i].rc;
+
+		::currTransformInd      = ::insideObjs[i].parentTransformInd;
+		::cl_MV_mtxStack.back() = ::recFrame->transformRanges[::currTransformInd].transform;
+
+		++::recFrame->numObjsInside;
+		const bool bVisible = !bTestOcclusion || !::IsObjectOccluded(rc);
+		if (bVisible)
+			::DrawCulledObject(rc);
+		else
+			++::recFrame->numObjsOccluded;
+		::DrawCulledBV(rc, bVisible);
+	}
 
-int BSvsFarPlane(const bbk::BSphere& bsphere)
-{
-	++::numPlaneTests;
-	return bbk::BSpherevsPlane(bsphere, ::cullingFrustum.farPl);
+	::cl_MV_mtxStack.back() = savedMtx;
+	::currTransformInd      = savedTransformInd;
+	::cullObjs.clear();
+	::insideObjs.clear();
+	::ClearOccluders();
 }
 
-int AABBvsLeftPlane(const bbk::AABB& aabb)
+void BatchFrustumCull()
 {
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.leftPl);
-}
+	const size_t numObjs = ::cullObjs.size();
 
-int AABBvsRightPlane(const bbk::AABB& aabb)
-{
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.rightPl);
-}
+	::cullPlaneInds.resize(numObjs);
+	::cullVisibleMask.resize((numObjs + 31) / 32);
+	::cullInsideMask.resize((numObjs + 31) / 32);
+	for (size_t i = 0; i < numObjs; ++i)
+		::cullPlaneInds[i] = static_cast<uint8_t>(::cullObjs[i].rc->planeInd);
 
-int AABBvsBottomPlane(const bbk::AABB& aabb)
-{
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.bottomPl);
-}
+	// Gather bounding volumes into one array per component and cull them together
+	switch (::vfcBV_type)
+	{
+	case bbk::gfx::E_BSPHERE:
+	{
+		::cullSoA.resize(4 * numObjs);
+		float *soa = &::cullSoA[0];
+		for (size_t i = 0; i < numObjs; ++i)
+		{
+			const bbk::BSphere &bsphere = ::cullObjs[i].rc->bsphere;
+			soa[i              ] = bsphere.center.x;
+			soa[i +     numObjs] = bsphere.center.y;
+			soa[i + 2 * numObjs] = bsphere.center.z;
+			soa[i + 3 * numObjs] = bsphere.radius;
+		}
+		break;
+	}
+	case bbk::gfx::E_AABB:
+	{
+		::cullSoA.resize(6 * numObjs);
+		float *soa = &::cullSoA[0];
+		for (size_t i = 0; i < numObjs; ++i)
+		{
+			const bbk::AABB &aabb = ::cullObjs[i].rc->aabb;
+			soa[i              ] = aabb.center.x;
+			soa[i +     numObjs] = aabb.center.y;
+			soa[i + 2 * numObjs] = aabb.center.z;
+			soa[i + 3 * numObjs] = aabb.diag.x;
+			soa[i + 4 * numObjs] = aabb.diag.y;
+			soa[i + 5 * numObjs] = aabb.diag.z;
+		}
+		break;
+	}
+	case bbk::gfx::E_OBB:
+	{
+		::cullSoA.resize(15 * numObjs);
+		float *soa = &::cullSoA[0];
+		for (size_t i = 0; i < numObjs; ++i)
+		{
+			const bbk::OBB &obb = ::cullObjs[i].rc->obb;
+			const float components[15] = {
+				obb.center.x, obb.center.y, obb.center.z,
+				obb.u.x, obb.u.y, obb.u.z,
+				obb.v.x, obb.v.y, obb.v.z,
+				obb.w.x, obb.w.y, obb.w.z,
+				obb.halfExtents.x, obb.halfExtents.y, obb.halfExtents.z};
+			for (size_t c = 0; c < 15; ++c)
+				soa[i + c * numObjs] = components[c];
+		}
+		break;
+	}
+	}
 
-int AABBvsTopPlane(const bbk::AABB& aabb)
-{
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.topPl);
+	// Chunks are whole mask words, so jobs never write the same word
+	::cullChunkPlaneTests.resize((numObjs + ::CullGrainSize - 1) / ::CullGrainSize);
+	bbk::jobs::ParallelFor(numObjs, ::CullGrainSize, ::CullChunk, nullptr);
+	for (size_t i = 0, size = ::cullChunkPlaneTests.size(); i < size; ++i)
+		::recFrame->numPlaneTests += ::cullChunkPlaneTests[i];
 }
 
-int AABBvsNearPlane(const bbk::AABB& aabb)
+void CullChunk(size_t begin, size_t end, void*)
 {
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.nearPl);
-}
+	const size_t  numObjs   = ::cullObjs.size();
+	const size_t  count     = end - begin;
+	const float  *soa       = &::cullSoA[begin];
+	uint8_t      *planeInds = &::cullPlaneInds[begin];
+	uint32_t     *visible   = &::cullVisibleMask[begin / 32];
+	uint32_t     *inside    = &::cullInsideMask[begin / 32];
+	unsigned      numTests  = 0;
 
-int AABBvsFarPlane(const bbk::AABB& aabb)
-{
-	++::numPlaneTests;
-	return bbk::AABBvsPlane(aabb, ::cullingFrustum.farPl);
-}
-
-int OBBvsLeftPlane(const bbk::OBB& obb)
-{
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.leftPl);
+	switch (::vfcBV_type)
+	{
+	case bbk::gfx::E_BSPHERE:
+	{
+		const bbk::BSphereSoA bspheres = {soa, soa + numObjs, soa + 2 * numObjs, soa + 3 * numObjs};
+		numTests = bbk::FrustumCullBSpheres(::cullingFrustum, bspheres, count, ::bPlaneCoherency, planeInds, visible, inside);
+		break;
+	}
+	case bbk::gfx::E_AABB:
+	{
+		const bbk::AABBSoA aabbs = {
+			soa,               soa +     numObjs, soa + 2 * numObjs,
+			soa + 3 * numObjs, soa + 4 * numObjs, soa + 5 * numObjs};
+		numTests = bbk::FrustumCullAABBs(::cullingFrustum, aabbs, count, ::bPlaneCoherency, planeInds, visible, inside);
+		break;
+	}
+	case bbk::gfx::E_OBB:
+	{
+		const bbk::OBBSoA obbs = {
+			soa,                soa +      numObjs, soa +  2 * numObjs,
+			soa +  3 * numObjs, soa +  4 * numObjs, soa +  5 * numObjs,
+			soa +  6 * numObjs, soa +  7 * numObjs, soa +  8 * numObjs,
+			soa +  9 * numObjs, soa + 10 * numObjs, soa + 11 * numObjs,
+			soa + 12 * numObjs, soa + 13 * numObjs, soa + 14 * numObjs};
+		numTests = bbk::FrustumCullOBBs(::cullingFrustum, obbs, count, ::bPlaneCoherency, planeInds, visible, inside);
+		break;
+	}
+	}
+	::cullChunkPlaneTests[begin / ::CullGrainSize] = numTests;
 }
 
-int OBBvsRightPlane(const bbk::OBB& obb)
+void BuildOcclusionBuffer()
 {
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.rightPl);
+	::occlusionBuffer.Clear();
+	::occlusionBuffer.SetViewProjMtx(::currPerspProjMtx * ::currWorldViewMtx);
+	for (size_t i = 0, size = ::occluders.size(); i < size; ++i)
+	{
+		// Same frame as the bounding volumes tested against it, which are culled as if in world
+		const bbk::RenderContext &rc     = *::occluders[i];
+		bbk::Model               *pModel = rc.model;
+		::occlusionBuffer.RasterizeOccluder(rc.transform, pModel->GetVertexArray(), pModel->GetVertIndArray(), pModel->GetNumIndices());
+	}
+	::occlusionBuffer.BuildHiZ();
 }
 
-int OBBvsBottomPlane(const bbk::OBB& obb)
+void ClearOccluders()
 {
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.bottomPl);
+	for (size_t i = 0, size = ::occluders.size(); i < size; ++i)
+		::occluders[i]->bOccluder = false;
+	::occluders.clear();
 }
 
-int OBBvsTopPlane(const bbk::OBB& obb)
+bool IsObjectOccluded(const bbk::RenderContext& rc)
 {
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.topPl);
-}
+	// Occluders would hide themselves
+	if (rc.bOccluder)
+		return false;
 
-int OBBvsNearPlane(const bbk::OBB& obb)
-{
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.nearPl);
+	switch (::vfcBV_type)
+	{
+	case bbk::gfx::E_BSPHERE:
+		return ::occlusionBuffer.IsOccluded(bbk::AABB(rc.bsphere.center, bbk::Vector3(rc.bsphere.radius, rc.bsphere.radius, rc.bsphere.radius)));
+	case bbk::gfx::E_AABB:
+		return ::occlusionBuffer.IsOccluded(rc.aabb);
+	case bbk::gfx::E_OBB:
+		return ::occlusionBuffer.IsOccluded(rc.obb);
+	}
+	return false;
 }
 
-int OBBvsFarPlane(const bbk::OBB& obb)
+void CullSceneNode(int nodeInd, unsigned planeMask)
 {
-	++::numPlaneTests;
-	return bbk::OBBvsPlane(obb, ::cullingFrustum.farPl);
-}
+	bbk::AABBTreeNode &node = ::sceneTree.GetNode(nodeInd);
+	++::recFrame->numSceneNodesTested;
 
-void BSphereVFC(bbk::RenderContext& rc)
-{
-	unsigned char inCode = 0;
-	const bbk::BSphere& bsphere(rc.bsphere);
-	
-	for (char i = 0; i < 6; ++i)
+	// Plane-coherency test against the plane that rejected node last time
+	int testedPlane = -1;
+	if (::bPlaneCoherency && (planeMask & (1 << node.planeInd)))
 	{
-		int result = ::bsTestFuncs[i](bsphere);
+		testedPlane = node.planeInd;
+		++::recFrame->numPlaneTests;
+		const int result = bbk::AABBvsPlane(node.aabb, *::scenePlanes[testedPlane]);
 		if (result == 1) // Outside
 		{
-			rc.planeInd = i; // Save plane coherency info
 			if (::bDrawBV)
-				bbk::DrawBSphereR(bsphere);
+				bbk::DrawAABBR(node.aabb);
 			return;
 		}
 		else if (result)
-			inCode |= 1 << i;
+			planeMask &= ~(1 << testedPlane);
 	}
 
-	// Bounding volume intersects view frustum
-	bbk::gfx::PushMVMatrixStack();
-	bbk::gfx::MV_Push(rc.transform);
-	bbk::gfx::DrawModel(rc.model);
-	bbk::gfx::PopMVMatrixStack();
-	if (::bDrawBV)
-		bbk::DrawBSphereG(bsphere);
-	++::numObjsRendered;
-	if (inCode == 0x3F)
-		++::numObjsInside;
-}
-
-void AABBVFC(bbk::RenderContext& rc)
-{
-	unsigned char inCode = 0;
-	const bbk::AABB& aabb(rc.aabb);
-
-	for (char i = 0; i < 6; ++i)
+	for (int i = 0; i < 6; ++i)
 	{
-		int result = ::aabbTestFuncs[i](aabb);
+		if (i == testedPlane || !(planeMask & (1 << i)))
+			continue;
+
+		++::recFrame->numPlaneTests;
+		const int result = bbk::AABBvsPlane(node.aabb, *::scenePlanes[i]);
 		if (result == 1) // Outside
 		{
-			rc.planeInd = i; // Save plane coherency info
+			node.planeInd = static_cast<char>(i); // Save plane coherency info
 			if (::bDrawBV)
-				bbk::DrawAABBR(aabb);
+				bbk::DrawAABBR(node.aabb);
 			return;
 		}
-		else if (result)
-			inCode |= 1 << i;
+		else if (result) // Inside plane, so are all descendants
+			planeMask &= ~(1 << i);
 	}
-		
-	// Bounding volume intersects view frustum
+
+	if (!planeMask)
+		::DrawSceneSubtree(nodeInd);
+	else if (node.IsLeaf())
+		::cullObjs.push_back(CullObject(static_cast<bbk::RenderContext*>(node.userData), ::currTransformInd));
+	else
+	{
+		::CullSceneNode(node.child1, planeMask);
+		::CullSceneNode(node.child2, planeMask);
+	}
+}
+
+void DrawSceneSubtree(int nodeInd)
+{
+	const bbk::AABBTreeNode &node = ::sceneTree.GetNode(nodeInd);
+	if (node.IsLeaf())
+	{
+		::insideObjs.push_back(CullObject(static_cast<bbk::RenderContext*>(node.userData), ::currTransformInd));
+		return;
+	}
+
+	::DrawSceneSubtree(node.child1);
+	::DrawSceneSubtree(node.child2);
+}
+
+void DrawCulledObject(bbk::RenderContext& rc)
+{
 	bbk::gfx::PushMVMatrixStack();
 	bbk::gfx::MV_Push(rc.transform);
 	bbk::gfx::DrawModel(rc.model);
 	bbk::gfx::PopMVMatrixStack();
-	if (::bDrawBV)
-		bbk::DrawAABBG(aabb);
-	++::numObjsRendered;
-	if (inCode == 0x3F)
-		++::numObjsInside;
+	++::recFrame->numObjsRendered;
 }
 
-void OBBVFC(bbk::RenderContext& rc)
+void DrawCulledBV(const bbk::RenderContext& rc, bool bVisible)
 {
-	unsigned char inCode = 0;
-	const bbk::OBB& obb(rc.obb);
+	if (!::bDrawBV)
+		return;
 
-	for (char i = 0; i < 6; ++i)
+	switch (::vfcBV_type)
 	{
-		int result = ::obbTestFuncs[i](obb);
-		if (result == 1) // Outside
-		{
-			rc.planeInd = i; // Save plane coherency info
-			if (::bDrawBV)
-				bbk::DrawOBBR(obb);
-			return;
-		}
-		else if (result)
-			inCode |= 1 << i;
+	case bbk::gfx::E_BSPHERE:
+		if (bVisible)
+			bbk::DrawBSphereG(rc.bsphere);
+		else
+			bbk::DrawBSphereR(rc.bsphere);
+		break;
+	case bbk::gfx::E_AABB:
+		if (bVisible)
+			bbk::DrawAABBG(rc.aabb);
+		else
+			bbk::DrawAABBR(rc.aabb);
+		break;
+	case bbk::gfx::E_OBB:
+		if (bVisible)
+			bbk::DrawOBBG(rc.obb);
+		else
+			bbk::DrawOBBR(rc.obb);
+		break;
 	}
-		
-	// Bounding volume intersects view frustum
-	bbk::gfx::PushMVMatrixStack();
-	bbk::gfx::MV_Push(rc.transform);
-	bbk::gfx::DrawModel(rc.model);
-	bbk::gfx::PopMVMatrixStack();
-	if (::bDrawBV)
-		bbk::DrawOBBG(obb);
-	++::numObjsRendered;
-	if (inCode == 0x3F)
-		++::numObjsInside;
 }
 
-void BSphereVFC_PC(bbk::RenderContext& rc)
+unsigned GetFrameMaterialId(const bbk::Colour &clr)
 {
-	unsigned char inCode = 0;
-	int result = 0;
-	const bbk::BSphere& bsphere(rc.bsphere);
+	for (size_t i = 0, size = ::frameMaterials.size(); i < size; ++i)
+	{
+		if (std::memcmp(&::frameMaterials[i], &clr, sizeof(bbk::Colour)) == 0)
+			return i & ::KeyIdMask;
+	}
+	::frameMaterials.push_back(clr);
+	return (::frameMaterials.size() - 1) & ::KeyIdMask;
+}
+
+unsigned GetFrameMeshId(const bbk::Model *pModel)
+{
+	for (size_t i = 0, size = ::frameMeshes.size(); i < size; ++i)
+	{
+		if (::frameMeshes[i] == pModel)
+			return i & ::KeyIdMask;
+	}
+	::frameMeshes.push_back(pModel);
+	return (::frameMeshes.size() - 1) & ::KeyIdMask;
+}
+
+void BuildDrawKeys()
+{
+	const float *wv = ::renderFrame->worldViewMtx.elements;
+
+	::drawKeys.resize(::renderFrame->drawCmds.size());
+	for (size_t i = 0, size = ::renderFrame->drawCmds.size(); i < size; ++i)
+	{
+		const DrawCommand &cmd = ::renderFrame->drawCmds[i];
+		const float       *t   = ::renderFrame->transformRanges[cmd.transformInd].transform.elements;
+
+		// View space distance of model origin; bit pattern of a non-negative
+		// float orders the same way as its value, so its top bits are the depth
+		float depth = -(wv[2] * t[12] + wv[6] * t[13] + wv[10] * t[14] + wv[14]);
+		if (!(depth > 0.0f))
+			depth = 0.0f;
+		uint32_t depthBits;
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+		uint64_t key = 0;
+		key |= static_cast<uint64_t>(cmd.bUseTextures ? 1 : 0) << ::KeyTexturedShift;
+		if (!cmd.bUseTextures) // Material only matters to untextured draws
+			key |= static_cast<uint64_t>(::GetFrameMaterialId(cmd.surfaceClr)) << ::KeyMaterialShift;
+		key |= static_cast<uint64_t>(::GetFrameMeshId(cmd.model)) << ::KeyMeshShift;
+		key |= static_cast<uint64_t>((depthBits >> 7) & ::KeyDepthMask) << ::KeyDepthShift;
+
+		::drawKeys[i].key    = key;
+		::drawKeys[i].cmdInd = i;
+	}
+
+	::frameMaterials.clear();
+	::frameMeshes.clear();
+}
+
+void SortDrawKeys()
+{
+	// LSD radix sort on 8-bit digits. All digit histograms are built in one
+	// pass, and digits that are equal across every key are skipped.
+	const size_t numKeys = ::drawKeys.size();
+	unsigned counts[8][256];
+	std::memset(counts, 0, sizeof(counts));
+	for (size_t i = 0; i < numKeys; ++i)
+	{
+		const uint64_t key = ::drawKeys[i].key;
+		for (unsigned d = 0; d < 8; ++d)
+			++counts[d][(key >> (d * 8)) & 0xFF];
+	}
 
-	// Plane-coherency test
-	result = ::bsTestFuncs[rc.planeInd](bsphere);
-	if (result < 1)
+	::drawKeysScratch.resize(numKeys);
+	for (unsigned d = 0; d < 8; ++d)
 	{
-		if (result)
-			inCode |= 1 << rc.planeInd;
-		for (char i = 0; i < 6; ++i)
+		const unsigned shift = d * 8;
+		if (counts[d][(::drawKeys[0].key >> shift) & 0xFF] == numKeys)
+			continue;
+
+		unsigned offset = 0;
+		for (unsigned b = 0; b < 256; ++b)
 		{
-			if (i != rc.planeInd)
-			{
-				int result = ::bsTestFuncs[i](bsphere);
-				if (result == 1) // Outside
-				{
-					rc.planeInd = i; // Save plane coherency info
-					if (::bDrawBV)
-						bbk::DrawBSphereR(bsphere);
-					return;
-				}
-				else if (result)
-					inCode |= 1 << i;
-			}
+			const unsigned count = counts[d][b];
+			counts[d][b] = offset;
+			offset += count;
 		}
-
-		// Bounding volume intersects view frustum
-		bbk::gfx::PushMVMatrixStack();
-		bbk::gfx::MV_Push(rc.transform);
-		bbk::gfx::DrawModel(rc.model);
-		bbk::gfx::PopMVMatrixStack();
-		if (::bDrawBV)
-			bbk::DrawBSphereG(bsphere);
-		++::numObjsRendered;
-		if (inCode == 0x3F)
-			++::numObjsInside;
+		for (size_t i = 0; i < numKeys; ++i)
+			::drawKeysScratch[counts[d][(::drawKeys[i].key >> shift) & 0xFF]++] = ::drawKeys[i];
+		::drawKeys.swap(::drawKeysScratch);
 	}
-	else if (::bDrawBV)
-		bbk::DrawBSphereR(bsphere);
 }
 
-void AABBVFC_PC(bbk::RenderContext& rc)
+void BuildInstanceBatches()
 {
-	unsigned char inCode = 0;
-	int result = 0;
-	const bbk::AABB& aabb(rc.aabb);
+	::instanceData.clear();
+	::instanceBatches.clear();
+	if (!::bInstancingSupported || !::bInstancingEnabled)
+		return;
 
-	// Plane-coherency test
-	result = ::aabbTestFuncs[rc.planeInd](aabb);
-	if (result < 1)
+	for (size_t i = 0, size = ::drawKeys.size(); i < size; )
 	{
-		if (result)
-			inCode |= 1 << rc.planeInd;
-		for (char i = 0; i < 6; ++i)
+		const DrawCommand &first = ::renderFrame->drawCmds[::drawKeys[i].cmdInd];
+
+		// Commands sharing mesh and texture flag are adjacent after sorting
+		size_t runEnd = i + 1;
+		while (runEnd < size &&
+			::renderFrame->drawCmds[::drawKeys[runEnd].cmdInd].model        == first.model &&
+			::renderFrame->drawCmds[::drawKeys[runEnd].cmdInd].bUseTextures == first.bUseTextures)
+			++runEnd;
+
+		if (runEnd - i >= ::MinInstanceBatch)
 		{
-			if (i != rc.planeInd)
+			::instanceBatches.push_back(InstanceBatch(i, runEnd - i, ::instanceData.size()));
+			for (size_t j = i; j < runEnd; ++j)
 			{
-				int result = ::aabbTestFuncs[i](aabb);
-				if (result == 1) // Outside
-				{
-					rc.planeInd = i; // Save plane coherency info
-					if (::bDrawBV)
-						bbk::DrawAABBR(aabb);
-					return;
-				}
-				else if (result)
-					inCode |= 1 << i;
+				const DrawCommand &cmd = ::renderFrame->drawCmds[::drawKeys[j].cmdInd];
+				InstanceData inst;
+				std::memcpy(inst.transform, ::renderFrame->transformRanges[cmd.transformInd].transform.elements, sizeof(inst.transform));
+				inst.surfaceClr = cmd.surfaceClr;
+				::instanceData.push_back(inst);
 			}
 		}
-		
-		// Bounding volume intersects view frustum
-		bbk::gfx::PushMVMatrixStack();
-		bbk::gfx::MV_Push(rc.transform);
-		bbk::gfx::DrawModel(rc.model);
-		bbk::gfx::PopMVMatrixStack();
-		if (::bDrawBV)
-			bbk::DrawAABBG(aabb);
-		++::numObjsRendered;
-		if (inCode == 0x3F)
-			++::numObjsInside;
+		i = runEnd;
+	}
+
+	// All of the frame's instances go to the GPU in one upload. Respecifying the
+	// store lets the driver hand out fresh memory instead of waiting on last frame's draws
+	if (!::instanceData.empty())
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, ::instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, ::instanceData.size() * sizeof(InstanceData), &::instanceData[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
-	else if (::bDrawBV)
-		bbk::DrawAABBR(aabb);
 }
 
-void OBBVFC_PC(bbk::RenderContext& rc)
+unsigned CountUnsortedStateChanges()
 {
-	unsigned char inCode = 0;
-	int result = 0;
-	const bbk::OBB& obb(rc.obb);
+	const std::vector<DrawCommand> &cmds = ::renderFrame->drawCmds;
 
-	// Plane-coherency test
-	result = ::obbTestFuncs[rc.planeInd](obb);
-	if (result < 1)
+	unsigned           numChanges    = 0;
+	unsigned           currTransform = ~0u;
+	int                currTextured  = -1;
+	const bbk::Colour *currMaterial  = nullptr;
+	bbk::Model        *currMesh      = nullptr;
+	for (size_t i = 0, size = cmds.size(); i < size; ++i)
 	{
-		if (result)
-			inCode |= 1 << rc.planeInd;
-		for (char i = 0; i < 6; ++i)
+		const DrawCommand &cmd = cmds[i];
+		if (cmd.transformInd != currTransform)
 		{
-			if (i != rc.planeInd)
-			{
-				int result = ::obbTestFuncs[i](obb);
-				if (result == 1) // Outside
-				{
-					rc.planeInd = i; // Save plane coherency info
-					if (::bDrawBV)
-						bbk::DrawOBBR(obb);
-					return;
-				}
-				else if (result)
-					inCode |= 1 << i;
-			}
+			currTransform = cmd.transformInd;
+			++numChanges;
 		}
-		
-		// Bounding volume intersects view frustum
-		bbk::gfx::PushMVMatrixStack();
-		bbk::gfx::MV_Push(rc.transform);
-		bbk::gfx::DrawModel(rc.model);
-		bbk::gfx::PopMVMatrixStack();
-		if (::bDrawBV)
-			bbk::DrawOBBG(obb);
-		++::numObjsRendered;
-		if (inCode == 0x3F)
-			++::numObjsInside;
+		if (static_cast<int>(cmd.bUseTextures) != currTextured)
+		{
+			currTextured = cmd.bUseTextures;
+			++numChanges;
+		}
+		if (!cmd.bUseTextures && (!currMaterial || std::memcmp(currMaterial, &cmd.surfaceClr, sizeof(bbk::Colour)) != 0))
+		{
+			currMaterial = &cmd.surfaceClr;
+			++numChanges;
+		}
+		if (cmd.model != currMesh)
+		{
+			currMesh = cmd.model;
+			++numChanges;
+		}
+	}
+	return numChanges;
+}
+
+void DrawDynamicMeshes()
+{
+	const FrameData &frame = *::renderFrame;
+	if (frame.dynamicMeshes.empty())
+		return;
+
+	// Every mesh's vertices go to the GPU in one upload. Respecifying the store
+	// lets the driver hand out fresh memory instead of waiting on last frame's draws
+	glBindBuffer(GL_ARRAY_BUFFER, ::dynamicVBO);
+	glBufferData(GL_ARRAY_BUFFER, frame.dynamicVerts.size() * sizeof(bbk::Vertex), &frame.dynamicVerts[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	::numVertsToGPU += static_cast<unsigned>(frame.dynamicVerts.size());
+
+	// Sheets are seen from both sides, with back faces lit as if their normals
+	// were flipped; wireframe lines are drawn over the faces they border
+	const GLboolean bCullFace = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(1.0f, 1.0f);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	bbk::gfx::locationMgrs[0].SetUniform(::uniUseTextures, 0);
+	bbk::gfx::locationMgrs[0].SetUniform(::uniTwoSided, 1);
+	{
+		const bbk::Colour white(1.0f, 1.0f, 1.0f, 1.0f);
+		const bbk::Colour black(0.0f, 0.0f, 0.0f, 0.0f);
+		bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKSpecular, &white.r);
+		bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKEmissive, &black.r);
 	}
-	else if (::bDrawBV)
-		bbk::DrawOBBR(obb);
+
+	for (size_t i = 0, size = frame.dynamicMeshes.size(); i < size; ++i)
+	{
+		const DynamicMeshDraw &draw = frame.dynamicMeshes[i];
+		glPushMatrix();
+		glMultMatrixf(frame.transformRanges[draw.transformInd].transform.elements);
+
+		// Attribute pointers are byte offsets into the stream buffer
+		const char *vtxBase = reinterpret_cast<const char*>(draw.firstVertex * sizeof(bbk::Vertex));
+		glVertexPointer(3, GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, pos));
+		glColorPointer (4, GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, clr));
+		glNormalPointer(GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, nrm));
+
+		bbk::gfx::locationMgrs[0].SetUniform(::uniUseVertexColor, 0);
+		bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKAmbient, &draw.surfaceClr.r);
+		bbk::gfx::locationMgrs[0].SetUniform4fv(::uniKDiffuse, &draw.surfaceClr.r);
+		bbk::gfx::locationMgrs[0].FlushUniforms();
+		glDrawElements(GL_TRIANGLES, draw.numTriIndices, GL_UNSIGNED_INT, &frame.dynamicIndices[draw.firstTriIndex]);
+		++::numDynamicDraws;
+
+		if (draw.numLineIndices)
+		{
+			// With the colour array off, every line vertex takes the current colour
+			glDisableClientState(GL_COLOR_ARRAY);
+			glColor4fv(&draw.lineClr.r);
+			bbk::gfx::locationMgrs[0].SetUniform(::uniUseVertexColor, 1);
+			bbk::gfx::locationMgrs[0].FlushUniforms();
+			glDrawElements(GL_LINES, draw.numLineIndices, GL_UNSIGNED_INT, &frame.dynamicIndices[draw.firstLineIndex]);
+			glEnableClientState(GL_COLOR_ARRAY);
+			++::numDynamicDraws;
+		}
+
+		glPopMatrix();
+	}
+
+	bbk::gfx::locationMgrs[0].SetUniform(::uniTwoSided, 0);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	if (bCullFace)
+		glEnable(GL_CULL_FACE);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BindModelGeometry(bbk::Model *pModel, bool &bTexCoordsEnabled, bool &bNormalsEnabled)
+{
+	if (pModel->hasTexCoords() != bTexCoordsEnabled)
+	{
+		bTexCoordsEnabled = pModel->hasTexCoords();
+		if (bTexCoordsEnabled)
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		else
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	if (pModel->hasNormals() != bNormalsEnabled)
+	{
+		bNormalsEnabled = pModel->hasNormals();
+		if (bNormalsEnabled)
+			glEnableClientState(GL_NORMAL_ARRAY);
+		else
+			glDisableClientState(GL_NORMAL_ARRAY);
+	}
+
+	// With buffer objects bound, attribute pointers are byte offsets into the VBO
+	const bool  bResident = pModel->GetVBOHandle() != 0;
+	const char *vtxBase   = bResident ? nullptr : reinterpret_cast<const char*>(pModel->GetVertexArray());
+	glBindBuffer(GL_ARRAY_BUFFER, pModel->GetVBOHandle());
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pModel->GetIBOHandle());
+
+	glVertexPointer(3, GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, pos));
+	glColorPointer (4, GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, clr));
+	if (bTexCoordsEnabled)
+		glTexCoordPointer(2, GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, tc));
+	if (bNormalsEnabled)
+		glNormalPointer(GL_FLOAT, sizeof(bbk::Vertex), vtxBase + offsetof(bbk::Vertex, nrm));
 }
 } // anon namespace
@@ -1,8 +1,55 @@
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include "model.h"
+#include "opengl/glew.h"
 #include "fileio/fileio.h"
+#include "fileio/mappedfile.h"
+#include "resources/meshfile.h"
 #include "utils.h"
 
+namespace
+{
+const char     CacheMagic[4] = {'B', 'B', 'K', 'C'};
+const uint32_t CacheVersion  = 2; ///< Bump whenever the layout below or the BVH builders change
+
+/** @struct CacheHeader
+ *  @brief  Start of a model cache file. Followed by numVertices Vertex
+ *          structs, numIndices vertex indices, numNodes BVHNodes, numTris
+ *          triangle indices and numTris*3 triangle vertices. */
+struct CacheHeader
+{
+	char     magic[4];
+	uint32_t version;
+	uint64_t sourceHash;  ///< Hash of the source file the cache was built from
+	uint32_t bvhScheme;
+	uint32_t bvhLeafTris; ///< As clamped by BuildBVH
+	char     name[64];
+	uint32_t numVertices;
+	uint32_t numIndices;
+	uint32_t numNodes;
+	uint32_t numTris;
+	uint32_t vertexSize;  ///< sizeof(Vertex) when written
+	uint32_t nodeSize;    ///< sizeof(BVHNode) when written
+	uint32_t vertSize;    ///< sizeof(Vector3) when written
+	uint8_t  hasTexCoords;
+	uint8_t  hasNormals;
+
+	bbk::BSphere   bsphere;
+	bbk::Vector3   bsphereOffset;
+	bbk::AABB      aabb;
+	bbk::Vector3   aabbOffset;
+	bbk::OBB       obb;
+	bbk::Vector3   obbOffset;
+	bbk::Vector3   centerMass;
+	float          mass;
+	bbk::Matrix3x3 inertiaTensor;
+}; // struct CacheHeader
+
+/// Whether nodes form one tree laid out depth-first whose leaves cover triIndices, with every triangle index below numTris
+bool IsValidBVH(const bbk::BVHNode *nodes, uint32_t numNodes, const unsigned *triIndices, uint32_t numTris);
+} // anon namespace
+
 namespace bbk
 {
 Model::Model() :
@@ -10,22 +57,180 @@ Model::Model() :
 	vertices_(nullptr),
 	numIndices_(0),
 	indices_(nullptr),
+	vbo_(0),
+	ibo_(0),
 	hasTexCoords_(false),
 	hasNormals_(false),
-	bvhroot_(nullptr)
+	bvh_(nullptr),
+	mass_(0.0f)
 {}
 
 Model::~Model()
 {
+	FreeBufferObjs();
 	if (vertices_)
 		delete[] vertices_;
 	if (indices_)
 		delete[] indices_;
-	if (bvhroot_)
-		delete bvhroot_;
+	if (bvh_)
+		delete bvh_;
+}
+
+bool Model::LoadGeometryFromFile(const char *filename, BVHBuildScheme bvhScheme, unsigned bvhLeafTris)
+{
+	fileio::MappedFile source;
+	if (!source.Open(filename))
+		return false;
+
+	// Take geometry, BVH, bounding volumes and mass properties from the
+	// sidecar if it was built from identical source with the same BVH
+	// settings, so the source is only hashed, not parsed
+	const uint64_t    sourceHash = utils::HashFNV1a(source.GetData(), source.GetSize());
+	const unsigned    leafTris   = bvhLeafTris < 1 ? 1 : bvhLeafTris; // As BuildBVH clamps it
+	const std::string cacheFilename(std::string(filename) + ".cache");
+	if (!LoadCache(cacheFilename.c_str(), sourceHash, bvhScheme, leafTris))
+	{
+		if (!LoadSourceFile(filename, source))
+			return false;
+
+		// Create array of points for BVH construction
+		Vector3* verts = new Vector3[numIndices_];
+		for (size_t i = 0; i < numIndices_; ++i)
+			verts[i] = vertices_[indices_[i]].pos;
+		if (bvh_)
+			delete bvh_;
+		bvh_ = BuildBVH(verts, numIndices_, bvhScheme, leafTris);
+		delete[] verts;
+
+		WriteCache(cacheFilename.c_str(), sourceHash, bvhScheme, leafTris);
+	}
+
+	// Keep GPU copy in step if model was already resident
+	if (vbo_)
+		return LoadGeometryToGPU();
+	return true;
+}
+
+bool Model::LoadRawGeometryFromFile(const char *filename)
+{
+	fileio::MappedFile source;
+	return source.Open(filename) && LoadSourceFile(filename, source);
+}
+
+bool Model::LoadGeometryToGPU()
+{
+	if (vbo_ || ibo_) // Geometry already resident
+		FreeBufferObjs();
+
+	glGenBuffers(1, &vbo_);
+	glGenBuffers(1, &ibo_);
+	if (vbo_ == 0 || ibo_ == 0)
+	{
+		std::fprintf(stdout, "Model::LoadGeometryToGPU: Failed to create buffer objects for %s\n", modelName_.c_str());
+		FreeBufferObjs();
+		return false;
+	}
+
+	// Geometry is static, so it is uploaded once and drawn from GPU memory from then on
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+	glBufferData(GL_ARRAY_BUFFER, numVertices_ * sizeof(Vertex), vertices_, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices_ * sizeof(unsigned), indices_, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	if (glGetError())
+	{
+		std::fprintf(stdout, "Model::LoadGeometryToGPU: Failed to load geometry to GPU for %s\n", modelName_.c_str());
+		FreeBufferObjs();
+		return false;
+	}
+	return true;
+}
+
+void Model::FreeBufferObjs()
+{
+	if (vbo_)
+		glDeleteBuffers(1, &vbo_);
+	if (ibo_)
+		glDeleteBuffers(1, &ibo_);
+	vbo_ = 0;
+	ibo_ = 0;
+}
+
+bool Model::SaveGeometryToFile(const char *filename) const
+{
+	MeshFileHeader header;
+	std::strncpy(header.name, modelName_.c_str(), sizeof(header.name) - 1);
+	header.numVertices   = static_cast<uint32_t>(numVertices_);
+	header.numIndices    = static_cast<uint32_t>(numIndices_);
+	header.hasTexCoords  = hasTexCoords_ ? 1 : 0;
+	header.hasNormals    = hasNormals_ ? 1 : 0;
+	header.hasMassInfo   = mass_ > 0.0f ? 1 : 0;
+	header.bsphere       = bsphere_;
+	header.bsphereOffset = bsphereOffset_;
+	header.aabb          = aabb_;
+	header.aabbOffset    = aabbOffset_;
+	header.obb           = obb_;
+	header.obbOffset     = obbOffset_;
+	header.centerMass    = centerMass_;
+	header.mass          = mass_;
+	header.inertiaTensor = inertiaTensor_;
+
+	return WriteMeshFile(filename, header, vertices_, indices_);
+}
+
+bool Model::LoadSourceFile(const char *filename, fileio::MappedFile& source)
+{
+	if (IsMeshFile(filename))
+		return LoadMeshFile(source.GetData(), source.GetSize());
+
+	source.Close();
+	return LoadXMLFile(filename);
+}
+
+bool Model::LoadMeshFile(const char *data, size_t size)
+{
+	const MeshFileHeader *header = GetMeshFileHeader(data, size);
+	if (!header)
+	{
+		std::fprintf(stdout, "Model::LoadMeshFile: Invalid or outdated mesh file\n");
+		return false;
+	}
+
+	const char *nameEnd = static_cast<const char*>(std::memchr(header->name, '\0', sizeof(header->name)));
+	modelName_.assign(header->name, nameEnd ? nameEnd : header->name + sizeof(header->name));
+
+	// Geometry arrays are stored as laid out in memory, copy them straight out
+	numVertices_ = header->numVertices;
+	numIndices_  = header->numIndices;
+	if (vertices_) delete[] vertices_;
+	vertices_ = new bbk::Vertex[numVertices_];
+	if (indices_) delete[] indices_;
+	indices_ = new unsigned[numIndices_];
+
+	const char *vertData = data + sizeof(MeshFileHeader);
+	std::memcpy(vertices_, vertData, numVertices_ * sizeof(Vertex));
+	std::memcpy(indices_, vertData + numVertices_ * sizeof(Vertex), numIndices_ * sizeof(unsigned));
+	hasTexCoords_ = header->hasTexCoords != 0;
+	hasNormals_   = header->hasNormals != 0;
+
+	bsphere_       = header->bsphere;
+	bsphereOffset_ = header->bsphereOffset;
+	aabb_          = header->aabb;
+	aabbOffset_    = header->aabbOffset;
+	obb_           = header->obb;
+	obbOffset_     = header->obbOffset;
+	if (header->hasMassInfo)
+	{
+		centerMass_    = header->centerMass;
+		mass_          = header->mass;
+		inertiaTensor_ = header->inertiaTensor;
+	}
+	return true;
 }
 
-bool Model::LoadGeometryFromFile(const char *filename)
+bool Model::LoadXMLFile(const char *filename)
 {
 	xmlElement *pRoot = bbk::fileio::ReadFile(filename);
 	if (!pRoot) return false;
@@ -46,14 +251,12 @@ bool Model::LoadGeometryFromFile(const char *filename)
 		// Positions
 		xmlElement *pos = mesh->GetChildElem("Positions");
 		{
-			std::vector<std::string> posvec(3 * numVertices_);
-			posvec = bbk::utils::SplitStrToWords(pos->GetContent_str(), ' ');
-
+			const char *str = pos->GetContent_str().c_str();
 			for (size_t i = 0; i < numVertices_; ++i)
 			{
-				vertices_[i].pos.x = static_cast<float>(std::atof(posvec[3 * i].c_str()));
-				vertices_[i].pos.y = static_cast<float>(std::atof(posvec[3 * i + 1].c_str()));
-				vertices_[i].pos.z = static_cast<float>(std::atof(posvec[3 * i + 2].c_str()));
+				bbk::utils::ParseFloat(str, vertices_[i].pos.x);
+				bbk::utils::ParseFloat(str, vertices_[i].pos.y);
+				bbk::utils::ParseFloat(str, vertices_[i].pos.z);
 				indices_[i] = i;
 			}
 		}
@@ -64,13 +267,11 @@ bool Model::LoadGeometryFromFile(const char *filename)
 		{
 			hasTexCoords_ = true;
 
-			std::vector<std::string> tcvec(2 * numVertices_);
-			tcvec = bbk::utils::SplitStrToWords(tc->GetContent_str(), ' ');
-
+			const char *str = tc->GetContent_str().c_str();
 			for (size_t i = 0; i < numVertices_; ++i)
 			{
-				vertices_[i].tc[0] = static_cast<float>(std::atof(tcvec[2 * i].c_str()));
-				vertices_[i].tc[1] = static_cast<float>(std::atof(tcvec[2 * i + 1].c_str()));
+				bbk::utils::ParseFloat(str, vertices_[i].tc[0]);
+				bbk::utils::ParseFloat(str, vertices_[i].tc[1]);
 			}
 		}
 
@@ -80,14 +281,12 @@ bool Model::LoadGeometryFromFile(const char *filename)
 		{
 			hasNormals_ = true;
 
-			std::vector<std::string> nrmvec(3 * numVertices_);
-			nrmvec = bbk::utils::SplitStrToWords(nrm->GetContent_str(), ' ');
-
+			const char *str = nrm->GetContent_str().c_str();
 			for (size_t i = 0; i < numVertices_; ++i)
 			{
-				vertices_[i].nrm.x = static_cast<float>(std::atof(nrmvec[3 * i].c_str()));
-				vertices_[i].nrm.y = static_cast<float>(std::atof(nrmvec[3 * i + 1].c_str()));
-				vertices_[i].nrm.z = static_cast<float>(std::atof(nrmvec[3 * i + 2].c_str()));
+				bbk::utils::ParseFloat(str, vertices_[i].nrm.x);
+				bbk::utils::ParseFloat(str, vertices_[i].nrm.y);
+				bbk::utils::ParseFloat(str, vertices_[i].nrm.z);
 			}
 		}
 
@@ -95,12 +294,8 @@ bool Model::LoadGeometryFromFile(const char *filename)
 		xmlElement *ind = mesh->GetChildElem("Indices");
 		if (ind)
 		{
-			std::vector<std::string> indvec(numIndices_);
-			indvec = bbk::utils::SplitStrToWords(ind->GetContent_str(), ' ');
-			for (size_t i = 0; i < numIndices_; ++i)
-			{
-				indices_[i] = static_cast<unsigned>(std::atoi(indvec[i].c_str()));
-			}
+			const char *str = ind->GetContent_str().c_str();
+			bbk::utils::ParseUnsigneds(str, indices_, numIndices_);
 		}
 	}
 
@@ -189,16 +384,183 @@ bool Model::LoadGeometryFromFile(const char *filename)
 		}
 	}
 
-	// Create array of points for BVH construction
+	delete pRoot;
+	return true;
+}
+
+bool Model::LoadCache(const char *cacheFilename, uint64_t sourceHash, BVHBuildScheme bvhScheme, unsigned bvhLeafTris)
+{
+	fileio::MappedFile cache;
+	if (!cache.Open(cacheFilename) || cache.GetSize() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	std::memcpy(&header, cache.GetData(), sizeof(CacheHeader));
+	if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) ||
+		header.version     != CacheVersion                        ||
+		header.sourceHash  != sourceHash                          ||
+		header.bvhScheme   != static_cast<uint32_t>(bvhScheme)    ||
+		header.bvhLeafTris != bvhLeafTris                         ||
+		header.vertexSize  != sizeof(Vertex)                      ||
+		header.nodeSize    != sizeof(BVHNode)                     ||
+		header.vertSize    != sizeof(Vector3)                       )
+		return false;
+
+	// Summed in 64 bits, as a corrupt header's counts could wrap a 32-bit size_t
+	const uint64_t vertexBytes   = static_cast<uint64_t>(header.numVertices) * sizeof(Vertex);
+	const uint64_t indexBytes    = static_cast<uint64_t>(header.numIndices) * sizeof(unsigned);
+	const uint64_t nodesBytes    = static_cast<uint64_t>(header.numNodes) * sizeof(BVHNode);
+	const uint64_t triIndexBytes = static_cast<uint64_t>(header.numTris) * sizeof(unsigned);
+	const uint64_t triVertsBytes = static_cast<uint64_t>(header.numTris) * 3 * sizeof(Vector3);
+	if (cache.GetSize() != sizeof(CacheHeader) + vertexBytes + indexBytes + nodesBytes + triIndexBytes + triVertsBytes)
+	{
+		std::fprintf(stdout, "Model::LoadCache: Size mismatch in %s, rebuilding\n", cacheFilename);
+		return false;
+	}
+
+	const char     *data       = cache.GetData() + sizeof(CacheHeader);
+	const Vertex   *vertices   = reinterpret_cast<const Vertex*>(data);
+	const unsigned *indices    = reinterpret_cast<const unsigned*>(data + vertexBytes);
+	const BVHNode  *nodes      = reinterpret_cast<const BVHNode*>(data + vertexBytes + indexBytes);
+	const unsigned *triIndices = reinterpret_cast<const unsigned*>(data + vertexBytes + indexBytes + nodesBytes);
+	const Vector3  *triVerts   = reinterpret_cast<const Vector3*>(data + vertexBytes + indexBytes + nodesBytes + triIndexBytes);
+
+	// Checked before anything is applied, so a bad cache leaves the model untouched
+	bool bValid = ::IsValidBVH(nodes, header.numNodes, triIndices, header.numTris);
+	for (uint32_t i = 0; bValid && i < header.numIndices; ++i)
+		bValid = indices[i] < header.numVertices;
+	if (!bValid)
 	{
-		Vector3* verts = new Vector3[numIndices_];
-		for (size_t i = 0; i < numIndices_; ++i)
-			verts[i] = vertices_[indices_[i]].pos;
-		bvhroot_ = BuildBVH(verts, numIndices_);
-		delete[] verts;
+		std::fprintf(stdout, "Model::LoadCache: Index out of range in %s, rebuilding\n", cacheFilename);
+		return false;
 	}
 
-	delete pRoot;
+	const char *name    = header.name;
+	const char *nameEnd = static_cast<const char*>(std::memchr(name, '\0', sizeof(header.name)));
+	modelName_.assign(name, nameEnd ? nameEnd : name + sizeof(header.name));
+
+	numVertices_ = header.numVertices;
+	numIndices_  = header.numIndices;
+	if (vertices_) delete[] vertices_;
+	vertices_ = new bbk::Vertex[numVertices_];
+	if (indices_) delete[] indices_;
+	indices_ = new unsigned[numIndices_];
+	std::memcpy(vertices_, vertices, numVertices_ * sizeof(Vertex));
+	std::memcpy(indices_, indices, numIndices_ * sizeof(unsigned));
+	hasTexCoords_ = header.hasTexCoords != 0;
+	hasNormals_   = header.hasNormals != 0;
+
+	bsphere_       = header.bsphere;
+	bsphereOffset_ = header.bsphereOffset;
+	aabb_          = header.aabb;
+	aabbOffset_    = header.aabbOffset;
+	obb_           = header.obb;
+	obbOffset_     = header.obbOffset;
+	centerMass_    = header.centerMass;
+	mass_          = header.mass;
+	inertiaTensor_ = header.inertiaTensor;
+
+	if (bvh_)
+		delete bvh_;
+	bvh_ = nullptr;
+	if (header.numNodes)
+	{
+		bvh_ = new BVH;
+		bvh_->nodes.assign(nodes, nodes + header.numNodes);
+		bvh_->triIndices.assign(triIndices, triIndices + header.numTris);
+		bvh_->triVerts.assign(triVerts, triVerts + header.numTris * 3);
+		bvh_->UpdateDepth();
+	}
 	return true;
 }
+
+void Model::WriteCache(const char *cacheFilename, uint64_t sourceHash, BVHBuildScheme bvhScheme, unsigned bvhLeafTris) const
+{
+	std::FILE *file = std::fopen(cacheFilename, "wb");
+	if (!file)
+	{
+		std::fprintf(stdout, "Model::WriteCache: Failed to open %s for writing\n", cacheFilename);
+		return;
+	}
+
+	// Zeroed so padding is the same in every cache built from the same source
+	CacheHeader header;
+	std::memset(&header, 0, sizeof(CacheHeader));
+	std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version       = CacheVersion;
+	header.sourceHash    = sourceHash;
+	header.bvhScheme     = static_cast<uint32_t>(bvhScheme);
+	header.bvhLeafTris   = bvhLeafTris;
+	std::strncpy(header.name, modelName_.c_str(), sizeof(header.name) - 1);
+	header.numVertices   = static_cast<uint32_t>(numVertices_);
+	header.numIndices    = static_cast<uint32_t>(numIndices_);
+	header.numNodes      = bvh_ ? static_cast<uint32_t>(bvh_->nodes.size()) : 0;
+	header.numTris       = bvh_ ? static_cast<uint32_t>(bvh_->triIndices.size()) : 0;
+	header.vertexSize    = sizeof(Vertex);
+	header.nodeSize      = sizeof(BVHNode);
+	header.vertSize      = sizeof(Vector3);
+	header.hasTexCoords  = hasTexCoords_ ? 1 : 0;
+	header.hasNormals    = hasNormals_ ? 1 : 0;
+	header.bsphere       = bsphere_;
+	header.bsphereOffset = bsphereOffset_;
+	header.aabb          = aabb_;
+	header.aabbOffset    = aabbOffset_;
+	header.obb           = obb_;
+	header.obbOffset     = obbOffset_;
+	header.centerMass    = centerMass_;
+	header.mass          = mass_;
+	header.inertiaTensor = inertiaTensor_;
+
+	std::fwrite(&header, sizeof(CacheHeader), 1, file);
+	if (header.numVertices)
+		std::fwrite(vertices_, sizeof(Vertex), header.numVertices, file);
+	if (header.numIndices)
+		std::fwrite(indices_, sizeof(unsigned), header.numIndices, file);
+	if (header.numNodes)
+	{
+		std::fwrite(&bvh_->nodes[0], sizeof(BVHNode), header.numNodes, file);
+		std::fwrite(&bvh_->triIndices[0], sizeof(unsigned), header.numTris, file);
+		std::fwrite(&bvh_->triVerts[0], sizeof(Vector3), header.numTris * 3, file);
+	}
+	std::fclose(file);
+}
 } // namespace bbk
+
+namespace
+{
+bool IsValidBVH(const bbk::BVHNode *nodes, uint32_t numNodes, const unsigned *triIndices, uint32_t numTris)
+{
+	for (uint32_t i = 0; i < numTris; ++i)
+	{
+		if (triIndices[i] >= numTris)
+			return false;
+	}
+
+	// Walk the tree as traversals do, expecting to meet nodes in array order;
+	// this rejects cycles, shared subtrees and children out of range
+	std::vector<uint32_t> stack;
+	uint32_t next = 0;
+	if (numNodes)
+		stack.push_back(0);
+	while (!stack.empty())
+	{
+		const uint32_t index = stack.back();
+		stack.pop_back();
+		if (index != next++)
+			return false;
+
+		const bbk::BVHNode &node = nodes[index];
+		if (node.IsLeaf())
+		{
+			if (node.firstTri > numTris || node.numTris > numTris - node.firstTri)
+				return false;
+			continue;
+		}
+		if (node.rightChild <= index + 1 || node.rightChild >= numNodes)
+			return false;
+		stack.push_back(node.rightChild);
+		stack.push_back(index + 1);
+	}
+	return next == numNodes;
+}
+} // anon namespace
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <xmmintrin.h>
+#include "occlusion.h"
+
+namespace
+{
+const float MinClipW = 1e-4f; ///< Vertices with smaller clip w are at or behind the eye
+
+/// Transforms p by column-major 4x4 matrix m
+inline void TransformPoint(const float *m, float x, float y, float z, float out[4])
+{
+	out[0] = m[0] * x + m[4] * y + m[8]  * z + m[12];
+	out[1] = m[1] * x + m[5] * y + m[9]  * z + m[13];
+	out[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+	out[3] = m[3] * x + m[7] * y + m[11] * z + m[15];
+}
+
+/// Whether a clip space point is nearer than the near plane, or at or behind the eye
+inline bool IsNearClipped(const float clip[4])
+{
+	return clip[3] < ::MinClipW || clip[2] < -clip[3];
+}
+} // anon namespace
+
+namespace bbk
+{
+OcclusionBuffer::OcclusionBuffer(unsigned width, unsigned height) :
+	width_((std::max(width, 4u) + 3) & ~3u),
+	height_(std::max(height, 1u)),
+	depth_(width_ * height_, 1.0f),
+	numTrisRasterized_(0)
+{
+	// Mip chain down to 1x1
+	unsigned w = width_, h = height_, offset = 0;
+	for (;;)
+	{
+		levelOffset_.push_back(offset);
+		levelWidth_.push_back(w);
+		levelHeight_.push_back(h);
+		offset += w * h;
+		if (w == 1 && h == 1)
+			break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	hiZ_.resize(offset, 1.0f);
+}
+
+void OcclusionBuffer::Clear()
+{
+	std::fill(depth_.begin(), depth_.end(), 1.0f);
+	numTrisRasterized_ = 0;
+}
+
+void OcclusionBuffer::RasterizeOccluder(const Matrix4x4& modelToWorld, const Vertex *vertices, const unsigned *indices, size_t numIndices)
+{
+	const Matrix4x4 modelToClip(viewProj_ * modelToWorld);
+	const float     halfW = 0.5f * width_;
+	const float     halfH = 0.5f * height_;
+
+	for (size_t t = 0; t + 2 < numIndices; t += 3)
+	{
+		// Project to screen, skipping triangles that reach past the near plane
+		float sx[3], sy[3], sz[3];
+		bool  bClipped = false;
+		for (int v = 0; v < 3; ++v)
+		{
+			const Point3 &pos = vertices[indices[t + v]].pos;
+			float clip[4];
+			::TransformPoint(modelToClip.elements, pos.x, pos.y, pos.z, clip);
+			if (::IsNearClipped(clip))
+			{
+				bClipped = true;
+				break;
+			}
+			const float invW = 1.0f / clip[3];
+			sx[v] = (clip[0] * invW + 1.0f) * halfW;
+			sy[v] = (clip[1] * invW + 1.0f) * halfH;
+			sz[v] = clip[2] * invW;
+		}
+		if (bClipped)
+			continue;
+
+		// Occluders are drawn double sided, so orient every triangle counter-clockwise
+		float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+		if (area < 0.0f)
+		{
+			std::swap(sx[1], sx[2]);
+			std::swap(sy[1], sy[2]);
+			std::swap(sz[1], sz[2]);
+			area = -area;
+		}
+		if (area < 1e-6f)
+			continue;
+
+		// Bounds in pixels, x aligned to 4 for the SIMD loop
+		const float fMinX = std::min(sx[0], std::min(sx[1], sx[2])), fMaxX = std::max(sx[0], std::max(sx[1], sx[2]));
+		const float fMinY = std::min(sy[0], std::min(sy[1], sy[2])), fMaxY = std::max(sy[0], std::max(sy[1], sy[2]));
+		if (fMaxX < 0.0f || fMaxY < 0.0f || fMinX >= width_ || fMinY >= height_)
+			continue;
+		const int minX = static_cast<int>(std::max(fMinX, 0.0f)) & ~3;
+		const int maxX = static_cast<int>(std::min(fMaxX, width_ - 1.0f));
+		const int minY = static_cast<int>(std::max(fMinY, 0.0f));
+		const int maxY = static_cast<int>(std::min(fMaxY, height_ - 1.0f));
+		++numTrisRasterized_;
+
+		// Edge i is opposite vertex i; its function is vertex i's barycentric weight times area
+		float edgeA[3], edgeB[3], edgeC[3];
+		for (int e = 0; e < 3; ++e)
+		{
+			const int v0 = (e + 1) % 3, v1 = (e + 2) % 3;
+			edgeA[e] = sy[v0] - sy[v1];
+			edgeB[e] = sx[v1] - sx[v0];
+			edgeC[e] = sx[v0] * sy[v1] - sx[v1] * sy[v0];
+		}
+
+		// Depth as a plane over screen position
+		const float invArea = 1.0f / area;
+		const float dzdx    = (edgeA[1] * (sz[1] - sz[0]) + edgeA[2] * (sz[2] - sz[0])) * invArea;
+		const float dzdy    = (edgeB[1] * (sz[1] - sz[0]) + edgeB[2] * (sz[2] - sz[0])) * invArea;
+		const float z00     = sz[0] + (edgeC[1] * (sz[1] - sz[0]) + edgeC[2] * (sz[2] - sz[0])) * invArea;
+
+		const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero        = _mm_setzero_ps();
+		__m128 stepE[3];
+		for (int e = 0; e < 3; ++e)
+			stepE[e] = _mm_set1_ps(4.0f * edgeA[e]);
+		const __m128 stepZ = _mm_set1_ps(4.0f * dzdx);
+
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float  py = y + 0.5f;
+			const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(minX)), laneOffsets);
+
+			__m128 e[3];
+			for (int i = 0; i < 3; ++i)
+				e[i] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[i]), px), _mm_set1_ps(edgeB[i] * py + edgeC[i]));
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), _mm_set1_ps(dzdy * py + z00));
+
+			float *row = &depth_[y * width_];
+			for (int x = minX; x <= maxX; x += 4)
+			{
+				const __m128 inside = _mm_and_ps(
+					_mm_and_ps(_mm_cmpge_ps(e[0], zero), _mm_cmpge_ps(e[1], zero)),
+					_mm_cmpge_ps(e[2], zero));
+				if (_mm_movemask_ps(inside))
+				{
+					const __m128 old = _mm_loadu_ps(row + x);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, z)), _mm_andnot_ps(inside, old)));
+				}
+				for (int i = 0; i < 3; ++i)
+					e[i] = _mm_add_ps(e[i], stepE[i]);
+				z = _mm_add_ps(z, stepZ);
+			}
+		}
+	}
+}
+
+void OcclusionBuffer::BuildHiZ()
+{
+	std::copy(depth_.begin(), depth_.end(), hiZ_.begin());
+
+	for (size_t level = 1; level < levelOffset_.size(); ++level)
+	{
+		const float   *src  = &hiZ_[levelOffset_[level - 1]];
+		float         *dst  = &hiZ_[levelOffset_[level]];
+		const unsigned srcW = levelWidth_[level - 1], srcH = levelHeight_[level - 1];
+		const unsigned dstW = levelWidth_[level],     dstH = levelHeight_[level];
+
+		for (unsigned y = 0; y < dstH; ++y)
+		{
+			const unsigned y0 = 2 * y, y1 = std::min(2 * y + 1, srcH - 1);
+			for (unsigned x = 0; x < dstW; ++x)
+			{
+				const unsigned x0 = 2 * x, x1 = std::min(2 * x + 1, srcW - 1);
+				dst[y * dstW + x] = std::max(
+					std::max(src[y0 * srcW + x0], src[y0 * srcW + x1]),
+					std::max(src[y1 * srcW + x0], src[y1 * srcW + x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsOccluded(const AABB& aabb) const
+{
+	Vector3 corners[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		corners[i] = Vector3(
+			aabb.center.x + (i & 1 ? aabb.diag.x : -aabb.diag.x),
+			aabb.center.y + (i & 2 ? aabb.diag.y : -aabb.diag.y),
+			aabb.center.z + (i & 4 ? aabb.diag.z : -aabb.diag.z));
+	}
+	return IsOccluded(corners);
+}
+
+bool OcclusionBuffer::IsOccluded(const OBB& obb) const
+{
+	const Vector3 u(obb.u * obb.halfExtents.x);
+	const Vector3 v(obb.v * obb.halfExtents.y);
+	const Vector3 w(obb.w * obb.halfExtents.z);
+
+	Vector3 corners[8];
+	for (int i = 0; i < 8; ++i)
+		corners[i] = obb.center + (i & 1 ? u : -u) + (i & 2 ? v : -v) + (i & 4 ? w : -w);
+	return IsOccluded(corners);
+}
+
+bool OcclusionBuffer::IsOccluded(const Vector3 corners[8]) const
+{
+	// Screen rectangle and nearest depth of box
+	float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+	for (int i = 0; i < 8; ++i)
+	{
+		float clip[4];
+		::TransformPoint(viewProj_.elements, corners[i].x, corners[i].y, corners[i].z, clip);
+		if (::IsNearClipped(clip))
+			return false;
+
+		const float invW = 1.0f / clip[3];
+		const float x    = (clip[0] * invW + 1.0f) * 0.5f * width_;
+		const float y    = (clip[1] * invW + 1.0f) * 0.5f * height_;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip[2] * invW);
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width_ || minY >= height_)
+		return false; // Off screen; left to frustum culling
+
+	const int x0 = static_cast<int>(std::max(minX, 0.0f));
+	const int y0 = static_cast<int>(std::max(minY, 0.0f));
+	const int x1 = static_cast<int>(std::min(maxX, width_  - 1.0f));
+	const int y1 = static_cast<int>(std::min(maxY, height_ - 1.0f));
+
+	// Coarsest level where the rectangle spans at most 2 texels per axis
+	size_t level = 0;
+	while (level + 1 < levelOffset_.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		++level;
+
+	const float   *hiZ = &hiZ_[levelOffset_[level]];
+	const unsigned lw  = levelWidth_[level];
+	for (int y = y0 >> level; y <= (y1 >> level); ++y)
+	{
+		for (int x = x0 >> level; x <= (x1 >> level); ++x)
+		{
+			if (hiZ[y * lw + x] >= minZ)
+				return false;
+		}
+	}
+	return true;
+}
+} // namespace bbk
@@ -1,3 +1,5 @@
+#include <cstdio>
+#include <vector>
 #include "resources/mesh.h"
 #include "math/mathlib.h"
 #include "fileio/fileio.h"
@@ -14,6 +16,14 @@ void EigenSolver(const bbk::Matrix3x3 &mtx, float evalues[3], bbk::Vector3 evect
 
 bbk::Tuple<bbk::Vector3, 3> GenerateEigenValues(const bbk::Matrix3x3 &mtx);
 double eigen[3];
+
+/// Skips over count floats of an accessor whose stride exceeds the components read
+inline void SkipFloats(const char *&str, unsigned count)
+{
+	float unused;
+	for (unsigned i = 0; i < count; ++i)
+		bbk::utils::ParseFloat(str, unused);
+}
 } // anon namespace
 
 namespace bbk
@@ -89,17 +99,23 @@ bool Mesh::LoadMeshFromFile(const char *filename)
 	//--------------------------------------------------------------------------
 	// Convert positions source node float array into array of Point3
 	unsigned numPositions = pSrcPosNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("count")->GetValue_int();
+	unsigned posStride    = pSrcPosNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+	if (posStride < 3)
+	{
+		std::fprintf(stdout, "Mesh::LoadMeshFromFile: %s positions stride %u is below 3\n", filename, posStride);
+		delete pRoot;
+		return false;
+	}
 	Point3  *positions    = new Point3[numPositions];
 	{
-		// Tokenise long string of floats into individual floats in string format
-		std::vector<std::string> pos_floatarray(bbk::utils::SplitStrToWords(pSrcPosNode->GetChildElem("float_array")->GetContent_str(), ' '));
-		// Save floats into points array
-		unsigned stride = pSrcPosNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+		// Parse floats straight out of float array content into points array
+		const char *str = pSrcPosNode->GetChildElem("float_array")->GetContent_str().c_str();
 		for (size_t i = 0; i < numPositions; ++i)
 		{
-			positions[i].x = static_cast<float>(std::atof(pos_floatarray[stride * i    ].c_str()));
-			positions[i].y = static_cast<float>(std::atof(pos_floatarray[stride * i + 1].c_str()));
-			positions[i].z = static_cast<float>(std::atof(pos_floatarray[stride * i + 2].c_str()));
+			bbk::utils::ParseFloat(str, positions[i].x);
+			bbk::utils::ParseFloat(str, positions[i].y);
+			bbk::utils::ParseFloat(str, positions[i].z);
+			::SkipFloats(str, posStride - 3);
 
 			if (!y_up)
 			{
@@ -155,20 +171,29 @@ bool Mesh::LoadMeshFromFile(const char *filename)
 
 			if (pSrcTCNode)
 			{
+				unsigned    stride = pSrcTCNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+				if (stride < 2)
+				{
+					std::fprintf(stdout, "Mesh::LoadMeshFromFile: %s texcoords stride %u is below 2\n", filename, stride);
+					delete[] positions;
+					delete pRoot;
+					return false;
+				}
+
 				hasTexCoords_ = true;
 				//--------------------------------------------------------------------------
 				// Convert texcoords source node float array into array of texcoords
 				numTexCoords = pSrcTCNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("count")->GetValue_int();
 				texcoords    = new Tuple<float, 2>[numTexCoords];
 				{
-					// Tokenise long string of floats into individual floats in string format
-					std::vector<std::string> tc_floatarray(bbk::utils::SplitStrToWords(pSrcTCNode->GetChildElem("float_array")->GetContent_str(), ' '));
-					// Save floats into texcoords array
-					unsigned stride = pSrcTCNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+					// Parse floats straight out of float array content into texcoords array
+					const char *str    = pSrcTCNode->GetChildElem("float_array")->GetContent_str().c_str();
 					for (size_t i = 0; i < numTexCoords; ++i)
 					{
-						texcoords[i][0] =  static_cast<float>(std::atof(tc_floatarray[stride * i    ].c_str()));
-						texcoords[i][1] = -static_cast<float>(std::atof(tc_floatarray[stride * i + 1].c_str()));
+						bbk::utils::ParseFloat(str, texcoords[i][0]);
+						bbk::utils::ParseFloat(str, texcoords[i][1]);
+						texcoords[i][1] = -texcoords[i][1];
+						::SkipFloats(str, stride - 2);
 					}
 				}
 			}
@@ -228,21 +253,31 @@ bool Mesh::LoadMeshFromFile(const char *filename)
 
 			if (pSrcNrmNode)
 			{
+				unsigned    stride = pSrcNrmNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+				if (stride < 3)
+				{
+					std::fprintf(stdout, "Mesh::LoadMeshFromFile: %s normals stride %u is below 3\n", filename, stride);
+					delete[] positions;
+					if (texcoords)
+						delete[] texcoords;
+					delete pRoot;
+					return false;
+				}
+
 				hasNormals_ = true;
 				//--------------------------------------------------------------------------
 				// Convert normals source node float array into array of normals
 				numNormals = pSrcNrmNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("count")->GetValue_int();
 				normals    = new Vector3[numNormals];
 				{
-					// Tokenise long string of floats into individual floats in string format
-					std::vector<std::string> nrm_floatarray(bbk::utils::SplitStrToWords(pSrcNrmNode->GetChildElem("float_array")->GetContent_str(), ' '));
-					// Save floats into normals array
-					unsigned stride = pSrcNrmNode->GetChildElem("technique_common")->GetChildElem("accessor")->GetAttrib("stride")->GetValue_int();
+					// Parse floats straight out of float array content into normals array
+					const char *str    = pSrcNrmNode->GetChildElem("float_array")->GetContent_str().c_str();
 					for (size_t i = 0; i < numNormals; ++i)
 					{
-						normals[i].x = static_cast<float>(std::atof(nrm_floatarray[stride * i    ].c_str()));
-						normals[i].y = static_cast<float>(std::atof(nrm_floatarray[stride * i + 1].c_str()));
-						normals[i].z = static_cast<float>(std::atof(nrm_floatarray[stride * i + 2].c_str()));
+						bbk::utils::ParseFloat(str, normals[i].x);
+						bbk::utils::ParseFloat(str, normals[i].y);
+						bbk::utils::ParseFloat(str, normals[i].z);
+						::SkipFloats(str, stride - 3);
 
 						if (!y_up)
 						{
@@ -290,32 +325,35 @@ bool Mesh::LoadMeshFromFile(const char *filename)
 
 	for (size_t posSemLen = sizeof ("VERTEX"), tcSemLen = sizeof("TEXCOORD"), nrmSemLen = sizeof("NORMAL"); it != it_end; ++it)
 	{
+		// Each vertex has one index per distinct offset, including those of inputs
+		// this loader ignores, e.g. COLOR or a second TEXCOORD set
+		const unsigned offset = (*it)->GetAttrib("offset")->GetValue_int();
+		if (offset >= stride)
+			stride = offset + 1;
+
 		if ((*it)->GetAttrib("semantic")->GetValue_str().compare(0, posSemLen, "VERTEX") == 0)
-			pos_offset = (*it)->GetAttrib("offset")->GetValue_int();
+			pos_offset = offset;
 		else if ((*it)->GetAttrib("semantic")->GetValue_str().compare(0, tcSemLen, "TEXCOORD") == 0)
-		{
-			tc_offset = (*it)->GetAttrib("offset")->GetValue_int();
-			++stride;
-		}
+			tc_offset = offset;
 		else if ((*it)->GetAttrib("semantic")->GetValue_str().compare(0, nrmSemLen, "NORMAL") == 0)
-		{
-			nrm_offset = (*it)->GetAttrib("offset")->GetValue_int();
-			++stride;
-		}
+			nrm_offset = offset;
 	}
 
 	bbk::Vector3 barycenter(0.0f, 0.0f, 0.0f);
-	// Tokenise long string of ints into individual ints in string format
-	std::vector<std::string> index_array(bbk::utils::SplitStrToWords(pTriNode->GetChildElem("p")->GetContent_str(), ' '));
+	// Parse one vertex worth of indices at a time straight out of index content
+	const char *index_str = pTriNode->GetChildElem("p")->GetContent_str().c_str();
+	std::vector<unsigned> index_array(stride, 0);
 	for (size_t i = 0; i < numVertices_; ++i)
 	{
+		bbk::utils::ParseUnsigneds(index_str, &index_array[0], stride);
+
 		vertInd_[i]      = i;
-		vertices_[i].pos = positions[std::atoi(index_array[stride * i + pos_offset].c_str())];
+		vertices_[i].pos = positions[index_array[pos_offset]];
 		vertices_[i].clr = Colour(0.0f, 0.0f, 1.0f, 1.0f);
 		if (hasTexCoords_)
-			vertices_[i].tc = texcoords[std::atoi(index_array[stride * i + tc_offset].c_str())];
+			vertices_[i].tc = texcoords[index_array[tc_offset]];
 		if (hasNormals_)
-			vertices_[i].nrm = normals[std::atoi(index_array[stride * i + nrm_offset].c_str())];
+			vertices_[i].nrm = normals[index_array[nrm_offset]];
 
 		barycenter += vertices_[i].pos;
 	}
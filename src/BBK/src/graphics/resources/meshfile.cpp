@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstring>
+#include "resources/meshfile.h"
+
+namespace
+{
+const char     MeshFileMagic[4] = {'B', 'B', 'K', 'M'};
+const uint32_t MeshFileVersion  = 1;
+const char     MeshFileExt[]    = ".bbkm";
+} // anon namespace
+
+namespace bbk
+{
+MeshFileHeader::MeshFileHeader()
+{
+	// Zeroed whole, so padding is the same in every file written from the same model
+	std::memset(this, 0, sizeof(MeshFileHeader));
+	std::memcpy(magic, ::MeshFileMagic, sizeof(magic));
+	version    = ::MeshFileVersion;
+	vertexSize = sizeof(Vertex);
+}
+
+bool WriteMeshFile(const char *filename, const MeshFileHeader& header, const Vertex *vertices, const unsigned *indices)
+{
+	std::FILE *file = std::fopen(filename, "wb");
+	if (!file)
+	{
+		std::fprintf(stdout, "WriteMeshFile: Failed to open %s for writing\n", filename);
+		return false;
+	}
+
+	bool bSuccess = std::fwrite(&header, sizeof(MeshFileHeader), 1, file) == 1;
+	if (bSuccess && header.numVertices)
+		bSuccess = std::fwrite(vertices, sizeof(Vertex), header.numVertices, file) == header.numVertices;
+	if (bSuccess && header.numIndices)
+		bSuccess = std::fwrite(indices, sizeof(unsigned), header.numIndices, file) == header.numIndices;
+	std::fclose(file);
+
+	if (!bSuccess)
+		std::fprintf(stdout, "WriteMeshFile: Failed to write %s\n", filename);
+	return bSuccess;
+}
+
+const MeshFileHeader* GetMeshFileHeader(const char *data, size_t size)
+{
+	if (!data || size < sizeof(MeshFileHeader))
+		return nullptr;
+
+	const MeshFileHeader *header = reinterpret_cast<const MeshFileHeader*>(data);
+	if (std::memcmp(header->magic, ::MeshFileMagic, sizeof(::MeshFileMagic)) ||
+		header->version    != ::MeshFileVersion ||
+		header->vertexSize != sizeof(Vertex)      )
+		return nullptr;
+
+	// Summed in 64 bits, as a crafted header's counts could wrap a 32-bit size_t
+	const uint64_t vertexBytes = static_cast<uint64_t>(header->numVertices) * sizeof(Vertex);
+	const uint64_t indexBytes  = static_cast<uint64_t>(header->numIndices) * sizeof(unsigned);
+	if (size != sizeof(MeshFileHeader) + vertexBytes + indexBytes)
+		return nullptr;
+
+	const unsigned *indices = reinterpret_cast<const unsigned*>(data + sizeof(MeshFileHeader) + vertexBytes);
+	for (uint32_t i = 0; i < header->numIndices; ++i)
+	{
+		if (indices[i] >= header->numVertices)
+			return nullptr;
+	}
+	return header;
+}
+
+bool IsMeshFile(const char *filename)
+{
+	const size_t len    = std::strlen(filename);
+	const size_t extLen = sizeof(::MeshFileExt) - 1;
+	return len >= extLen && std::strcmp(filename + len - extLen, ::MeshFileExt) == 0;
+}
+} // namespace bbk
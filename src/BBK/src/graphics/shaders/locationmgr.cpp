@@ -1,3 +1,5 @@
+#include <cstdio>
+#include <cstring>
 #include "shaders/locationmgr.h"
 #include "opengl/glew.h"
 
@@ -9,7 +11,7 @@ LocationMgr::LocationMgr() : shadProgHandle_(0)
 
 LocationMgr::~LocationMgr()
 {
-	uni_var_loc_map_.clear();
+	uni_var_id_map_.clear();
 	att_var_loc_map_.clear();
 }
 
@@ -34,7 +36,19 @@ int LocationMgr::AddUniformLocation(const std::string &var)
 		return loc;
 	}
 
-	uni_var_loc_map_.insert(std::pair<std::string, int>(var, loc));
+	// Already registered names keep their ID
+	if (uni_var_id_map_.find(var) != uni_var_id_map_.end())
+		return loc;
+
+	UniformSlot slot;
+	slot.location = loc;
+	slot.type     = E_UNI_UNSET;
+	slot.bDirty   = false;
+	slot.intValue = 0;
+	std::memset(slot.floatValues, 0, sizeof(slot.floatValues));
+
+	uni_var_id_map_.insert(std::pair<std::string, UniformID>(var, uniforms_.size()));
+	uniforms_.push_back(slot);
 	return loc;
 }
 
@@ -46,17 +60,99 @@ int LocationMgr::GetUniformLocHandle(const std::string &var) const
 		return -1;
 	}
 
-	std::map<std::string, int>::const_iterator it = uni_var_loc_map_.find(var);
+	std::map<std::string, UniformID>::const_iterator it = uni_var_id_map_.find(var);
 
-	if (it == uni_var_loc_map_.end())
+	if (it == uni_var_id_map_.end())
 	{
 		std::fprintf(stdout, "LocationMgr::GetUniformLocHandle: %s is not registered with LocationMgr.\n", var.c_str());
 		return -1;
 	}
 
+	return uniforms_[(*it).second].location;
+}
+
+LocationMgr::UniformID LocationMgr::GetUniformID(const std::string &var) const
+{
+	std::map<std::string, UniformID>::const_iterator it = uni_var_id_map_.find(var);
+
+	if (it == uni_var_id_map_.end())
+	{
+		std::fprintf(stdout, "LocationMgr::GetUniformID: %s is not registered with LocationMgr.\n", var.c_str());
+		return INVALID_UNIFORM;
+	}
+
 	return (*it).second;
 }
 
+void LocationMgr::SetUniform(UniformID id, int value)
+{
+	SetShadow(id, E_UNI_INT, value, nullptr, 0);
+}
+
+void LocationMgr::SetUniform(UniformID id, float value)
+{
+	SetShadow(id, E_UNI_FLOAT, 0, &value, 1);
+}
+
+void LocationMgr::SetUniform3fv(UniformID id, const float *values)
+{
+	SetShadow(id, E_UNI_VEC3, 0, values, 3);
+}
+
+void LocationMgr::SetUniform4fv(UniformID id, const float *values)
+{
+	SetShadow(id, E_UNI_VEC4, 0, values, 4);
+}
+
+void LocationMgr::FlushUniforms()
+{
+	for (size_t i = 0, size = dirtyUniforms_.size(); i < size; ++i)
+	{
+		UniformSlot &slot = uniforms_[dirtyUniforms_[i]];
+		switch (slot.type)
+		{
+		case E_UNI_INT:
+			glUniform1i(slot.location, slot.intValue);
+			break;
+		case E_UNI_FLOAT:
+			glUniform1f(slot.location, slot.floatValues[0]);
+			break;
+		case E_UNI_VEC3:
+			glUniform3fv(slot.location, 1, slot.floatValues);
+			break;
+		case E_UNI_VEC4:
+			glUniform4fv(slot.location, 1, slot.floatValues);
+			break;
+		default:
+			break;
+		}
+		slot.bDirty = false;
+	}
+	dirtyUniforms_.clear();
+}
+
+void LocationMgr::SetShadow(UniformID id, UniformType type, int intValue, const float *floatValues, unsigned numFloats)
+{
+	if (id >= uniforms_.size()) // Unregistered uniforms are ignored, like location -1 is by GL
+		return;
+
+	UniformSlot &slot = uniforms_[id];
+	if (slot.type == type && slot.intValue == intValue &&
+		std::memcmp(slot.floatValues, floatValues ? floatValues : slot.floatValues, numFloats * sizeof(float)) == 0)
+		return;
+
+	slot.type     = type;
+	slot.intValue = intValue;
+	if (numFloats)
+		std::memcpy(slot.floatValues, floatValues, numFloats * sizeof(float));
+
+	if (!slot.bDirty)
+	{
+		slot.bDirty = true;
+		dirtyUniforms_.push_back(id);
+	}
+}
+
 int LocationMgr::AddAttributeLocation(const std::string &var)
 {
 	if (shadProgHandle_ == 0)
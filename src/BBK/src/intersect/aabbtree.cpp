@@ -0,0 +1,245 @@
+#include <algorithm>
+#include "aabbtree.h"
+
+namespace
+{
+bbk::AABB Union(const bbk::AABB& a, const bbk::AABB& b)
+{
+	const bbk::Vector3 minA(a.center - a.diag), maxA(a.center + a.diag);
+	const bbk::Vector3 minB(b.center - b.diag), maxB(b.center + b.diag);
+	const bbk::Vector3 minU(std::min(minA.x, minB.x), std::min(minA.y, minB.y), std::min(minA.z, minB.z));
+	const bbk::Vector3 maxU(std::max(maxA.x, maxB.x), std::max(maxA.y, maxB.y), std::max(maxA.z, maxB.z));
+	return bbk::AABB((minU + maxU) * 0.5f, (maxU - minU) * 0.5f);
+}
+
+/// Proportional to surface area, which is all insertion costs need
+float Area(const bbk::AABB& aabb)
+{
+	return aabb.diag.x * aabb.diag.y + aabb.diag.y * aabb.diag.z + aabb.diag.z * aabb.diag.x;
+}
+
+/// True if inner lies within outer and outer is no more than slack larger on any side
+bool FitsWithin(const bbk::AABB& outer, const bbk::AABB& inner, float slack)
+{
+	const bbk::Vector3 lo((outer.center - outer.diag) - (inner.center - inner.diag));
+	const bbk::Vector3 hi((inner.center + inner.diag) - (outer.center + outer.diag));
+	return
+		lo.x <= 0.0f && lo.y <= 0.0f && lo.z <= 0.0f &&
+		hi.x <= 0.0f && hi.y <= 0.0f && hi.z <= 0.0f &&
+		lo.x >= -slack && lo.y >= -slack && lo.z >= -slack &&
+		hi.x >= -slack && hi.y >= -slack && hi.z >= -slack;
+}
+} // anon namespace
+
+namespace bbk
+{
+AABBTree::AABBTree(float margin) :
+	root_(NullNode),
+	freeList_(NullNode),
+	numProxies_(0),
+	margin_(margin)
+{}
+
+int AABBTree::CreateProxy(const AABB& aabb, void *userData)
+{
+	const int proxy = AllocNode();
+	AABBTreeNode &node = nodes_[proxy];
+	node.aabb     = AABB(aabb.center, aabb.diag + Vector3(margin_, margin_, margin_));
+	node.userData = userData;
+
+	InsertLeaf(proxy);
+	++numProxies_;
+	return proxy;
+}
+
+void AABBTree::DestroyProxy(int proxy)
+{
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	--numProxies_;
+}
+
+bool AABBTree::MoveProxy(int proxy, const AABB& aabb)
+{
+	// Enlarged AABB still fits and has not grown stale by shrinking objects
+	if (::FitsWithin(nodes_[proxy].aabb, aabb, 4.0f * margin_))
+		return false;
+
+	RemoveLeaf(proxy);
+	nodes_[proxy].aabb = AABB(aabb.center, aabb.diag + Vector3(margin_, margin_, margin_));
+	InsertLeaf(proxy);
+	return true;
+}
+
+int AABBTree::AllocNode()
+{
+	int node = freeList_;
+	if (node == NullNode)
+	{
+		node = static_cast<int>(nodes_.size());
+		nodes_.push_back(AABBTreeNode());
+	}
+	else
+		freeList_ = nodes_[node].parent;
+
+	AABBTreeNode &newNode = nodes_[node];
+	newNode.userData = nullptr;
+	newNode.parent   = NullNode;
+	newNode.child1   = NullNode;
+	newNode.child2   = NullNode;
+	newNode.height   = 0;
+	newNode.planeInd = 0;
+	return node;
+}
+
+void AABBTree::FreeNode(int node)
+{
+	nodes_[node].parent = freeList_;
+	nodes_[node].height = -1;
+	freeList_ = node;
+}
+
+void AABBTree::InsertLeaf(int leaf)
+{
+	if (root_ == NullNode)
+	{
+		root_ = leaf;
+		nodes_[leaf].parent = NullNode;
+		return;
+	}
+
+	// Descend towards the sibling whose union with leaf adds least area, stopping
+	// when making a new parent here is cheaper than pushing leaf further down
+	const AABB leafAABB = nodes_[leaf].aabb;
+	int index = root_;
+	while (!nodes_[index].IsLeaf())
+	{
+		const AABBTreeNode &node = nodes_[index];
+		const float combinedArea = ::Area(::Union(node.aabb, leafAABB));
+		const float cost         = 2.0f * combinedArea;
+		const float inheritCost  = 2.0f * (combinedArea - ::Area(node.aabb)); // Growth of every ancestor below here
+
+		const AABBTreeNode &child1 = nodes_[node.child1];
+		const AABBTreeNode &child2 = nodes_[node.child2];
+		float cost1 = ::Area(::Union(leafAABB, child1.aabb)) + inheritCost;
+		if (!child1.IsLeaf())
+			cost1 -= ::Area(child1.aabb);
+		float cost2 = ::Area(::Union(leafAABB, child2.aabb)) + inheritCost;
+		if (!child2.IsLeaf())
+			cost2 -= ::Area(child2.aabb);
+
+		if (cost < cost1 && cost < cost2)
+			break;
+		index = cost1 < cost2 ? node.child1 : node.child2;
+	}
+
+	const int sibling   = index;
+	const int oldParent = nodes_[sibling].parent;
+	const int newParent = AllocNode();
+	nodes_[newParent].parent = oldParent;
+	nodes_[newParent].aabb   = ::Union(leafAABB, nodes_[sibling].aabb);
+	nodes_[newParent].height = nodes_[sibling].height + 1;
+	nodes_[newParent].child1 = sibling;
+	nodes_[newParent].child2 = leaf;
+
+	if (oldParent == NullNode)
+		root_ = newParent;
+	else if (nodes_[oldParent].child1 == sibling)
+		nodes_[oldParent].child1 = newParent;
+	else
+		nodes_[oldParent].child2 = newParent;
+	nodes_[sibling].parent = newParent;
+	nodes_[leaf].parent    = newParent;
+
+	Refit(newParent);
+}
+
+void AABBTree::RemoveLeaf(int leaf)
+{
+	if (leaf == root_)
+	{
+		root_ = NullNode;
+		return;
+	}
+
+	const int parent      = nodes_[leaf].parent;
+	const int grandParent = nodes_[parent].parent;
+	const int sibling     = nodes_[parent].child1 == leaf ? nodes_[parent].child2 : nodes_[parent].child1;
+
+	// Sibling takes parent's place
+	nodes_[sibling].parent = grandParent;
+	if (grandParent == NullNode)
+		root_ = sibling;
+	else if (nodes_[grandParent].child1 == parent)
+		nodes_[grandParent].child1 = sibling;
+	else
+		nodes_[grandParent].child2 = sibling;
+	FreeNode(parent);
+
+	Refit(grandParent);
+}
+
+void AABBTree::Refit(int node)
+{
+	while (node != NullNode)
+	{
+		node = Balance(node);
+
+		AABBTreeNode &n = nodes_[node];
+		n.height = 1 + std::max(nodes_[n.child1].height, nodes_[n.child2].height);
+		n.aabb   = ::Union(nodes_[n.child1].aabb, nodes_[n.child2].aabb);
+		node     = n.parent;
+	}
+}
+
+int AABBTree::Balance(int iA)
+{
+	AABBTreeNode &A = nodes_[iA];
+	if (A.IsLeaf() || A.height < 2)
+		return iA;
+
+	const int iB = A.child1;
+	const int iC = A.child2;
+	AABBTreeNode &B = nodes_[iB];
+	AABBTreeNode &C = nodes_[iC];
+	const int balance = C.height - B.height;
+
+	// Rotate the taller child up into A's place; A keeps its other child and
+	// takes the shorter of the taller child's children
+	if (balance > 1 || balance < -1)
+	{
+		const int     iUp     = balance > 1 ? iC : iB;
+		const int     iStay   = balance > 1 ? iB : iC;
+		AABBTreeNode &up      = nodes_[iUp];
+		AABBTreeNode &stay    = nodes_[iStay];
+		const int     iTall   = nodes_[up.child1].height > nodes_[up.child2].height ? up.child1 : up.child2;
+		const int     iShort  = iTall == up.child1 ? up.child2 : up.child1;
+
+		up.parent = A.parent;
+		if (up.parent == NullNode)
+			root_ = iUp;
+		else if (nodes_[up.parent].child1 == iA)
+			nodes_[up.parent].child1 = iUp;
+		else
+			nodes_[up.parent].child2 = iUp;
+
+		up.child1 = iA;
+		up.child2 = iTall;
+		A.parent  = iUp;
+
+		if (balance > 1)
+			A.child2 = iShort;
+		else
+			A.child1 = iShort;
+		nodes_[iShort].parent = iA;
+
+		A.aabb    = ::Union(stay.aabb, nodes_[iShort].aabb);
+		A.height  = 1 + std::max(stay.height, nodes_[iShort].height);
+		up.aabb   = ::Union(A.aabb, nodes_[iTall].aabb);
+		up.height = 1 + std::max(A.height, nodes_[iTall].height);
+		return iUp;
+	}
+
+	return iA;
+}
+} // namespace bbk
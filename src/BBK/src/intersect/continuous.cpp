@@ -0,0 +1,169 @@
+#include <cmath>
+#include "intersect.h"
+
+namespace
+{
+const unsigned MaxStackSize = 256;    ///< Nodes held on the call stack; deeper trees use the heap
+const float    MinSweepSq   = 1e-12f; ///< Squared motion or edge length below which a feature is skipped
+
+inline bbk::Point3 TransformPoint(const bbk::Matrix4x4& mtx, const bbk::Point3& p)
+{
+	return bbk::Point3(
+		mtx.elements[12] + mtx.elements[0] * p.x + mtx.elements[4] * p.y + mtx.elements[8]  * p.z,
+		mtx.elements[13] + mtx.elements[1] * p.x + mtx.elements[5] * p.y + mtx.elements[9]  * p.z,
+		mtx.elements[14] + mtx.elements[2] * p.x + mtx.elements[6] * p.y + mtx.elements[10] * p.z);
+}
+
+/// Earliest t up to maxT at which |offset + motion * t| falls to radius. Offsets
+/// already within radius, or moving away, do not count, so resting contacts are
+/// left to the discrete narrow phase.
+bool Approach(const bbk::Vector3& offset, const bbk::Vector3& motion, float radius, float maxT, float& t)
+{
+	const float a = motion.Dot(motion);
+	const float b = offset.Dot(motion);
+	const float c = offset.Dot(offset) - radius * radius;
+	if (a < ::MinSweepSq || b >= 0.0f || c < 0.0f)
+		return false;
+
+	const float disc = b * b - a * c;
+	if (disc < 0.0f)
+		return false;
+	t = (-b - std::sqrt(disc)) / a;
+	return t <= maxT;
+}
+
+/// Earliest fraction of motion, up to maxT, at which a sphere moving from center
+/// touches tri. Normal is unit, from the triangle towards the sphere.
+bool SweptSpherevsTri(const bbk::Point3& center, float radius, const bbk::Vector3& motion, const bbk::Vector3 *tri, float maxT, float& t, bbk::Vector3& normal)
+{
+	// Face first; a contact inside the face comes before any with its edges or vertices
+	const bbk::Vector3 faceNormal((tri[1] - tri[0]).Cross(tri[2] - tri[0]).Normalise());
+	const float dist = faceNormal.Dot(center - tri[0]);
+	if (std::fabs(dist) >= radius)
+	{
+		const bbk::Vector3 side(dist > 0.0f ? faceNormal : -faceNormal);
+		const float speed = side.Dot(motion);
+		if (speed >= 0.0f)
+			return false; // Moving away from the plane, so it never reaches the triangle either
+
+		const float faceT = (std::fabs(dist) - radius) / -speed;
+		if (faceT > maxT)
+			return false;
+
+		const bbk::Point3 contact(center + motion * faceT - side * radius);
+		bool bInside = true;
+		for (int i = 0; i < 3 && bInside; ++i)
+			bInside = (tri[(i + 1) % 3] - tri[i]).Cross(contact - tri[i]).Dot(faceNormal) >= 0.0f;
+		if (bInside)
+		{
+			t      = faceT;
+			normal = side;
+			return true;
+		}
+	}
+
+	// Otherwise the sphere first meets a vertex, or the side of an edge
+	bool bHit = false;
+	for (int i = 0; i < 3; ++i)
+	{
+		const bbk::Vector3 &a = tri[i];
+		const bbk::Vector3  edge(tri[(i + 1) % 3] - a);
+		const bbk::Vector3  offset(center - a);
+		float hitT;
+
+		if (::Approach(offset, motion, radius, maxT, hitT))
+		{
+			maxT   = hitT;
+			normal = (offset + motion * hitT) / radius;
+			bHit   = true;
+		}
+
+		// Parts of offset and motion across the edge's line
+		const float edgeSq = edge.Dot(edge);
+		if (edgeSq < ::MinSweepSq)
+			continue;
+		const bbk::Vector3 offsetAcross(offset - edge * (offset.Dot(edge) / edgeSq));
+		const bbk::Vector3 motionAcross(motion - edge * (motion.Dot(edge) / edgeSq));
+		if (!::Approach(offsetAcross, motionAcross, radius, maxT, hitT))
+			continue;
+
+		const float along = (offset.Dot(edge) + motion.Dot(edge) * hitT) / edgeSq;
+		if (along < 0.0f || along > 1.0f)
+			continue;
+		maxT   = hitT;
+		normal = (offsetAcross + motionAcross * hitT) / radius;
+		bHit   = true;
+	}
+	t = maxT;
+	return bHit;
+}
+} // anon namespace
+
+namespace bbk
+{
+bool SweptSpherevsBVH(const BSphere& sphere, const Vector3& displacement, const BVH& bvh, const Matrix4x4& transform, float& toi, Vector3& normal)
+{
+	if (bvh.nodes.empty())
+		return false;
+
+	// Sweep in the BVH's model frame, so only the sphere is transformed
+	const Matrix4x4 toModel(Matrix4x4::MakeInverse(transform));
+	const float     scale  = Vector3(transform.elements[0], transform.elements[1], transform.elements[2]).Magnitude();
+	const Point3    center(::TransformPoint(toModel, sphere.center));
+	const Vector3   motion(toModel * displacement);
+	const float     radius = sphere.radius / scale;
+
+	// A depth-first walk holds at most one pending sibling per level, plus the node being split
+	unsigned              localStack[::MaxStackSize];
+	std::vector<unsigned> heapStack;
+	unsigned             *stack = localStack;
+	if (bvh.depth + 2 > ::MaxStackSize)
+	{
+		heapStack.resize(bvh.depth + 2);
+		stack = &heapStack[0];
+	}
+	unsigned stackSize = 1;
+	stack[0] = 0;
+
+	bool    bHit = false;
+	float   nearest = 1.0f;
+	Vector3 localNormal;
+	while (stackSize > 0)
+	{
+		const unsigned node = stack[--stackSize];
+
+		// Centre's path against the node grown by the radius, which contains every point the sphere can touch
+		OBB grown(bvh.nodes[node].obb);
+		grown.halfExtents += radius;
+		float intersects[2];
+		if (!LinevsOBB(Line(center, motion), grown, intersects) || intersects[0] > nearest)
+			continue;
+
+		const BVHNode &bvhNode = bvh.nodes[node];
+		if (bvhNode.IsLeaf())
+		{
+			for (unsigned i = bvhNode.firstTri; i < bvhNode.firstTri + bvhNode.numTris; ++i)
+			{
+				float   t;
+				Vector3 triNormal;
+				if (::SweptSpherevsTri(center, radius, motion, bvh.GetTri(i), nearest, t, triNormal))
+				{
+					nearest     = t;
+					localNormal = triNormal;
+					bHit        = true;
+				}
+			}
+			continue;
+		}
+
+		stack[stackSize++] = bvh.GetRightChild(node);
+		stack[stackSize++] = bvh.GetLeftChild(node);
+	}
+
+	if (!bHit)
+		return false;
+	toi    = nearest;
+	normal = (transform * localNormal).Normalise();
+	return true;
+}
+} // namespace bbk
@@ -0,0 +1,238 @@
+#include <xmmintrin.h>
+#include "frustumcull.h"
+
+namespace
+{
+/// Plane equation, either the same plane or one plane per lane
+struct PlaneLanes
+{
+	__m128 nx, ny, nz;
+	__m128 absNx, absNy, absNz;
+	__m128 dist;
+
+	void Set(const bbk::Plane *planes[4]);
+}; // struct PlaneLanes
+
+inline __m128 Abs(__m128 x)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+/// Loads 4 consecutive values, zero filling lanes past count
+inline __m128 Load4(const float *arr, size_t i, size_t count)
+{
+	if (i + 4 <= count)
+		return _mm_loadu_ps(arr + i);
+
+	float tail[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+	for (size_t j = 0; i + j < count; ++j)
+		tail[j] = arr[i + j];
+	return _mm_loadu_ps(tail);
+}
+
+/**
+ * Four bounding volumes of one type. Eval returns, per lane, the signed
+ * distance of the volume's center from a plane and the volume's extent along
+ * the plane normal.
+ */
+struct BSphereLanes
+{
+	__m128 cx, cy, cz, radius;
+
+	void Load(const bbk::BSphereSoA& soa, size_t i, size_t count)
+	{
+		cx     = Load4(soa.centerX, i, count);
+		cy     = Load4(soa.centerY, i, count);
+		cz     = Load4(soa.centerZ, i, count);
+		radius = Load4(soa.radius,  i, count);
+	}
+
+	void Eval(const PlaneLanes& pl, __m128& dist, __m128& extent) const
+	{
+		dist   = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, cx), _mm_mul_ps(pl.ny, cy)), _mm_mul_ps(pl.nz, cz)), pl.dist);
+		extent = radius;
+	}
+
+	/// Same comparison as BSpherevsPlane
+	static __m128 IsInside(__m128 dist, __m128 extent)
+	{
+		return _mm_cmplt_ps(_mm_add_ps(dist, extent), _mm_setzero_ps());
+	}
+}; // struct BSphereLanes
+
+struct AABBLanes
+{
+	__m128 cx, cy, cz;
+	__m128 ex, ey, ez;
+
+	void Load(const bbk::AABBSoA& soa, size_t i, size_t count)
+	{
+		cx = Load4(soa.centerX, i, count);
+		cy = Load4(soa.centerY, i, count);
+		cz = Load4(soa.centerZ, i, count);
+		ex = Load4(soa.diagX,   i, count);
+		ey = Load4(soa.diagY,   i, count);
+		ez = Load4(soa.diagZ,   i, count);
+	}
+
+	void Eval(const PlaneLanes& pl, __m128& dist, __m128& extent) const
+	{
+		dist   = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, cx), _mm_mul_ps(pl.ny, cy)), _mm_mul_ps(pl.nz, cz)), pl.dist);
+		extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.absNx, ex), _mm_mul_ps(pl.absNy, ey)), _mm_mul_ps(pl.absNz, ez));
+	}
+
+	/// Same comparison as AABBvsPlane
+	static __m128 IsInside(__m128 dist, __m128 extent)
+	{
+		return _mm_cmple_ps(_mm_add_ps(dist, extent), _mm_setzero_ps());
+	}
+}; // struct AABBLanes
+
+struct OBBLanes
+{
+	__m128 cx, cy, cz;
+	__m128 ux, uy, uz;
+	__m128 vx, vy, vz;
+	__m128 wx, wy, wz;
+	__m128 hx, hy, hz;
+
+	void Load(const bbk::OBBSoA& soa, size_t i, size_t count)
+	{
+		cx = Load4(soa.centerX, i, count);
+		cy = Load4(soa.centerY, i, count);
+		cz = Load4(soa.centerZ, i, count);
+		ux = Load4(soa.uX,      i, count);
+		uy = Load4(soa.uY,      i, count);
+		uz = Load4(soa.uZ,      i, count);
+		vx = Load4(soa.vX,      i, count);
+		vy = Load4(soa.vY,      i, count);
+		vz = Load4(soa.vZ,      i, count);
+		wx = Load4(soa.wX,      i, count);
+		wy = Load4(soa.wY,      i, count);
+		wz = Load4(soa.wZ,      i, count);
+		hx = Load4(soa.halfX,   i, count);
+		hy = Load4(soa.halfY,   i, count);
+		hz = Load4(soa.halfZ,   i, count);
+	}
+
+	void Eval(const PlaneLanes& pl, __m128& dist, __m128& extent) const
+	{
+		// Extent is the half extents weighted by the normal in box space
+		const __m128 nu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, ux), _mm_mul_ps(pl.ny, uy)), _mm_mul_ps(pl.nz, uz));
+		const __m128 nv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, vx), _mm_mul_ps(pl.ny, vy)), _mm_mul_ps(pl.nz, vz));
+		const __m128 nw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, wx), _mm_mul_ps(pl.ny, wy)), _mm_mul_ps(pl.nz, wz));
+		dist   = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(pl.nx, cx), _mm_mul_ps(pl.ny, cy)), _mm_mul_ps(pl.nz, cz)), pl.dist);
+		extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Abs(nu), hx), _mm_mul_ps(Abs(nv), hy)), _mm_mul_ps(Abs(nw), hz));
+	}
+
+	/// Same comparison as OBBvsPlane
+	static __m128 IsInside(__m128 dist, __m128 extent)
+	{
+		return _mm_cmple_ps(_mm_add_ps(dist, extent), _mm_setzero_ps());
+	}
+}; // struct OBBLanes
+
+void PlaneLanes::Set(const bbk::Plane *planes[4])
+{
+	nx    = _mm_setr_ps(planes[0]->nrm.x, planes[1]->nrm.x, planes[2]->nrm.x, planes[3]->nrm.x);
+	ny    = _mm_setr_ps(planes[0]->nrm.y, planes[1]->nrm.y, planes[2]->nrm.y, planes[3]->nrm.y);
+	nz    = _mm_setr_ps(planes[0]->nrm.z, planes[1]->nrm.z, planes[2]->nrm.z, planes[3]->nrm.z);
+	dist  = _mm_setr_ps(planes[0]->dist,  planes[1]->dist,  planes[2]->dist,  planes[3]->dist);
+	absNx = Abs(nx);
+	absNy = Abs(ny);
+	absNz = Abs(nz);
+}
+
+template <typename Lanes, typename SoA>
+unsigned FrustumCull(const bbk::Frustum& frustum, const SoA& soa, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask)
+{
+	// Same plane order as plane-coherency indices
+	const bbk::Plane *planes[bbk::NUM_FRUSTUM_PLANES] = {
+		&frustum.leftPl, &frustum.rightPl, &frustum.nearPl, &frustum.farPl, &frustum.bottomPl, &frustum.topPl};
+
+	PlaneLanes splatPlanes[bbk::NUM_FRUSTUM_PLANES];
+	for (unsigned p = 0; p < bbk::NUM_FRUSTUM_PLANES; ++p)
+	{
+		const bbk::Plane *splat[4] = {planes[p], planes[p], planes[p], planes[p]};
+		splatPlanes[p].Set(splat);
+	}
+
+	unsigned numPlaneTests = 0;
+	for (size_t i = 0; i < count; i += 4)
+	{
+		const unsigned numLanes = count - i < 4 ? static_cast<unsigned>(count - i) : 4;
+		const int      allLanes = (1 << numLanes) - 1;
+
+		Lanes lanes;
+		lanes.Load(soa, i, count);
+
+		__m128 dist, extent;
+		int outside = 0;       // Lanes outside some plane
+		int inside  = allLanes; // Lanes inside every plane
+
+		// Plane-coherency test against each lane's cached plane; lanes it
+		// rejects keep their index
+		if (bPlaneCoherency)
+		{
+			const bbk::Plane *cached[4] = {planes[0], planes[0], planes[0], planes[0]};
+			for (unsigned j = 0; j < numLanes; ++j)
+				cached[j] = planes[planeInds[i + j]];
+
+			PlaneLanes cachedPlanes;
+			cachedPlanes.Set(cached);
+			lanes.Eval(cachedPlanes, dist, extent);
+			outside = _mm_movemask_ps(_mm_cmpgt_ps(dist, extent)) & allLanes;
+			numPlaneTests += numLanes;
+		}
+
+		for (unsigned p = 0; p < bbk::NUM_FRUSTUM_PLANES && outside != allLanes; ++p)
+		{
+			lanes.Eval(splatPlanes[p], dist, extent);
+			numPlaneTests += numLanes;
+
+			// Cache the first plane rejecting each lane
+			const int rejected = _mm_movemask_ps(_mm_cmpgt_ps(dist, extent)) & allLanes & ~outside;
+			for (unsigned j = 0; j < numLanes; ++j)
+			{
+				if (rejected & (1 << j))
+					planeInds[i + j] = static_cast<uint8_t>(p);
+			}
+			outside |= rejected;
+			inside  &= _mm_movemask_ps(Lanes::IsInside(dist, extent));
+		}
+
+		const uint32_t visible = static_cast<uint32_t>(allLanes & ~outside);
+		const size_t   word    = i / 32;
+		const unsigned shift   = static_cast<unsigned>(i % 32);
+		if (shift == 0)
+			visibleMask[word] = 0;
+		visibleMask[word] |= visible << shift;
+		if (insideMask)
+		{
+			if (shift == 0)
+				insideMask[word] = 0;
+			insideMask[word] |= (visible & static_cast<uint32_t>(inside)) << shift;
+		}
+	}
+
+	return numPlaneTests;
+}
+} // anon namespace
+
+namespace bbk
+{
+unsigned FrustumCullBSpheres(const Frustum& frustum, const BSphereSoA& bspheres, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask)
+{
+	return ::FrustumCull< ::BSphereLanes>(frustum, bspheres, count, bPlaneCoherency, planeInds, visibleMask, insideMask);
+}
+
+unsigned FrustumCullAABBs(const Frustum& frustum, const AABBSoA& aabbs, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask)
+{
+	return ::FrustumCull< ::AABBLanes>(frustum, aabbs, count, bPlaneCoherency, planeInds, visibleMask, insideMask);
+}
+
+unsigned FrustumCullOBBs(const Frustum& frustum, const OBBSoA& obbs, size_t count, bool bPlaneCoherency, uint8_t *planeInds, uint32_t *visibleMask, uint32_t *insideMask)
+{
+	return ::FrustumCull< ::OBBLanes>(frustum, obbs, count, bPlaneCoherency, planeInds, visibleMask, insideMask);
+}
+} // namespace bbk
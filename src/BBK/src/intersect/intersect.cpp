@@ -1,6 +1,8 @@
+#include <algorithm>
 #include "intersect.h"
 #include "graphics/graphics.h"
 #include "graphics/vertex.h"
+#include "platform/jobs.h"
 #include "utils.h"
 
 namespace bbk
@@ -1368,30 +1370,84 @@ OBB FitOBBToVerts(Vector3 *vertices, size_t numVerts)
 	return result;
 }
 
-BVHNode* BuildBVH(Vector3 *vertices, size_t numVerts)
+namespace
 {
-	if (numVerts < 3)
-		return nullptr;
-	
-	if (numVerts == 3) // Build OBB for triangle and return as leaf node
+const unsigned NumSAHBins = 16; ///< Centroid bins per axis for SAH splits
+const unsigned MinParallelBuildTris = 4096; ///< Smaller subtrees are built serially
+
+/// Predicate for partitioning triangles about the mean of their centroids
+struct TriCentroidBelow
+{
+	const Vector3 *verts;
+	const Vector3 *axis;
+	float          mean;
+
+	TriCentroidBelow(const Vector3 *triVerts, const Vector3 *splitAxis, float splitMean) : verts(triVerts), axis(splitAxis), mean(splitMean) {}
+	bool operator()(unsigned tri) const
 	{
-		BVHNode* node = new BVHNode(FitOBBToTri(vertices), nullptr);
-		node->numVerts = numVerts;
-		node->triVerts = new Vector3[numVerts];
-		for (size_t i = 0; i < numVerts; ++i)
-			node->triVerts[i] = vertices[i];
-		return node;
+		const Vector3 *v = verts + tri * 3;
+		return axis->Dot((v[0] + v[1] + v[2])*(1.0f / 3.0f)) < mean;
 	}
+}; // struct TriCentroidBelow
 
-	if (numVerts % 3)
-		return nullptr;
+/// Maps triangles to SAH bins by the projection of their centroids on an axis
+struct TriCentroidBin
+{
+	const Vector3 *verts;
+	const Vector3 *axis;
+	float          minProj;
+	float          binScale;
+	unsigned       splitBin; ///< Bins <= splitBin go left when used as predicate
+
+	TriCentroidBin(const Vector3 *triVerts, const Vector3 *binAxis, float projMin, float projMax) :
+		verts(triVerts), axis(binAxis), minProj(projMin), binScale(static_cast<float>(NumSAHBins) / (projMax - projMin)), splitBin(0) {}
+	unsigned Bin(unsigned tri) const
+	{
+		const Vector3 *v = verts + tri * 3;
+		const unsigned bin = static_cast<unsigned>((axis->Dot((v[0] + v[1] + v[2])*(1.0f / 3.0f)) - minProj) * binScale);
+		return bin < NumSAHBins ? bin : NumSAHBins - 1;
+	}
+	bool operator()(unsigned tri) const {return Bin(tri) <= splitBin;}
+}; // struct TriCentroidBin
 
-	// Build OBB for input vertices
-	OBB currbox(FitOBBToVerts(vertices, numVerts));
+/// Bounds of triangles in a node's OBB frame, for SAH cost evaluation
+struct SAHBin
+{
+	Vector3  min, max;
+	unsigned numTris;
 
-	BVHNode *currnode = new BVHNode(currbox);
+	SAHBin() : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX), numTris(0) {}
+	void Grow(const Vector3& pt)
+	{
+		min.x = pt.x < min.x ? pt.x : min.x; max.x = pt.x > max.x ? pt.x : max.x;
+		min.y = pt.y < min.y ? pt.y : min.y; max.y = pt.y > max.y ? pt.y : max.y;
+		min.z = pt.z < min.z ? pt.z : min.z; max.z = pt.z > max.z ? pt.z : max.z;
+	}
+	void Grow(const SAHBin& bin) {if (bin.numTris) {Grow(bin.min); Grow(bin.max); numTris += bin.numTris;}}
+	float HalfArea() const
+	{
+		if (numTris == 0)
+			return 0.0f;
+		const Vector3 d(max - min);
+		return d.x*d.y + d.y*d.z + d.z*d.x;
+	}
+}; // struct SAHBin
 
-	// Find splitting plane
+/// Parameters shared by every level of a BVH build
+struct BVHBuildParams
+{
+	BVHBuildScheme scheme;
+	unsigned       maxLeafTris;
+	Vector3       *scratch; ///< 3 vertices per triangle in the build
+};
+
+/**
+ * Orders the node's OBB axes by extent and splits triangles about the mean
+ * centroid projection, trying max, mid then min axis until neither side is
+ * empty. Returns the number of triangles moved to the front (left child).
+ */
+unsigned SplitMean(BVH& bvh, unsigned firstTri, unsigned numTris, const OBB& currbox)
+{
 	const Vector3 *maxAxis = &currbox.u;
 	const Vector3 *midAxis = &currbox.v;
 	const Vector3 *minAxis = &currbox.w;
@@ -1445,129 +1501,236 @@ BVHNode* BuildBVH(Vector3 *vertices, size_t numVerts)
 		}
 	}
 
-	std::vector<Vector3*> leftChildren, rightChildren;
-	// Try max axis
+	// Stable so the children see triangles in the same order as the parent
+	unsigned *first = &bvh.triIndices[firstTri];
+	unsigned *last  = first + numTris;
+	const Vector3 *axes[3] = {maxAxis, midAxis, minAxis};
+	unsigned numLeft = 0;
+	for (size_t a = 0; a < 3 && (numLeft == 0 || numLeft == numTris); ++a)
 	{
-		const float onethird = 1.0f / 3.0f;
 		float mean = 0.0f;
-		for (size_t i = 0; i < numVerts; i+=3)
+		for (unsigned i = 0; i < numTris; ++i)
 		{
-			mean += maxAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
+			const Vector3 *tri = bvh.GetTri(firstTri + i);
+			mean += axes[a]->Dot((tri[0] + tri[1] + tri[2])*(1.0f / 3.0f));
 		}
-		mean /= static_cast<float>(numVerts / 3);
-
-		// Sort vertices(grouped into 3's to represent triangles) into +ve or -ve half-spaces
-		for (size_t i = 0; i < numVerts; i+=3)
-		{
-			float baryproj = maxAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
+		mean /= static_cast<float>(numTris);
 
-			if (baryproj < mean)
-			{
-				leftChildren.push_back(vertices + i);
-				leftChildren.push_back(vertices + i+1);
-				leftChildren.push_back(vertices + i+2);
-			}
-			else
-			{
-				rightChildren.push_back(vertices + i);
-				rightChildren.push_back(vertices + i+1);
-				rightChildren.push_back(vertices + i+2);
-			}
-		}
+		numLeft = static_cast<unsigned>(std::stable_partition(first, last, TriCentroidBelow(&bvh.triVerts[0], axes[a], mean)) - first);
 	}
+	return numLeft;
+}
 
-	// Try mid axis if uneven
-	if ( (leftChildren.size() == 0) || (rightChildren.size() == 0) )
-	{
-		leftChildren.clear();
-		rightChildren.clear();
+/**
+ * Bins triangle centroids along each of the node's OBB axes and splits at the
+ * bin boundary with the lowest surface area heuristic cost. Child bounds are
+ * measured in the parent's OBB frame. Returns the number of triangles moved to
+ * the front (left child), 0 if every centroid falls in one bin.
+ */
+unsigned SplitSAH(BVH& bvh, unsigned firstTri, unsigned numTris, const OBB& currbox)
+{
+	const Vector3 *axes[3] = {&currbox.u, &currbox.v, &currbox.w};
 
-		float mean = 0.0f;
-		// Compute centroid
-		for (size_t i = 0; i < numVerts; i+=3)
+	float    bestCost = FLT_MAX;
+	size_t   bestAxis = 0;
+	unsigned bestBin  = NumSAHBins;
+	float    bestMin  = 0.0f, bestMax = 0.0f;
+
+	for (size_t a = 0; a < 3; ++a)
+	{
+		// Range of centroid projections
+		float minProj = FLT_MAX, maxProj = -FLT_MAX;
+		for (unsigned i = 0; i < numTris; ++i)
 		{
-			const float onethird = 1.0f / 3.0f;
-			mean += midAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
+			const Vector3 *tri = bvh.GetTri(firstTri + i);
+			const float proj = axes[a]->Dot((tri[0] + tri[1] + tri[2])*(1.0f / 3.0f));
+			minProj = proj < minProj ? proj : minProj;
+			maxProj = proj > maxProj ? proj : maxProj;
 		}
-		mean /= static_cast<float>(numVerts / 3);
+		if (maxProj - minProj < EPSILONf)
+			continue;
 
-		// Sort vertices(grouped into 3's to represent triangles) into +ve or -ve half-spaces
-		for (size_t i = 0; i < numVerts; i+=3)
+		// Bin triangles, growing bin bounds in the OBB frame
+		const TriCentroidBin binner(&bvh.triVerts[0], axes[a], minProj, maxProj);
+		SAHBin bins[NumSAHBins];
+		for (unsigned i = 0; i < numTris; ++i)
 		{
-			const float onethird = 1.0f / 3.0f;
-			float baryproj = midAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
+			const Vector3 *tri = bvh.GetTri(firstTri + i);
+			SAHBin& bin = bins[binner.Bin(bvh.triIndices[firstTri + i])];
+			for (size_t j = 0; j < 3; ++j)
+				bin.Grow(Vector3(currbox.u.Dot(tri[j]), currbox.v.Dot(tri[j]), currbox.w.Dot(tri[j])));
+			++bin.numTris;
+		}
 
-			if (baryproj < mean)
-			{
-				leftChildren.push_back(vertices + i);
-				leftChildren.push_back(vertices + i+1);
-				leftChildren.push_back(vertices + i+2);
-			}
-			else
+		// Sweep from the right, then evaluate each boundary sweeping from the left
+		float rightCost[NumSAHBins];
+		SAHBin accum;
+		for (unsigned b = NumSAHBins - 1; b > 0; --b)
+		{
+			accum.Grow(bins[b]);
+			rightCost[b - 1] = accum.HalfArea() * static_cast<float>(accum.numTris);
+		}
+		accum = SAHBin();
+		for (unsigned b = 0; b < NumSAHBins - 1; ++b)
+		{
+			accum.Grow(bins[b]);
+			if (accum.numTris == 0 || accum.numTris == numTris)
+				continue;
+			const float cost = accum.HalfArea() * static_cast<float>(accum.numTris) + rightCost[b];
+			if (cost < bestCost)
 			{
-				rightChildren.push_back(vertices + i);
-				rightChildren.push_back(vertices + i+1);
-				rightChildren.push_back(vertices + i+2);
+				bestCost = cost;
+				bestAxis = a;
+				bestBin  = b;
+				bestMin  = minProj;
+				bestMax  = maxProj;
 			}
 		}
 	}
 
-	// Try min axis if uneven
-	if ( (leftChildren.size() == 0) || (rightChildren.size() == 0) )
+	if (bestBin == NumSAHBins)
+		return 0;
+
+	TriCentroidBin pred(&bvh.triVerts[0], axes[bestAxis], bestMin, bestMax);
+	pred.splitBin = bestBin;
+	unsigned *first = &bvh.triIndices[firstTri];
+	return static_cast<unsigned>(std::stable_partition(first, first + numTris, pred) - first);
+}
+
+void BuildBVHRange(BVH& bvh, std::vector<BVHNode>& nodes, unsigned firstTri, unsigned numTris, const BVHBuildParams& params);
+
+/// Subtree built as a job. Node child indices are local to the task's array.
+struct BVHBuildTask
+{
+	BVH                  *bvh;
+	std::vector<BVHNode>  nodes;
+	unsigned              firstTri;
+	unsigned              numTris;
+	const BVHBuildParams *params;
+}; // struct BVHBuildTask
+
+void BuildBVHTask(void *data)
+{
+	BVHBuildTask *task = static_cast<BVHBuildTask*>(data);
+	BuildBVHRange(*task->bvh, task->nodes, task->firstTri, task->numTris, *task->params);
+}
+
+/// Appends a subtree's nodes, rebasing its child indices
+void SpliceBVHNodes(std::vector<BVHNode>& nodes, const std::vector<BVHNode>& subtree)
+{
+	const unsigned offset = static_cast<unsigned>(nodes.size());
+	nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+	for (size_t i = offset, size = nodes.size(); i < size; ++i)
 	{
-		leftChildren.clear();
-		rightChildren.clear();
+		if (!nodes[i].IsLeaf())
+			nodes[i].rightChild += offset;
+	}
+}
 
-		float mean = 0.0f;
-		// Compute centroid
-		for (size_t i = 0; i < numVerts; i+=3)
-		{
-			const float onethird = 1.0f / 3.0f;
-			mean += minAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
-		}
-		mean /= static_cast<float>(numVerts / 3);
+/**
+ * Builds the subtree over triIndices[firstTri, firstTri + numTris), appending
+ * its nodes to nodes in depth-first order. Subtrees of at least
+ * MinParallelBuildTris triangles are built as jobs, then spliced back in the
+ * same order as a serial build.
+ */
+void BuildBVHRange(BVH& bvh, std::vector<BVHNode>& nodes, unsigned firstTri, unsigned numTris, const BVHBuildParams& params)
+{
+	const unsigned nodeInd = static_cast<unsigned>(nodes.size());
+	nodes.push_back(BVHNode());
+	nodes[nodeInd].firstTri = firstTri;
+	nodes[nodeInd].numTris = numTris;
 
-		// Sort vertices(grouped into 3's to represent triangles) into +ve or -ve half-spaces
-		for (size_t i = 0; i < numVerts; i+=3)
-		{
-			const float onethird = 1.0f / 3.0f;
-			float baryproj = minAxis->Dot((vertices[i] + vertices[i+1] + vertices[i+2])*onethird);
+	if (numTris == 1) // Build OBB for triangle and return as leaf node
+	{
+		nodes[nodeInd].obb = FitOBBToTri(&bvh.triVerts[bvh.triIndices[firstTri] * 3]);
+		return;
+	}
 
-			if (baryproj < mean)
-			{
-				leftChildren.push_back(vertices + i);
-				leftChildren.push_back(vertices + i+1);
-				leftChildren.push_back(vertices + i+2);
-			}
-			else
-			{
-				rightChildren.push_back(vertices + i);
-				rightChildren.push_back(vertices + i+1);
-				rightChildren.push_back(vertices + i+2);
-			}
-		}
+	// Build OBB for vertices of all triangles in range. Each range owns the
+	// matching slice of scratch, so concurrent subtrees never overlap.
+	Vector3 *scratch = params.scratch + firstTri * 3;
+	for (unsigned i = 0; i < numTris; ++i)
+	{
+		const Vector3 *tri = bvh.GetTri(firstTri + i);
+		scratch[i*3]   = tri[0];
+		scratch[i*3+1] = tri[1];
+		scratch[i*3+2] = tri[2];
 	}
+	const OBB currbox(FitOBBToVerts(scratch, numTris * 3));
+	nodes[nodeInd].obb = currbox;
+
+	if (numTris <= params.maxLeafTris)
+		return;
+
+	unsigned numLeft = params.scheme == E_BVH_SAH ?
+		SplitSAH(bvh, firstTri, numTris, currbox) :
+		SplitMean(bvh, firstTri, numTris, currbox);
 
-	Vector3 *leftVerts = new Vector3[leftChildren.size()];
-	for (size_t i = 0, size = leftChildren.size(); i < size; ++i)
+	// All centroids coincide, split in half
+	if (numLeft == 0 || numLeft == numTris)
+		numLeft = numTris / 2;
+
+	if (numTris < MinParallelBuildTris || jobs::GetNumWorkers() == 0)
 	{
-		leftVerts[i] = *leftChildren[i];
+		BuildBVHRange(bvh, nodes, firstTri, numLeft, params);
+		nodes[nodeInd].rightChild = static_cast<unsigned>(nodes.size());
+		BuildBVHRange(bvh, nodes, firstTri + numLeft, numTris - numLeft, params);
+		return;
 	}
-	currnode->left = BuildBVH(leftVerts, leftChildren.size());
-	delete[] leftVerts;
 
-	Vector3 *rightVerts = new Vector3[rightChildren.size()];
-	for (size_t i = 0, size = rightChildren.size(); i < size; ++i)
+	// Left subtree as a job, right subtree on this thread
+	BVHBuildTask left = {&bvh, std::vector<BVHNode>(), firstTri, numLeft, &params};
+	std::vector<BVHNode> right;
+	jobs::Counter counter;
+	jobs::Run(BuildBVHTask, &left, &counter);
+	BuildBVHRange(bvh, right, firstTri + numLeft, numTris - numLeft, params);
+	jobs::WaitForCounter(&counter);
+
+	SpliceBVHNodes(nodes, left.nodes);
+	nodes[nodeInd].rightChild = static_cast<unsigned>(nodes.size());
+	SpliceBVHNodes(nodes, right);
+}
+} // anon namespace
+
+BVH* BuildBVH(const Vector3 *vertices, size_t numVerts, BVHBuildScheme scheme, unsigned maxLeafTris)
+{
+	if (numVerts < 3 || numVerts % 3)
+		return nullptr;
+
+	const unsigned numTris = static_cast<unsigned>(numVerts / 3);
+
+	BVH *bvh = new BVH;
+	bvh->nodes.reserve(numTris * 2 - 1);
+	bvh->triVerts.assign(vertices, vertices + numVerts);
+	bvh->triIndices.resize(numTris);
+	for (unsigned i = 0; i < numTris; ++i)
+		bvh->triIndices[i] = i;
+
+	BVHBuildParams params;
+	params.scheme      = scheme;
+	params.maxLeafTris = maxLeafTris < 1 ? 1 : maxLeafTris;
+	params.scratch     = new Vector3[numVerts];
+	BuildBVHRange(*bvh, bvh->nodes, 0, numTris, params);
+	delete[] params.scratch;
+	bvh->UpdateDepth();
+
+	return bvh;
+}
+
+void BVH::UpdateDepth()
+{
+	// Children always come after their parent, so one forward pass sees every parent's level first
+	std::vector<unsigned> levels(nodes.size(), 0);
+	depth = 0;
+	for (size_t i = 0; i < nodes.size(); ++i)
 	{
-		rightVerts[i] = *rightChildren[i];
+		if (levels[i] > depth)
+			depth = levels[i];
+		if (!nodes[i].IsLeaf())
+		{
+			levels[GetLeftChild(static_cast<unsigned>(i))]  = levels[i] + 1;
+			levels[GetRightChild(static_cast<unsigned>(i))] = levels[i] + 1;
+		}
 	}
-	currnode->right = BuildBVH(rightVerts, rightChildren.size());
-	delete[] rightVerts;
-
-	currnode->numVerts = numVerts;
-	currnode->triVerts = new Vector3[numVerts];
-	for (size_t i = 0; i < numVerts; ++i)
-		currnode->triVerts[i] = vertices[i];
-	return currnode;
 }
 } // namespace bbk
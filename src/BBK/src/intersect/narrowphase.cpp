@@ -0,0 +1,254 @@
+#include <algorithm>
+#include "intersect.h"
+
+namespace
+{
+const unsigned MaxStackSize  = 256;   ///< Node pairs held on the call stack; deeper pairs of trees use the heap
+const float    SATEpsilon    = 1e-6f; ///< Guards cross product axes of near parallel edges
+const float    PlaneEpsilon  = 1e-6f; ///< Relative distance below which a vertex is on a plane
+
+/// Pair of nodes awaiting a test, one from each BVH
+struct NodePair
+{
+	unsigned a;
+	unsigned b;
+}; // struct NodePair
+
+inline const float* Extents(const bbk::OBB& obb) {return &obb.halfExtents.x;}
+
+inline bbk::Point3 TransformPoint(const bbk::Matrix4x4& mtx, const bbk::Point3& p)
+{
+	return bbk::Point3(
+		mtx.elements[12] + mtx.elements[0] * p.x + mtx.elements[4] * p.y + mtx.elements[8]  * p.z,
+		mtx.elements[13] + mtx.elements[1] * p.x + mtx.elements[5] * p.y + mtx.elements[9]  * p.z,
+		mtx.elements[14] + mtx.elements[2] * p.x + mtx.elements[6] * p.y + mtx.elements[10] * p.z);
+}
+
+/// Signed distances of tri's vertices to the plane through planeTri, 0 within epsilon.
+/// Returns false if all are on the same side, or all on the plane.
+bool PlaneDistances(const bbk::Vector3 *tri, const bbk::Vector3 *planeTri, bbk::Vector3& normal, float dist[3])
+{
+	normal = (planeTri[1] - planeTri[0]).Cross(planeTri[2] - planeTri[0]);
+	const float eps = ::PlaneEpsilon * normal.Magnitude();
+
+	int numPos = 0, numNeg = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		dist[i] = normal.Dot(tri[i] - planeTri[0]);
+		if (std::fabs(dist[i]) <= eps)
+			dist[i] = 0.0f;
+		else if (dist[i] > 0.0f)
+			++numPos;
+		else
+			++numNeg;
+	}
+	return !(numPos == 3 || numNeg == 3 || (numPos == 0 && numNeg == 0));
+}
+
+/// Points where tri meets the plane its vertex distances are to; returns count
+unsigned PlaneCrossings(const bbk::Vector3 *tri, const float dist[3], bbk::Point3 points[3])
+{
+	unsigned numPoints = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const int j = (i + 1) % 3;
+		if (dist[i] == 0.0f)
+			points[numPoints++] = tri[i];
+		else if (dist[j] != 0.0f && (dist[i] < 0.0f) != (dist[j] < 0.0f))
+			points[numPoints++] = tri[i] + (tri[j] - tri[i]) * (dist[i] / (dist[i] - dist[j]));
+	}
+	return numPoints;
+}
+
+/// Interval of points along dir, as the points at either end
+void Interval(const bbk::Point3 *points, unsigned numPoints, const bbk::Vector3& dir, float& lo, float& hi, unsigned& loInd, unsigned& hiInd)
+{
+	lo = hi = dir.Dot(points[0]);
+	loInd = hiInd = 0;
+	for (unsigned i = 1; i < numPoints; ++i)
+	{
+		const float t = dir.Dot(points[i]);
+		if (t < lo)
+		{
+			lo    = t;
+			loInd = i;
+		}
+		if (t > hi)
+		{
+			hi    = t;
+			hiInd = i;
+		}
+	}
+}
+} // anon namespace
+
+namespace bbk
+{
+bool OBBvsOBB(const OBB& a, const OBB& b)
+{
+	const Vector3 *axesA[3] = {&a.u, &a.v, &a.w};
+	const Vector3 *axesB[3] = {&b.u, &b.v, &b.w};
+	const float   *extA     = ::Extents(a);
+	const float   *extB     = ::Extents(b);
+
+	// b's axes and centre in a's frame
+	float rot[3][3], absRot[3][3], t[3];
+	const Vector3 d(b.center - a.center);
+	for (int i = 0; i < 3; ++i)
+	{
+		t[i] = d.Dot(*axesA[i]);
+		for (int j = 0; j < 3; ++j)
+		{
+			rot[i][j]    = axesA[i]->Dot(*axesB[j]);
+			absRot[i][j] = std::fabs(rot[i][j]) + ::SATEpsilon;
+		}
+	}
+
+	// a's face axes
+	for (int i = 0; i < 3; ++i)
+	{
+		const float rb = extB[0] * absRot[i][0] + extB[1] * absRot[i][1] + extB[2] * absRot[i][2];
+		if (std::fabs(t[i]) > extA[i] + rb)
+			return false;
+	}
+
+	// b's face axes
+	for (int j = 0; j < 3; ++j)
+	{
+		const float ra = extA[0] * absRot[0][j] + extA[1] * absRot[1][j] + extA[2] * absRot[2][j];
+		const float tb = t[0] * rot[0][j] + t[1] * rot[1][j] + t[2] * rot[2][j];
+		if (std::fabs(tb) > ra + extB[j])
+			return false;
+	}
+
+	// Edge cross products, a's axis i with b's axis j
+	for (int i = 0; i < 3; ++i)
+	{
+		const int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; ++j)
+		{
+			const int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			const float ra = extA[i1] * absRot[i2][j] + extA[i2] * absRot[i1][j];
+			const float rb = extB[j1] * absRot[i][j2] + extB[j2] * absRot[i][j1];
+			if (std::fabs(t[i2] * rot[i1][j] - t[i1] * rot[i2][j]) > ra + rb)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool TrivsTri(const Vector3 *a, const Vector3 *b, Point3 segment[2])
+{
+	// Each triangle must straddle the other's plane; coplanar triangles are not reported
+	Vector3 normalA, normalB;
+	float   distA[3], distB[3];
+	if (!::PlaneDistances(a, b, normalB, distA) || !::PlaneDistances(b, a, normalA, distB))
+		return false;
+
+	// Both triangles meet the planes' line of intersection in an interval; contact is their overlap
+	const Vector3 dir(normalA.Cross(normalB));
+	Point3   pointsA[3], pointsB[3];
+	const unsigned numA = ::PlaneCrossings(a, distA, pointsA);
+	const unsigned numB = ::PlaneCrossings(b, distB, pointsB);
+
+	float    loA, hiA, loB, hiB;
+	unsigned loIndA, hiIndA, loIndB, hiIndB;
+	::Interval(pointsA, numA, dir, loA, hiA, loIndA, hiIndA);
+	::Interval(pointsB, numB, dir, loB, hiB, loIndB, hiIndB);
+	if (loA > hiB || loB > hiA)
+		return false;
+
+	segment[0] = loA > loB ? pointsA[loIndA] : pointsB[loIndB];
+	segment[1] = hiA < hiB ? pointsA[hiIndA] : pointsB[hiIndB];
+	return true;
+}
+
+unsigned BVHvsBVH(const BVH& bvhA, const Matrix4x4& transformA, const BVH& bvhB, const Matrix4x4& transformB, Contact *contacts, unsigned maxContacts)
+{
+	if (bvhA.nodes.empty() || bvhB.nodes.empty() || maxContacts == 0)
+		return 0;
+
+	// Descend in a's model frame, so only b's nodes are transformed
+	const Matrix4x4 bToA(Matrix4x4::MakeInverse(transformA) * transformB);
+	const float     scaleB = Vector3(bToA.elements[0], bToA.elements[1], bToA.elements[2]).Magnitude();
+	const Matrix3x3 rotA(
+		transformA.elements[0], transformA.elements[1], transformA.elements[2],
+		transformA.elements[4], transformA.elements[5], transformA.elements[6],
+		transformA.elements[8], transformA.elements[9], transformA.elements[10]);
+
+	// Simultaneous descent holds at most one pending pair per level of either tree, plus the pair being split
+	::NodePair               localStack[::MaxStackSize];
+	std::vector< ::NodePair> heapStack;
+	::NodePair              *stack = localStack;
+	if (bvhA.depth + bvhB.depth + 2 > ::MaxStackSize)
+	{
+		heapStack.resize(bvhA.depth + bvhB.depth + 2);
+		stack = &heapStack[0];
+	}
+	unsigned stackSize   = 1;
+	unsigned numContacts = 0;
+	stack[0].a = 0;
+	stack[0].b = 0;
+
+	while (stackSize > 0)
+	{
+		const ::NodePair pair  = stack[--stackSize];
+		const BVHNode   &nodeA = bvhA.nodes[pair.a];
+		const BVHNode   &nodeB = bvhB.nodes[pair.b];
+
+		OBB obbB(TransformOBB(bToA, nodeB.obb));
+		obbB.halfExtents *= scaleB;
+		if (!OBBvsOBB(nodeA.obb, obbB))
+			continue;
+
+		if (nodeA.IsLeaf() && nodeB.IsLeaf())
+		{
+			for (unsigned j = nodeB.firstTri; j < nodeB.firstTri + nodeB.numTris; ++j)
+			{
+				const Vector3 *srcB = bvhB.GetTri(j);
+				const Point3   triB[3] = {::TransformPoint(bToA, srcB[0]), ::TransformPoint(bToA, srcB[1]), ::TransformPoint(bToA, srcB[2])};
+				const Point3   centroidB((triB[0] + triB[1] + triB[2]) * (1.0f / 3.0f));
+				const Vector3  normalB((triB[1] - triB[0]).Cross(triB[2] - triB[0]));
+
+				for (unsigned i = nodeA.firstTri; i < nodeA.firstTri + nodeA.numTris; ++i)
+				{
+					const Vector3 *triA = bvhA.GetTri(i);
+					Point3 segment[2];
+					if (!TrivsTri(triA, triB, segment))
+						continue;
+
+					// Normal of b's face, turned towards a
+					const Point3 centroidA((triA[0] + triA[1] + triA[2]) * (1.0f / 3.0f));
+					const Vector3 normal(normalB.Dot(centroidA - centroidB) < 0.0f ? -normalB : normalB);
+
+					Contact &contact = contacts[numContacts++];
+					contact.point  = ::TransformPoint(transformA, (segment[0] + segment[1]) * 0.5f);
+					contact.normal = (rotA * normal).Normalise();
+					if (numContacts == maxContacts)
+						return numContacts;
+				}
+			}
+			continue;
+		}
+
+		// Split the larger volume, or whichever is not a leaf
+		const Vector3 &extA = nodeA.obb.halfExtents;
+		const Vector3 &extB = obbB.halfExtents;
+		if (nodeB.IsLeaf() || (!nodeA.IsLeaf() && extA.x * extA.y * extA.z >= extB.x * extB.y * extB.z))
+		{
+			stack[stackSize].a   = bvhA.GetRightChild(pair.a);
+			stack[stackSize++].b = pair.b;
+			stack[stackSize].a   = bvhA.GetLeftChild(pair.a);
+			stack[stackSize++].b = pair.b;
+		}
+		else
+		{
+			stack[stackSize].a   = pair.a;
+			stack[stackSize++].b = bvhB.GetRightChild(pair.b);
+			stack[stackSize].a   = pair.a;
+			stack[stackSize++].b = bvhB.GetLeftChild(pair.b);
+		}
+	}
+	return numContacts;
+}
+} // namespace bbk
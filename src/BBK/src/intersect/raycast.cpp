@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cfloat>
+#include <xmmintrin.h>
+#include "intersect.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const unsigned MaxStackSize    = 256;   ///< Nodes held on the call stack; deeper trees use the heap
+const size_t   PacketGrainSize = 64;    ///< Packets per job
+const float    SlabEpsilon     = 1e-5f; ///< Relative exit distance slack, as leaves around one triangle are flat
+
+/// 4 rays in a BVH's model frame, one per SSE lane
+struct Packet
+{
+	__m128 pt[3];
+	__m128 vec[3];
+	__m128 start;
+}; // struct Packet
+
+/// Nearest hits found so far for a packet's rays
+struct PacketHits
+{
+	__m128 t;
+	__m128 u;
+	__m128 v;
+	int    tri[4];
+}; // struct PacketHits
+
+/// Node awaiting a visit, with the nearest distance any ray enters its volume at
+struct StackEntry
+{
+	unsigned node;
+	float    entry;
+}; // struct StackEntry
+
+/// Arguments shared by RaycastBVH's jobs
+struct RaycastJob
+{
+	const bbk::BVH       *bvh;
+	const bbk::Matrix4x4 *toModel;
+	const bbk::Ray       *rays;
+	size_t                numRays;
+	bbk::RayHit          *hits;
+}; // struct RaycastJob
+
+inline bbk::Point3 TransformPoint(const bbk::Matrix4x4& mtx, const bbk::Point3& p)
+{
+	return bbk::Point3(
+		mtx.elements[12] + mtx.elements[0] * p.x + mtx.elements[4] * p.y + mtx.elements[8]  * p.z,
+		mtx.elements[13] + mtx.elements[1] * p.x + mtx.elements[5] * p.y + mtx.elements[9]  * p.z,
+		mtx.elements[14] + mtx.elements[2] * p.x + mtx.elements[6] * p.y + mtx.elements[10] * p.z);
+}
+
+inline __m128 Select(const __m128& mask, const __m128& a, const __m128& b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 Dot(const __m128 a[3], const __m128& x, const __m128& y, const __m128& z)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], x), _mm_mul_ps(a[1], y)), _mm_mul_ps(a[2], z));
+}
+
+inline float HorizontalMin(const __m128& x)
+{
+	const __m128 pairs = _mm_min_ps(x, _mm_movehl_ps(x, x));
+	return _mm_cvtss_f32(_mm_min_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+inline float HorizontalMax(const __m128& x)
+{
+	const __m128 pairs = _mm_max_ps(x, _mm_movehl_ps(x, x));
+	return _mm_cvtss_f32(_mm_max_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+/// Mask of rays entering obb before far; entry is the nearest of their entry distances
+int SlabTest(const Packet& packet, const bbk::OBB& obb, const __m128& far, float& entry)
+{
+	const __m128 rel[3] = {
+		_mm_sub_ps(packet.pt[0], _mm_set1_ps(obb.center.x)),
+		_mm_sub_ps(packet.pt[1], _mm_set1_ps(obb.center.y)),
+		_mm_sub_ps(packet.pt[2], _mm_set1_ps(obb.center.z))};
+	const bbk::Vector3 *axes[3]    = {&obb.u, &obb.v, &obb.w};
+	const float         extents[3] = {obb.halfExtents.x, obb.halfExtents.y, obb.halfExtents.z};
+
+	__m128 tMin = packet.start;
+	__m128 tMax = far;
+	for (int i = 0; i < 3; ++i)
+	{
+		const __m128 x = _mm_set1_ps(axes[i]->x), y = _mm_set1_ps(axes[i]->y), z = _mm_set1_ps(axes[i]->z);
+		const __m128 localPt  = ::Dot(rel, x, y, z);
+		const __m128 invVec   = _mm_div_ps(_mm_set1_ps(1.0f), ::Dot(packet.vec, x, y, z));
+		const __m128 extent   = _mm_set1_ps(extents[i]);
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), extent), localPt), invVec);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(extent, localPt), invVec);
+
+		// min and max return their second operand on NaN, from rays parallel to and on a slab's face
+		tMin = _mm_max_ps(_mm_min_ps(t0, t1), tMin);
+		tMax = _mm_min_ps(_mm_max_ps(t0, t1), tMax);
+	}
+
+	const __m128 hit = _mm_cmple_ps(tMin, _mm_mul_ps(tMax, _mm_set1_ps(1.0f + ::SlabEpsilon)));
+	entry = ::HorizontalMin(::Select(hit, tMin, _mm_set1_ps(FLT_MAX)));
+	return _mm_movemask_ps(hit);
+}
+
+/// Moller-Trumbore test of the packet against one triangle, keeping nearer hits
+void TriTest(const Packet& packet, const bbk::Vector3 *tri, int triIndex, PacketHits& hits)
+{
+	const bbk::Vector3 edge1(tri[1] - tri[0]);
+	const bbk::Vector3 edge2(tri[2] - tri[0]);
+	const __m128 e1x = _mm_set1_ps(edge1.x), e1y = _mm_set1_ps(edge1.y), e1z = _mm_set1_ps(edge1.z);
+	const __m128 e2x = _mm_set1_ps(edge2.x), e2y = _mm_set1_ps(edge2.y), e2z = _mm_set1_ps(edge2.z);
+	const __m128 *vec = packet.vec;
+
+	const __m128 p[3] = {
+		_mm_sub_ps(_mm_mul_ps(vec[1], e2z), _mm_mul_ps(vec[2], e2y)),
+		_mm_sub_ps(_mm_mul_ps(vec[2], e2x), _mm_mul_ps(vec[0], e2z)),
+		_mm_sub_ps(_mm_mul_ps(vec[0], e2y), _mm_mul_ps(vec[1], e2x))};
+	const __m128 s[3] = {
+		_mm_sub_ps(packet.pt[0], _mm_set1_ps(tri[0].x)),
+		_mm_sub_ps(packet.pt[1], _mm_set1_ps(tri[0].y)),
+		_mm_sub_ps(packet.pt[2], _mm_set1_ps(tri[0].z))};
+	const __m128 q[3] = {
+		_mm_sub_ps(_mm_mul_ps(s[1], e1z), _mm_mul_ps(s[2], e1y)),
+		_mm_sub_ps(_mm_mul_ps(s[2], e1x), _mm_mul_ps(s[0], e1z)),
+		_mm_sub_ps(_mm_mul_ps(s[0], e1y), _mm_mul_ps(s[1], e1x))};
+
+	// Rays in the triangle's plane divide by zero, and the NaN or infinite results fail every comparison below
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), ::Dot(p, e1x, e1y, e1z));
+	const __m128 u = _mm_mul_ps(::Dot(s, p[0], p[1], p[2]), invDet);
+	const __m128 v = _mm_mul_ps(::Dot(vec, q[0], q[1], q[2]), invDet);
+	const __m128 t = _mm_mul_ps(::Dot(q, e2x, e2y, e2z), invDet);
+
+	// Same edge slack as RayvsTri, so rounding in either frame cannot open a crack between neighbours
+	const __m128 minWeight = _mm_set1_ps(-bbk::TriEdgeEpsilon);
+	const __m128 hit = _mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(u, minWeight), _mm_cmpge_ps(v, minWeight)),
+		_mm_and_ps(_mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f + bbk::TriEdgeEpsilon)),
+			_mm_and_ps(_mm_cmpge_ps(t, packet.start), _mm_cmplt_ps(t, hits.t))));
+	const int mask = _mm_movemask_ps(hit);
+	if (!mask)
+		return;
+
+	hits.t = ::Select(hit, t, hits.t);
+	hits.u = ::Select(hit, u, hits.u);
+	hits.v = ::Select(hit, v, hits.v);
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		if (mask & (1 << lane))
+			hits.tri[lane] = triIndex;
+	}
+}
+
+void TracePacket(const bbk::BVH& bvh, const Packet& packet, PacketHits& hits)
+{
+	// A depth-first walk holds at most one pending sibling per level, plus the node being split
+	::StackEntry               localStack[::MaxStackSize];
+	std::vector< ::StackEntry> heapStack;
+	::StackEntry              *stack = localStack;
+	if (bvh.depth + 2 > ::MaxStackSize)
+	{
+		heapStack.resize(bvh.depth + 2);
+		stack = &heapStack[0];
+	}
+	unsigned stackSize = 0;
+
+	float entry;
+	if (bvh.nodes.empty() || !::SlabTest(packet, bvh.nodes[0].obb, hits.t, entry))
+		return;
+	stack[stackSize].node    = 0;
+	stack[stackSize++].entry = entry;
+
+	while (stackSize > 0)
+	{
+		const ::StackEntry top = stack[--stackSize];
+
+		// Every ray has already hit something nearer than this subtree
+		if (top.entry > ::HorizontalMax(hits.t))
+			continue;
+
+		const bbk::BVHNode &node = bvh.nodes[top.node];
+		if (node.IsLeaf())
+		{
+			for (unsigned i = node.firstTri; i < node.firstTri + node.numTris; ++i)
+				::TriTest(packet, bvh.GetTri(i), static_cast<int>(bvh.triIndices[i]), hits);
+			continue;
+		}
+
+		// Push the child rays enter first last, so hits found in it cull the other
+		const unsigned left  = bvh.GetLeftChild(top.node);
+		const unsigned right = bvh.GetRightChild(top.node);
+		float entryLeft, entryRight;
+		const bool bHitLeft  = ::SlabTest(packet, bvh.nodes[left].obb, hits.t, entryLeft) != 0;
+		const bool bHitRight = ::SlabTest(packet, bvh.nodes[right].obb, hits.t, entryRight) != 0;
+		const bool bLeftFirst = !bHitRight || (bHitLeft && entryLeft <= entryRight);
+		if (bLeftFirst && bHitRight)
+		{
+			stack[stackSize].node    = right;
+			stack[stackSize++].entry = entryRight;
+		}
+		if (bHitLeft)
+		{
+			stack[stackSize].node    = left;
+			stack[stackSize++].entry = entryLeft;
+		}
+		if (!bLeftFirst)
+		{
+			stack[stackSize].node    = right;
+			stack[stackSize++].entry = entryRight;
+		}
+	}
+}
+
+/// Traces packets [begin, end); a tail packet's unused lanes start past everything
+void RaycastRange(size_t begin, size_t end, void *data)
+{
+	const ::RaycastJob &job = *static_cast<const ::RaycastJob*>(data);
+
+	for (size_t packetIndex = begin; packetIndex < end; ++packetIndex)
+	{
+		const size_t first = packetIndex * 4;
+		float pt[3][4], vec[3][4], start[4], t[4];
+		::PacketHits hits;
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			const bool     bUsed = first + lane < job.numRays;
+			const bbk::Ray &ray  = job.rays[std::min(first + lane, job.numRays - 1)];
+
+			// Affine transform keeps distances along vec in the same units
+			const bbk::Point3  localPt(::TransformPoint(*job.toModel, ray.pt));
+			const bbk::Vector3 localVec(*job.toModel * ray.vec);
+			pt[0][lane]  = localPt.x;
+			pt[1][lane]  = localPt.y;
+			pt[2][lane]  = localPt.z;
+			vec[0][lane] = localVec.x;
+			vec[1][lane] = localVec.y;
+			vec[2][lane] = localVec.z;
+			start[lane]  = bUsed ? ray.start : FLT_MAX;
+			t[lane]      = bUsed ? FLT_MAX : -FLT_MAX;
+			hits.tri[lane] = -1;
+		}
+
+		::Packet packet;
+		for (int i = 0; i < 3; ++i)
+		{
+			packet.pt[i]  = _mm_loadu_ps(pt[i]);
+			packet.vec[i] = _mm_loadu_ps(vec[i]);
+		}
+		packet.start = _mm_loadu_ps(start);
+		hits.t = _mm_loadu_ps(t);
+		hits.u = _mm_setzero_ps();
+		hits.v = _mm_setzero_ps();
+
+		::TracePacket(*job.bvh, packet, hits);
+
+		float u[4], v[4];
+		_mm_storeu_ps(t, hits.t);
+		_mm_storeu_ps(u, hits.u);
+		_mm_storeu_ps(v, hits.v);
+		for (size_t lane = 0; lane < 4 && first + lane < job.numRays; ++lane)
+		{
+			bbk::RayHit &hit = job.hits[first + lane];
+			hit.t   = t[lane];
+			hit.tri = hits.tri[lane];
+			hit.u   = u[lane];
+			hit.v   = v[lane];
+		}
+	}
+}
+} // anon namespace
+
+namespace bbk
+{
+bool RayvsTri(const Ray& ray, const Vector3 *tri, float& t, float& u, float& v)
+{
+	const Vector3 edge1(tri[1] - tri[0]);
+	const Vector3 edge2(tri[2] - tri[0]);
+	const Vector3 p(ray.vec.Cross(edge2));
+	const float det = edge1.Dot(p);
+	if (det == 0.0f)
+		return false;
+
+	const float invDet = 1.0f / det;
+	const Vector3 s(ray.pt - tri[0]);
+	const Vector3 q(s.Cross(edge1));
+	u = s.Dot(p) * invDet;
+	v = ray.vec.Dot(q) * invDet;
+	t = edge2.Dot(q) * invDet;
+	return u >= -TriEdgeEpsilon && v >= -TriEdgeEpsilon && u + v <= 1.0f + TriEdgeEpsilon && t >= ray.start;
+}
+
+void RaycastBVH(const BVH& bvh, const Matrix4x4& transform, const Ray *rays, size_t numRays, RayHit *hits)
+{
+	if (numRays == 0)
+		return;
+
+	const Matrix4x4 toModel(Matrix4x4::MakeInverse(transform));
+	::RaycastJob job = {&bvh, &toModel, rays, numRays, hits};
+	jobs::ParallelFor((numRays + 3) / 4, ::PacketGrainSize, ::RaycastRange, &job);
+}
+} // namespace bbk
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cfloat>
+#include <xmmintrin.h>
+#include "sweepandprune.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const size_t SweepGrainSize = 1024; ///< Sorted proxies per sweep job
+} // anon namespace
+
+namespace bbk
+{
+SweepAndPrune::SweepAndPrune(int axis) :
+	axis_(axis),
+	numSwaps_(0)
+{}
+
+int SweepAndPrune::CreateProxy(const AABB& aabb)
+{
+	int proxy;
+	if (freeProxies_.empty())
+	{
+		proxy = static_cast<int>(bounds_.size());
+		bounds_.push_back(Bounds());
+	}
+	else
+	{
+		proxy = freeProxies_.back();
+		freeProxies_.pop_back();
+	}
+	MoveProxy(proxy, aabb);
+
+	// Insertion sort moves it into place on the next update
+	order_.push_back(proxy);
+	return proxy;
+}
+
+void SweepAndPrune::DestroyProxy(int proxy)
+{
+	order_.erase(std::find(order_.begin(), order_.end(), proxy));
+	freeProxies_.push_back(proxy);
+}
+
+void SweepAndPrune::MoveProxy(int proxy, const AABB& aabb)
+{
+	Bounds &bounds = bounds_[proxy];
+	bounds.min[0] = aabb.center.x - aabb.diag.x;
+	bounds.min[1] = aabb.center.y - aabb.diag.y;
+	bounds.min[2] = aabb.center.z - aabb.diag.z;
+	bounds.max[0] = aabb.center.x + aabb.diag.x;
+	bounds.max[1] = aabb.center.y + aabb.diag.y;
+	bounds.max[2] = aabb.center.z + aabb.diag.z;
+}
+
+void SweepAndPrune::UpdatePairs()
+{
+	const size_t n       = order_.size();
+	const int    axes[3] = {axis_, (axis_ + 1) % 3, (axis_ + 2) % 3};
+
+	// 4 padding entries, so the sweep can read whole SSE batches; lanes past n are masked off
+	for (int i = 0; i < 3; ++i)
+	{
+		sortedMin_[i].resize(n + 4);
+		sortedMax_[i].resize(n + 4);
+	}
+	for (size_t i = n; i < n + 4; ++i)
+		sortedMin_[0][i] = FLT_MAX;
+
+	// Insertion sort on last update's order, with keys gathered so comparisons stay in cache
+	std::vector<float> &keys = sortedMin_[0];
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = bounds_[order_[i]].min[axes[0]];
+
+	numSwaps_ = 0;
+	for (size_t i = 1; i < n; ++i)
+	{
+		const float key   = keys[i];
+		const int   proxy = order_[i];
+		size_t      j     = i;
+		for (; j > 0 && keys[j - 1] > key; --j)
+		{
+			keys[j]   = keys[j - 1];
+			order_[j] = order_[j - 1];
+		}
+		keys[j]   = key;
+		order_[j] = proxy;
+		numSwaps_ += static_cast<unsigned>(i - j);
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Bounds &bounds = bounds_[order_[i]];
+		sortedMax_[0][i] = bounds.max[axes[0]];
+		sortedMin_[1][i] = bounds.min[axes[1]];
+		sortedMax_[1][i] = bounds.max[axes[1]];
+		sortedMin_[2][i] = bounds.min[axes[2]];
+		sortedMax_[2][i] = bounds.max[axes[2]];
+	}
+
+	// Chunks append to their own lists, joined in chunk order so pairs do not depend on threading
+	chunkPairs_.resize((n + ::SweepGrainSize - 1) / ::SweepGrainSize);
+	jobs::ParallelFor(n, ::SweepGrainSize, SweepRange, this);
+
+	pairs_.clear();
+	for (size_t i = 0; i < chunkPairs_.size(); ++i)
+		pairs_.insert(pairs_.end(), chunkPairs_[i].begin(), chunkPairs_[i].end());
+}
+
+void SweepAndPrune::SweepRange(size_t begin, size_t end, void *data)
+{
+	SweepAndPrune &sap = *static_cast<SweepAndPrune*>(data);
+	std::vector<OverlapPair> &pairs = sap.chunkPairs_[begin / ::SweepGrainSize];
+	pairs.clear();
+
+	const size_t n     = sap.order_.size();
+	const int   *order = &sap.order_[0];
+	const float *min0  = &sap.sortedMin_[0][0], *max0 = &sap.sortedMax_[0][0];
+	const float *min1  = &sap.sortedMin_[1][0], *max1 = &sap.sortedMax_[1][0];
+	const float *min2  = &sap.sortedMin_[2][0], *max2 = &sap.sortedMax_[2][0];
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		const __m128 end0   = _mm_set1_ps(max0[i]);
+		const __m128 start1 = _mm_set1_ps(min1[i]), end1 = _mm_set1_ps(max1[i]);
+		const __m128 start2 = _mm_set1_ps(min2[i]), end2 = _mm_set1_ps(max2[i]);
+
+		// Later proxies start no earlier along the sort axis, so stop at the first that starts past i's end.
+		// The count bounds the sweep too, since an unbounded max lies past every start
+		for (size_t j = i + 1; j < n; j += 4)
+		{
+			const int    validMask = n - j >= 4 ? 0xF : (1 << (n - j)) - 1;
+			const __m128 inRange   = _mm_cmple_ps(_mm_loadu_ps(min0 + j), end0);
+			const int    rangeMask = _mm_movemask_ps(inRange) & validMask;
+			if (!rangeMask)
+				break;
+
+			const __m128 overlap = _mm_and_ps(
+				_mm_and_ps(inRange,
+					_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min1 + j), end1), _mm_cmpge_ps(_mm_loadu_ps(max1 + j), start1))),
+				_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min2 + j), end2), _mm_cmpge_ps(_mm_loadu_ps(max2 + j), start2)));
+			for (int mask = _mm_movemask_ps(overlap) & validMask, lane = 0; mask; mask >>= 1, ++lane)
+			{
+				if (!(mask & 1))
+					continue;
+
+				OverlapPair pair;
+				pair.a = std::min(order[i], order[j + lane]);
+				pair.b = std::max(order[i], order[j + lane]);
+				pairs.push_back(pair);
+			}
+			if (rangeMask != 0xF)
+				break;
+		}
+	}
+}
+} // namespace bbk
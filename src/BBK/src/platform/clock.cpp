@@ -1,36 +1,66 @@
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h> /* QueryPerformanceCounter */
+#else
+  #include <time.h>    /* clock_gettime */
+#endif
 #include "sdl/SDL_timer.h"
 #include "clock.h"
 
 namespace
 {
-uint32_t tickCount     = 0;
-uint32_t prevTickCount = 0;
-uint32_t deltaTicks    = 0;
+uint64_t nanoseconds     = 0;
+uint64_t prevNanoseconds = 0;
+uint32_t tickCount       = 0;
+uint32_t prevTickCount   = 0;
 } // anon namespace
 
 namespace bbk
 {
 namespace clock
 {
-//void Update()
-//{
-//	tickCount_     = SDL_GetTicks();
-//	deltaTicks_    = tickCount_ - prevTickCount_;
-//	prevTickCount_ = tickCount_;
-//}
+void Update()
+{
+	::prevTickCount   = ::tickCount;
+	::tickCount       = GetTicks();
+	::prevNanoseconds = ::nanoseconds;
+	::nanoseconds     = GetNanoseconds();
+}
 
 uint32_t GetTicks()
 {
-	::tickCount     = SDL_GetTicks();
-	::deltaTicks    = ::tickCount - ::prevTickCount;
-	::prevTickCount = ::tickCount;
-	return ::tickCount;
+	return SDL_GetTicks();
 }
 
 uint32_t GetDeltaTicks()
 {
-	return ::deltaTicks;
+	return ::tickCount - ::prevTickCount;
+}
+
+uint64_t GetNanoseconds()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {0};
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	// Whole seconds and remainder apart, so counts do not overflow when scaled
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	const uint64_t count = static_cast<uint64_t>(counter.QuadPart);
+	const uint64_t freq  = static_cast<uint64_t>(frequency.QuadPart);
+	return (count / freq) * 1000000000ull + (count % freq) * 1000000000ull / freq;
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+#endif
 }
 
+uint64_t GetDeltaNanoseconds()
+{
+	return ::nanoseconds - ::prevNanoseconds;
+}
 } // namespace clock
 } // namespace bbk
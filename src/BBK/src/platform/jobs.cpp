@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include "sdl/SDL_thread.h"
+#include "sdl/SDL_mutex.h"
+#include "sdl/SDL_timer.h"
+#ifdef _MSC_VER
+  #include <intrin.h>  /* _InterlockedIncrement, _InterlockedDecrement */
+#endif
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h> /* GetSystemInfo */
+#else
+  #include <unistd.h>  /* sysconf */
+#endif
+#include "jobs.h"
+
+namespace
+{
+struct Job
+{
+	bbk::jobs::JobFunc        func;
+	void                     *data;
+	bbk::jobs::Counter       *counter;
+	const bbk::jobs::Counter *dependency;
+}; // struct Job
+
+/// Jobs queued before their shared dependency reached zero, in submission order
+struct WaitList
+{
+	const bbk::jobs::Counter *dependency;
+	std::vector<Job>          jobs;
+}; // struct WaitList
+
+/// Chunk of a ParallelFor
+struct RangeJob
+{
+	bbk::jobs::RangeFunc  func;
+	void                 *data;
+	size_t                begin;
+	size_t                end;
+}; // struct RangeJob
+
+/** @struct JobQueue
+ *  @brief  Per-thread deque of ready jobs. The owner pushes and pops at the
+ *          back, other threads steal from the front. Jobs whose dependency
+ *          is outstanding wait in one list per dependency, and the whole list
+ *          moves to the deque once that dependency reaches zero. */
+struct JobQueue
+{
+	std::deque<Job>       ready;
+	std::vector<WaitList> waiting;
+	SDL_mutex            *lock;
+}; // struct JobQueue
+
+std::vector<SDL_Thread*> workers;
+std::vector<Uint32>      threadIds;   ///< [0] is the thread that called Init
+std::vector<unsigned>    queueIndices; ///< Passed to each worker on creation
+std::vector<JobQueue>    queues;      ///< One per entry in threadIds
+SDL_sem                 *startSem = nullptr;
+SDL_sem                 *jobSem   = nullptr;
+volatile long            bRunning = 0;     ///< Accessed atomically, as the interlocked intrinsics take a long
+bool                     bSingleThreaded = false;
+
+long AtomicIncrement(volatile long *value);
+long AtomicDecrement(volatile long *value);
+/// Reads value with acquire semantics, so results of the jobs that counted it down are visible
+long AtomicLoad(const volatile long *value);
+/// Writes value with release semantics
+void AtomicStore(volatile long *value, long newValue);
+bool IsDone(const bbk::jobs::Counter *counter);
+unsigned GetNumCores();
+unsigned GetQueueIndex();
+void Enqueue(JobQueue& queue, const Job& job);
+/// Moves the jobs of every wait list whose dependency has reached zero to the ready deque
+void ReleaseWaiting(JobQueue& queue);
+bool FindJob(unsigned queueIndex, Job& job);
+void Execute(const Job& job);
+void RunRange(void *data);
+int WorkerMain(void *data);
+} // anon namespace
+
+namespace bbk
+{
+namespace jobs
+{
+bool Init(unsigned numWorkers)
+{
+	if (!::workers.empty())
+		return true;
+
+	if (numWorkers == 0)
+		numWorkers = ::GetNumCores() - 1;
+	if (numWorkers == 0)
+		return true;
+
+	::startSem = SDL_CreateSemaphore(0);
+	::jobSem   = SDL_CreateSemaphore(0);
+	::threadIds.assign(numWorkers + 1, 0);
+	::queueIndices.resize(numWorkers + 1);
+	::queues.resize(numWorkers + 1);
+	for (unsigned i = 0; i <= numWorkers; ++i)
+	{
+		::queueIndices[i] = i;
+		::queues[i].lock = SDL_CreateMutex();
+	}
+	::threadIds[0] = SDL_ThreadID();
+	::AtomicStore(&::bRunning, 1);
+
+	for (unsigned i = 1; i <= numWorkers; ++i)
+	{
+		SDL_Thread *thread = SDL_CreateThread(::WorkerMain, &::queueIndices[i]);
+		if (!thread)
+		{
+			std::fprintf(stdout, "jobs::Init: Failed to create worker thread %u of %u\n", i, numWorkers);
+			break;
+		}
+		::workers.push_back(thread);
+		::threadIds[i] = SDL_GetThreadID(thread);
+	}
+
+	// Workers look up their own queues by thread id, so hold them until all ids are known
+	for (size_t i = 0; i < ::workers.size(); ++i)
+		SDL_SemPost(::startSem);
+
+	return !::workers.empty();
+}
+
+void Halt()
+{
+	if (::workers.empty())
+		return;
+
+	::AtomicStore(&::bRunning, 0);
+	for (size_t i = 0; i < ::workers.size(); ++i)
+		SDL_SemPost(::jobSem);
+	for (size_t i = 0; i < ::workers.size(); ++i)
+		SDL_WaitThread(::workers[i], nullptr);
+	::workers.clear();
+
+	for (size_t i = 0; i < ::queues.size(); ++i)
+		SDL_DestroyMutex(::queues[i].lock);
+	::queues.clear();
+	::threadIds.clear();
+	::queueIndices.clear();
+
+	SDL_DestroySemaphore(::startSem);
+	SDL_DestroySemaphore(::jobSem);
+	::startSem = nullptr;
+	::jobSem   = nullptr;
+}
+
+unsigned GetNumWorkers()
+{
+	return ::bSingleThreaded ? 0 : static_cast<unsigned>(::workers.size());
+}
+
+void SetSingleThreaded(bool flag)
+{
+	::bSingleThreaded = flag;
+}
+
+bool IsSingleThreaded()
+{
+	return ::bSingleThreaded;
+}
+
+void Run(JobFunc func, void *data, Counter *counter, const Counter *dependency)
+{
+	// Inline jobs finish before Run returns, so dependencies on them are met,
+	// but a dependency may still count jobs queued before going single-threaded
+	if (::workers.empty() || ::bSingleThreaded)
+	{
+		WaitForCounter(dependency);
+		func(data);
+		return;
+	}
+
+	if (counter)
+		::AtomicIncrement(&counter->value);
+
+	Job job = {func, data, counter, dependency};
+	::Enqueue(::queues[::GetQueueIndex()], job);
+	SDL_SemPost(::jobSem);
+}
+
+void WaitForCounter(const Counter *counter)
+{
+	if (!counter)
+		return;
+
+	const unsigned queueIndex = ::GetQueueIndex();
+	while (::AtomicLoad(&counter->value) > 0)
+	{
+		Job job;
+		if (::FindJob(queueIndex, job))
+			::Execute(job);
+		else
+			SDL_Delay(0);
+	}
+}
+
+void ParallelFor(size_t count, size_t grainSize, RangeFunc func, void *data)
+{
+	if (grainSize == 0)
+		grainSize = 1;
+	const size_t numChunks = (count + grainSize - 1) / grainSize;
+
+	if (numChunks <= 1 || ::workers.empty() || ::bSingleThreaded)
+	{
+		for (size_t begin = 0; begin < count; begin += grainSize)
+			func(begin, std::min(begin + grainSize, count), data);
+		return;
+	}
+
+	std::vector< ::RangeJob> ranges(numChunks);
+	Counter counter;
+	for (size_t i = 0; i < numChunks; ++i)
+	{
+		::RangeJob &range = ranges[i];
+		range.func  = func;
+		range.data  = data;
+		range.begin = i * grainSize;
+		range.end   = std::min(range.begin + grainSize, count);
+		Run(::RunRange, &range, &counter);
+	}
+	WaitForCounter(&counter);
+}
+} // namespace jobs
+} // namespace bbk
+
+namespace
+{
+long AtomicIncrement(volatile long *value)
+{
+#ifdef _MSC_VER
+	return _InterlockedIncrement(value);
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+long AtomicDecrement(volatile long *value)
+{
+#ifdef _MSC_VER
+	return _InterlockedDecrement(value);
+#else
+	return __sync_sub_and_fetch(value, 1);
+#endif
+}
+
+long AtomicLoad(const volatile long *value)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange(const_cast<volatile long*>(value), 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void AtomicStore(volatile long *value, long newValue)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange(value, newValue);
+#else
+	__atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
+
+bool IsDone(const bbk::jobs::Counter *counter)
+{
+	return !counter || ::AtomicLoad(&counter->value) <= 0;
+}
+
+unsigned GetNumCores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwNumberOfProcessors > 0 ? static_cast<unsigned>(sysInfo.dwNumberOfProcessors) : 1;
+#else
+	const long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+	return numCores > 0 ? static_cast<unsigned>(numCores) : 1;
+#endif
+}
+
+/// Threads outside the pool share the queue of the thread that called Init
+unsigned GetQueueIndex()
+{
+	const Uint32 id = SDL_ThreadID();
+	for (unsigned i = 1; i < ::threadIds.size(); ++i)
+	{
+		if (::threadIds[i] == id)
+			return i;
+	}
+	return 0;
+}
+
+void Enqueue(JobQueue& queue, const Job& job)
+{
+	SDL_mutexP(queue.lock);
+	if (::IsDone(job.dependency))
+	{
+		queue.ready.push_back(job);
+	}
+	else
+	{
+		// Few distinct dependencies are outstanding at once, so a linear search is short
+		size_t i = 0;
+		while (i < queue.waiting.size() && queue.waiting[i].dependency != job.dependency)
+			++i;
+		if (i == queue.waiting.size())
+		{
+			queue.waiting.push_back(WaitList());
+			queue.waiting.back().dependency = job.dependency;
+		}
+		queue.waiting[i].jobs.push_back(job);
+	}
+	SDL_mutexV(queue.lock);
+}
+
+void ReleaseWaiting(JobQueue& queue)
+{
+	for (size_t i = 0; i < queue.waiting.size(); )
+	{
+		WaitList &list = queue.waiting[i];
+		if (!::IsDone(list.dependency))
+		{
+			++i;
+			continue;
+		}
+
+		queue.ready.insert(queue.ready.end(), list.jobs.begin(), list.jobs.end());
+		// Order of the wait lists does not matter, so fill the gap from the back
+		if (i + 1 < queue.waiting.size())
+		{
+			list.dependency = queue.waiting.back().dependency;
+			list.jobs.swap(queue.waiting.back().jobs);
+		}
+		queue.waiting.pop_back();
+	}
+}
+
+/// Pops newest ready job from own queue, else steals oldest ready job from another queue
+bool FindJob(unsigned queueIndex, Job& job)
+{
+	const size_t numQueues = ::queues.size();
+	for (size_t i = 0; i < numQueues; ++i)
+	{
+		JobQueue& queue = ::queues[(queueIndex + i) % numQueues];
+		SDL_mutexP(queue.lock);
+		if (!queue.waiting.empty())
+			::ReleaseWaiting(queue);
+		const bool bFound = !queue.ready.empty();
+		if (bFound && i == 0)
+		{
+			job = queue.ready.back();
+			queue.ready.pop_back();
+		}
+		else if (bFound)
+		{
+			job = queue.ready.front();
+			queue.ready.pop_front();
+		}
+		SDL_mutexV(queue.lock);
+		if (bFound)
+			return true;
+	}
+	return false;
+}
+
+void Execute(const Job& job)
+{
+	job.func(job.data);
+
+	// Wake a sleeping worker in case a job was waiting on this counter
+	if (job.counter && ::AtomicDecrement(&job.counter->value) == 0)
+		SDL_SemPost(::jobSem);
+}
+
+void RunRange(void *data)
+{
+	const ::RangeJob *range = static_cast< ::RangeJob*>(data);
+	range->func(range->begin, range->end, range->data);
+}
+
+int WorkerMain(void *data)
+{
+	const unsigned queueIndex = *static_cast<unsigned*>(data);
+	SDL_SemWait(::startSem);
+
+	while (::AtomicLoad(&::bRunning))
+	{
+		Job job;
+		if (::FindJob(queueIndex, job))
+			::Execute(job);
+		else
+			SDL_SemWait(::jobSem);
+	}
+	return 0;
+}
+} // anon namespace
@@ -12,12 +12,14 @@ bool InitPlatform()
 		return false;
 	if (!mouse::Init())
 		return false;
+	jobs::Init();
 
 	return true;
 }
 
 void HaltPlatform()
 {
+	jobs::Halt();
 	appwindow::Halt();
 	SDL_Quit();
 }
@@ -1,8 +1,32 @@
 #include <cctype>
 #include <cstdarg>
+#include <cstdlib>
 #include <sstream>
 #include "utils.h"
 
+namespace
+{
+/// Powers of ten exactly representable as doubles
+const double ExactPow10[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const int      MaxExactPow10      = 22;
+const uint64_t MaxExactMantissa   = 1ULL << 53;
+const int      MaxMantissaDigits  = 19; ///< Decimal digits that always fit in uint64_t
+
+inline bool IsSpace(char c) {return c == ' ' || c == '\t' || c == '\n' || c == '\r';}
+inline bool IsDigit(char c) {return c >= '0' && c <= '9';}
+
+inline const char* SkipSpace(const char *str)
+{
+	while (IsSpace(*str))
+		++str;
+	return str;
+}
+} // anon namespace
+
 namespace bbk
 {
 namespace utils
@@ -56,5 +80,140 @@ std::vector<std::string> SplitStrToWords(const std::string &origStr, char delimi
 	SplitStrToWords(origStr, delimiter, outputWordsVec);
 	return outputWordsVec;
 }
+
+bool ParseFloat(const char *&str, float &value)
+{
+	const char *start = ::SkipSpace(str);
+	const char *p     = start;
+
+	const bool isNeg = *p == '-';
+	if (*p == '-' || *p == '+')
+		++p;
+
+	// Accumulate significant digits into an integer mantissa, tracking the
+	// decimal exponent of its last digit
+	uint64_t mantissa  = 0;
+	int      numDigits = 0;
+	int      exp10     = 0;
+	bool     hasDigits = false;
+	for (; ::IsDigit(*p); ++p, hasDigits = true)
+	{
+		if (numDigits < ::MaxMantissaDigits)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa) ++numDigits;
+		}
+		else
+			++exp10;
+	}
+	if (*p == '.')
+	{
+		for (++p; ::IsDigit(*p); ++p, hasDigits = true)
+		{
+			if (numDigits < ::MaxMantissaDigits)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) ++numDigits;
+				--exp10;
+			}
+		}
+	}
+	if (!hasDigits)
+		return false;
+
+	// Exponent is only consumed if digits follow it
+	if (*p == 'e' || *p == 'E')
+	{
+		const char *e = p + 1;
+		const bool isExpNeg = *e == '-';
+		if (*e == '-' || *e == '+')
+			++e;
+		if (::IsDigit(*e))
+		{
+			int exp = 0;
+			for (; ::IsDigit(*e); ++e)
+				if (exp < 10000) exp = exp * 10 + (*e - '0');
+			exp10 += isExpNeg ? -exp : exp;
+			p = e;
+		}
+	}
+
+	if (mantissa <= ::MaxExactMantissa && exp10 >= -::MaxExactPow10 && exp10 <= ::MaxExactPow10)
+	{
+		// Both operands are exact, so a single multiply or divide rounds correctly
+		double result = static_cast<double>(mantissa);
+		result = exp10 < 0 ? result / ::ExactPow10[-exp10] : result * ::ExactPow10[exp10];
+		value = static_cast<float>(isNeg ? -result : result);
+	}
+	else
+		value = static_cast<float>(std::strtod(start, nullptr)); // Rare; long mantissas or huge exponents
+
+	str = p;
+	return true;
+}
+
+bool ParseInt(const char *&str, int &value)
+{
+	const char *p = ::SkipSpace(str);
+
+	const bool isNeg = *p == '-';
+	if (*p == '-' || *p == '+')
+		++p;
+	if (!::IsDigit(*p))
+		return false;
+
+	int result = 0;
+	for (; ::IsDigit(*p); ++p)
+		result = result * 10 + (*p - '0');
+
+	value = isNeg ? -result : result;
+	str   = p;
+	return true;
+}
+
+bool ParseUnsigned(const char *&str, unsigned &value)
+{
+	const char *p = ::SkipSpace(str);
+	if (*p == '+')
+		++p;
+	if (!::IsDigit(*p))
+		return false;
+
+	unsigned result = 0;
+	for (; ::IsDigit(*p); ++p)
+		result = result * 10 + static_cast<unsigned>(*p - '0');
+
+	value = result;
+	str   = p;
+	return true;
+}
+
+size_t ParseFloats(const char *&str, float *out, size_t count)
+{
+	size_t i = 0;
+	while (i < count && ParseFloat(str, out[i]))
+		++i;
+	return i;
+}
+
+size_t ParseUnsigneds(const char *&str, unsigned *out, size_t count)
+{
+	size_t i = 0;
+	while (i < count && ParseUnsigned(str, out[i]))
+		++i;
+	return i;
+}
+
+uint64_t HashFNV1a(const void *data, size_t size)
+{
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 } // namespace utils
 } // namespace bbk
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "sdl/SDL.h"
+#include "framework/clothgrid.h"
+#include "framework/clothmesh.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const float    Spacing        = 0.1f;
+const float    Gravity        = 9.8f;
+const float    Deltatime      = 1.0f / 60.0f;
+const unsigned SheetSize      = 128;   ///< Rows and columns of the stretch test
+const unsigned StretchFrames  = 240;
+const unsigned StretchWarmup  = 30;    ///< Frames before the sheet has taken up its weight
+const float    MaxStretch     = 1.2f;  ///< Longest structural spring over its rest length
+const float    MaxMeanStretch = 1.04f;
+const unsigned SmallSize      = 64;    ///< Rows and columns of the convergence and determinism tests
+const unsigned SettleFrames   = 600;
+const float    MaxSettleSpeed = 0.05f; ///< Of any particle once the sheet has settled
+const unsigned CompareFrames  = 60;
+const unsigned MinColours     = 12;    ///< Springs of a particle away from the edges, each needing its own colour
+const unsigned MaxColours     = 23;    ///< Greedy bound for 12 springs per particle
+
+/// Structural spring lengths over their rest length
+struct Stretch
+{
+	float max;
+	float mean;
+	float meanError; ///< Mean of |length / rest length - 1|
+	bool  bFinite;
+}; // struct Stretch
+
+const char* GetSolverName(bbk::ClothGrid::Solver solver);
+/// Top row pinned, hanging under gravity
+void HangSheet(bbk::ClothGrid& cloth, bbk::ClothGrid::Solver solver);
+/// Gravity plus a gust that varies across the sheet and over time, so every particle moves differently
+void ApplyForces(bbk::ClothGrid& cloth, unsigned frame);
+Stretch MeasureStretch(const bbk::ClothGrid& cloth);
+float GetMaxSpeed(const bbk::ClothGrid& cloth);
+void GetPositions(const bbk::ClothGrid& cloth, std::vector<bbk::Vector3>& positions);
+bool TestStretch(bbk::ClothGrid::Solver solver);
+bool TestConvergence();
+bool TestColours();
+bool TestWorkerCounts(bbk::ClothGrid::Solver solver, unsigned numWorkers);
+bool TestMesh();
+} // anon namespace
+
+/**
+ * Headless check and benchmark of the cloth simulation. Hangs sheets with the
+ * default settings of each solver and checks that they keep their shape, that
+ * XPBD converges with more work and comes to rest, that constraint colouring
+ * stays within its bounds, that results do not depend on the number of
+ * workers, and that ClothMesh follows the sheet.
+ */
+int main(int argc, char *argv[])
+{
+	const unsigned numWorkers = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 0;
+
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+	{
+		std::fprintf(stdout, "ClothBench: Failed to init SDL timer\n");
+		return 1;
+	}
+	bbk::jobs::Init(numWorkers);
+	std::fprintf(stdout, "ClothBench: %u worker threads\n", bbk::jobs::GetNumWorkers());
+
+	unsigned numFailed = 0;
+	if (!::TestStretch(bbk::ClothGrid::SPRINGS))
+		++numFailed;
+	if (!::TestStretch(bbk::ClothGrid::XPBD))
+		++numFailed;
+	if (!::TestConvergence())
+		++numFailed;
+	if (!::TestColours())
+		++numFailed;
+	if (!::TestWorkerCounts(bbk::ClothGrid::SPRINGS, numWorkers))
+		++numFailed;
+	if (!::TestWorkerCounts(bbk::ClothGrid::XPBD, numWorkers))
+		++numFailed;
+	if (!::TestMesh())
+		++numFailed;
+
+	bbk::jobs::Halt();
+	SDL_Quit();
+
+	if (numFailed)
+	{
+		std::fprintf(stdout, "ClothBench: %u tests failed\n", numFailed);
+		return 1;
+	}
+	std::fprintf(stdout, "ClothBench: All tests passed\n");
+	return 0;
+}
+
+namespace
+{
+const char* GetSolverName(bbk::ClothGrid::Solver solver)
+{
+	return solver == bbk::ClothGrid::XPBD ? "XPBD" : "SPRINGS";
+}
+
+void HangSheet(bbk::ClothGrid& cloth, bbk::ClothGrid::Solver solver)
+{
+	cloth.SetSolver(solver);
+	for (unsigned col = 0; col < cloth.GetNumCols(); ++col)
+		cloth.SetPinned(0, col, true);
+}
+
+void ApplyForces(bbk::ClothGrid& cloth, unsigned frame)
+{
+	cloth.AddUniformForce(bbk::Vector3(0.0f, -Gravity, 0.0f));
+	for (unsigned row = 0; row < cloth.GetNumRows(); ++row)
+	{
+		for (unsigned col = 0; col < cloth.GetNumCols(); ++col)
+		{
+			const float phase = 0.05f * static_cast<float>(row + 2 * col + 3 * frame);
+			cloth.AddForce(row, col, bbk::Vector3(std::sin(phase), 0.0f, 2.0f * std::cos(phase)));
+		}
+	}
+}
+
+Stretch MeasureStretch(const bbk::ClothGrid& cloth)
+{
+	Stretch stretch = {0.0f, 0.0f, 0.0f, true};
+	unsigned numSprings = 0;
+	for (unsigned row = 0; row < cloth.GetNumRows(); ++row)
+	{
+		for (unsigned col = 0; col < cloth.GetNumCols(); ++col)
+		{
+			const bbk::Vector3 pos(cloth.GetPosition(row, col));
+			for (int dir = 0; dir < 2; ++dir)
+			{
+				const unsigned otherRow = row + dir;
+				const unsigned otherCol = col + 1 - dir;
+				if (otherRow >= cloth.GetNumRows() || otherCol >= cloth.GetNumCols())
+					continue;
+
+				const float ratio = (cloth.GetPosition(otherRow, otherCol) - pos).Magnitude() / Spacing;
+				stretch.bFinite    = stretch.bFinite && ratio == ratio && ratio < FLT_MAX;
+				stretch.max        = std::max(stretch.max, ratio);
+				stretch.mean      += ratio;
+				stretch.meanError += std::fabs(ratio - 1.0f);
+				++numSprings;
+			}
+		}
+	}
+	if (numSprings)
+	{
+		stretch.mean      /= static_cast<float>(numSprings);
+		stretch.meanError /= static_cast<float>(numSprings);
+	}
+	return stretch;
+}
+
+float GetMaxSpeed(const bbk::ClothGrid& cloth)
+{
+	float maxSpeedSq = 0.0f;
+	for (unsigned row = 0; row < cloth.GetNumRows(); ++row)
+	{
+		for (unsigned col = 0; col < cloth.GetNumCols(); ++col)
+			maxSpeedSq = std::max(maxSpeedSq, cloth.GetVelocity(row, col).MagnitudeSq());
+	}
+	return std::sqrt(maxSpeedSq);
+}
+
+void GetPositions(const bbk::ClothGrid& cloth, std::vector<bbk::Vector3>& positions)
+{
+	positions.clear();
+	for (unsigned row = 0; row < cloth.GetNumRows(); ++row)
+	{
+		for (unsigned col = 0; col < cloth.GetNumCols(); ++col)
+			positions.push_back(cloth.GetPosition(row, col));
+	}
+}
+
+bool TestStretch(bbk::ClothGrid::Solver solver)
+{
+	bbk::ClothGrid cloth(SheetSize, SheetSize, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+	::HangSheet(cloth, solver);
+
+	// Worst of every frame once the sheet has dropped into its springs
+	Stretch worst = {0.0f, 0.0f, 0.0f, true};
+	uint32_t ticks = 0;
+	for (unsigned frame = 0; frame < StretchFrames; ++frame)
+	{
+		cloth.AddUniformForce(bbk::Vector3(0.0f, -Gravity, 0.0f));
+		const uint32_t start = SDL_GetTicks();
+		cloth.Step(Deltatime);
+		ticks += SDL_GetTicks() - start;
+
+		if (frame < StretchWarmup)
+			continue;
+		const Stretch stretch = ::MeasureStretch(cloth);
+		worst.max     = std::max(worst.max, stretch.max);
+		worst.mean    = std::max(worst.mean, stretch.mean);
+		worst.bFinite = worst.bFinite && stretch.bFinite;
+	}
+
+	std::fprintf(stdout, "Stretch: %s %ux%u sheet, %.2f ms per frame, longest spring %.3f, mean %.4f of rest length\n",
+		::GetSolverName(solver), SheetSize, SheetSize, static_cast<float>(ticks) / static_cast<float>(StretchFrames), worst.max, worst.mean);
+	if (!worst.bFinite || worst.max > MaxStretch || worst.mean > MaxMeanStretch)
+	{
+		std::fprintf(stdout, "Stretch: %s sheet stretched beyond %.2f longest, %.2f mean\n", ::GetSolverName(solver), MaxStretch, MaxMeanStretch);
+		return false;
+	}
+	return true;
+}
+
+bool TestConvergence()
+{
+	// Sheets in the same state take their last frame with more substeps of one
+	// iteration, then more iterations of one substep; either way the sheet
+	// should end up closer to its rest lengths
+	const unsigned counts[] = {1, 2, 4, 8};
+	const int      numCounts = sizeof(counts) / sizeof(counts[0]);
+	float substepErrors[numCounts], iterationErrors[numCounts];
+	for (int i = 0; i < numCounts; ++i)
+	{
+		for (int bIterations = 0; bIterations < 2; ++bIterations)
+		{
+			bbk::ClothGrid cloth(SmallSize, SmallSize, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+			::HangSheet(cloth, bbk::ClothGrid::XPBD);
+			for (unsigned frame = 0; frame < CompareFrames; ++frame)
+			{
+				::ApplyForces(cloth, frame);
+				cloth.Step(Deltatime);
+			}
+
+			cloth.SetNumSubsteps(bIterations ? 1 : counts[i]);
+			cloth.SetNumIterations(bIterations ? counts[i] : 1);
+			::ApplyForces(cloth, CompareFrames);
+			cloth.Step(Deltatime);
+			(bIterations ? iterationErrors : substepErrors)[i] = ::MeasureStretch(cloth).meanError;
+		}
+	}
+
+	for (int i = 0; i < numCounts; ++i)
+	{
+		std::fprintf(stdout, "Convergence: XPBD x%u, mean spring error %.5f over substeps, %.5f over iterations\n",
+			counts[i], substepErrors[i], iterationErrors[i]);
+	}
+	for (int i = 1; i < numCounts; ++i)
+	{
+		if (!(substepErrors[i] < substepErrors[i - 1]) || !(iterationErrors[i] < iterationErrors[i - 1]))
+		{
+			std::fprintf(stdout, "Convergence: XPBD error did not shrink going from x%u to x%u\n", counts[i - 1], counts[i]);
+			return false;
+		}
+	}
+
+	// Position corrections take energy out, so with the defaults the sheet comes to rest
+	bbk::ClothGrid cloth(SmallSize, SmallSize, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+	::HangSheet(cloth, bbk::ClothGrid::XPBD);
+	for (unsigned frame = 0; frame < SettleFrames; ++frame)
+	{
+		cloth.AddUniformForce(bbk::Vector3(0.0f, -Gravity, 0.0f));
+		cloth.Step(Deltatime);
+	}
+	const float maxSpeed = ::GetMaxSpeed(cloth);
+	std::fprintf(stdout, "Convergence: XPBD %ux%u sheet moving at most %.4f m/s after %u frames\n", SmallSize, SmallSize, maxSpeed, SettleFrames);
+	if (!(maxSpeed <= MaxSettleSpeed))
+	{
+		std::fprintf(stdout, "Convergence: XPBD sheet did not come to rest\n");
+		return false;
+	}
+	return true;
+}
+
+bool TestColours()
+{
+	const unsigned sizes[][2] = {{1, 1}, {1, 8}, {3, 3}, {5, 5}, {13, 10}, {SmallSize, SmallSize}, {SheetSize, SheetSize}};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		const unsigned rows = sizes[i][0], cols = sizes[i][1];
+		const bbk::ClothGrid cloth(rows, cols, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+		const unsigned numColours = cloth.GetNumColours();
+
+		// A particle 2 or more from every edge has all 12 springs
+		const bool bHasInterior = rows >= 5 && cols >= 5;
+		if (numColours > MaxColours || (bHasInterior && numColours < MinColours) || (rows == 1 && cols == 1 && numColours != 0))
+		{
+			std::fprintf(stdout, "Colours: %ux%u sheet has %u colours\n", rows, cols, numColours);
+			return false;
+		}
+		if (rows == SheetSize)
+			std::fprintf(stdout, "Colours: %ux%u sheet has %u colours\n", rows, cols, numColours);
+	}
+	return true;
+}
+
+bool TestWorkerCounts(bbk::ClothGrid::Solver solver, unsigned numWorkers)
+{
+	// 0 runs single-threaded, and is the result the others must match bit for bit
+	const unsigned workerCounts[] = {0, 1, 2, 3, 7};
+	std::vector<bbk::Vector3> expected, positions;
+	for (size_t i = 0; i < sizeof(workerCounts) / sizeof(workerCounts[0]); ++i)
+	{
+		bbk::jobs::Halt();
+		bbk::jobs::Init(workerCounts[i]);
+		bbk::jobs::SetSingleThreaded(workerCounts[i] == 0);
+
+		bbk::ClothGrid cloth(SmallSize, SmallSize, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+		::HangSheet(cloth, solver);
+		for (unsigned frame = 0; frame < CompareFrames; ++frame)
+		{
+			::ApplyForces(cloth, frame);
+			cloth.Step(Deltatime);
+		}
+
+		::GetPositions(cloth, i == 0 ? expected : positions);
+		if (i > 0 && std::memcmp(&positions[0], &expected[0], expected.size() * sizeof(bbk::Vector3)) != 0)
+		{
+			std::fprintf(stdout, "WorkerCounts: %s sheet differs with %u workers\n", ::GetSolverName(solver), bbk::jobs::GetNumWorkers());
+			bbk::jobs::SetSingleThreaded(false);
+			return false;
+		}
+	}
+
+	bbk::jobs::SetSingleThreaded(false);
+	bbk::jobs::Halt();
+	bbk::jobs::Init(numWorkers);
+	std::fprintf(stdout, "WorkerCounts: %s sheet identical with 0 to %u workers\n", ::GetSolverName(solver), workerCounts[sizeof(workerCounts) / sizeof(workerCounts[0]) - 1]);
+	return true;
+}
+
+bool TestMesh()
+{
+	const unsigned rows = 5, cols = 4;
+	bbk::ClothGrid cloth(rows, cols, Spacing, bbk::Point3(0.0f, 0.0f, 0.0f));
+	bbk::ClothMesh mesh(cloth);
+
+	const std::vector<bbk::Vertex>   &verts = mesh.GetVertices();
+	const std::vector<unsigned>      &tris  = mesh.GetTriIndices();
+	const std::vector<unsigned>      &lines = mesh.GetLineIndices();
+	if (verts.size() != rows * cols || tris.size() != 6 * (rows - 1) * (cols - 1) || lines.size() != 2 * (rows * (cols - 1) + (rows - 1) * cols))
+	{
+		std::fprintf(stdout, "Mesh: %u vertices, %u triangle and %u line indices for a %ux%u sheet\n",
+			static_cast<unsigned>(verts.size()), static_cast<unsigned>(tris.size()), static_cast<unsigned>(lines.size()), rows, cols);
+		return false;
+	}
+
+	// Flat sheet faces colDir x rowDir, and triangles wind the same way
+	const bbk::Vector3 facing(bbk::Vector3(1.0f, 0.0f, 0.0f).Cross(bbk::Vector3(0.0f, -1.0f, 0.0f)));
+	for (size_t i = 0; i < tris.size(); i += 3)
+	{
+		const bbk::Vector3 faceNormal((verts[tris[i + 1]].pos - verts[tris[i]].pos).Cross(verts[tris[i + 2]].pos - verts[tris[i]].pos));
+		if (!(faceNormal.Dot(facing) > 0.0f))
+		{
+			std::fprintf(stdout, "Mesh: Triangle %u winds away from the sheet's normal\n", static_cast<unsigned>(i / 3));
+			return false;
+		}
+	}
+
+	// Once the sheet has moved, vertices follow it and normals stay unit length
+	cloth.SetPinned(0, 0, true);
+	for (unsigned frame = 0; frame < CompareFrames; ++frame)
+	{
+		::ApplyForces(cloth, frame);
+		cloth.Step(Deltatime);
+	}
+	mesh.Update(cloth);
+	for (unsigned row = 0; row < rows; ++row)
+	{
+		for (unsigned col = 0; col < cols; ++col)
+		{
+			const bbk::Vertex &vtx = verts[row * cols + col];
+			if ((vtx.pos - cloth.GetPosition(row, col)).MagnitudeSq() != 0.0f || std::fabs(vtx.nrm.MagnitudeSq() - 1.0f) > 1e-4f)
+			{
+				std::fprintf(stdout, "Mesh: Vertex (%u, %u) does not follow the sheet\n", row, col);
+				return false;
+			}
+		}
+	}
+	std::fprintf(stdout, "Mesh: %ux%u sheet, %u triangles follow the simulation\n", rows, cols, static_cast<unsigned>(tris.size() / 3));
+	return true;
+}
+} // anon namespace
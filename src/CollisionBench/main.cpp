@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "sdl/SDL.h"
+#include "intersect/intersect.h"
+#include "intersect/sweepandprune.h"
+#include "graphics/resources/mesh.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const unsigned NumFrames        = 30;
+const unsigned NumBruteFrames   = 3;     ///< All-pairs is too slow to run every frame at high counts
+const float    BodyHalfSize     = 0.5f;
+const float    BodiesPerUnit3   = 0.05f; ///< Density kept constant as counts grow
+const float    MaxSpeed         = 0.05f; ///< Per frame
+const unsigned SphereRings      = 32;    ///< Narrow phase mesh has 4 * rings^2 triangles
+const unsigned MaxContacts      = 1 << 16;
+const unsigned NumNarrowRepeats = 20;
+const unsigned RaysPerSide      = 256;   ///< Ray batches are a square grid of this many rays per side
+const unsigned NumRayRepeats    = 10;
+const float    RayTolerance     = 1e-4f; ///< Relative, as the single-ray path tests triangles in world frame
+const float    EdgeTolerance    = 1e-5f; ///< Barycentric distance from the edge slack within which only one walk may hit
+
+/// Boxes moving inside a cube, bouncing off its walls
+struct Scene
+{
+	std::vector<bbk::AABB>    boxes;
+	std::vector<bbk::Vector3> velocities;
+	float                     halfWidth;
+}; // struct Scene
+
+bool  PairLess(const bbk::OverlapPair& lhs, const bbk::OverlapPair& rhs);
+bool  PairEqual(const bbk::OverlapPair& lhs, const bbk::OverlapPair& rhs);
+float Random(float lo, float hi);
+void  InitScene(Scene& scene, unsigned numBodies);
+void  MoveScene(Scene& scene);
+void  BruteForcePairs(const Scene& scene, std::vector<bbk::OverlapPair>& pairs);
+bool  TestBodyCount(unsigned numBodies);
+void  BuildSphereTris(std::vector<bbk::Vector3>& verts);
+unsigned BruteForceContacts(const bbk::BVH& bvhA, const bbk::Matrix4x4& transformA, const bbk::BVH& bvhB, const bbk::Matrix4x4& transformB);
+bool  TestNarrowPhase();
+bool  LoadMeshTris(const char *filename, std::vector<bbk::Vector3>& verts);
+void  RaycastRecursive(const bbk::BVH& bvh, const bbk::Matrix4x4& transform, float scale, const bbk::Ray& ray, unsigned node, bbk::RayHit& hit);
+float MinWeight(const bbk::RayHit& hit);
+unsigned CompareHits(const std::vector<bbk::RayHit>& packetHits, const std::vector<bbk::RayHit>& singleHits, unsigned& numHits, unsigned& numGrazes);
+bool  TestRaycast(const char *filename);
+} // anon namespace
+
+/**
+ * Headless benchmark of the collision pipeline. Compares the sweep and prune
+ * broad phase against brute-force all-pairs tests on moving boxes, and the
+ * BVH narrow phase against testing every triangle pair of two meshes, and
+ * packet ray casts against the recursive single-ray BVH walk, checking that
+ * both sides of each comparison agree. Meshes are loaded from the working
+ * directory.
+ */
+int main(int argc, char *argv[])
+{
+	const unsigned numWorkers = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 0;
+
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+	{
+		std::fprintf(stdout, "CollisionBench: Failed to init SDL timer\n");
+		return 1;
+	}
+	bbk::jobs::Init(numWorkers);
+	std::fprintf(stdout, "CollisionBench: %u worker threads\n", bbk::jobs::GetNumWorkers());
+	std::srand(1);
+
+	const unsigned bodyCounts[] = {1000, 5000, 20000, 50000};
+	unsigned numFailed = 0;
+	for (size_t i = 0; i < sizeof(bodyCounts) / sizeof(bodyCounts[0]); ++i)
+	{
+		if (!::TestBodyCount(bodyCounts[i]))
+			++numFailed;
+	}
+	if (!::TestNarrowPhase())
+		++numFailed;
+
+	const char *rayMeshes[] = {"duck.dae", "sphere.dae"};
+	for (size_t i = 0; i < sizeof(rayMeshes) / sizeof(rayMeshes[0]); ++i)
+	{
+		if (!::TestRaycast(rayMeshes[i]))
+			++numFailed;
+	}
+
+	bbk::jobs::Halt();
+	SDL_Quit();
+
+	if (numFailed)
+	{
+		std::fprintf(stdout, "CollisionBench: %u tests failed\n", numFailed);
+		return 1;
+	}
+	std::fprintf(stdout, "CollisionBench: All tests passed\n");
+	return 0;
+}
+
+namespace
+{
+bool PairLess(const bbk::OverlapPair& lhs, const bbk::OverlapPair& rhs)
+{
+	return lhs.a < rhs.a || (lhs.a == rhs.a && lhs.b < rhs.b);
+}
+
+bool PairEqual(const bbk::OverlapPair& lhs, const bbk::OverlapPair& rhs)
+{
+	return lhs.a == rhs.a && lhs.b == rhs.b;
+}
+
+float Random(float lo, float hi)
+{
+	return lo + (hi - lo) * (static_cast<float>(std::rand()) / RAND_MAX);
+}
+
+void InitScene(Scene& scene, unsigned numBodies)
+{
+	scene.halfWidth = 0.5f * std::pow(numBodies / ::BodiesPerUnit3, 1.0f / 3.0f);
+	scene.boxes.resize(numBodies);
+	scene.velocities.resize(numBodies);
+	for (unsigned i = 0; i < numBodies; ++i)
+	{
+		const float w = scene.halfWidth - ::BodyHalfSize;
+		scene.boxes[i] = bbk::AABB(
+			bbk::Vector3(::Random(-w, w), ::Random(-w, w), ::Random(-w, w)),
+			bbk::Vector3(::BodyHalfSize, ::BodyHalfSize, ::BodyHalfSize) * ::Random(0.5f, 1.5f));
+		scene.velocities[i] = bbk::Vector3(
+			::Random(-::MaxSpeed, ::MaxSpeed), ::Random(-::MaxSpeed, ::MaxSpeed), ::Random(-::MaxSpeed, ::MaxSpeed));
+	}
+}
+
+void MoveScene(Scene& scene)
+{
+	for (size_t i = 0; i < scene.boxes.size(); ++i)
+	{
+		bbk::AABB    &box = scene.boxes[i];
+		bbk::Vector3 &vel = scene.velocities[i];
+		box.center += vel;
+
+		const float w = scene.halfWidth - ::BodyHalfSize;
+		if (box.center.x < -w || box.center.x > w)
+			vel.x = -vel.x;
+		if (box.center.y < -w || box.center.y > w)
+			vel.y = -vel.y;
+		if (box.center.z < -w || box.center.z > w)
+			vel.z = -vel.z;
+	}
+}
+
+void BruteForcePairs(const Scene& scene, std::vector<bbk::OverlapPair>& pairs)
+{
+	pairs.clear();
+	const size_t n = scene.boxes.size();
+	for (size_t i = 0; i < n; ++i)
+	{
+		const bbk::AABB   &a = scene.boxes[i];
+		const bbk::Vector3 minA(a.center - a.diag), maxA(a.center + a.diag);
+		for (size_t j = i + 1; j < n; ++j)
+		{
+			// Same min/max rounding as the broad phase, so touching boxes agree
+			const bbk::AABB   &b = scene.boxes[j];
+			const bbk::Vector3 minB(b.center - b.diag), maxB(b.center + b.diag);
+			if (minB.x > maxA.x || maxB.x < minA.x ||
+			    minB.y > maxA.y || maxB.y < minA.y ||
+			    minB.z > maxA.z || maxB.z < minA.z)
+				continue;
+
+			const bbk::OverlapPair pair = {static_cast<int>(i), static_cast<int>(j)};
+			pairs.push_back(pair);
+		}
+	}
+}
+
+bool TestBodyCount(unsigned numBodies)
+{
+	Scene scene;
+	::InitScene(scene, numBodies);
+
+	bbk::SweepAndPrune sap;
+	std::vector<int>   proxies(numBodies);
+	for (unsigned i = 0; i < numBodies; ++i)
+		proxies[i] = sap.CreateProxy(scene.boxes[i]);
+
+	// First update sorts from scratch, so it is left out of the timings
+	sap.UpdatePairs();
+
+	uint32_t sapTicks = 0, bruteTicks = 0;
+	unsigned numSwaps = 0;
+	size_t   numPairs = 0;
+	std::vector<bbk::OverlapPair> sapPairs, brutePairs;
+	for (unsigned frame = 0; frame < ::NumFrames; ++frame)
+	{
+		::MoveScene(scene);
+
+		uint32_t start = SDL_GetTicks();
+		for (unsigned i = 0; i < numBodies; ++i)
+			sap.MoveProxy(proxies[i], scene.boxes[i]);
+		sap.UpdatePairs();
+		sapTicks += SDL_GetTicks() - start;
+		numSwaps += sap.GetNumSwaps();
+		numPairs += sap.GetPairs().size();
+
+		if (frame >= ::NumBruteFrames)
+			continue;
+
+		start = SDL_GetTicks();
+		::BruteForcePairs(scene, brutePairs);
+		bruteTicks += SDL_GetTicks() - start;
+
+		// Proxies were created in body order, so proxy and body indices match
+		sapPairs = sap.GetPairs();
+		std::sort(sapPairs.begin(), sapPairs.end(), ::PairLess);
+		if (sapPairs.size() != brutePairs.size() || !std::equal(sapPairs.begin(), sapPairs.end(), brutePairs.begin(), ::PairEqual))
+		{
+			std::fprintf(stdout, "%u bodies: Frame %u found %u pairs, brute force %u\n", numBodies, frame,
+				static_cast<unsigned>(sapPairs.size()), static_cast<unsigned>(brutePairs.size()));
+			return false;
+		}
+	}
+
+	std::fprintf(stdout, "%u bodies: %.2f ms sweep and prune, %.2f ms brute force per frame, %u pairs, %u swaps\n",
+		numBodies,
+		static_cast<float>(sapTicks) / ::NumFrames,
+		static_cast<float>(bruteTicks) / ::NumBruteFrames,
+		static_cast<unsigned>(numPairs / ::NumFrames),
+		numSwaps / ::NumFrames);
+	return true;
+}
+
+void BuildSphereTris(std::vector<bbk::Vector3>& verts)
+{
+	const float pi = 3.14159265f;
+	verts.clear();
+	for (unsigned ring = 0; ring < ::SphereRings; ++ring)
+	{
+		const float theta0 = pi * ring / ::SphereRings, theta1 = pi * (ring + 1) / ::SphereRings;
+		for (unsigned seg = 0; seg < 2 * ::SphereRings; ++seg)
+		{
+			const float phi0 = pi * seg / ::SphereRings, phi1 = pi * (seg + 1) / ::SphereRings;
+			const bbk::Vector3 p00(std::sin(theta0) * std::cos(phi0), std::cos(theta0), std::sin(theta0) * std::sin(phi0));
+			const bbk::Vector3 p01(std::sin(theta0) * std::cos(phi1), std::cos(theta0), std::sin(theta0) * std::sin(phi1));
+			const bbk::Vector3 p10(std::sin(theta1) * std::cos(phi0), std::cos(theta1), std::sin(theta1) * std::sin(phi0));
+			const bbk::Vector3 p11(std::sin(theta1) * std::cos(phi1), std::cos(theta1), std::sin(theta1) * std::sin(phi1));
+			const bbk::Vector3 quad[6] = {p00, p10, p11, p00, p11, p01};
+			verts.insert(verts.end(), quad, quad + 6);
+		}
+	}
+}
+
+unsigned BruteForceContacts(const bbk::BVH& bvhA, const bbk::Matrix4x4& transformA, const bbk::BVH& bvhB, const bbk::Matrix4x4& transformB)
+{
+	// Same frame and rounding as BVHvsBVH: b's triangles moved into a's model frame
+	const bbk::Matrix4x4 bToA(bbk::Matrix4x4::MakeInverse(transformA) * transformB);
+	const float *m = bToA.elements;
+
+	unsigned numContacts = 0;
+	for (size_t j = 0; j < bvhB.triVerts.size(); j += 3)
+	{
+		bbk::Point3 triB[3];
+		for (int v = 0; v < 3; ++v)
+		{
+			const bbk::Point3 &p = bvhB.triVerts[j + v];
+			triB[v] = bbk::Point3(
+				m[12] + m[0] * p.x + m[4] * p.y + m[8]  * p.z,
+				m[13] + m[1] * p.x + m[5] * p.y + m[9]  * p.z,
+				m[14] + m[2] * p.x + m[6] * p.y + m[10] * p.z);
+		}
+		for (size_t i = 0; i < bvhA.triVerts.size(); i += 3)
+		{
+			bbk::Point3 segment[2];
+			if (bbk::TrivsTri(&bvhA.triVerts[i], triB, segment))
+				++numContacts;
+		}
+	}
+	return numContacts;
+}
+
+bool TestNarrowPhase()
+{
+	std::vector<bbk::Vector3> verts;
+	::BuildSphereTris(verts);
+	bbk::BVH *bvh = bbk::BuildBVH(&verts[0], verts.size(), bbk::E_BVH_SAH);
+	std::vector<bbk::Contact> contacts(::MaxContacts);
+
+	// Second sphere rotated, scaled and moved from touching deeply to apart
+	const float offsets[] = {0.5f, 1.2f, 2.1f, 2.5f};
+	const bbk::Matrix4x4 transformA(bbk::Matrix4x4::MakeRotate(0.3f, 1.0f, 0.2f, 0.7f));
+	bool bPassed = true;
+	for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]) && bPassed; ++i)
+	{
+		const bbk::Matrix4x4 transformB(
+			bbk::Matrix4x4::MakeTranslate(offsets[i], 0.1f, 0.0f) *
+			bbk::Matrix4x4::MakeRotate(1.0f, 0.0f, 0.5f, 1.1f) *
+			bbk::Matrix4x4::MakeUniScale(1.2f));
+
+		uint32_t start = SDL_GetTicks();
+		unsigned numContacts = 0;
+		for (unsigned repeat = 0; repeat < ::NumNarrowRepeats; ++repeat)
+			numContacts = bbk::BVHvsBVH(*bvh, transformA, *bvh, transformB, &contacts[0], ::MaxContacts);
+		const uint32_t bvhTicks = SDL_GetTicks() - start;
+
+		start = SDL_GetTicks();
+		const unsigned numBrute = ::BruteForceContacts(*bvh, transformA, *bvh, transformB);
+		const uint32_t bruteTicks = SDL_GetTicks() - start;
+
+		std::fprintf(stdout, "Narrow phase, offset %.1f: %.2f ms BVH, %u ms all triangle pairs, %u contacts\n",
+			offsets[i], static_cast<float>(bvhTicks) / ::NumNarrowRepeats, bruteTicks, numContacts);
+		if (numContacts != numBrute)
+		{
+			std::fprintf(stdout, "Narrow phase: BVH found %u contacts, all triangle pairs %u\n", numContacts, numBrute);
+			bPassed = false;
+		}
+	}
+
+	delete bvh;
+	return bPassed;
+}
+
+bool LoadMeshTris(const char *filename, std::vector<bbk::Vector3>& verts)
+{
+	bbk::Mesh mesh;
+	if (!mesh.LoadMeshFromFile(filename))
+		return false;
+
+	const bbk::Vertex *vertices = mesh.GetVertexArray();
+	verts.resize(mesh.GetNumVertices());
+	for (size_t i = 0; i < verts.size(); ++i)
+		verts[i] = vertices[i].pos;
+	return !verts.empty();
+}
+
+void RaycastRecursive(const bbk::BVH& bvh, const bbk::Matrix4x4& transform, float scale, const bbk::Ray& ray, unsigned node, bbk::RayHit& hit)
+{
+	// Node volumes moved to world frame per test, as the Sandbox's picking does
+	bbk::OBB obb(bbk::TransformOBB(transform, bvh.nodes[node].obb));
+	obb.halfExtents *= scale;
+	float intersects[2];
+	if (!bbk::LinevsOBB(bbk::Line(ray.pt, ray.vec), obb, intersects) || intersects[0] > hit.t)
+		return;
+
+	const bbk::BVHNode &bvhNode = bvh.nodes[node];
+	if (!bvhNode.IsLeaf())
+	{
+		::RaycastRecursive(bvh, transform, scale, ray, bvh.GetLeftChild(node), hit);
+		::RaycastRecursive(bvh, transform, scale, ray, bvh.GetRightChild(node), hit);
+		return;
+	}
+
+	const float *m = transform.elements;
+	for (unsigned i = bvhNode.firstTri; i < bvhNode.firstTri + bvhNode.numTris; ++i)
+	{
+		const bbk::Vector3 *src = bvh.GetTri(i);
+		bbk::Point3 tri[3];
+		for (int v = 0; v < 3; ++v)
+		{
+			tri[v] = bbk::Point3(
+				m[12] + m[0] * src[v].x + m[4] * src[v].y + m[8]  * src[v].z,
+				m[13] + m[1] * src[v].x + m[5] * src[v].y + m[9]  * src[v].z,
+				m[14] + m[2] * src[v].x + m[6] * src[v].y + m[10] * src[v].z);
+		}
+
+		float t, u, v;
+		if (bbk::RayvsTri(ray, tri, t, u, v) && t < hit.t)
+		{
+			hit.t   = t;
+			hit.tri = static_cast<int>(bvh.triIndices[i]);
+			hit.u   = u;
+			hit.v   = v;
+		}
+	}
+}
+
+float MinWeight(const bbk::RayHit& hit)
+{
+	return std::min(std::min(hit.u, hit.v), 1.0f - hit.u - hit.v);
+}
+
+unsigned CompareHits(const std::vector<bbk::RayHit>& packetHits, const std::vector<bbk::RayHit>& singleHits, unsigned& numHits, unsigned& numGrazes)
+{
+	// Rays through shared edges may report either triangle, so only distances are compared
+	unsigned numMismatches = 0;
+	numHits   = 0;
+	numGrazes = 0;
+	for (size_t i = 0; i < packetHits.size(); ++i)
+	{
+		const bbk::RayHit &a = packetHits[i], &b = singleHits[i];
+		if (a.tri >= 0)
+			++numHits;
+		if ((a.tri < 0) == (b.tri < 0) &&
+			(a.tri < 0 || std::fabs(a.t - b.t) <= ::RayTolerance * std::max(1.0f, b.t)))
+			continue;
+
+		// The walk with the nearer hit found a triangle the other passed by. Both allow the
+		// same edge slack, so that is only rounding when the hit lies right at the slack.
+		const bbk::RayHit &nearer = b.tri < 0 || (a.tri >= 0 && a.t < b.t) ? a : b;
+		if (std::fabs(::MinWeight(nearer) + bbk::TriEdgeEpsilon) <= ::EdgeTolerance)
+			++numGrazes;
+		else
+			++numMismatches;
+	}
+	return numMismatches;
+}
+
+bool TestRaycast(const char *filename)
+{
+	std::vector<bbk::Vector3> verts;
+	if (!::LoadMeshTris(filename, verts))
+	{
+		std::fprintf(stdout, "Raycast: Failed to load %s\n", filename);
+		return false;
+	}
+	bbk::BVH *bvh = bbk::BuildBVH(&verts[0], verts.size(), bbk::E_BVH_SAH);
+
+	const float scale = 1.5f;
+	const bbk::Matrix4x4 transform(
+		bbk::Matrix4x4::MakeTranslate(2.0f, -1.0f, 3.0f) *
+		bbk::Matrix4x4::MakeRotate(0.8f, 0.3f, 1.0f, 0.2f) *
+		bbk::Matrix4x4::MakeUniScale(scale));
+
+	// Rays are aimed at the mesh's bounding sphere in world frame
+	bbk::Vector3 lo(verts[0]), hi(verts[0]);
+	for (size_t i = 1; i < verts.size(); ++i)
+	{
+		lo = bbk::Vector3(std::min(lo.x, verts[i].x), std::min(lo.y, verts[i].y), std::min(lo.z, verts[i].z));
+		hi = bbk::Vector3(std::max(hi.x, verts[i].x), std::max(hi.y, verts[i].y), std::max(hi.z, verts[i].z));
+	}
+	const bbk::Point3 localCenter((lo + hi) * 0.5f);
+	const float *m = transform.elements;
+	const bbk::Point3 center(
+		m[12] + m[0] * localCenter.x + m[4] * localCenter.y + m[8]  * localCenter.z,
+		m[13] + m[1] * localCenter.x + m[5] * localCenter.y + m[9]  * localCenter.z,
+		m[14] + m[2] * localCenter.x + m[6] * localCenter.y + m[10] * localCenter.z);
+	const float radius = (hi - lo).Magnitude() * 0.5f * scale;
+
+	// Coherent batch: a view from one eye point through a grid over the mesh.
+	// Scattered batch: each ray from a random point around the mesh to a random point in it.
+	const unsigned numRays = ::RaysPerSide * ::RaysPerSide;
+	std::vector<bbk::Ray> batches[2];
+	const bbk::Point3 eye(center + bbk::Vector3(0.0f, 0.0f, 3.0f * radius));
+	for (unsigned i = 0; i < numRays; ++i)
+	{
+		const float x = radius * (2.0f * (i % ::RaysPerSide) / (::RaysPerSide - 1) - 1.0f);
+		const float y = radius * (2.0f * (i / ::RaysPerSide) / (::RaysPerSide - 1) - 1.0f);
+		batches[0].push_back(bbk::Ray(eye, (center + bbk::Vector3(x, y, 0.0f) - eye).Normalise()));
+
+		const bbk::Vector3 from(::Random(-1.0f, 1.0f), ::Random(-1.0f, 1.0f), ::Random(-1.0f, 1.0f));
+		const bbk::Vector3 to(::Random(-0.5f, 0.5f), ::Random(-0.5f, 0.5f), ::Random(-0.5f, 0.5f));
+		const bbk::Point3  origin(center + from.Normalise() * (3.0f * radius));
+		batches[1].push_back(bbk::Ray(origin, (center + to * radius - origin).Normalise()));
+	}
+
+	const char *batchNames[2] = {"coherent", "scattered"};
+	std::vector<bbk::RayHit> packetHits(numRays), singleHits(numRays);
+	bool bPassed = true;
+	for (int batch = 0; batch < 2; ++batch)
+	{
+		const std::vector<bbk::Ray> &rays = batches[batch];
+
+		uint32_t start = SDL_GetTicks();
+		for (unsigned repeat = 0; repeat < ::NumRayRepeats; ++repeat)
+			bbk::RaycastBVH(*bvh, transform, &rays[0], numRays, &packetHits[0]);
+		const uint32_t packetTicks = SDL_GetTicks() - start;
+
+		start = SDL_GetTicks();
+		for (unsigned i = 0; i < numRays; ++i)
+		{
+			bbk::RayHit &hit = singleHits[i];
+			hit.t   = FLT_MAX;
+			hit.tri = -1;
+			::RaycastRecursive(*bvh, transform, scale, rays[i], 0, hit);
+		}
+		const uint32_t singleTicks = SDL_GetTicks() - start;
+
+		unsigned numHits, numGrazes;
+		const unsigned numMismatches = ::CompareHits(packetHits, singleHits, numHits, numGrazes);
+		std::fprintf(stdout, "Raycast %s, %u tris, %u %s rays: %.2f ms packets, %u ms single rays, %u hits, %u edge grazes\n",
+			filename, static_cast<unsigned>(verts.size() / 3), numRays, batchNames[batch],
+			static_cast<float>(packetTicks) / ::NumRayRepeats, singleTicks, numHits, numGrazes);
+		if (numMismatches)
+		{
+			std::fprintf(stdout, "Raycast %s: %u of %u rays differ from single-ray walk\n", filename, numMismatches, numRays);
+			bPassed = false;
+		}
+	}
+
+	delete bvh;
+	return bPassed;
+}
+} // anon namespace
@@ -0,0 +1,286 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "sdl/SDL.h"
+#include "platform/jobs.h"
+
+namespace
+{
+const size_t NumElements  = 1 << 22;
+const size_t GrainSize    = 4096;
+const size_t NumJobs      = 20000;
+const size_t NumStages    = 8;
+const size_t StageWidth   = 64;
+const unsigned NumRepeats = 5;
+
+/// Input and per-chunk partial sums of the ParallelFor benchmark
+struct SumData
+{
+	const float        *values;
+	std::vector<double> partials;
+}; // struct SumData
+
+/// Slot written by one job of the stress test
+struct StressJob
+{
+	unsigned index;
+	unsigned result;
+}; // struct StressJob
+
+/// One job of a stage that reads the previous stage's output
+struct StageJob
+{
+	const std::vector<unsigned> *src;
+	std::vector<unsigned>       *dst;
+	size_t                       index;
+}; // struct StageJob
+
+struct NestedJob
+{
+	SumData *sum;
+	double   result;
+}; // struct NestedJob
+
+void SumRange(size_t begin, size_t end, void *data);
+double ParallelSum(SumData& sum);
+void StressFunc(void *data);
+void StageFunc(void *data);
+void NestedFunc(void *data);
+
+bool TestStress();
+bool TestDependencies();
+bool TestParallelFor(const std::vector<float>& values);
+bool TestNested(const std::vector<float>& values);
+} // anon namespace
+
+/**
+ * Headless stress test and benchmark of the job system. Runs every test with
+ * workers and then single-threaded, and checks that both agree.
+ */
+int main(int argc, char *argv[])
+{
+	const unsigned numWorkers = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 0;
+
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+	{
+		std::fprintf(stdout, "JobsBench: Failed to init SDL timer\n");
+		return 1;
+	}
+	bbk::jobs::Init(numWorkers);
+	std::fprintf(stdout, "JobsBench: %u worker threads\n", bbk::jobs::GetNumWorkers());
+
+	std::vector<float> values(NumElements);
+	for (size_t i = 0; i < NumElements; ++i)
+		values[i] = std::sin(static_cast<float>(i) * 0.001f);
+
+	unsigned numFailed = 0;
+	if (!::TestStress())
+		++numFailed;
+	if (!::TestDependencies())
+		++numFailed;
+	if (!::TestParallelFor(values))
+		++numFailed;
+	if (!::TestNested(values))
+		++numFailed;
+
+	bbk::jobs::Halt();
+	SDL_Quit();
+
+	if (numFailed)
+	{
+		std::fprintf(stdout, "JobsBench: %u tests failed\n", numFailed);
+		return 1;
+	}
+	std::fprintf(stdout, "JobsBench: All tests passed\n");
+	return 0;
+}
+
+namespace
+{
+void SumRange(size_t begin, size_t end, void *data)
+{
+	SumData *sum = static_cast<SumData*>(data);
+	double partial = 0.0;
+	for (size_t i = begin; i < end; ++i)
+		partial += std::sqrt(std::fabs(sum->values[i])) * sum->values[i];
+	sum->partials[begin / GrainSize] = partial;
+}
+
+/// Sums chunk partials in chunk order, so result does not depend on threading
+double ParallelSum(SumData& sum)
+{
+	sum.partials.assign((NumElements + GrainSize - 1) / GrainSize, 0.0);
+	bbk::jobs::ParallelFor(NumElements, GrainSize, ::SumRange, &sum);
+
+	double total = 0.0;
+	for (size_t i = 0; i < sum.partials.size(); ++i)
+		total += sum.partials[i];
+	return total;
+}
+
+void StressFunc(void *data)
+{
+	StressJob *job = static_cast<StressJob*>(data);
+	unsigned hash = job->index;
+	for (unsigned i = 0; i < 64; ++i)
+		hash = hash * 1664525u + 1013904223u;
+	job->result = hash;
+}
+
+void StageFunc(void *data)
+{
+	const StageJob *job = static_cast<StageJob*>(data);
+	const std::vector<unsigned> &src = *job->src;
+
+	// Each output depends on neighbouring outputs of the previous stage
+	const size_t n = src.size();
+	(*job->dst)[job->index] = src[job->index] * 3u + src[(job->index + 1) % n] + src[(job->index + n - 1) % n];
+}
+
+void NestedFunc(void *data)
+{
+	NestedJob *job = static_cast<NestedJob*>(data);
+	job->result = ::ParallelSum(*job->sum);
+}
+
+bool TestStress()
+{
+	std::vector<StressJob> jobs(NumJobs);
+	uint32_t totalTicks = 0;
+	for (unsigned repeat = 0; repeat < NumRepeats; ++repeat)
+	{
+		for (size_t i = 0; i < NumJobs; ++i)
+		{
+			jobs[i].index  = static_cast<unsigned>(i);
+			jobs[i].result = 0;
+		}
+
+		const uint32_t start = SDL_GetTicks();
+		bbk::jobs::Counter counter;
+		for (size_t i = 0; i < NumJobs; ++i)
+			bbk::jobs::Run(::StressFunc, &jobs[i], &counter);
+		bbk::jobs::WaitForCounter(&counter);
+		totalTicks += SDL_GetTicks() - start;
+
+		for (size_t i = 0; i < NumJobs; ++i)
+		{
+			StressJob expected = {static_cast<unsigned>(i), 0};
+			::StressFunc(&expected);
+			if (jobs[i].result != expected.result)
+			{
+				std::fprintf(stdout, "Stress: Job %u has wrong result\n", static_cast<unsigned>(i));
+				return false;
+			}
+		}
+	}
+	std::fprintf(stdout, "Stress: %u jobs x %u in %u ms\n", static_cast<unsigned>(NumJobs), NumRepeats, totalTicks);
+	return true;
+}
+
+bool TestDependencies()
+{
+	// Stage k's jobs may only start once every job of stage k - 1 is done
+	std::vector< std::vector<unsigned> > buffers(NumStages + 1, std::vector<unsigned>(StageWidth));
+	for (size_t i = 0; i < StageWidth; ++i)
+		buffers[0][i] = static_cast<unsigned>(i);
+
+	std::vector<StageJob>           jobs(NumStages * StageWidth);
+	std::vector<bbk::jobs::Counter> counters(NumStages);
+	for (size_t stage = 0; stage < NumStages; ++stage)
+	{
+		for (size_t i = 0; i < StageWidth; ++i)
+		{
+			StageJob &job = jobs[stage * StageWidth + i];
+			job.src   = &buffers[stage];
+			job.dst   = &buffers[stage + 1];
+			job.index = i;
+			bbk::jobs::Run(::StageFunc, &job, &counters[stage], stage > 0 ? &counters[stage - 1] : nullptr);
+		}
+	}
+	bbk::jobs::WaitForCounter(&counters[NumStages - 1]);
+
+	// Same stages one after another
+	std::vector<unsigned> src(buffers[0]), dst(StageWidth);
+	for (size_t stage = 0; stage < NumStages; ++stage)
+	{
+		for (size_t i = 0; i < StageWidth; ++i)
+		{
+			StageJob job = {&src, &dst, i};
+			::StageFunc(&job);
+		}
+		src.swap(dst);
+	}
+
+	if (std::memcmp(&src[0], &buffers[NumStages][0], StageWidth * sizeof(unsigned)) != 0)
+	{
+		std::fprintf(stdout, "Dependencies: Stages ran out of order\n");
+		return false;
+	}
+	std::fprintf(stdout, "Dependencies: %u stages of %u jobs ran in order\n", static_cast<unsigned>(NumStages), static_cast<unsigned>(StageWidth));
+	return true;
+}
+
+bool TestParallelFor(const std::vector<float>& values)
+{
+	SumData sum;
+	sum.values = &values[0];
+
+	double   parallelSum = 0.0, serialSum = 0.0;
+	uint32_t parallelTicks = 0, serialTicks = 0;
+	for (unsigned repeat = 0; repeat < NumRepeats; ++repeat)
+	{
+		uint32_t start = SDL_GetTicks();
+		parallelSum = ::ParallelSum(sum);
+		parallelTicks += SDL_GetTicks() - start;
+
+		bbk::jobs::SetSingleThreaded(true);
+		start = SDL_GetTicks();
+		serialSum = ::ParallelSum(sum);
+		serialTicks += SDL_GetTicks() - start;
+		bbk::jobs::SetSingleThreaded(false);
+	}
+
+	std::fprintf(stdout, "ParallelFor: %u elements, %u ms parallel, %u ms single-threaded\n",
+		static_cast<unsigned>(NumElements), parallelTicks, serialTicks);
+	if (parallelSum != serialSum)
+	{
+		std::fprintf(stdout, "ParallelFor: Sum %.17g differs from single-threaded %.17g\n", parallelSum, serialSum);
+		return false;
+	}
+	return true;
+}
+
+bool TestNested(const std::vector<float>& values)
+{
+	// Jobs that run ParallelFor themselves, waiting on workers while holding one
+	const size_t numOuter = 4;
+	std::vector<SumData>   sums(numOuter);
+	std::vector<NestedJob> jobs(numOuter);
+	bbk::jobs::Counter counter;
+	for (size_t i = 0; i < numOuter; ++i)
+	{
+		sums[i].values = &values[0];
+		jobs[i].sum    = &sums[i];
+		jobs[i].result = 0.0;
+		bbk::jobs::Run(::NestedFunc, &jobs[i], &counter);
+	}
+	bbk::jobs::WaitForCounter(&counter);
+
+	SumData sum;
+	sum.values = &values[0];
+	const double expected = ::ParallelSum(sum);
+	for (size_t i = 0; i < numOuter; ++i)
+	{
+		if (jobs[i].result != expected)
+		{
+			std::fprintf(stdout, "Nested: Job %u has wrong sum\n", static_cast<unsigned>(i));
+			return false;
+		}
+	}
+	std::fprintf(stdout, "Nested: %u jobs each running ParallelFor\n", static_cast<unsigned>(numOuter));
+	return true;
+}
+} // anon namespace
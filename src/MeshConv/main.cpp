@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "graphics/model.h"
+#include "graphics/resources/mesh.h"
+#include "graphics/resources/meshfile.h"
+
+namespace
+{
+bool ConvertModel(const char *srcFilename, const char *dstFilename);
+bool ConvertCollada(const char *srcFilename, const char *dstFilename);
+} // anon namespace
+
+/**
+ * Converts an XML model or COLLADA (.dae) mesh into a binary mesh (.bbkm)
+ * that Model::LoadGeometryFromFile maps without parsing.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		std::fprintf(stdout, "Usage: MeshConv <model.xml | mesh.dae> <output.bbkm>\n");
+		return 1;
+	}
+
+	const std::string src(argv[1]);
+	const bool bCollada = src.size() > 4 && src.compare(src.size() - 4, 4, ".dae") == 0;
+	const bool bSuccess = bCollada ? ::ConvertCollada(argv[1], argv[2]) : ::ConvertModel(argv[1], argv[2]);
+
+	if (!bSuccess)
+	{
+		std::fprintf(stdout, "MeshConv: Failed to convert %s\n", argv[1]);
+		return 1;
+	}
+	std::fprintf(stdout, "MeshConv: Wrote %s\n", argv[2]);
+	return 0;
+}
+
+namespace
+{
+bool ConvertModel(const char *srcFilename, const char *dstFilename)
+{
+	// Raw load, so no BVH is built and no cache sidecar is left next to the source
+	bbk::Model model;
+	if (!model.LoadRawGeometryFromFile(srcFilename))
+		return false;
+	return model.SaveGeometryToFile(dstFilename);
+}
+
+bool ConvertCollada(const char *srcFilename, const char *dstFilename)
+{
+	bbk::Mesh mesh;
+	if (!mesh.LoadMeshFromFile(srcFilename))
+		return false;
+
+	bbk::MeshFileHeader header;
+
+	// Name mesh after source file, without directories or extension
+	std::string name(srcFilename);
+	const size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos)
+		name.erase(0, slash + 1);
+	const size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos)
+		name.erase(dot);
+	std::strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+
+	header.numVertices  = mesh.GetNumVertices();
+	header.numIndices   = mesh.GetNumVertices();
+	header.hasTexCoords = mesh.hasTexCoords() ? 1 : 0;
+	header.hasNormals   = mesh.hasNormals() ? 1 : 0;
+
+	// Bounding volumes are stored centered at origin, with offsets from model origin
+	const bbk::Vertex *vertices = mesh.GetVertexArray();
+	header.aabb        = mesh.GetAABB();
+	header.aabbOffset  = header.aabb.center;
+	header.aabb.center = bbk::Vector3();
+
+	header.obb        = mesh.GetOBB();
+	header.obbOffset  = header.obb.u * header.obb.center.x + header.obb.v * header.obb.center.y + header.obb.w * header.obb.center.z;
+	header.obb.center = bbk::Vector3();
+
+	header.bsphereOffset = header.aabbOffset;
+	for (size_t i = 0; i < mesh.GetNumVertices(); ++i)
+	{
+		const float dist = (vertices[i].pos - header.bsphereOffset).Magnitude();
+		if (dist > header.bsphere.radius)
+			header.bsphere.radius = dist;
+	}
+
+	return bbk::WriteMeshFile(dstFilename, header, vertices, mesh.GetVertIndexArray());
+}
+} // anon namespace
@@ -1,6 +1,7 @@
 #include "Sandbox.h"
 #include "bbk.h"
 #include <cstring>
+#include <vector>
 
 /*------------------------------------------------------------------------------
  * Structs */
@@ -82,26 +83,30 @@ bbk::Vector4 backgroundColor(0.16f, 0.16f, 0.16f, 1.0f);
 
 // Shader Program --------------------------------------------------------------
 unsigned int materialType   = TEX_NUM_TYPES;
+bbk::LocationMgr::UniformID uniLightPos = bbk::LocationMgr::INVALID_UNIFORM; ///< Updated every frame
+bbk::LocationMgr::UniformID uniLightDir = bbk::LocationMgr::INVALID_UNIFORM; ///< Updated every frame
 
 // Scene variables -------------------------------------------------------------
 bbk::Model* pSphereModel = nullptr;
 bbk::Model* pCubeModel   = nullptr;
 bbk::Model* pDuckModel   = nullptr;
 
+bbk::RigidBodyWorld* world = nullptr;
 bbk::BObject* obj;
 bool vsync = true;
 int  showOBBlvl = 0;
-bbk::BVHNode* pickedBVHNode = nullptr;
+int  pickedBVHNode = -1; ///< Index into the BVH node array, -1 if none
+bool showProfile = false;
 
 float        pushPower = 0.0f;
 bbk::Vector3 pushDisp;
 bbk::Vector3 pushVec;
 
-void DrawBVHLevel(bbk::BVHNode *root, size_t current, size_t target);
-void DrawBVHNodeChildren(bbk::BVHNode* node);
-bbk::BVHNode* LinevsBVHNode(const bbk::Line& line, bbk::BVHNode* node);
-bbk::BVHNode* LinevsBVHChild(const bbk::Line& line, bbk::BVHNode* root);
-bbk::BVHNode* LinevsBVHLeaf(const bbk::Line& line, bbk::BVHNode* root);
+void DrawBVHLevel(const bbk::BVH& bvh, unsigned node, size_t current, size_t target);
+void DrawBVHNodeChildren(const bbk::BVH& bvh, unsigned node);
+bool LinevsBVHNode(const bbk::Line& line, const bbk::BVH& bvh, unsigned node);
+int  LinevsBVHChild(const bbk::Line& line, const bbk::BVH& bvh, unsigned root);
+int  LinevsBVHLeaf(const bbk::Line& line, const bbk::BVH& bvh);
 } // anon namespace
 
 /******************************************************************************/
@@ -109,7 +114,8 @@ bbk::BVHNode* LinevsBVHLeaf(const bbk::Line& line, bbk::BVHNode* root);
 bool Sandbox::Load()
 {
 	::pCam = new bbk::PerspCam;
-	::obj = new bbk::BObject;
+	::world = new bbk::RigidBodyWorld;
+	::obj = new bbk::BObject(*::world);
 
 	/*--------------------------------------------------------------------------
 	 * Load textures
@@ -120,7 +126,7 @@ bool Sandbox::Load()
 		::textures[i].LoadTexDataFromFile(::texFilenames[i]);
 		::textures[i].LoadTexDataToGPU();
 		::textures[i].FreeTexData();
-		glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle(::texNames[i]), i);
+		bbk::gfx::locationMgrs[0].SetUniform(bbk::gfx::locationMgrs[0].GetUniformID(::texNames[i]), static_cast<int>(i));
 	}
 
 	// Load models
@@ -130,6 +136,9 @@ bool Sandbox::Load()
 	::pSphereModel->LoadGeometryFromFile("Sphere.xml");
 	::pCubeModel->LoadGeometryFromFile("Cube.xml");
 	//::pDuckModel->LoadGeometryFromFile("Duck.xml");
+	::pSphereModel->LoadGeometryToGPU();
+	::pCubeModel->LoadGeometryToGPU();
+	//::pDuckModel->LoadGeometryToGPU();
 
 	return true;
 }
@@ -178,52 +187,35 @@ void Sandbox::Init()
 		std::cos(30.0f / 180.0f * bbk::PIf),
 		1.0f);
 		
-	/* Register light variables and set their values */
-	char buffer[64] = {0};
-	std::sprintf(buffer, "lights[0].type");
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), ::lightSrc.type);
-
-	std::sprintf(buffer, "lights[0].position");
-	glUniform3fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.position.x);
-
-	std::sprintf(buffer, "lights[0].direction");
-	bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer);
-
-	std::sprintf(buffer, "lights[0].I_ambient");
-	glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.I_ambient.x);
-
-	std::sprintf(buffer, "lights[0].I_diffuse");
-	glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.I_diffuse.x);
-
-	std::sprintf(buffer, "lights[0].I_specular");
-	glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.I_specular.x);
-
-	std::sprintf(buffer, "lights[0].spotAttCoeff");
-	glUniform3fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.spotAttCoeff.x);
-
-	std::sprintf(buffer, "lights[0].distAttCoeff");
-	glUniform3fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &::lightSrc.distAttCoeff.x);
-
-	glUniform4f(bbk::gfx::locationMgrs[0].GetUniformLocHandle("I_globAmbient"), 0.2f, 0.2f, 0.2f, 1.0f);
+	/* Set light variables; values are uploaded on the next draw */
+	bbk::LocationMgr &locMgr = bbk::gfx::locationMgrs[0];
+	::uniLightPos = locMgr.GetUniformID("lights[0].position");
+	::uniLightDir = locMgr.GetUniformID("lights[0].direction");
+
+	locMgr.SetUniform    (locMgr.GetUniformID("lights[0].type"), static_cast<int>(::lightSrc.type));
+	locMgr.SetUniform3fv (::uniLightPos, &::lightSrc.position.x);
+	locMgr.SetUniform4fv (locMgr.GetUniformID("lights[0].I_ambient"),    &::lightSrc.I_ambient.x);
+	locMgr.SetUniform4fv (locMgr.GetUniformID("lights[0].I_diffuse"),    &::lightSrc.I_diffuse.x);
+	locMgr.SetUniform4fv (locMgr.GetUniformID("lights[0].I_specular"),   &::lightSrc.I_specular.x);
+	locMgr.SetUniform3fv (locMgr.GetUniformID("lights[0].spotAttCoeff"), &::lightSrc.spotAttCoeff.x);
+	locMgr.SetUniform3fv (locMgr.GetUniformID("lights[0].distAttCoeff"), &::lightSrc.distAttCoeff.x);
+
+	const bbk::Vector4 globAmbient(0.2f, 0.2f, 0.2f, 1.0f);
+	locMgr.SetUniform4fv(locMgr.GetUniformID("I_globAmbient"), &globAmbient.x);
 
 	// Fog parameters
-	glUniform4fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle("fog.color"), 1, &backgroundColor.x);
-	glUniform1f(bbk::gfx::locationMgrs[0].GetUniformLocHandle("fog.nearDist"), 0.5f * ::pCam->GetFarPlaneDist());
-	glUniform1f(bbk::gfx::locationMgrs[0].GetUniformLocHandle("fog.farDist"), 10.0f * ::pCam->GetFarPlaneDist());
+	locMgr.SetUniform4fv(locMgr.GetUniformID("fog.color"), &backgroundColor.x);
+	locMgr.SetUniform   (locMgr.GetUniformID("fog.nearDist"), 0.5f * ::pCam->GetFarPlaneDist());
+	locMgr.SetUniform   (locMgr.GetUniformID("fog.farDist"), 10.0f * ::pCam->GetFarPlaneDist());
 	
-	//glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("constLightType_Point"), 0);
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("constLightType_Dir"),   LIGHT_DIR);
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("constLightType_Spot"),  LIGHT_SPOT);
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("numLightSrc"), 1);
+	//locMgr.SetUniform(locMgr.GetUniformID("constLightType_Point"), 0);
+	locMgr.SetUniform(locMgr.GetUniformID("constLightType_Dir"),  static_cast<int>(LIGHT_DIR));
+	locMgr.SetUniform(locMgr.GetUniformID("constLightType_Spot"), static_cast<int>(LIGHT_SPOT));
+	locMgr.SetUniform(locMgr.GetUniformID("numLightSrc"), 1);
 	
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("isUseTextures"), true);
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("materialType"), ::materialType);
-	glUniform1i(bbk::gfx::locationMgrs[0].GetUniformLocHandle("useVertexColor"), false);
-
-	bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_ambient");
-	bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_diffuse");
-	bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_specular");
-	bbk::gfx::locationMgrs[0].GetUniformLocHandle("surfaceClr.K_emissive");
+	locMgr.SetUniform(locMgr.GetUniformID("isUseTextures"), 1);
+	locMgr.SetUniform(locMgr.GetUniformID("materialType"), static_cast<int>(::materialType));
+	locMgr.SetUniform(locMgr.GetUniformID("useVertexColor"), 0);
 
 	/*--------------------------------------------------------------------------
 	 * Print instructions to debug console
@@ -262,6 +254,10 @@ void Sandbox::Update(float deltatime)
 	{
 		::obj->Serialise("object.xml");
 	}
+	if (bbk::keyboard::IsKeyTriggered(bbk::KB_F2))
+		::showProfile = !::showProfile;
+	if (bbk::keyboard::IsKeyTriggered(bbk::KB_F3))
+		bbk::profiler::DumpCSV("profile.csv");
 
 	// Camera controls
 	/*{
@@ -301,26 +297,9 @@ void Sandbox::Update(float deltatime)
 			::pCam->Displace(camup * 10.0f * deltatime);
 	}*/
 
-	// Ship controls
+	// Ship steering by mouse; its forces apply over the next fixed step
 	{
 		const bbk::Matrix3x3 objorient(bbk::QuatToMatrix(::obj->GetQuat()));
-		const bbk::Vector3 fore(objorient.GetCol(0));
-		if (bbk::keyboard::IsKeyPressed(bbk::KB_w))
-			::obj->AddForce(400.0f * fore, ::obj->GetPosition());
-		else if (bbk::keyboard::IsKeyPressed(bbk::KB_s))
-			::obj->AddForce(-15.0f * fore, ::obj->GetPosition());
-
-		if (bbk::keyboard::IsKeyPressed(bbk::KB_a))
-		{
-			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, -1.0f)), objorient.GetCol(0));
-			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, 1.0f)), -objorient.GetCol(0));
-		}
-		else if (bbk::keyboard::IsKeyPressed(bbk::KB_d))
-		{
-			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, 1.0f)), objorient.GetCol(0));
-			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, -1.0f)), -objorient.GetCol(0));
-		}
-
 		if (bbk::mouse::IsPressed(bbk::MOUSE_LMB))
 		{
 			const float dy = static_cast<float>(bbk::mouse::GetDeltaY());
@@ -330,11 +309,6 @@ void Sandbox::Update(float deltatime)
 			::obj->AddForce(objorient * (dx * bbk::Vector3(0.0f, 0.0f, 16.0f)), objorient * bbk::Vector3(0.0f, 1.0f, 0.0f));
 			::obj->AddForce(objorient * (dx * bbk::Vector3(0.0f, 0.0f, -16.0f)), objorient * bbk::Vector3(0.0f, -1.0f, 0.0f));
 		}
-
-		if (::obj->GetAngularMom().MagnitudeSq() > 0.0f)
-		{
-			::obj->SetAngularMom(0.7f * ::obj->GetAngularMom());
-		}
 	}
 
 	// Show OBB level
@@ -363,6 +337,7 @@ void Sandbox::Update(float deltatime)
 			::pushDisp = pickline.pt + intertimes[0]*pickline.vec - ::obj->GetPosition();
 			::pushVec = pickline.vec;
 		}
+
 	}
 	else if (bbk::keyboard::IsKeyReleased(bbk::KB_SPACE))
 	{
@@ -379,24 +354,61 @@ void Sandbox::Update(float deltatime)
 	/*--------------------------------------------------------------------------
 	 * Update positions and directions of light sources
 	 */
+}
+
+void Sandbox::FixedUpdate(float timestep)
+{
+	// Ship thrust, held across steps
+	{
+		const bbk::Matrix3x3 objorient(bbk::QuatToMatrix(::obj->GetQuat()));
+		const bbk::Vector3 fore(objorient.GetCol(0));
+		if (bbk::keyboard::IsKeyPressed(bbk::KB_w))
+			::obj->AddForce(400.0f * fore, ::obj->GetPosition());
+		else if (bbk::keyboard::IsKeyPressed(bbk::KB_s))
+			::obj->AddForce(-15.0f * fore, ::obj->GetPosition());
+
+		if (bbk::keyboard::IsKeyPressed(bbk::KB_a))
+		{
+			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, -1.0f)), objorient.GetCol(0));
+			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, 1.0f)), -objorient.GetCol(0));
+		}
+		else if (bbk::keyboard::IsKeyPressed(bbk::KB_d))
+		{
+			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, 1.0f)), objorient.GetCol(0));
+			::obj->AddForce(objorient * (16.0f * bbk::Vector3(0.0f, 0.0f, -1.0f)), -objorient.GetCol(0));
+		}
+
+		if (::obj->GetAngularMom().MagnitudeSq() > 0.0f)
+		{
+			::obj->SetAngularMom(0.7f * ::obj->GetAngularMom());
+		}
+	}
 
 	// Update objects' rigid body dynamics
-	::obj->Integrate(deltatime);
-	::obj->Update(deltatime);
+	::world->Step(timestep);
+}
+
+void Sandbox::Draw()
+{
+	// Objects are drawn between their last two fixed steps, so motion stays smooth at any frame rate
+	::world->Interpolate(bbk::GameStateMgr::GetInterpolation());
 
-	// Set camera position and direction
+	// Set camera position and direction, following the ship as drawn
 	{
-		const bbk::Matrix3x3 objorient(bbk::QuatToMatrix(::obj->GetQuat()));
+		const bbk::Matrix4x4 &mtx      = ::obj->GetTransform();
+		const float           invScale = 1.0f / ::obj->GetScale();
+		const bbk::Matrix3x3  objorient(
+			bbk::Vector3(mtx.elements[0], mtx.elements[1], mtx.elements[2]) * invScale,
+			bbk::Vector3(mtx.elements[4], mtx.elements[5], mtx.elements[6]) * invScale,
+			bbk::Vector3(mtx.elements[8], mtx.elements[9], mtx.elements[10]) * invScale);
+		const bbk::Point3 objpos(mtx.elements[12], mtx.elements[13], mtx.elements[14]);
 		const bbk::Vector3 camdisp(objorient * bbk::Vector3(-20.4f, 0.f, 0.0f));
 		const bbk::Vector3 nose(objorient * bbk::Vector3(3.2f, 0.0f, 0.0f));
 		::pCam->SetGlobalUpVec(objorient * bbk::Vector3(0.0f, 1.0f, 0.0f));
-		::pCam->SetPosition(::obj->GetPosition() + camdisp);
-		::pCam->SetTargetPos(::obj->GetPosition() + nose);
+		::pCam->SetPosition(objpos + camdisp);
+		::pCam->SetTargetPos(objpos + nose);
 	}
-}
 
-void Sandbox::Draw()
-{
 	bbk::gfx::SetPerspProjMtx(::pCam->GetProjectionMtx());
 	bbk::gfx::SetViewMtx(::pCam->GetWorldToViewMtx());
 	bbk::gfx::SetCullingFrustum(::pCam->GetFrustum());
@@ -409,12 +421,8 @@ void Sandbox::Draw()
 	bbk::Vector4 viewFrame_lightPos = mtx44_view * bbk::Vector4(::lightSrc.position, 1.0f);
 	bbk::Vector3 viewFrame_lightDir = mtx44_view * ::lightSrc.direction;
 
-	char buffer[64] = {0};
-	std::sprintf(buffer, "lights[0].position");
-	glUniform3fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &viewFrame_lightPos.x);
-		
-	std::sprintf(buffer, "lights[0].direction");
-	glUniform3fv(bbk::gfx::locationMgrs[0].GetUniformLocHandle(buffer), 1, &viewFrame_lightDir.x);
+	bbk::gfx::SetUniform3fv(::uniLightPos, &viewFrame_lightPos.x);
+	bbk::gfx::SetUniform3fv(::uniLightDir, &viewFrame_lightDir.x);
 
 	/*==========================================================================
 	 * Draw scene
@@ -424,32 +432,28 @@ void Sandbox::Draw()
 	 * Set texture units to use appropriate textures
 	 */
 	for (size_t i = 0; i < TEX_NUM_TYPES; ++i)
-	{
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, ::textures[i].GetGLHandle());
-	}
+		bbk::gfx::BindTexture(i, ::textures[i]);
 
 	/*--------------------------------------------------------------------------
 	 * Render objects
 	 */
-	::obj->Draw();
-	
-	glActiveTexture(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	bbk::gfx::DrawScene();
 
 	/*--------------------------------------------------------------------------
 	 * Display debug info
 	 */
 	// Draw BVH
-	if (::showOBBlvl > -1)
+	if (::showOBBlvl > -1 && ::obj->GetModel()->GetBVH())
 	{
-		DrawBVHLevel(::obj->GetModel()->GetBVH(), 0, ::showOBBlvl);
+		DrawBVHLevel(*::obj->GetModel()->GetBVH(), 0, 0, ::showOBBlvl);
 	}
 	{
 		char buffer[64] = {0};
 		std::sprintf(buffer, "bvh lvl %d", ::showOBBlvl);
 		bbk::gfx::PrintDebugInfo(buffer);
 	}
+	if (::showProfile)
+		bbk::profiler::PrintSummaries();
 
 	// Draw spatial grid
 	{
@@ -538,8 +542,8 @@ void Sandbox::Draw()
 		std::sprintf(buffer, "zx %f", ang);
 		bbk::gfx::PrintDebugInfo(buffer);*/
 	}
-	if (::pickedBVHNode)
-		::DrawBVHNodeChildren(::pickedBVHNode);
+	if (::pickedBVHNode > -1 && ::obj->GetModel()->GetBVH())
+		::DrawBVHNodeChildren(*::obj->GetModel()->GetBVH(), ::pickedBVHNode);
 }
 
 void Sandbox::Cleanup()
@@ -553,45 +557,52 @@ void Sandbox::Unload()
 	delete ::pCubeModel;
 	delete ::pDuckModel;
 	delete ::obj;
+	delete ::world;
 }
 
 namespace
 {
-void DrawBVHLevel(bbk::BVHNode *root, size_t current, size_t target)
+void DrawBVHLevel(const bbk::BVH& bvh, unsigned node, size_t current, size_t target)
 {
+	const bbk::BVHNode& root(bvh.nodes[node]);
 	if (current == target)
 	{
 		// Draw obb
-		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), root->obb);
+		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), root.obb);
 		const bbk::Vector3 scaledOffset(::obj->GetModel()->GetOBBOffset() * ::obj->GetScale());
 		//obb.center += ::obj->GetRotation() * scaledOffset;
 		obb.halfExtents *= ::obj->GetScale();
 		bbk::DrawOBBG(obb);
 
 		/*{
-			for (size_t i = 0; i < root->numVerts; i+=3)
+			for (unsigned i = root.firstTri; i < root.firstTri + root.numTris; ++i)
 			{
-				bbk::Vertex v0(root->triVerts[i], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
-				bbk::Vertex v1(root->triVerts[i+1], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
-				bbk::Vertex v2(root->triVerts[i+2], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+				const bbk::Vector3 *tri = bvh.GetTri(i);
+				bbk::Vertex v0(tri[0], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+				bbk::Vertex v1(tri[1], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+				bbk::Vertex v2(tri[2], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
 				bbk::gfx::DrawTri(v0, v1, v2);
 			}
 		}*/
 		return;
 	}
 	
-	if (root->left)
-		DrawBVHLevel(root->left, current + 1, target);
-	if (root->right)
-		DrawBVHLevel(root->right, current + 1, target);
+	if (!root.IsLeaf())
+	{
+		DrawBVHLevel(bvh, bvh.GetLeftChild(node), current + 1, target);
+		DrawBVHLevel(bvh, bvh.GetRightChild(node), current + 1, target);
+	}
 }
 
-void DrawBVHNodeChildren(bbk::BVHNode* node)
+void DrawBVHNodeChildren(const bbk::BVH& bvh, unsigned node)
 {
+	if (bvh.nodes[node].IsLeaf())
+		return;
+
 	// Draw obb
-	if (node->left)
 	{
-		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), node->left->obb);
+		const bbk::BVHNode& left(bvh.nodes[bvh.GetLeftChild(node)]);
+		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), left.obb);
 		const bbk::Vector3 scaledOffset(::obj->GetModel()->GetOBBOffset() * ::obj->GetScale());
 		obb.center += ::obj->GetRotation() * scaledOffset;
 		obb.halfExtents *= ::obj->GetScale();
@@ -602,20 +613,21 @@ void DrawBVHNodeChildren(bbk::BVHNode* node)
 			bbk::gfx::MV_Translate(obb.center);
 			bbk::gfx::MV_Push(::obj->GetTransform());*/
 			{
-				for (size_t i = 0; i < node->left->numVerts; i+=3)
+				for (unsigned i = left.firstTri; i < left.firstTri + left.numTris; ++i)
 				{
-					bbk::Vertex v0(node->left->triVerts[i], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
-					bbk::Vertex v1(node->left->triVerts[i+1], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
-					bbk::Vertex v2(node->left->triVerts[i+2], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
+					const bbk::Vector3 *tri = bvh.GetTri(i);
+					bbk::Vertex v0(tri[0], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
+					bbk::Vertex v1(tri[1], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
+					bbk::Vertex v2(tri[2], bbk::Colour(1.0f, 0.0f, 0.0f, 0.64f));
 					bbk::gfx::DrawTri(v0, v1, v2);
 				}
 			}
 			//bbk::gfx::PopMVMatrixStack();
 		}
 	}
-	if (node->right)
 	{
-		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), node->right->obb);
+		const bbk::BVHNode& right(bvh.nodes[bvh.GetRightChild(node)]);
+		bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), right.obb);
 		const bbk::Vector3 scaledOffset(::obj->GetModel()->GetOBBOffset() * ::obj->GetScale());
 		obb.center += ::obj->GetRotation() * scaledOffset;
 		obb.halfExtents *= ::obj->GetScale();
@@ -626,11 +638,12 @@ void DrawBVHNodeChildren(bbk::BVHNode* node)
 			bbk::gfx::MV_Translate(obb.center);
 			bbk::gfx::MV_Push(::obj->GetTransform());*/
 			{
-				for (size_t i = 0; i < node->right->numVerts; i+=3)
+				for (unsigned i = right.firstTri; i < right.firstTri + right.numTris; ++i)
 				{
-					bbk::Vertex v0(node->right->triVerts[i], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
-					bbk::Vertex v1(node->right->triVerts[i+1], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
-					bbk::Vertex v2(node->right->triVerts[i+2], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+					const bbk::Vector3 *tri = bvh.GetTri(i);
+					bbk::Vertex v0(tri[0], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+					bbk::Vertex v1(tri[1], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
+					bbk::Vertex v2(tri[2], bbk::Colour(0.0f, 0.0f, 1.0f, 0.64f));
 					bbk::gfx::DrawTri(v0, v1, v2);
 				}
 			}
@@ -639,51 +652,49 @@ void DrawBVHNodeChildren(bbk::BVHNode* node)
 	}
 }
 
-bbk::BVHNode* LinevsBVHNode(const bbk::Line& line, bbk::BVHNode* node)
+bool LinevsBVHNode(const bbk::Line& line, const bbk::BVH& bvh, unsigned node)
 {
 	// Transform bvhnode obb to world space
-	bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), node->obb);
+	bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), bvh.nodes[node].obb);
 	const bbk::Vector3 scaledOffset(::obj->GetModel()->GetOBBOffset() * ::obj->GetScale());
 	//obb.center += ::obj->GetRotation() * scaledOffset;
 	obb.halfExtents *= ::obj->GetScale();
 
 	float intertimes[2] = {0.0f};
-	return bbk::LinevsOBB(line, obb, intertimes) ? node : nullptr;
+	return bbk::LinevsOBB(line, obb, intertimes);
 }
 
-bbk::BVHNode* LinevsBVHChild(const bbk::Line& line, bbk::BVHNode* root)
+int LinevsBVHChild(const bbk::Line& line, const bbk::BVH& bvh, unsigned root)
 {
-	bbk::BVHNode* hitChild = nullptr;
-	if (root->left)
-		hitChild = ::LinevsBVHNode(line, root->left);
-	if (!hitChild && root->right)
-		hitChild = ::LinevsBVHNode(line, root->right);
-	return hitChild;
+	if (bvh.nodes[root].IsLeaf())
+		return -1;
+	if (::LinevsBVHNode(line, bvh, bvh.GetLeftChild(root)))
+		return bvh.GetLeftChild(root);
+	if (::LinevsBVHNode(line, bvh, bvh.GetRightChild(root)))
+		return bvh.GetRightChild(root);
+	return -1;
 }
 
-bbk::BVHNode* LinevsBVHLeaf(const bbk::Line& line, bbk::BVHNode* root)
+int LinevsBVHLeaf(const bbk::Line& line, const bbk::BVH& bvh)
 {
-	// Transform bvhnode obb to world space
-	bbk::OBB obb = bbk::TransformOBB(::obj->GetTransform(), root->obb);
-	const bbk::Vector3 scaledOffset(::obj->GetModel()->GetOBBOffset() * ::obj->GetScale());
-	//obb.center += ::obj->GetRotation() * scaledOffset;
-	obb.halfExtents *= ::obj->GetScale();
+	// Depth-first walk of the node array, skipping subtrees the line misses
+	std::vector<unsigned> stack;
+	stack.push_back(0);
 
-	float intertimes[2] = {0.0f};
-	if (bbk::LinevsOBB(line, obb, intertimes)) // Line intersects current node
+	while (!stack.empty())
 	{
-		if (root->left == nullptr && root->right == nullptr) // leaf node
-			return root;
-
-		bbk::BVHNode* hitChild = nullptr;
-		if (root->left)
-			hitChild = ::LinevsBVHLeaf(line, root->left);
+		const unsigned node = stack.back();
+		stack.pop_back();
+		if (!::LinevsBVHNode(line, bvh, node))
+			continue;
 
-		if (!hitChild && root->right)
-			hitChild = ::LinevsBVHLeaf(line, root->right);
+		if (bvh.nodes[node].IsLeaf())
+			return node;
 
-		return hitChild;
+		// Push right first so the left subtree is tested first
+		stack.push_back(bvh.GetRightChild(node));
+		stack.push_back(bvh.GetLeftChild(node));
 	}
-	return nullptr;
+	return -1;
 }
 } // anon namespace
@@ -9,6 +9,7 @@ public:
 	virtual bool Load();
 	virtual void Init();
 	virtual void Update(float deltatime);
+	virtual void FixedUpdate(float timestep);
 	virtual void Draw();
 	virtual void Cleanup();
 	virtual void Unload();
@@ -12,6 +12,7 @@ int main(int, char *[])
 	bbk::GameStateMgr::SetInitState(0);
 
 	bbk::appwindow::OpenWindow(1024, 768, bbk::appwindow::OPENGL, false);
+	bbk::EnableFramePipelining(true);
 
 	bbk::RunFramework();
 